@@ -0,0 +1,266 @@
+// Microbenchmarks of the per-read stages of fastqprocess, plus, given a
+// directory made by utils/generate_fastq.py, an end-to-end mainCommon() run.
+//
+//   bin/fastq_common_bench [data_dir]
+//
+// Each microbenchmark repeats its body for about a second and reports reads
+// (or calls) per second, and bytes per second where there's a natural byte
+// count. `make bench` generates the data and runs everything.
+
+#include "../src/fastq_common.h"
+#include "../src/output_stream.h"
+#include "../src/whitelist_corrector.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+namespace
+{
+constexpr double kMinBenchmarkSec = 1.0;
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void printRates(const char* name, int64_t items, int64_t bytes, double seconds)
+{
+  printf("%-40s %12.0f reads/sec", name, items / seconds);
+  if (bytes > 0)
+    printf(" %10.1f MB/sec", bytes / seconds / 1e6);
+  printf("\n");
+}
+
+// Calls 'body' until kMinBenchmarkSec has passed. Each call processes
+// items_per_call reads totalling bytes_per_call bytes.
+void runBenchmark(const char* name, int64_t items_per_call, int64_t bytes_per_call,
+                  std::function<void()> const& body)
+{
+  body(); // warm up
+  int64_t calls = 0;
+  auto start = std::chrono::steady_clock::now();
+  double seconds;
+  do
+  {
+    body();
+    calls++;
+    seconds = secondsSince(start);
+  } while (seconds < kMinBenchmarkSec);
+  printRates(name, calls * items_per_call, calls * bytes_per_call, seconds);
+}
+
+std::string randomSequence(std::mt19937& rng, int length)
+{
+  std::string ret(length, 'A');
+  for (char& c : ret)
+    c = "ACGT"[rng() % 4];
+  return ret;
+}
+
+// A batch of reads laid out as fastqprocess's reader threads hold them.
+struct SyntheticReads
+{
+  std::vector<std::string> r1_sequences;
+  std::vector<std::string> r2_sequences;
+  std::vector<std::string> barcodes;
+  std::string r1_quality;
+  std::string r2_quality;
+  WhiteListCorrector corrector;
+};
+
+// 85% exact whitelist hits, 7% one base off, the rest misses; like the
+// generator's defaults.
+SyntheticReads makeSyntheticReads(int num_reads)
+{
+  std::mt19937 rng(1);
+  SyntheticReads reads;
+  for (int i = 0; i < 100000; i++)
+    addMutationsOfBarcodeToWhiteList(reads.corrector, randomSequence(rng, 16));
+  for (int i = 0; i < num_reads; i++)
+  {
+    std::string barcode = reads.corrector.whitelist[rng() % 5000];
+    int draw = rng() % 100;
+    if (draw >= 85 && draw < 92)
+      barcode[rng() % 16] = 'N';
+    else if (draw >= 92)
+      barcode = randomSequence(rng, 16);
+    reads.barcodes.push_back(barcode);
+    reads.r1_sequences.push_back(barcode + randomSequence(rng, 12));
+    reads.r2_sequences.push_back(randomSequence(rng, 90));
+  }
+  reads.r1_quality = std::string(28, 'F');
+  reads.r2_quality = std::string(90, 'F');
+  return reads;
+}
+
+void setRecord(FastQFile& file, std::string const& name, std::string const& sequence,
+               std::string const& quality)
+{
+  file.mySequenceIdLine = ("@" + name).c_str();
+  file.mySequenceIdentifier = name.c_str();
+  file.myRawSequence = sequence.c_str();
+  file.myPlusLine = "+";
+  file.myQualityString = quality.c_str();
+}
+
+void benchParseReadStructure()
+{
+  constexpr int kCalls = 1000;
+  runBenchmark("parseReadStructure(8C18X6C9M1X)", kCalls, 0, []() {
+    for (int i = 0; i < kCalls; i++)
+      parseReadStructure("8C18X6C9M1X");
+  });
+}
+
+void benchFillSamRecord(SyntheticReads const& reads)
+{
+  std::vector<std::pair<char, int>> read_structure = parseReadStructure("16C12M");
+  FastQFile i1(4, 4), r1(4, 4), r2(4, 4), r3(4, 4);
+  SamRecord sam;
+  int64_t bytes = 0;
+  for (int i = 0; i < reads.r1_sequences.size(); i++)
+    bytes += 2 * (reads.r1_sequences[i].size() + reads.r2_sequences[i].size());
+  runBenchmark("fillSamRecord(16C12M)", reads.r1_sequences.size(), bytes, [&]() {
+    for (int i = 0; i < reads.r1_sequences.size(); i++)
+    {
+      setRecord(r1, "read", reads.r1_sequences[i], reads.r1_quality);
+      setRecord(r2, "read", reads.r2_sequences[i], reads.r2_quality);
+      fillSamRecord(&sam, &i1, &r1, &r2, &r3, false, false, "FIRST_BP", read_structure);
+    }
+  });
+}
+
+void benchCorrectBarcode(SyntheticReads const& reads)
+{
+  SamRecord sam;
+  int corrected = 0, correct = 0, errors = 0;
+  runBenchmark("correctBarcodeToWhitelist", reads.barcodes.size(), 0, [&]() {
+    for (std::string const& barcode : reads.barcodes)
+    {
+      sam.resetRecord();
+      correctBarcodeToWhitelist(barcode, &sam, &reads.corrector, &corrected, &correct, &errors, 16);
+    }
+  });
+}
+
+// Records as the writers receive them: filled and barcode-corrected.
+std::vector<SamRecord> makeFilledRecords(SyntheticReads const& reads)
+{
+  std::vector<std::pair<char, int>> read_structure = parseReadStructure("16C12M");
+  FastQFile i1(4, 4), r1(4, 4), r2(4, 4), r3(4, 4);
+  std::vector<SamRecord> records(reads.r1_sequences.size());
+  int corrected = 0, correct = 0, errors = 0;
+  for (int i = 0; i < records.size(); i++)
+  {
+    setRecord(r1, "SIM:1:FC:1:1101:" + std::to_string(i), reads.r1_sequences[i], reads.r1_quality);
+    setRecord(r2, "SIM:1:FC:1:1101:" + std::to_string(i), reads.r2_sequences[i], reads.r2_quality);
+    fillSamRecord(&records[i], &i1, &r1, &r2, &r3, false, false, "FIRST_BP", read_structure);
+    correctBarcodeToWhitelist(reads.barcodes[i], &records[i], &reads.corrector,
+                              &corrected, &correct, &errors, 16);
+  }
+  return records;
+}
+
+void benchFastqSerializer(std::vector<SamRecord>& records, int compression_level, const char* name)
+{
+  std::string dir = std::filesystem::temp_directory_path().string();
+  std::string r1_path = dir + "/fastq_common_bench_R1.fastq";
+  std::string r2_path = dir + "/fastq_common_bench_R2.fastq";
+  // Bytes are of FASTQ text, before compression.
+  int64_t bytes = 0;
+  auto write_all = [&]() {
+    ShardOutputStream r1_out(r1_path, compression_level);
+    ShardOutputStream r2_out(r2_path, compression_level);
+    for (SamRecord& sam : records)
+      writeFastqRecord(r1_out, r2_out, &sam, false);
+    r1_out.close();
+    r2_out.close();
+    bytes = r1_out.uncompressedBytes() + r2_out.uncompressedBytes();
+  };
+  write_all();
+  runBenchmark(name, records.size(), bytes, write_all);
+  std::filesystem::remove(r1_path);
+  std::filesystem::remove(r2_path);
+}
+
+void benchBamSerializer(std::vector<SamRecord>& records)
+{
+  std::string path = (std::filesystem::temp_directory_path() / "fastq_common_bench.bam").string();
+  runBenchmark("SamFile::WriteRecord (BAM)", records.size(), 0, [&]() {
+    SamFile sam_out;
+    if (!sam_out.OpenForWrite(path.c_str()))
+      crash("ERROR: Failed to open " + path);
+    SamFileHeader header;
+    header.setHDTag("VN", "1.6");
+    sam_out.WriteHeader(header);
+    for (SamRecord& sam : records)
+      sam_out.WriteRecord(header, sam);
+    sam_out.Close();
+  });
+  std::filesystem::remove(path);
+}
+
+int64_t countFastqRecords(std::string const& path)
+{
+  gzFile in = gzopen(path.c_str(), "rb");
+  if (!in)
+    crash("ERROR: Failed to open " + path);
+  int64_t lines = 0;
+  char buf[65536];
+  int n;
+  while ((n = gzread(in, buf, sizeof(buf))) > 0)
+    lines += std::count(buf, buf + n, '\n');
+  gzclose(in);
+  return lines / 4;
+}
+
+// mainCommon() keeps global state, so this can only run once per process.
+void benchMainCommon(std::string const& data_dir, std::string const& output_format)
+{
+  std::string R1 = data_dir + "/R1.fastq.gz";
+  std::string R2 = data_dir + "/R2.fastq.gz";
+  std::string I1 = data_dir + "/I1.fastq.gz";
+  std::vector<std::string> I1s;
+  if (std::filesystem::exists(I1))
+    I1s.push_back(I1);
+  int64_t reads = countFastqRecords(R1);
+  int64_t input_bytes = std::filesystem::file_size(R1) + std::filesystem::file_size(R2) +
+                        (I1s.empty() ? 0 : std::filesystem::file_size(I1));
+
+  PipelineOptions pipeline;
+  pipeline.output_dir = data_dir + "/bench_out";
+  std::filesystem::create_directories(pipeline.output_dir);
+  auto start = std::chrono::steady_clock::now();
+  mainCommon(data_dir + "/whitelist.txt", "FIRST_BP", 4, output_format, I1s, {R1}, {R2}, {},
+             "bench", parseReadStructure("16C12M"), false, pipeline);
+  double seconds = secondsSince(start);
+  printf("\n");
+  printRates(("mainCommon end-to-end (" + output_format + ")").c_str(), reads, input_bytes, seconds);
+  printf("%-40s %12s (MB/sec of gzipped input)\n", "", "");
+  std::filesystem::remove_all(pipeline.output_dir);
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+  benchParseReadStructure();
+  SyntheticReads reads = makeSyntheticReads(100000);
+  benchFillSamRecord(reads);
+  benchCorrectBarcode(reads);
+  std::vector<SamRecord> records = makeFilledRecords(reads);
+  benchFastqSerializer(records, 0, "writeFastqRecord (uncompressed)");
+  benchFastqSerializer(records, 1, "writeFastqRecord (gzip level 1)");
+  benchFastqSerializer(records, -1, "writeFastqRecord (gzip default)");
+  benchBamSerializer(records);
+
+  if (argc > 1)
+    benchMainCommon(argv[1], argc > 2 ? argv[2] : "FASTQ");
+  return 0;
+}
@@ -0,0 +1,255 @@
+#include "approximate_counts.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "input_options.h"
+
+namespace
+{
+// std::hash of a string isn't guaranteed to mix its bits well; this is
+// SplitMix64's finalizer on top.
+uint64_t hashSequence(std::string_view seq)
+{
+  uint64_t x = std::hash<std::string_view>{}(seq);
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+} // namespace
+
+void HyperLogLog::add(std::string_view value)
+{
+  uint64_t hash = hashSequence(value);
+  uint64_t index = hash >> (64 - kPrecision);
+  // The position of the first 1 bit in the rest of the hash (capped, as if
+  // the bit after them were set).
+  uint64_t rest = (hash << kPrecision) | (uint64_t{1} << (kPrecision - 1));
+  uint8_t rank = __builtin_clzll(rest) + 1;
+  registers_[index] = std::max(registers_[index], rank);
+}
+
+HyperLogLog& HyperLogLog::operator+=(HyperLogLog const& rhs)
+{
+  for (int i = 0; i < kNumRegisters; i++)
+    registers_[i] = std::max(registers_[i], rhs.registers_[i]);
+  return *this;
+}
+
+double HyperLogLog::estimate() const
+{
+  double sum = 0;
+  int zeros = 0;
+  for (uint8_t reg : registers_)
+  {
+    sum += std::ldexp(1.0, -reg);
+    zeros += reg == 0;
+  }
+  double m = kNumRegisters;
+  double raw = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+  // Linear counting is more accurate while many registers are still empty.
+  if (raw <= 2.5 * m && zeros > 0)
+    return m * std::log(m / zeros);
+  return raw;
+}
+
+void SpaceSavingCounter::add(std::string_view seq, int64_t count)
+{
+  total_ += count;
+  key_.assign(seq);
+  if (auto it = index_.find(key_); it != index_.end())
+  {
+    heap_[it->second].count += count;
+    siftDown(it->second);
+    return;
+  }
+
+  if (heap_.size() < std::max<size_t>(capacity_, 1))
+  {
+    heap_.push_back(Entry{std::string(seq), floor_ + count, floor_});
+    size_t i = heap_.size() - 1;
+    index_[heap_[i].seq] = i;
+    for (; i > 0 && heap_[(i - 1) / 2].count > heap_[i].count; i = (i - 1) / 2)
+      swapEntries(i, (i - 1) / 2);
+    return;
+  }
+
+  // Replace the sequence with the fewest counts.
+  Entry& fewest = heap_.front();
+  index_.erase(fewest.seq);
+  fewest.seq = std::string(seq);
+  fewest.error = std::max(floor_, fewest.count);
+  fewest.count = fewest.error + count;
+  index_[fewest.seq] = 0;
+  siftDown(0);
+}
+
+void SpaceSavingCounter::siftDown(size_t i)
+{
+  for (;;)
+  {
+    size_t smallest = i;
+    for (size_t child : {2 * i + 1, 2 * i + 2})
+      if (child < heap_.size() && heap_[child].count < heap_[smallest].count)
+        smallest = child;
+    if (smallest == i)
+      return;
+    swapEntries(i, smallest);
+    i = smallest;
+  }
+}
+
+void SpaceSavingCounter::swapEntries(size_t a, size_t b)
+{
+  std::swap(heap_[a], heap_[b]);
+  index_[heap_[a].seq] = a;
+  index_[heap_[b].seq] = b;
+}
+
+SpaceSavingCounter& SpaceSavingCounter::operator+=(SpaceSavingCounter const& rhs)
+{
+  if (rhs.heap_.empty() && rhs.floor_ == 0)
+  {
+    total_ += rhs.total_;
+    return *this;
+  }
+  int64_t missing = missingCount();
+  int64_t rhs_missing = rhs.missingCount();
+  std::vector<Entry> merged;
+  merged.reserve(heap_.size() + rhs.heap_.size());
+  for (Entry const& entry : heap_)
+  {
+    auto it = rhs.index_.find(entry.seq);
+    merged.push_back(it == rhs.index_.end()
+                         ? Entry{entry.seq, entry.count + rhs_missing, entry.error + rhs_missing}
+                         : Entry{entry.seq, entry.count + rhs.heap_[it->second].count,
+                                 entry.error + rhs.heap_[it->second].error});
+  }
+  for (Entry const& entry : rhs.heap_)
+    if (!index_.count(entry.seq))
+      merged.push_back(Entry{entry.seq, entry.count + missing, entry.error + missing});
+
+  // Keep the capacity_ with the most counts.
+  if (merged.size() > capacity_)
+  {
+    std::nth_element(merged.begin(), merged.begin() + capacity_, merged.end(),
+                     [](Entry const& a, Entry const& b) { return a.count > b.count; });
+    merged.resize(capacity_);
+  }
+  std::make_heap(merged.begin(), merged.end(), [](Entry const& a, Entry const& b) { return a.count > b.count; });
+  heap_ = std::move(merged);
+  index_.clear();
+  for (size_t i = 0; i < heap_.size(); i++)
+    index_[heap_[i].seq] = i;
+  total_ += rhs.total_;
+  floor_ = missing + rhs_missing;
+  return *this;
+}
+
+void SpaceSavingCounter::addDisjoint(SpaceSavingCounter const& rhs)
+{
+  floor_ = std::max(missingCount(), rhs.missingCount());
+  heap_.insert(heap_.end(), rhs.heap_.begin(), rhs.heap_.end());
+  std::make_heap(heap_.begin(), heap_.end(), [](Entry const& a, Entry const& b) { return a.count > b.count; });
+  index_.clear();
+  for (size_t i = 0; i < heap_.size(); i++)
+    index_[heap_[i].seq] = i;
+  capacity_ += rhs.capacity_;
+  total_ += rhs.total_;
+}
+
+void HyperLogLog::save(StateWriter* out) const
+{
+  out->writeString(std::string_view(reinterpret_cast<const char*>(registers_.data()), registers_.size()));
+}
+
+HyperLogLog HyperLogLog::load(StateReader* in)
+{
+  std::string registers = in->readString();
+  if (registers.size() != kNumRegisters)
+    crash("ERROR: State file " + in->path() + " is corrupt");
+  HyperLogLog ret;
+  ret.registers_.assign(registers.begin(), registers.end());
+  return ret;
+}
+
+void SpaceSavingCounter::save(StateWriter* out) const
+{
+  out->writeInt(capacity_);
+  out->writeInt(total_);
+  out->writeInt(floor_);
+  out->writeInt(heap_.size());
+  for (Entry const& entry : heap_)
+  {
+    out->writeString(entry.seq);
+    out->writeInt(entry.count);
+    out->writeInt(entry.error);
+  }
+}
+
+SpaceSavingCounter SpaceSavingCounter::load(StateReader* in)
+{
+  SpaceSavingCounter counter(in->readInt());
+  counter.total_ = in->readInt();
+  counter.floor_ = in->readInt();
+  int64_t size = in->readInt();
+  if (size < 0 || size > std::max<size_t>(counter.capacity_, 1))
+    crash("ERROR: State file " + in->path() + " is corrupt");
+  // Saved in heap order, so it's still a heap.
+  for (int64_t i = 0; i < size; i++)
+  {
+    std::string seq = in->readString();
+    int64_t count = in->readInt();
+    int64_t error = in->readInt();
+    counter.index_[seq] = i;
+    counter.heap_.push_back(Entry{std::move(seq), count, error});
+  }
+  return counter;
+}
+
+std::vector<SpaceSavingCounter::Entry> SpaceSavingCounter::entries() const
+{
+  std::vector<Entry> ret = heap_;
+  std::sort(ret.begin(), ret.end(), [](Entry const& a, Entry const& b) {
+    return a.count != b.count ? a.count > b.count : a.seq < b.seq;
+  });
+  return ret;
+}
+
+ConcurrentApproximateCounter::ConcurrentApproximateCounter(size_t capacity, int num_partitions)
+{
+  for (int i = 0; i < num_partitions; i++)
+    partitions_.push_back(std::make_unique<Partition>(capacity / num_partitions + (i < capacity % num_partitions)));
+}
+
+void ConcurrentApproximateCounter::add(std::unordered_map<std::string, int64_t> const& batch)
+{
+  size_t num_partitions = partitions_.size();
+  std::vector<std::vector<std::pair<std::string const*, int64_t>>> by_partition(num_partitions);
+  for (auto const& [seq, count] : batch)
+    by_partition[hashSequence(seq) % num_partitions].emplace_back(&seq, count);
+  size_t first = next_partition_++;
+  for (size_t i = 0; i < num_partitions; i++)
+  {
+    size_t partition = (first + i) % num_partitions;
+    if (by_partition[partition].empty())
+      continue;
+    std::lock_guard<std::mutex> lock(partitions_[partition]->mutex);
+    for (auto [seq, count] : by_partition[partition])
+      partitions_[partition]->counter.add(*seq, count);
+  }
+}
+
+ApproximateSequenceCounter ConcurrentApproximateCounter::merged() const
+{
+  ApproximateSequenceCounter ret(0);
+  for (auto const& partition : partitions_)
+    ret.addDisjoint(partition->counter);
+  return ret;
+}
+
+void ApproximateCountBatch::flush()
+{
+  counter_->add(counts_);
+  counts_.clear();
+}
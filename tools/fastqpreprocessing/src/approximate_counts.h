@@ -0,0 +1,191 @@
+#ifndef __SCTOOLS_FASTQPREPROCESSING_APPROXIMATE_COUNTS_H_
+#define __SCTOOLS_FASTQPREPROCESSING_APPROXIMATE_COUNTS_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "metrics_state.h"
+
+// Estimates how many distinct values were added, in 2^14 bytes, with a
+// standard error of about 0.8%.
+class HyperLogLog
+{
+public:
+  HyperLogLog() : registers_(kNumRegisters) {}
+  void add(std::string_view value);
+  HyperLogLog& operator+=(HyperLogLog const& rhs);
+  double estimate() const;
+
+  void save(StateWriter* out) const;
+  static HyperLogLog load(StateReader* in);
+
+private:
+  static constexpr int kPrecision = 14;
+  static constexpr int kNumRegisters = 1 << kPrecision;
+  std::vector<uint8_t> registers_;
+};
+
+// The Space-Saving heavy hitters algorithm: counts up to 'capacity' distinct
+// sequences. Once full, a new sequence takes the place of the one with the
+// fewest counts, inheriting its count as the possible overestimate ('error').
+// Every sequence seen more than (total seen) / capacity times is kept, and
+// its true count is between count - error and count.
+class SpaceSavingCounter
+{
+public:
+  struct Entry
+  {
+    std::string seq;
+    int64_t count;
+    int64_t error;
+  };
+
+  explicit SpaceSavingCounter(size_t capacity) : capacity_(capacity) {}
+  void add(std::string_view seq, int64_t count = 1);
+  // Merges the summaries as Agarwal et al.'s mergeable summaries do: a
+  // sequence missing from a full summary could have up to its smallest count.
+  SpaceSavingCounter& operator+=(SpaceSavingCounter const& rhs);
+  // Takes in a summary of other sequences than this one's (such as another
+  // partition by hash), and its capacity: the entries of both are kept as
+  // they are, and a sequence missing from both could have been seen as often
+  // as the summary it would have been in allows.
+  void addDisjoint(SpaceSavingCounter const& rhs);
+
+  // The counted sequences, most counts first (ties by sequence).
+  std::vector<Entry> entries() const;
+  size_t capacity() const { return capacity_; }
+  int64_t total() const { return total_; }
+
+  void save(StateWriter* out) const;
+  static SpaceSavingCounter load(StateReader* in);
+
+private:
+  // Most counts a sequence not in the summary could have had.
+  int64_t missingCount() const
+  {
+    return heap_.size() < capacity_ || heap_.empty() ? floor_ : std::max(floor_, heap_.front().count);
+  }
+  void siftDown(size_t i);
+  void swapEntries(size_t a, size_t b);
+
+  size_t capacity_;
+  int64_t total_ = 0;
+  // Most counts a sequence not in the summary could have had even while it
+  // isn't full, once merged from summaries that were; new entries start
+  // from it.
+  int64_t floor_ = 0;
+  // A min-heap by count, and where each sequence is in it.
+  std::vector<Entry> heap_;
+  std::unordered_map<std::string, size_t> index_;
+  // Reused to look sequences up in index_ without allocating.
+  std::string key_;
+};
+
+// Heap bytes each SpaceSavingCounter entry takes, roughly, for sequences of up
+// to 15 bases (longer ones add their length, twice).
+constexpr int64_t kSpaceSavingEntryBytes = 128;
+
+// Approximate counts of sequences in bounded memory: the most frequent ones
+// (SpaceSavingCounter) and how many distinct ones there were (HyperLogLog).
+class ApproximateSequenceCounter
+{
+public:
+  explicit ApproximateSequenceCounter(size_t capacity) : top_(capacity) {}
+  void add(std::string_view seq, int64_t count = 1)
+  {
+    top_.add(seq, count);
+    distinct_.add(seq);
+  }
+  ApproximateSequenceCounter& operator+=(ApproximateSequenceCounter const& rhs)
+  {
+    top_ += rhs.top_;
+    distinct_ += rhs.distinct_;
+    return *this;
+  }
+  // See SpaceSavingCounter::addDisjoint().
+  void addDisjoint(ApproximateSequenceCounter const& rhs)
+  {
+    top_.addDisjoint(rhs.top_);
+    distinct_ += rhs.distinct_;
+  }
+
+  SpaceSavingCounter const& top() const { return top_; }
+  double distinctEstimate() const { return distinct_.estimate(); }
+
+  void save(StateWriter* out) const
+  {
+    top_.save(out);
+    distinct_.save(out);
+  }
+  static ApproximateSequenceCounter load(StateReader* in)
+  {
+    ApproximateSequenceCounter counter(0);
+    counter.top_ = SpaceSavingCounter::load(in);
+    counter.distinct_ = HyperLogLog::load(in);
+    return counter;
+  }
+
+private:
+  SpaceSavingCounter top_;
+  HyperLogLog distinct_;
+};
+
+// An ApproximateSequenceCounter that several threads add to at once, in
+// 'capacity' sequences however many threads there are. Each sequence is
+// counted in one of num_partitions counters (by its hash), each of its share
+// of the capacity and behind a lock of its own, so a sequence's error is
+// bounded as in one counter of the whole capacity.
+class ConcurrentApproximateCounter
+{
+public:
+  ConcurrentApproximateCounter(size_t capacity, int num_partitions);
+  // Adds the counts gathered in 'batch' (see ApproximateCountBatch).
+  void add(std::unordered_map<std::string, int64_t> const& batch);
+  // The partitions put together in one counter.
+  ApproximateSequenceCounter merged() const;
+
+private:
+  struct Partition
+  {
+    explicit Partition(size_t capacity) : counter(capacity) {}
+    std::mutex mutex;
+    ApproximateSequenceCounter counter;
+  };
+  std::vector<std::unique_ptr<Partition>> partitions_;
+  // The partition the next add() starts from, so that threads adding at once
+  // mostly take different locks.
+  std::atomic<size_t> next_partition_{0};
+};
+
+// One thread's counts for a ConcurrentApproximateCounter, gathered to be added
+// to it a batch at a time.
+class ApproximateCountBatch
+{
+public:
+  explicit ApproximateCountBatch(std::shared_ptr<ConcurrentApproximateCounter> counter)
+    : counter_(std::move(counter)) {}
+  void add(std::string_view seq)
+  {
+    key_.assign(seq);
+    counts_[key_]++;
+  }
+  // Adds the counts to the counter, and starts a new batch.
+  void flush();
+  // Shared by every batch adding to it.
+  std::shared_ptr<ConcurrentApproximateCounter> const& counter() const { return counter_; }
+
+private:
+  std::shared_ptr<ConcurrentApproximateCounter> counter_;
+  std::unordered_map<std::string, int64_t> counts_;
+  // Reused to look sequences up in counts_ without allocating.
+  std::string key_;
+};
+
+#endif // __SCTOOLS_FASTQPREPROCESSING_APPROXIMATE_COUNTS_H_
@@ -0,0 +1,279 @@
+#include "barcode_sorted_shard.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <queue>
+
+#include "input_options.h"
+
+// Rough per-record overhead of a SortEntry beyond its string contents.
+constexpr int64_t kSortEntryOverhead = sizeof(std::string) * 2 + 32;
+
+namespace {
+
+void appendU32(std::string* out, uint32_t value)
+{
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void appendString(std::string* out, const char* str, uint32_t len)
+{
+  appendU32(out, len);
+  out->append(str, len);
+}
+
+uint32_t takeU32(std::string const& in, size_t* pos)
+{
+  uint32_t value;
+  in.copy(reinterpret_cast<char*>(&value), sizeof(value), *pos);
+  *pos += sizeof(value);
+  return value;
+}
+
+std::string takeString(std::string const& in, size_t* pos)
+{
+  uint32_t len = takeU32(in, pos);
+  std::string ret = in.substr(*pos, len);
+  *pos += len;
+  return ret;
+}
+
+// Reads back the entries of one spilled run, in order.
+class RunFile
+{
+public:
+  explicit RunFile(std::string const& filename) : file_(filename, std::ios::binary)
+  {
+    if (!file_)
+      crash("ERROR failed to open the sort run file " + filename);
+  }
+
+  // Returns false once the run is exhausted.
+  bool readNext(std::string* key, std::string* record)
+  {
+    return readString(key) && readString(record);
+  }
+
+private:
+  bool readString(std::string* out)
+  {
+    uint32_t len;
+    if (!file_.read(reinterpret_cast<char*>(&len), sizeof(len)))
+      return false;
+    out->resize(len);
+    return static_cast<bool>(file_.read(out->data(), len));
+  }
+
+  std::ifstream file_;
+};
+
+std::ofstream openRunForWrite(std::string const& filename)
+{
+  std::ofstream out(filename, std::ios::binary);
+  if (!out)
+    crash("ERROR failed to open the sort run file " + filename + " for writing");
+  return out;
+}
+
+void writeRunEntry(std::ofstream& out, std::string const& key, std::string const& record)
+{
+  uint32_t len = key.size();
+  out.write(reinterpret_cast<const char*>(&len), sizeof(len));
+  out.write(key.data(), len);
+  len = record.size();
+  out.write(reinterpret_cast<const char*>(&len), sizeof(len));
+  out.write(record.data(), len);
+}
+
+// k-way merge of the runs in 'run_files', calling emit(key, record) on each
+// entry in order. It keeps the current head of each run in 'heads' and a
+// min-heap of run indices ordered by their head's key. Ties go to the earlier
+// run, preserving arrival order as in sortBuffer().
+template <typename F> void mergeRuns(std::vector<std::string> const& run_files, F emit)
+{
+  std::vector<RunFile> runs;
+  std::vector<std::pair<std::string, std::string>> heads(run_files.size());
+  for (std::string const& run_file : run_files)
+    runs.emplace_back(run_file);
+
+  auto greater_than = [&heads](int a, int b)
+  {
+    if (heads[a].first != heads[b].first)
+      return heads[a].first > heads[b].first;
+    return a > b;
+  };
+  std::priority_queue<int, std::vector<int>, decltype(greater_than)> heap(greater_than);
+  for (int i = 0; i < runs.size(); i++)
+    if (runs[i].readNext(&heads[i].first, &heads[i].second))
+      heap.push(i);
+
+  while (!heap.empty())
+  {
+    int next = heap.top();
+    heap.pop();
+    emit(heads[next].first, heads[next].second);
+    if (runs[next].readNext(&heads[next].first, &heads[next].second))
+      heap.push(next);
+  }
+}
+
+} // namespace
+
+std::string barcodeSortKey(SamRecord* sam)
+{
+  // '0'/'1' puts corrected barcodes first; '\t' sorts before any base, so a
+  // barcode that is a prefix of another can't interleave their groups.
+  if (const String* cb = sam->getStringTag("CB"))
+    return std::string("0") + cb->c_str() + "\t" + sam->getString("UR").c_str();
+  return std::string("1") + sam->getString("CR").c_str() + "\t" + sam->getString("UR").c_str();
+}
+
+void serializeSamRecord(SamRecord* sam, std::string* out)
+{
+  out->clear();
+  const char* name = sam->getReadName();
+  const char* seq = sam->getSequence();
+  const char* qual = sam->getQuality();
+  appendString(out, name, strlen(name));
+  appendU32(out, sam->getFlag());
+  appendString(out, seq, strlen(seq));
+  appendString(out, qual, strlen(qual));
+
+  char tag[3] = {0, 0, 0};
+  char vtype;
+  void* value;
+  sam->resetTagIter();
+  while (sam->getNextSamTag(tag, vtype, &value))
+  {
+    // fillSamRecord() and correctBarcodeToWhitelist() only add string tags.
+    if (vtype != 'Z')
+      crash(std::string("ERROR: can't sort a record with non-string tag ") + tag);
+    const String* str = static_cast<const String*>(value);
+    out->append(tag, 2);
+    appendString(out, str->c_str(), str->Length());
+  }
+}
+
+void deserializeSamRecord(std::string const& in, SamRecord* sam)
+{
+  size_t pos = 0;
+  sam->resetRecord();
+  sam->setReadName(takeString(in, &pos).c_str());
+  sam->setFlag(takeU32(in, &pos));
+  sam->setSequence(takeString(in, &pos).c_str());
+  sam->setQuality(takeString(in, &pos).c_str());
+  while (pos < in.size())
+  {
+    std::string tag = in.substr(pos, 2);
+    pos += 2;
+    sam->addTag(tag.c_str(), 'Z', takeString(in, &pos).c_str());
+  }
+}
+
+BarcodeSortedShard::BarcodeSortedShard(std::string temp_prefix, int64_t memory_limit_bytes,
+                                       int max_merge_fan_in)
+  : temp_prefix_(temp_prefix), memory_limit_bytes_(memory_limit_bytes),
+    max_merge_fan_in_(std::max(max_merge_fan_in, 2)) {}
+
+BarcodeSortedShard::~BarcodeSortedShard()
+{
+  for (std::string const& run_file : run_files_)
+    std::remove(run_file.c_str());
+}
+
+void BarcodeSortedShard::add(SamRecord* sam)
+{
+  SortEntry entry;
+  entry.key = barcodeSortKey(sam);
+  serializeSamRecord(sam, &entry.record);
+  buffered_bytes_ += entry.key.size() + entry.record.size() + kSortEntryOverhead;
+  buffer_.push_back(std::move(entry));
+
+  peak_buffered_bytes_ = std::max(peak_buffered_bytes_, buffered_bytes_);
+  if (buffered_bytes_ >= memory_limit_bytes_)
+    spillRun();
+}
+
+void BarcodeSortedShard::sortBuffer()
+{
+  // stable, so records of the same barcode and UMI keep their arrival order.
+  std::stable_sort(buffer_.begin(), buffer_.end(),
+                   [](SortEntry const& a, SortEntry const& b) { return a.key < b.key; });
+}
+
+std::string BarcodeSortedShard::nextRunFileName()
+{
+  return temp_prefix_ + ".sortrun_" + std::to_string(run_files_created_++);
+}
+
+void BarcodeSortedShard::spillRun()
+{
+  sortBuffer();
+  std::string filename = nextRunFileName();
+  std::ofstream out = openRunForWrite(filename);
+  for (SortEntry const& entry : buffer_)
+    writeRunEntry(out, entry.key, entry.record);
+  if (!out.flush())
+    crash("ERROR failed writing the sort run file " + filename);
+  run_files_.push_back(filename);
+  num_runs_++;
+
+  buffer_.clear();
+  buffer_.shrink_to_fit();
+  buffered_bytes_ = 0;
+}
+
+void BarcodeSortedShard::finish(std::function<void(SamRecord*)> const& write)
+{
+  SamRecord sam;
+  // Nothing was spilled: the whole shard fit in memory, no need to merge.
+  if (run_files_.empty())
+  {
+    sortBuffer();
+    for (SortEntry const& entry : buffer_)
+    {
+      deserializeSamRecord(entry.record, &sam);
+      write(&sam);
+    }
+    buffer_.clear();
+    return;
+  }
+
+  if (!buffer_.empty())
+    spillRun();
+
+  // Merge groups of consecutive runs until few enough are left to open at
+  // once; consecutive, so that ties still come out in arrival order.
+  while (run_files_.size() > max_merge_fan_in_)
+  {
+    std::vector<std::string> merged_files;
+    for (size_t start = 0; start < run_files_.size(); start += max_merge_fan_in_)
+    {
+      std::vector<std::string> group(run_files_.begin() + start,
+                                     run_files_.begin() + std::min(start + max_merge_fan_in_, run_files_.size()));
+      if (group.size() == 1)
+      {
+        merged_files.push_back(group[0]);
+        continue;
+      }
+      std::string filename = nextRunFileName();
+      std::ofstream out = openRunForWrite(filename);
+      mergeRuns(group, [&out](std::string const& key, std::string const& record) {
+        writeRunEntry(out, key, record);
+      });
+      if (!out.flush())
+        crash("ERROR failed writing the sort run file " + filename);
+      for (std::string const& run_file : group)
+        std::remove(run_file.c_str());
+      merged_files.push_back(filename);
+    }
+    run_files_ = std::move(merged_files);
+  }
+
+  mergeRuns(run_files_, [&](std::string const& key, std::string const& record) {
+    deserializeSamRecord(record, &sam);
+    write(&sam);
+  });
+}
@@ -0,0 +1,76 @@
+#ifndef __SCTOOLS_FASTQPREPROCESSING_BARCODE_SORTED_SHARD_H_
+#define __SCTOOLS_FASTQPREPROCESSING_BARCODE_SORTED_SHARD_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "SamFile.h"
+
+// Value for the @HD SS header tag of BAM shards written by BarcodeSortedShard,
+// so that downstream tools (e.g. TagSort) can tell the records are grouped.
+constexpr char kBarcodeSortedSubSort[] = "unsorted:CB:UR";
+
+// Collects the records of one output shard, and hands them back grouped and
+// sorted by corrected barcode (CB), then UMI (UR). Records whose barcode could
+// not be corrected come after all others, sorted by raw barcode (CR).
+//
+// Memory use is bounded: once the buffered records reach memory_limit_bytes,
+// they are sorted and spilled to a run file next to temp_prefix. finish()
+// then merges the runs (or, if nothing was spilled, just sorts in memory).
+// So as not to run out of file descriptors, no more than max_merge_fan_in
+// runs are open at once: past that, groups of runs are first merged into
+// fewer, longer ones.
+class BarcodeSortedShard
+{
+public:
+  static constexpr int kMaxMergeFanIn = 128;
+
+  BarcodeSortedShard(std::string temp_prefix, int64_t memory_limit_bytes,
+                     int max_merge_fan_in = kMaxMergeFanIn);
+  ~BarcodeSortedShard();
+
+  // Copies sam into the buffer; the caller can reuse sam right away.
+  void add(SamRecord* sam);
+
+  // Calls 'write' on every added record, in sorted order. The SamRecord passed
+  // to 'write' is only valid for the duration of the call.
+  void finish(std::function<void(SamRecord*)> const& write);
+
+  int64_t peakBufferedBytes() const { return peak_buffered_bytes_; }
+  // Runs spilled by add(), not counting those finish() merged them into.
+  int numRuns() const { return num_runs_; }
+
+private:
+  struct SortEntry
+  {
+    std::string key;
+    std::string record;
+  };
+
+  void sortBuffer();
+  void spillRun();
+  std::string nextRunFileName();
+
+  std::string temp_prefix_;
+  int64_t memory_limit_bytes_;
+  int max_merge_fan_in_;
+  std::vector<SortEntry> buffer_;
+  int64_t buffered_bytes_ = 0;
+  int64_t peak_buffered_bytes_ = 0;
+  // The runs not yet merged away.
+  std::vector<std::string> run_files_;
+  int num_runs_ = 0;
+  int run_files_created_ = 0;
+};
+
+// The key BarcodeSortedShard orders sam by.
+std::string barcodeSortKey(SamRecord* sam);
+
+// Flattens the fields fillSamRecord() sets (name, flag, sequence, quality and
+// string tags) into 'out', and restores them from it.
+void serializeSamRecord(SamRecord* sam, std::string* out);
+void deserializeSamRecord(std::string const& in, SamRecord* sam);
+
+#endif // __SCTOOLS_FASTQPREPROCESSING_BARCODE_SORTED_SHARD_H_
@@ -0,0 +1,92 @@
+#include "cell_prefilter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+#include "input_options.h"
+
+CellPrefilterSpec CellPrefilterSpec::parse(std::string const& spec)
+{
+  CellPrefilterSpec ret;
+  if (spec == "knee")
+    return ret;
+
+  size_t colon = spec.find(':');
+  std::string method = spec.substr(0, colon);
+  if (method == "top")
+    ret.method = Method::kTopN;
+  else if (method == "min-reads")
+    ret.method = Method::kMinReads;
+  else
+    colon = std::string::npos;
+
+  std::string value = colon == std::string::npos ? "" : spec.substr(colon + 1);
+  if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos ||
+      (ret.value = std::stoll(value)) <= 0)
+  {
+    crash("ERROR: cell-prefilter must be knee, top:<N> or min-reads:<N> with N positive; got " + spec);
+  }
+  return ret;
+}
+
+std::vector<std::pair<std::string, int64_t>> rankBarcodes(
+    std::unordered_map<std::string, int64_t> const& reads_per_barcode)
+{
+  std::vector<std::pair<std::string, int64_t>> ranked(reads_per_barcode.begin(), reads_per_barcode.end());
+  std::sort(ranked.begin(), ranked.end(), [](auto const& a, auto const& b) {
+    return a.second != b.second ? a.second > b.second : a.first < b.first;
+  });
+  return ranked;
+}
+
+int64_t kneeRank(std::vector<int64_t> const& sorted_counts)
+{
+  int64_t n = sorted_counts.size();
+  if (n < 3)
+    return n;
+  auto x = [](int64_t i) { return std::log10(i + 1.0); };
+  auto y = [&](int64_t i) { return std::log10(static_cast<double>(sorted_counts[i])); };
+  double slope = (y(n - 1) - y(0)) / (x(n - 1) - x(0));
+  int64_t knee = n;
+  double farthest = 0;
+  for (int64_t i = 1; i < n - 1; i++)
+  {
+    double above_line = y(i) - (y(0) + slope * (x(i) - x(0)));
+    if (above_line > farthest)
+    {
+      farthest = above_line;
+      knee = i + 1;
+    }
+  }
+  return knee;
+}
+
+int64_t numCells(std::vector<std::pair<std::string, int64_t>> const& ranked, CellPrefilterSpec const& spec)
+{
+  switch (spec.method)
+  {
+  case CellPrefilterSpec::Method::kTopN:
+    return std::min<int64_t>(spec.value, ranked.size());
+  case CellPrefilterSpec::Method::kMinReads:
+    return std::count_if(ranked.begin(), ranked.end(), [&](auto const& barcode) {
+      return barcode.second >= spec.value;
+    });
+  case CellPrefilterSpec::Method::kKnee:
+  default:
+    std::vector<int64_t> counts;
+    for (auto const& barcode : ranked)
+      counts.push_back(barcode.second);
+    return kneeRank(counts);
+  }
+}
+
+void writeBarcodeCounts(std::string const& path, std::vector<std::pair<std::string, int64_t>> const& ranked,
+                        int64_t num_cells)
+{
+  std::ofstream out(path);
+  for (int64_t i = 0; i < ranked.size(); i++)
+    out << ranked[i].first << '\t' << ranked[i].second << '\t' << (i < num_cells) << '\n';
+  if (!out)
+    crash("ERROR: Failed to write barcode counts " + path);
+}
@@ -0,0 +1,49 @@
+#ifndef __SCTOOLS_FASTQPREPROCESSING_CELL_PREFILTER_H_
+#define __SCTOOLS_FASTQPREPROCESSING_CELL_PREFILTER_H_
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// How --cell-prefilter picks the barcodes whose reads are kept, from a first
+// pass counting reads per corrected barcode:
+//   "knee"          the barcodes ranked above the knee of the barcode rank plot
+//   "top:<N>"       the N barcodes with the most reads
+//   "min-reads:<N>" the barcodes with at least N reads
+struct CellPrefilterSpec
+{
+  enum class Method
+  {
+    kKnee,
+    kTopN,
+    kMinReads,
+  };
+  Method method = Method::kKnee;
+  int64_t value = 0;
+
+  // Crashes on anything but the forms above.
+  static CellPrefilterSpec parse(std::string const& spec);
+};
+
+// Barcodes and their read counts, most reads first (ties by barcode).
+std::vector<std::pair<std::string, int64_t>> rankBarcodes(
+    std::unordered_map<std::string, int64_t> const& reads_per_barcode);
+
+// Of counts sorted in decreasing order, how many are up to the knee: the point
+// of the log(count) vs. log(rank) curve farthest above the line from its first
+// to its last point, where the cells' plateau drops off to the empty droplets.
+// All of them if there's no such point.
+int64_t kneeRank(std::vector<int64_t> const& sorted_counts);
+
+// How many of the barcodes 'ranked' (as from rankBarcodes()) are cells.
+int64_t numCells(std::vector<std::pair<std::string, int64_t>> const& ranked, CellPrefilterSpec const& spec);
+
+// Writes "<barcode>\t<reads>\t<1 if a cell, else 0>" lines for all of 'ranked',
+// of which the first num_cells are cells.
+void writeBarcodeCounts(std::string const& path, std::vector<std::pair<std::string, int64_t>> const& ranked,
+                        int64_t num_cells);
+
+#endif // __SCTOOLS_FASTQPREPROCESSING_CELL_PREFILTER_H_
@@ -0,0 +1,217 @@
+#include "checkpoint.h"
+
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+#include "input_options.h"
+
+constexpr char kManifestHeader[] = "fastqprocess_checkpoint";
+constexpr int kManifestVersion = 2;
+
+// The manifest is tab-separated text, one item per line:
+//   fastqprocess_checkpoint  <version>
+//   output_format  <format>
+//   reader  <R1>  <records>  <correct>  <corrected>  <errors>
+//   shard  <records>  <correct>  <corrected>  <uncorrectable>  [<path>  <bytes>]...
+void writeCheckpointManifest(std::string const& path, CheckpointManifest const& manifest)
+{
+  std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream out(tmp_path);
+    if (!out)
+      crash("ERROR: Failed to open checkpoint manifest " + tmp_path + " for writing");
+    out << kManifestHeader << "\t" << kManifestVersion << "\n";
+    out << "output_format\t" << manifest.output_format << "\n";
+    for (int i = 0; i < manifest.readers.size(); i++)
+    {
+      ReaderCheckpoint const& reader = manifest.readers[i];
+      out << "reader\t" << manifest.R1s[i] << "\t" << reader.records << "\t"
+          << reader.n_barcode_correct << "\t" << reader.n_barcode_corrected << "\t"
+          << reader.n_barcode_errors << "\n";
+    }
+    for (ShardCheckpoint const& shard : manifest.shards)
+    {
+      out << "shard\t" << shard.records << "\t" << shard.barcodes_correct << "\t"
+          << shard.barcodes_corrected << "\t" << shard.barcodes_uncorrectable;
+      for (ShardFileCheckpoint const& file : shard.files)
+        out << "\t" << file.path << "\t" << file.bytes;
+      out << "\n";
+    }
+    if (!out.flush())
+      crash("ERROR: Failed to write checkpoint manifest " + tmp_path);
+  }
+  syncFile(tmp_path);
+  if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    crash("ERROR: Failed to rename checkpoint manifest into place at " + path);
+}
+
+bool readCheckpointManifest(std::string const& path, CheckpointManifest* manifest)
+{
+  std::ifstream in(path);
+  if (!in)
+    return false;
+
+  *manifest = CheckpointManifest();
+  std::string line;
+  std::string header;
+  int version = 0;
+  if (!std::getline(in, line) || !(std::istringstream(line) >> header >> version) ||
+      header != kManifestHeader || version != kManifestVersion)
+  {
+    crash("ERROR: " + path + " is not a checkpoint manifest this version can resume from");
+  }
+  while (std::getline(in, line))
+  {
+    std::istringstream fields(line);
+    std::string kind;
+    std::getline(fields, kind, '\t');
+    if (kind == "output_format")
+    {
+      std::getline(fields, manifest->output_format, '\t');
+    }
+    else if (kind == "reader")
+    {
+      std::string R1;
+      ReaderCheckpoint reader;
+      std::getline(fields, R1, '\t');
+      if (!(fields >> reader.records >> reader.n_barcode_correct >>
+            reader.n_barcode_corrected >> reader.n_barcode_errors))
+      {
+        crash("ERROR: Malformed reader line in checkpoint manifest " + path + ": " + line);
+      }
+      manifest->R1s.push_back(R1);
+      manifest->readers.push_back(reader);
+    }
+    else if (kind == "shard")
+    {
+      ShardCheckpoint shard;
+      std::string field;
+      if (!(fields >> shard.records >> shard.barcodes_correct >> shard.barcodes_corrected >>
+            shard.barcodes_uncorrectable))
+      {
+        crash("ERROR: Malformed shard line in checkpoint manifest " + path + ": " + line);
+      }
+      fields.ignore(1);  // the tab before the first path
+      ShardFileCheckpoint file;
+      while (std::getline(fields, file.path, '\t') && std::getline(fields, field, '\t'))
+      {
+        file.bytes = std::stoll(field);
+        shard.files.push_back(file);
+      }
+      manifest->shards.push_back(shard);
+    }
+    else if (!kind.empty())
+    {
+      crash("ERROR: Unknown line in checkpoint manifest " + path + ": " + line);
+    }
+  }
+  return true;
+}
+
+void syncFile(std::string const& path)
+{
+  // fsync() applies to the file, not the descriptor, so a fresh read-only
+  // descriptor is enough to flush what other descriptors wrote.
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0 || fdatasync(fd) != 0)
+    crash("ERROR: Failed to sync " + path + " to disk");
+  close(fd);
+}
+
+CheckpointCoordinator::CheckpointCoordinator(std::string manifest_path, CheckpointManifest initial,
+                                             int interval_sec, std::function<void()> signal_writers)
+  : manifest_path_(manifest_path),
+    manifest_(initial),
+    interval_(interval_sec),
+    signal_writers_(signal_writers) {}
+
+CheckpointCoordinator::~CheckpointCoordinator()
+{
+  stop();
+}
+
+void CheckpointCoordinator::start()
+{
+  thread_ = std::thread(&CheckpointCoordinator::run, this);
+}
+
+void CheckpointCoordinator::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void CheckpointCoordinator::pause(int reader_thread_index, ReaderCheckpoint const& state)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!pause_requested_)
+    return;
+  manifest_.readers[reader_thread_index] = state;
+  readers_paused_++;
+  int generation = generation_;
+  cv_.notify_all();
+  cv_.wait(lock, [&] { return generation_ != generation; });
+}
+
+void CheckpointCoordinator::readerFinished(int reader_thread_index, ReaderCheckpoint const& state)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  manifest_.readers[reader_thread_index] = state;
+  readers_finished_++;
+  cv_.notify_all();
+}
+
+void CheckpointCoordinator::writerCheckpointed(int write_thread_index, ShardCheckpoint const& state)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  manifest_.shards[write_thread_index] = state;
+  writers_checkpointed_++;
+  cv_.notify_all();
+}
+
+void CheckpointCoordinator::run()
+{
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (cv_.wait_for(lock, interval_, [&] { return stopping_; }))
+        return;
+    }
+    takeCheckpoint();
+  }
+}
+
+void CheckpointCoordinator::takeCheckpoint()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  int num_readers = manifest_.readers.size();
+  int num_writers = manifest_.shards.size();
+
+  pause_requested_ = true;
+  cv_.wait(lock, [&] { return readers_paused_ + readers_finished_ == num_readers; });
+
+  writers_checkpointed_ = 0;
+  lock.unlock();
+  signal_writers_();
+  lock.lock();
+  cv_.wait(lock, [&] { return writers_checkpointed_ == num_writers; });
+
+  writeCheckpointManifest(manifest_path_, manifest_);
+  num_checkpoints_++;
+  std::cout << "wrote checkpoint " << num_checkpoints_ << " to " << manifest_path_ << std::endl;
+
+  pause_requested_ = false;
+  readers_paused_ = 0;
+  generation_++;
+  cv_.notify_all();
+}
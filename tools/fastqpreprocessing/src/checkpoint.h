@@ -0,0 +1,143 @@
+#ifndef __SCTOOLS_FASTQPREPROCESSING_CHECKPOINT_H_
+#define __SCTOOLS_FASTQPREPROCESSING_CHECKPOINT_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Overview of checkpointing (--checkpoint-interval-sec):
+// * Every interval, the CheckpointCoordinator asks all readers to pause. Each
+//   reader stops between two reads and records how many reads it has consumed.
+// * Once all readers are paused (or finished), every write queue gets a
+//   checkpoint marker behind the records already queued. A writer reaching
+//   the marker has written everything its shard will get before the pause, so
+//   it flushes and syncs its files and reports their sizes.
+// * Once all writers have reported, the manifest is written atomically (temp
+//   file + rename), and the readers continue.
+// * With --resume, each reader skips the reads the manifest says it already
+//   consumed, and each writer cuts its shard back to the manifest's sizes
+//   before writing on, so the outputs match an uninterrupted run.
+
+// Progress of one reader thread at a checkpoint.
+struct ReaderCheckpoint
+{
+  int64_t records = 0;
+  int64_t n_barcode_correct = 0;
+  int64_t n_barcode_corrected = 0;
+  int64_t n_barcode_errors = 0;
+};
+
+// How many of a reader's reads a checkpoint can count as done. A reader may
+// hold filled records back, unwritten (until the whitelist corrector is
+// ready); then everything from the first held read on is left for a resumed
+// run to read again, including reads dropped (trimmed) since.
+class ReaderProgress
+{
+public:
+  // Read number 'read' (counting from 1) is held back.
+  void hold(int64_t read)
+  {
+    if (held_++ == 0)
+      first_held_ = read - 1;
+  }
+  // The held records have all been handed to the writers.
+  void releaseHeld() { held_ = 0; }
+  // With 'reads' read so far.
+  int64_t done(int64_t reads) const { return held_ > 0 ? first_held_ : reads; }
+
+private:
+  int64_t held_ = 0;
+  int64_t first_held_ = 0;
+};
+
+// Size of one output file of a shard, as flushed and synced at a checkpoint.
+struct ShardFileCheckpoint
+{
+  std::string path;
+  int64_t bytes = 0;
+};
+
+// Progress of one writer thread at a checkpoint.
+struct ShardCheckpoint
+{
+  int64_t records = 0;
+  // How many of the records had a whitelist barcode, one a base off one, or
+  // neither; for the output manifest.
+  int64_t barcodes_correct = 0;
+  int64_t barcodes_corrected = 0;
+  int64_t barcodes_uncorrectable = 0;
+  std::vector<ShardFileCheckpoint> files;
+};
+
+struct CheckpointManifest
+{
+  std::string output_format;
+  // The R1 input of each reader; resuming with different inputs is an error.
+  std::vector<std::string> R1s;
+  std::vector<ReaderCheckpoint> readers;
+  std::vector<ShardCheckpoint> shards;
+};
+
+// Writes 'manifest' to a temporary file next to 'path', syncs it, and renames
+// it over 'path', so that 'path' always holds a complete manifest.
+void writeCheckpointManifest(std::string const& path, CheckpointManifest const& manifest);
+
+// Returns false if there is no manifest at 'path'. Crashes if it's malformed.
+bool readCheckpointManifest(std::string const& path, CheckpointManifest* manifest);
+
+// Flushes the data of the file at 'path' to stable storage.
+void syncFile(std::string const& path);
+
+class CheckpointCoordinator
+{
+public:
+  // signal_writers must put a checkpoint marker at the end of every write
+  // queue; each writer then answers with writerCheckpointed().
+  CheckpointCoordinator(std::string manifest_path, CheckpointManifest initial,
+                        int interval_sec, std::function<void()> signal_writers);
+  ~CheckpointCoordinator();
+
+  void start();
+  // Stops taking checkpoints. Call once all readers have finished, and before
+  // the writers are shut down.
+  void stop();
+
+  // Called by reader threads between reads. Blocks for the duration of a
+  // checkpoint if one has been requested.
+  void maybePause(int reader_thread_index, ReaderCheckpoint const& state)
+  {
+    if (pause_requested_.load(std::memory_order_relaxed))
+      pause(reader_thread_index, state);
+  }
+  void readerFinished(int reader_thread_index, ReaderCheckpoint const& state);
+  void writerCheckpointed(int write_thread_index, ShardCheckpoint const& state);
+
+private:
+  void pause(int reader_thread_index, ReaderCheckpoint const& state);
+  void run();
+  void takeCheckpoint();
+
+  std::string manifest_path_;
+  CheckpointManifest manifest_;
+  std::chrono::seconds interval_;
+  std::function<void()> signal_writers_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::atomic<bool> pause_requested_{false};
+  bool stopping_ = false;
+  int generation_ = 0;
+  int readers_paused_ = 0;
+  int readers_finished_ = 0;
+  int writers_checkpointed_ = 0;
+  int num_checkpoints_ = 0;
+  std::thread thread_;
+};
+
+#endif // __SCTOOLS_FASTQPREPROCESSING_CHECKPOINT_H_
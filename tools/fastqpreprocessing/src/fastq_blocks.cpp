@@ -0,0 +1,87 @@
+#include "fastq_blocks.h"
+
+#include <cstring>
+#include <iostream>
+#include <zlib.h>
+
+#include "input_options.h"
+
+void FastqBlockQueue::push(std::string block)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  not_full_.wait(lock, [this] { return blocks_.size() < capacity_; });
+  blocks_.push_back(std::move(block));
+  not_empty_.notify_one();
+}
+
+bool FastqBlockQueue::pop(std::string* block)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  not_empty_.wait(lock, [this] { return !blocks_.empty() || closed_; });
+  if (blocks_.empty())
+    return false;
+  *block = std::move(blocks_.front());
+  blocks_.pop_front();
+  not_full_.notify_one();
+  return true;
+}
+
+void FastqBlockQueue::close()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  closed_ = true;
+  not_empty_.notify_all();
+}
+
+void readFastqBlocks(std::string const& filename, FastqBlockQueue* queue, size_t block_bytes)
+{
+  gzFile file = gzopen(filename.c_str(), "rb");
+  if (!file)
+    crash("Failed to open R1 file " + filename);
+  gzbuffer(file, 1 << 20);
+
+  std::string block;
+  int64_t num_records = 0;
+  // Lines of the record being read at the end of 'block', and where that
+  // record starts.
+  int lines_into_record = 0;
+  size_t record_start = 0;
+  for (;;)
+  {
+    size_t old_size = block.size();
+    block.resize(old_size + block_bytes);
+    int bytes = gzread(file, &block[old_size], block_bytes);
+    if (bytes < 0)
+      crash("Failed to read R1 file " + filename);
+    block.resize(old_size + bytes);
+    if (bytes == 0)
+      break;
+
+    for (const char* newline = block.data() + old_size;
+         (newline = static_cast<const char*>(memchr(newline, '\n', block.data() + block.size() - newline)));
+         newline++)
+    {
+      if (++lines_into_record == 4)
+      {
+        lines_into_record = 0;
+        record_start = newline + 1 - block.data();
+        if (++num_records % 10000000 == 0)
+          std::cout << filename << ": " << num_records << " reads" << std::endl;
+      }
+    }
+    // Hand over the whole records (if any), keeping the partial one for the
+    // next block.
+    if (record_start > 0)
+    {
+      std::string rest = block.substr(record_start);
+      block.resize(record_start);
+      queue->push(std::move(block));
+      block = std::move(rest);
+      record_start = 0;
+    }
+  }
+  // A last record missing its final newline.
+  if (!block.empty())
+    queue->push(std::move(block));
+  gzclose(file);
+}
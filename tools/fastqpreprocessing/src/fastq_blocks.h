@@ -0,0 +1,65 @@
+#ifndef __SCTOOLS_FASTQPREPROCESSING_FASTQ_BLOCKS_H_
+#define __SCTOOLS_FASTQPREPROCESSING_FASTQ_BLOCKS_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+// Blocks of whole FASTQ records, decompressed from the R1s, on their way from
+// the threads reading the R1s to the threads counting them. push() waits
+// while the queue is full.
+class FastqBlockQueue
+{
+public:
+  explicit FastqBlockQueue(size_t capacity) : capacity_(capacity) {}
+  void push(std::string block);
+  // Returns false once the queue is closed and empty.
+  bool pop(std::string* block);
+  // Called once nothing more will be pushed.
+  void close();
+
+private:
+  size_t capacity_;
+  bool closed_ = false;
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+  std::deque<std::string> blocks_;
+};
+
+// Decompressed bytes of an R1 read at a time.
+constexpr size_t kFastqBlockBytes = 4 << 20;
+
+// Decompresses (if gzipped) 'filename' and pushes it to 'queue' in blocks of
+// whole 4 line FASTQ records, reading block_bytes at a time. A block holds
+// every record that ended in what was read so far; only the last may be
+// missing its final newline.
+void readFastqBlocks(std::string const& filename, FastqBlockQueue* queue,
+                     size_t block_bytes = kFastqBlockBytes);
+
+// Calls f(sequence, quality) for each 4 line record in 'block', a block
+// readFastqBlocks() pushed. Lines may end in "\r\n".
+template <typename F> void forEachFastqRecord(std::string_view block, F f)
+{
+  size_t line_start = 0;
+  std::string_view seq;
+  for (int line = 0; line_start < block.size(); line = (line + 1) % 4)
+  {
+    size_t line_end = block.find('\n', line_start);
+    if (line_end == std::string_view::npos)
+      line_end = block.size();
+    std::string_view text = block.substr(line_start, line_end - line_start);
+    if (!text.empty() && text.back() == '\r')
+      text.remove_suffix(1);
+    if (line == 1)
+      seq = text;
+    else if (line == 3)
+      f(seq, text);
+    line_start = line_end + 1;
+  }
+}
+
+#endif // __SCTOOLS_FASTQPREPROCESSING_FASTQ_BLOCKS_H_
@@ -1,12 +1,24 @@
-#include <gzstream.h>
 #include <iostream>
 #include <fstream>
 #include <cstdint>
 
 #include "fastq_common.h"
 // number of samrecords per buffer in each reader
-constexpr size_t kSamRecordBufferSize = 10000;
+#include "barcode_sorted_shard.h"
+#include "cell_prefilter.h"
+#include "checkpoint.h"
+#include "input_backend.h"
 #include "input_options.h"
+#include "memory_budget.h"
+#include "numa_placement.h"
+#include "output_schema.h"
+#include "output_stream.h"
+#include "pipeline_metrics.h"
+#include "quality_binning.h"
+#include "read_trimmer.h"
+#include "sample_demux.h"
+#include "shard_manifest.h"
+#include "thread_tuner.h"
 #include "whitelist_corrector.h"
 
 #include "FastQFile.h"
@@ -18,6 +30,7 @@ constexpr size_t kSamRecordBufferSize = 10000;
 #include <thread>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <iostream>
 #include <fstream>
 #include <cstdio>
@@ -25,7 +38,10 @@ constexpr size_t kSamRecordBufferSize = 10000;
 #include <getopt.h>
 #include <vector>
 #include <functional>
+#include <filesystem>
+#include <future>
 #include <stack>
+#include <sys/resource.h>
 
 // Overview of multithreading:
 // * There are reader threads and writer threads. (Writers are either fastq or
@@ -39,55 +55,170 @@ constexpr size_t kSamRecordBufferSize = 10000;
 //   the record pointer's arena that the record's memory is no longer in use.
 //   The arena can then give that pointer to its reader for a new read.
 
+// Nanoseconds since 'start', for the blocked time counters.
+int64_t nanosSince(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
 PendingWrite WriteQueue::dequeueWrite()
 {
   std::unique_lock<std::mutex> lock(mutex_);
-  cv_.wait(lock, [&] { return !queue_.empty(); });
-  auto pair = queue_.front();
+  if (queue_.empty())
+  {
+    auto start = std::chrono::steady_clock::now();
+    cv_.wait(lock, [&] { return !queue_.empty(); });
+    blocked_ns_.fetch_add(nanosSince(start), std::memory_order_relaxed);
+  }
+  PendingWrite write = queue_.front();
   queue_.pop();
-  return pair;
+  return write;
 }
 void WriteQueue::enqueueWrite(PendingWrite write)
 {
   mutex_.lock();
   queue_.push(write);
+  peak_depth_ = std::max(peak_depth_, queue_.size());
   mutex_.unlock();
   cv_.notify_one();
 }
+size_t WriteQueue::depth()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return queue_.size();
+}
+size_t WriteQueue::peakDepth()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return peak_depth_;
+}
 void WriteQueue::enqueueShutdownSignal()
 {
   mutex_.lock();
-  queue_.push(std::make_pair(nullptr, kShutdown));
+  queue_.push(PendingWrite{nullptr, kShutdown});
+  mutex_.unlock();
+  cv_.notify_one();
+}
+void WriteQueue::enqueueCheckpointSignal()
+{
+  mutex_.lock();
+  queue_.push(PendingWrite{nullptr, kCheckpoint});
   mutex_.unlock();
   cv_.notify_one();
 }
 std::vector<std::unique_ptr<WriteQueue>> g_write_queues;
 
+// Set when --checkpoint-interval-sec is given; see checkpoint.h.
+std::unique_ptr<CheckpointCoordinator> g_checkpointer;
+// With --resume, the checkpoint to continue from. Its readers and shards are
+// empty when starting from scratch.
+CheckpointManifest g_resume_from;
+constexpr char kCheckpointManifestName[] = "fastqprocess_checkpoint.tsv";
+
+// Sizes of the arenas and sort buffers; see memory_budget.h.
+MemoryPlan g_memory_plan;
+// Each writer's peak sort buffer usage, for the memory report.
+std::vector<int64_t> g_sort_peak_bytes;
+
+// Set when --quality-binning is given.
+std::unique_ptr<QualityBinning> g_quality_binning;
+// With --output-tags, the optional tags to add; all of them when null.
+std::unique_ptr<OutputTagSet> g_output_tags;
+
+// Set when any --trim-* or --min-read-* option is given. Each reader adds its
+// counts to g_trim_counts when it's done.
+std::unique_ptr<ReadTrimmer> g_read_trimmer;
+TrimCounts g_trim_counts;
+std::mutex g_trim_counts_mutex;
+
+// With --cell-prefilter, the corrected barcodes whose reads are written. The
+// readers drop the others' reads, counting them in g_prefiltered_reads.
+std::unique_ptr<std::unordered_set<std::string>> g_cells;
+std::atomic<int64_t> g_prefiltered_reads{0};
+constexpr char kCellPrefilterCountsName[] = "cell_prefilter_barcodes.tsv";
+
+// With --sample-sheet, the samples reads are demultiplexed into; see
+// sample_demux.h. Each sample, then the undetermined reads, gets a set of
+// g_shards_per_set consecutive writers. Otherwise all writers form one set.
+std::unique_ptr<SampleDemultiplexer> g_demux;
+int g_shards_per_set = 1;
+
+// What each writer wrote, filled in as it finishes; see shard_manifest.h.
+std::vector<ShardSummary> g_shard_summaries;
+constexpr char kOutputManifestName[] = "fastqprocess_manifest.json";
+
+// With --numa on a multi-node host, where each reader and writer runs; see
+// numa_placement.h. Otherwise it has no nodes.
+NumaPlacement g_numa_placement;
+
+// Set when --auto-threads is given; see thread_tuner.h.
+std::unique_ptr<ReaderSlots> g_reader_slots;
+constexpr std::chrono::milliseconds kThreadTunerInterval(2000);
+
+void pinToNumaNode(std::vector<int> const& thread_nodes, int thread_index)
+{
+  if (!g_numa_placement.nodes.empty())
+    pinCurrentThreadToNode(g_numa_placement.nodes[thread_nodes[thread_index]]);
+}
+
+// Progress counters that the reader and writer threads publish for
+// samplePipelineMetrics(), which may read them at any time.
+struct ReaderStats
+{
+  std::atomic<int64_t> reads{0};
+  std::atomic<int64_t> inflated_bytes{0};
+  std::atomic<int64_t> barcodes_correct{0};
+  std::atomic<int64_t> barcodes_corrected{0};
+  std::atomic<int64_t> barcodes_uncorrectable{0};
+};
+struct ShardStats
+{
+  std::atomic<int64_t> records{0};
+  std::atomic<int64_t> uncompressed_bytes{0};
+  std::atomic<int64_t> deflated_bytes{0};
+};
+std::vector<std::unique_ptr<ReaderStats>> g_reader_stats;
+std::vector<std::unique_ptr<ShardStats>> g_shard_stats;
+// Readers publish their counters once per this many reads (and when done).
+constexpr int kReaderStatsInterval = 1024;
+
 // I wrote this class to stay close to the performance characteristics of the
 // original code, but I suspect the large buffers might not be necessary.
 // If it doesn't slow things down noticeably, it would be cleaner to just delete
 // this class, and have the WriteQueue accept unique_ptr<SamRecord> (with the
 // addition of some reasonable bound on how much WriteQueue can have
-// outstanding; maybe kSamRecordBufferSize items), and let them be directly
+// outstanding; maybe kDefaultArenaRecords items), and let them be directly
 // destroyed after writing rather than be reused with this arena approach.
 class SamRecordArena
 {
 public:
-  SamRecordArena()
+  explicit SamRecordArena(int64_t capacity) : capacity_(capacity) {}
+
+  // Creates the records. The reader thread calls this itself, so that they
+  // are first touched (and so, by default, placed) on its NUMA node.
+  void allocate()
   {
-    for (int i = 0; i < kSamRecordBufferSize; i++)
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = 0; i < capacity_; i++)
       samrecords_memory_.push_back(std::make_unique<SamRecord>());
 
     for (int i = samrecords_memory_.size() - 1; i >= 0; i--)
       available_samrecords_.push(samrecords_memory_[i].get());
+    min_available_ = available_samrecords_.size();
   }
 
   SamRecord* acquireSamRecordMemory()
   {
     std::unique_lock<std::mutex> lock(mutex_);
-    cv_.wait(lock, [&] { return !available_samrecords_.empty(); });
+    if (available_samrecords_.empty())
+    {
+      auto start = std::chrono::steady_clock::now();
+      cv_.wait(lock, [&] { return !available_samrecords_.empty(); });
+      blocked_ns_.fetch_add(nanosSince(start), std::memory_order_relaxed);
+    }
     SamRecord* sam = available_samrecords_.top();
     available_samrecords_.pop();
+    min_available_ = std::min(min_available_, available_samrecords_.size());
     return sam;
   }
   void releaseSamRecordMemory(SamRecord* sam)
@@ -97,12 +228,25 @@ public:
     mutex_.unlock();
     cv_.notify_one();
   }
+
+  size_t capacity() const { return capacity_; }
+  // Most records loaned out at any one time.
+  size_t peakInUse()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return samrecords_memory_.size() - min_available_;
+  }
+  // Total time acquireSamRecordMemory() has spent waiting for a release.
+  int64_t blockedNanos() const { return blocked_ns_.load(std::memory_order_relaxed); }
 private:
+  int64_t capacity_;
   std::vector<std::unique_ptr<SamRecord>> samrecords_memory_;
   std::mutex mutex_;
   std::condition_variable cv_;
   // Reusing most-recently-used memory first ought to be more cache friendly.
   std::stack<SamRecord*> available_samrecords_;
+  size_t min_available_ = 0;
+  std::atomic<int64_t> blocked_ns_{0};
 };
 
 std::vector<std::unique_ptr<SamRecordArena>> g_read_arenas;
@@ -111,14 +255,14 @@ void releaseReaderThreadMemory(int reader_thread_index, SamRecord* samRecord)
   g_read_arenas[reader_thread_index]->releaseSamRecordMemory(samRecord);
 }
 
-void outputHandler(WriteQueue* cur_write_queue, SamRecord* samrec, int reader_thread_index)
+void outputHandler(WriteQueue* cur_write_queue, SamRecord* samrec, int reader_thread_index, BarcodeMatch match)
 {
-  cur_write_queue->enqueueWrite(std::make_pair(samrec, reader_thread_index));
+  cur_write_queue->enqueueWrite(PendingWrite{samrec, reader_thread_index, match});
 }
 // ---------------------------------------------------
 // Write to output BAM OR FASTQ
 // ----------------------------------------------------
-void writeFastqRecord(ogzstream& r1_out, ogzstream& r2_out, SamRecord* sam, bool sample_bool)
+void writeFastqRecord(std::ostream& r1_out, std::ostream& r2_out, SamRecord* sam, bool sample_bool)
 {
   // if sample_bool set to true, write reads with only corrected/correct barcodes 
   // probably would need to change how this is done
@@ -145,7 +289,7 @@ void writeFastqRecord(ogzstream& r1_out, ogzstream& r2_out, SamRecord* sam, bool
   }
 }
 
-void writeFastqRecordATAC(ogzstream& r1_out, ogzstream& r2_out, ogzstream& r3_out, 
+void writeFastqRecordATAC(std::ostream& r1_out, std::ostream& r2_out, std::ostream& r3_out, 
                           SamRecord* sam, bool sample_bool)
 {
   std::string cb_barcode = sam->getString("CB").c_str();
@@ -199,72 +343,340 @@ void writeFastqRecordATAC(ogzstream& r1_out, ogzstream& r2_out, ogzstream& r3_ou
   
 }
 
-void fastqWriterThread(int write_thread_index, bool sample_bool)
+// With --sort-by-barcode, the sorter a writer hands its records to instead of
+// writing them right away; its run files are named after shard_name. The
+// sorting memory budget is split evenly between the shards. Null otherwise.
+std::unique_ptr<BarcodeSortedShard> makeShardSorter(PipelineOptions const& pipeline, std::string const& shard_name)
 {
-  std::string r1_output_fname = "fastq_R1_" + std::to_string(write_thread_index) + ".fastq.gz";
-  ogzstream r1_out(r1_output_fname.c_str());
+  if (!pipeline.sort_by_barcode)
+    return nullptr;
+  std::string temp_dir = pipeline.sort_temp_dir.empty() ? pipeline.output_dir : pipeline.sort_temp_dir;
+  int64_t memory_limit_bytes = g_memory_plan.sort_bytes / g_write_queues.size();
+  return std::make_unique<BarcodeSortedShard>((std::filesystem::path(temp_dir) / shard_name).string(),
+                                              std::max<int64_t>(memory_limit_bytes, 1024 * 1024));
+}
+
+// With --resume, the size 'path' had at the checkpoint, for
+// ShardOutputStream's resume_offset. -1 when starting from scratch.
+int64_t resumeOffset(int write_thread_index, std::string const& path)
+{
+  if (g_resume_from.shards.empty())
+    return -1;
+  for (ShardFileCheckpoint const& file : g_resume_from.shards[write_thread_index].files)
+    if (file.path == path)
+      return file.bytes;
+  crash("ERROR: checkpoint manifest has no entry for " + path + "; can't resume.");
+  return -1;
+}
+
+// A writer's barcode counter, continuing from the checkpoint when resuming.
+ShardBarcodeCounter makeShardBarcodeCounter(int write_thread_index)
+{
+  ShardBarcodeCounter counter;
+  if (!g_resume_from.shards.empty())
+  {
+    ShardCheckpoint const& resumed = g_resume_from.shards[write_thread_index];
+    counter.resume(BarcodeTallies{resumed.barcodes_correct, resumed.barcodes_corrected,
+                                  resumed.barcodes_uncorrectable});
+  }
+  return counter;
+}
+
+void countShardBarcode(ShardBarcodeCounter& counter, SamRecord* sam, BarcodeMatch match)
+{
+  counter.add(sam->getString("CB").c_str(), match);
+}
+
+// A checkpoint of a shard's records and barcode counts, without its files.
+ShardCheckpoint shardCheckpoint(int64_t records, ShardBarcodeCounter const& counter)
+{
+  ShardCheckpoint state;
+  state.records = records;
+  state.barcodes_correct = counter.tallies().correct;
+  state.barcodes_corrected = counter.tallies().corrected;
+  state.barcodes_uncorrectable = counter.tallies().uncorrectable;
+  return state;
+}
+
+// Flushes the files of a FASTQ shard at a checkpoint marker, and reports them.
+void checkpointFastqShard(int write_thread_index, int64_t records, ShardBarcodeCounter const& counter,
+                          std::vector<std::pair<std::string, ShardOutputStream*>> const& files)
+{
+  ShardCheckpoint state = shardCheckpoint(records, counter);
+  for (auto [path, out] : files)
+    state.files.push_back(ShardFileCheckpoint{path, out->checkpoint()});
+  g_checkpointer->writerCheckpointed(write_thread_index, state);
+}
+
+// Records a finished FASTQ shard for the output manifest. With sample_bool,
+// only the records with a corrected barcode were written.
+void summarizeFastqShard(int write_thread_index, int64_t records, bool sample_bool,
+                         ShardBarcodeCounter const& counter,
+                         std::vector<std::pair<std::string, ShardOutputStream*>> const& files)
+{
+  ShardSummary& summary = g_shard_summaries[write_thread_index];
+  summary.barcodes = counter.tallies();
+  summary.records = sample_bool ? summary.barcodes.correct + summary.barcodes.corrected : records;
+  summary.distinct_barcodes = counter.distinctBarcodes();
+  for (auto [path, out] : files)
+    summary.files.push_back(ShardFileSummary{path, out->compressedBytes(), out->md5()});
+}
+
+// Records a finished BAM shard for the output manifest. libStatGen writes the
+// file itself, so it's checksummed on its way through 'checksummed', which is
+// null for a shard streamed to a FIFO.
+void summarizeBamShard(int write_thread_index, int64_t records, ShardBarcodeCounter const& counter,
+                       std::string const& path, ChecksummedOutputPipe* checksummed)
+{
+  ShardSummary& summary = g_shard_summaries[write_thread_index];
+  summary.records = records;
+  summary.barcodes = counter.tallies();
+  summary.distinct_barcodes = counter.distinctBarcodes();
+  if (checksummed)
+    summary.files.push_back(ShardFileSummary{path, checksummed->bytes(), checksummed->md5()});
+  else
+    summary.files.push_back(ShardFileSummary{path});
+}
+
+// Publishes a FASTQ shard's progress for the metrics.
+void publishShardStats(int write_thread_index, int64_t records,
+                       std::initializer_list<ShardOutputStream const*> files)
+{
+  ShardStats& stats = *g_shard_stats[write_thread_index];
+  int64_t uncompressed_bytes = 0;
+  int64_t deflated_bytes = 0;
+  for (ShardOutputStream const* file : files)
+  {
+    uncompressed_bytes += file->uncompressedBytes();
+    deflated_bytes += file->compressedBytes();
+  }
+  stats.records.store(records, std::memory_order_relaxed);
+  stats.uncompressed_bytes.store(uncompressed_bytes, std::memory_order_relaxed);
+  stats.deflated_bytes.store(deflated_bytes, std::memory_order_relaxed);
+}
+
+// The same for a BAM shard, whose bytes are only seen once libStatGen has
+// compressed them, on their way through 'checksummed' (null for a FIFO shard,
+// which then reports none).
+void publishShardStats(int write_thread_index, int64_t records, ChecksummedOutputPipe const* checksummed)
+{
+  ShardStats& stats = *g_shard_stats[write_thread_index];
+  stats.records.store(records, std::memory_order_relaxed);
+  if (checksummed)
+    stats.deflated_bytes.store(checksummed->bytes(), std::memory_order_relaxed);
+}
+
+// With --sample-sheet, the sample whose reads writer write_thread_index gets.
+std::string shardSampleName(int write_thread_index)
+{
+  int shard_set = write_thread_index / g_shards_per_set;
+  return shard_set < g_demux->numSamples() ? g_demux->sampleName(shard_set) : kUndeterminedSampleName;
+}
+
+// Path of the output file <prefix><number><extension> of writer
+// write_thread_index, numbered within its shard set. With --sample-sheet it
+// goes in the sample's subdirectory.
+std::string shardPath(PipelineOptions const& pipeline, std::string const& prefix, int write_thread_index,
+                      std::string const& extension)
+{
+  std::string filename = prefix + std::to_string(write_thread_index % g_shards_per_set) + extension;
+  if (g_demux)
+    filename = shardSampleName(write_thread_index) + "/" + filename;
+  return outputPath(pipeline, filename);
+}
+
+// Path of the FASTQ shard for 'read' ("R1", "R2" or "R3") from writer
+// write_thread_index.
+std::string fastqShardPath(PipelineOptions const& pipeline, std::string const& read, int write_thread_index)
+{
+  std::string extension = pipeline.output_compression_level == 0 ? ".fastq" : ".fastq.gz";
+  return shardPath(pipeline, "fastq_" + read + "_", write_thread_index, extension);
+}
+
+// Path of the BAM shard of writer write_thread_index. libStatGen picks
+// uncompressed BAM from the .ubam extension.
+std::string bamShardPath(PipelineOptions const& pipeline, int write_thread_index)
+{
+  std::string extension = pipeline.output_compression_level == 0 ? ".ubam" : ".bam";
+  return shardPath(pipeline, "subfile_", write_thread_index, extension);
+}
+
+// Path of the --compact-read-names mapping of reader reader_thread_index.
+std::string readNamesPath(PipelineOptions const& pipeline, int reader_thread_index)
+{
+  std::string extension = pipeline.output_compression_level == 0 ? ".tsv" : ".tsv.gz";
+  return outputPath(pipeline, "read_names_" + std::to_string(reader_thread_index) + extension);
+}
+
+void fastqWriterThread(int write_thread_index, bool sample_bool, PipelineOptions const& pipeline)
+{
+  pinToNumaNode(g_numa_placement.writer_nodes, write_thread_index);
+  std::string r1_output_fname = fastqShardPath(pipeline, "R1", write_thread_index);
+  ShardOutputStream r1_out(r1_output_fname, pipeline.output_compression_level,
+                           resumeOffset(write_thread_index, r1_output_fname));
   if (!r1_out)
     crash("ERROR: Failed to open R1 fastq file " + r1_output_fname + " for writing");
 
-  std::string r2_output_fname = "fastq_R2_" + std::to_string(write_thread_index) + ".fastq.gz";
-  ogzstream r2_out(r2_output_fname.c_str());
+  std::string r2_output_fname = fastqShardPath(pipeline, "R2", write_thread_index);
+  ShardOutputStream r2_out(r2_output_fname, pipeline.output_compression_level,
+                           resumeOffset(write_thread_index, r2_output_fname));
   if (!r2_out)
     crash("ERROR: Failed to open R2 fastq file " + r2_output_fname + " for writing");
 
+  std::unique_ptr<BarcodeSortedShard> sorter =
+      makeShardSorter(pipeline, "fastq_" + std::to_string(write_thread_index));
+  int64_t records = g_resume_from.shards.empty() ? 0 : g_resume_from.shards[write_thread_index].records;
+  ShardBarcodeCounter barcode_counter = makeShardBarcodeCounter(write_thread_index);
   while (true)
   {
-    auto [sam, source_reader_index] = g_write_queues[write_thread_index]->dequeueWrite();
+    auto [sam, source_reader_index, barcode_match] = g_write_queues[write_thread_index]->dequeueWrite();
     if (source_reader_index == WriteQueue::kShutdown)
       break;
+    if (source_reader_index == WriteQueue::kCheckpoint)
+    {
+      checkpointFastqShard(write_thread_index, records, barcode_counter,
+                           {{r1_output_fname, &r1_out}, {r2_output_fname, &r2_out}});
+      continue;
+    }
 
-    writeFastqRecord(r1_out, r2_out, sam, sample_bool);
+    records++;
+    countShardBarcode(barcode_counter, sam, barcode_match);
+    if (sorter)
+      sorter->add(sam);
+    else
+      writeFastqRecord(r1_out, r2_out, sam, sample_bool);
     g_read_arenas[source_reader_index]->releaseSamRecordMemory(sam);
+    publishShardStats(write_thread_index, records, {&r1_out, &r2_out});
+  }
+  if (sorter)
+  {
+    sorter->finish([&](SamRecord* sorted) { writeFastqRecord(r1_out, r2_out, sorted, sample_bool); });
+    g_sort_peak_bytes[write_thread_index] = sorter->peakBufferedBytes();
   }
 
   // close the fastq files
   r1_out.close();
   r2_out.close();
+  publishShardStats(write_thread_index, records, {&r1_out, &r2_out});
+  summarizeFastqShard(write_thread_index, records, sample_bool, barcode_counter,
+                      {{r1_output_fname, &r1_out}, {r2_output_fname, &r2_out}});
 }
 
 // write fastq for atac
-void fastqWriterThreadATAC(int write_thread_index, bool sample_bool)
+void fastqWriterThreadATAC(int write_thread_index, bool sample_bool, PipelineOptions const& pipeline)
 {
-  std::string r1_output_fname = "fastq_R1_" + std::to_string(write_thread_index) + ".fastq.gz";
-  ogzstream r1_out(r1_output_fname.c_str());
+  pinToNumaNode(g_numa_placement.writer_nodes, write_thread_index);
+  std::string r1_output_fname = fastqShardPath(pipeline, "R1", write_thread_index);
+  ShardOutputStream r1_out(r1_output_fname, pipeline.output_compression_level,
+                           resumeOffset(write_thread_index, r1_output_fname));
   if (!r1_out)
     crash("ERROR: Failed to open R1 fastq file " + r1_output_fname + " for writing");
 
-  std::string r2_output_fname = "fastq_R2_" + std::to_string(write_thread_index) + ".fastq.gz";
-  ogzstream r2_out(r2_output_fname.c_str());
+  std::string r2_output_fname = fastqShardPath(pipeline, "R2", write_thread_index);
+  ShardOutputStream r2_out(r2_output_fname, pipeline.output_compression_level,
+                           resumeOffset(write_thread_index, r2_output_fname));
   if (!r2_out)
     crash("ERROR: Failed to open R2 fastq file " + r2_output_fname + " for writing");
 
-  std::string r3_output_fname = "fastq_R3_" + std::to_string(write_thread_index) + ".fastq.gz";
-  ogzstream r3_out(r3_output_fname.c_str());
+  std::string r3_output_fname = fastqShardPath(pipeline, "R3", write_thread_index);
+  ShardOutputStream r3_out(r3_output_fname, pipeline.output_compression_level,
+                           resumeOffset(write_thread_index, r3_output_fname));
   if (!r3_out)
-    crash("ERROR: Failed to open R3 fastq file " + r2_output_fname + " for writing");
-  
+    crash("ERROR: Failed to open R3 fastq file " + r3_output_fname + " for writing");
+
+  std::unique_ptr<BarcodeSortedShard> sorter =
+      makeShardSorter(pipeline, "fastq_" + std::to_string(write_thread_index));
+  int64_t records = g_resume_from.shards.empty() ? 0 : g_resume_from.shards[write_thread_index].records;
+  ShardBarcodeCounter barcode_counter = makeShardBarcodeCounter(write_thread_index);
   while (true)
   {
-    auto [sam, source_reader_index] = g_write_queues[write_thread_index]->dequeueWrite();
+    auto [sam, source_reader_index, barcode_match] = g_write_queues[write_thread_index]->dequeueWrite();
     if (source_reader_index == WriteQueue::kShutdown)
       break;
+    if (source_reader_index == WriteQueue::kCheckpoint)
+    {
+      checkpointFastqShard(write_thread_index, records, barcode_counter,
+                           {{r1_output_fname, &r1_out}, {r2_output_fname, &r2_out},
+                            {r3_output_fname, &r3_out}});
+      continue;
+    }
 
-    writeFastqRecordATAC(r1_out, r2_out, r3_out, sam, sample_bool);    
+    records++;
+    countShardBarcode(barcode_counter, sam, barcode_match);
+    if (sorter)
+      sorter->add(sam);
+    else
+      writeFastqRecordATAC(r1_out, r2_out, r3_out, sam, sample_bool);
     g_read_arenas[source_reader_index]->releaseSamRecordMemory(sam);
+    publishShardStats(write_thread_index, records, {&r1_out, &r2_out, &r3_out});
+  }
+  if (sorter)
+  {
+    sorter->finish([&](SamRecord* sorted)
+    {
+      writeFastqRecordATAC(r1_out, r2_out, r3_out, sorted, sample_bool);
+    });
+    g_sort_peak_bytes[write_thread_index] = sorter->peakBufferedBytes();
   }
 
   // close the fastq files
   r1_out.close();
   r2_out.close();
   r3_out.close();
+  publishShardStats(write_thread_index, records, {&r1_out, &r2_out, &r3_out});
+  summarizeFastqShard(write_thread_index, records, sample_bool, barcode_counter,
+                      {{r1_output_fname, &r1_out}, {r2_output_fname, &r2_out}, {r3_output_fname, &r3_out}});
 }
 
-void bamWriterThread(int write_thread_index, std::string sample_id)
+// A SamFile whose buffered output can be flushed for a checkpoint, which
+// libStatGen's SamFile doesn't offer itself.
+class FlushableSamFile : public SamFile
 {
-  std::string bam_out_fname = "subfile_" + std::to_string(write_thread_index) + ".bam";
-  SamFile samOut;
-  samOut.OpenForWrite(bam_out_fname.c_str());
+public:
+  bool flush() { return ifflush(myFilePtr) == 0; }
+};
+
+// libStatGen can't append to an existing BAM file, so resuming a BAM shard
+// copies the records it held at the checkpoint from the old file (moved aside
+// to old_path) into the fresh one, then deletes the old file.
+void copyCheckpointedBamRecords(std::string const& old_path, int64_t records,
+                                SamFileHeader& header, SamFile& samOut)
+{
+  SamFile samIn;
+  SamFileHeader old_header;
+  if (!samIn.OpenForRead(old_path.c_str()) || !samIn.ReadHeader(old_header))
+    crash("ERROR: Failed to read checkpointed bam file " + old_path + "; can't resume.");
+  SamRecord sam;
+  for (int64_t i = 0; i < records; i++)
+  {
+    if (!samIn.ReadRecord(old_header, sam))
+      crash("ERROR: " + old_path + " has fewer records than its checkpoint; can't resume.");
+    samOut.WriteRecord(header, sam);
+  }
+  samIn.Close();
+  std::remove(old_path.c_str());
+}
+
+void bamWriterThread(int write_thread_index, std::string sample_id, PipelineOptions const& pipeline)
+{
+  pinToNumaNode(g_numa_placement.writer_nodes, write_thread_index);
+  std::string bam_out_fname = bamShardPath(pipeline, write_thread_index);
+  int64_t records = g_resume_from.shards.empty() ? 0 : g_resume_from.shards[write_thread_index].records;
+  ShardBarcodeCounter barcode_counter = makeShardBarcodeCounter(write_thread_index);
+  std::string checkpointed_fname = bam_out_fname + ".checkpointed";
+  if (!g_resume_from.shards.empty() && std::rename(bam_out_fname.c_str(), checkpointed_fname.c_str()) != 0)
+    crash("ERROR: Failed to move aside " + bam_out_fname + " to resume it.");
+
+  // Unless the shard is streamed to a FIFO, it's checksummed on its way to the
+  // file.
+  std::unique_ptr<ChecksummedOutputPipe> checksummed;
+  if (!isStreamingInput(bam_out_fname))
+    checksummed = std::make_unique<ChecksummedOutputPipe>(bam_out_fname);
+  FlushableSamFile samOut;
+  if (!samOut.OpenForWrite(checksummed ? checksummed->pipePath().c_str() : bam_out_fname.c_str()))
+    crash("ERROR: Failed to open bam file " + bam_out_fname + " for writing");
+  if (checksummed)
+    checksummed->start();
 
   // Write the sam header.
   SamFileHeader samHeader;
@@ -272,8 +684,14 @@ void bamWriterThread(int write_thread_index, std::string sample_id)
   // add the HD tags for the header
   samHeader.setHDTag("VN", "1.6");
   samHeader.setHDTag("SO", "unsorted");
+  std::unique_ptr<BarcodeSortedShard> sorter =
+      makeShardSorter(pipeline, "subfile_" + std::to_string(write_thread_index));
+  if (sorter)
+    samHeader.setHDTag("SS", kBarcodeSortedSubSort);
 
   // add the RG group tags
+  if (g_demux)
+    sample_id = shardSampleName(write_thread_index);
   SamHeaderRG* headerRG = new SamHeaderRG;
   headerRG->setTag("ID", "A");
   headerRG->setTag("SM", sample_id.c_str());
@@ -282,18 +700,48 @@ void bamWriterThread(int write_thread_index, std::string sample_id)
   // add the header to the output bam
   samOut.WriteHeader(samHeader);
 
+  if (!g_resume_from.shards.empty())
+    copyCheckpointedBamRecords(checkpointed_fname, records, samHeader, samOut);
+
   while (true)
   {
-    auto [sam, source_reader_index] = g_write_queues[write_thread_index]->dequeueWrite();
+    auto [sam, source_reader_index, barcode_match] = g_write_queues[write_thread_index]->dequeueWrite();
     if (source_reader_index == WriteQueue::kShutdown)
       break;
+    if (source_reader_index == WriteQueue::kCheckpoint)
+    {
+      // Checkpoints are refused for FIFO shards, so 'checksummed' is set.
+      if (!samOut.flush())
+        crash("ERROR: Failed to flush " + bam_out_fname + " for a checkpoint");
+      checksummed->drain();
+      syncFile(bam_out_fname);
+      ShardCheckpoint state = shardCheckpoint(records, barcode_counter);
+      state.files.push_back(ShardFileCheckpoint{bam_out_fname, checksummed->bytes()});
+      g_checkpointer->writerCheckpointed(write_thread_index, state);
+      continue;
+    }
 
-    samOut.WriteRecord(samHeader, *sam);
+    records++;
+    countShardBarcode(barcode_counter, sam, barcode_match);
+    if (sorter)
+      sorter->add(sam);
+    else
+      samOut.WriteRecord(samHeader, *sam);
     g_read_arenas[source_reader_index]->releaseSamRecordMemory(sam);
+    publishShardStats(write_thread_index, records, checksummed.get());
+  }
+  if (sorter)
+  {
+    sorter->finish([&](SamRecord* sorted) { samOut.WriteRecord(samHeader, *sorted); });
+    g_sort_peak_bytes[write_thread_index] = sorter->peakBufferedBytes();
   }
 
   // close the bamfile
   samOut.Close();
+  if (checksummed)
+    checksummed->finish();
+  publishShardStats(write_thread_index, records, checksummed.get());
+  summarizeBamShard(write_thread_index, records, barcode_counter, bam_out_fname, checksummed.get());
 }
 
 // ---------------------------------------------------
@@ -340,6 +788,22 @@ std::string reverseComplement(std::string sequence)
   return sequence;
 }
 
+// 'qualities' itself, or with --quality-binning its binned copy, in a buffer
+// the calling (reader) thread reuses: valid until its next call.
+const char* outputQualities(const char* qualities)
+{
+  if (!g_quality_binning)
+    return qualities;
+  thread_local std::string binned;
+  g_quality_binning->map(qualities, &binned);
+  return binned.c_str();
+}
+
+bool outputTag(const char* tag)
+{
+  return !g_output_tags || g_output_tags->has(tag);
+}
+
 // add tags to sam record 
 void fillSamRecordCommon(SamRecord* samRecord, FastQFile* fastQFileI1,
                          FastQFile* fastQFileR1, FastQFile* fastQFileR2, FastQFile* fastQFileR3,
@@ -355,42 +819,49 @@ void fillSamRecordCommon(SamRecord* samRecord, FastQFile* fastQFileI1,
   // add identifier, sequence and quality score of the alignments
   samRecord->setReadName(fastQFileR2->mySequenceIdentifier.c_str());
   samRecord->setSequence(fastQFileR2->myRawSequence.c_str());
-  samRecord->setQuality(fastQFileR2->myQualityString.c_str());
+  samRecord->setQuality(outputQualities(fastQFileR2->myQualityString.c_str()));
   
   // add raw sequence from R1 -- this is for the downsampling
-  samRecord->addTag("S1", 'Z', fastQFileR1->myRawSequence.c_str());
-  samRecord->addTag("Q1", 'Z', fastQFileR1->myQualityString.c_str());
+  if (outputTag("S1"))
+    samRecord->addTag("S1", 'Z', fastQFileR1->myRawSequence.c_str());
+  if (outputTag("Q1"))
+    samRecord->addTag("Q1", 'Z', outputQualities(fastQFileR1->myQualityString.c_str()));
   
   // add barcode and quality
-  samRecord->addTag("CR", 'Z', barcode_seq.c_str());
-  samRecord->addTag("CY", 'Z', barcode_quality.c_str());
+  if (outputTag("CR"))
+    samRecord->addTag("CR", 'Z', barcode_seq.c_str());
+  if (outputTag("CY"))
+    samRecord->addTag("CY", 'Z', outputQualities(barcode_quality.c_str()));
   // add UMI
-  samRecord->addTag("UR", 'Z', umi_seq.c_str());
-  samRecord->addTag("UY", 'Z', umi_quality.c_str());
+  if (outputTag("UR"))
+    samRecord->addTag("UR", 'Z', umi_seq.c_str());
+  if (outputTag("UY"))
+    samRecord->addTag("UY", 'Z', outputQualities(umi_quality.c_str()));
   // add raw sequence and quality sequence for the index
   if (has_I1_file_list)
   {
-    samRecord->addTag("SR", 'Z', fastQFileI1->myRawSequence.c_str());
-    samRecord->addTag("SY", 'Z', fastQFileI1->myQualityString.c_str());
+    if (outputTag("SR"))
+      samRecord->addTag("SR", 'Z', fastQFileI1->myRawSequence.c_str());
+    if (outputTag("SY"))
+      samRecord->addTag("SY", 'Z', outputQualities(fastQFileI1->myQualityString.c_str()));
   }
   // add raw sequence and quality sequence for the R3 atac fastq file 
   if (has_R3_file_list)
   { 
-    samRecord->addTag("S3", 'Z', fastQFileR3->myRawSequence.c_str());
-    samRecord->addTag("Q3", 'Z', fastQFileR3->myQualityString.c_str());
+    if (outputTag("S3"))
+      samRecord->addTag("S3", 'Z', fastQFileR3->myRawSequence.c_str());
+    if (outputTag("Q3"))
+      samRecord->addTag("Q3", 'Z', outputQualities(fastQFileR3->myQualityString.c_str()));
   }
 }
 
-// fill sam record -- this function was modified and moved from fastqprocess.cpp, samplefastq.cpp and fastq_slideseq.cpp
-void fillSamRecord(SamRecord* samRecord, FastQFile* fastQFileI1,
-                   FastQFile* fastQFileR1, FastQFile* fastQFileR2, FastQFile* fastQFileR3,
-                   bool has_I1_file_list, bool has_R3_file_list, std::string orientation, 
-                   std::vector<std::pair<char, int>> g_parsed_read_structure)  
+// Extracts the raw barcode and UMI, and their qualities, from the barcode
+// read. Split out of fillSamRecord() for the --cell-prefilter first pass.
+void splitBarcodeRead(std::string const& sequence, std::string quality_sequence, std::string const& orientation,
+                      bool has_R3_file_list, std::vector<std::pair<char, int>> const& g_parsed_read_structure,
+                      std::string* barcode_seq, std::string* barcode_quality,
+                      std::string* umi_seq, std::string* umi_quality)
 {
-  // check the sequence names matching
-  std::string sequence = std::string(fastQFileR1->myRawSequence.c_str());
-  std::string quality_sequence = std::string(fastQFileR1->myQualityString.c_str());
-  std::string barcode_seq, barcode_quality, umi_seq, umi_quality;
   int g_barcode_length;
 
   // extract the raw barcode and barcode quality  
@@ -406,12 +877,12 @@ void fillSamRecord(SamRecord* samRecord, FastQFile* fastQFileI1,
         switch (tag)
         {
           case 'C':
-            barcode_seq += sequence.substr(cur_ind, length);
-            barcode_quality += quality_sequence.substr(cur_ind, length);
+            *barcode_seq += sequence.substr(cur_ind, length);
+            *barcode_quality += quality_sequence.substr(cur_ind, length);
             break;
           case 'M':
-            umi_seq += sequence.substr(cur_ind, length);
-            umi_quality += quality_sequence.substr(cur_ind, length);
+            *umi_seq += sequence.substr(cur_ind, length);
+            *umi_quality += quality_sequence.substr(cur_ind, length);
             break;
           default:
             break;
@@ -426,26 +897,38 @@ void fillSamRecord(SamRecord* samRecord, FastQFile* fastQFileI1,
       
       if (strcmp(orientation.c_str(), "LAST_BP") == 0)
       {
-          barcode_seq = sequence.substr(sequence.length() - g_barcode_length, sequence.length());
-          barcode_quality = quality_sequence.substr(quality_sequence.length() - g_barcode_length, quality_sequence.length());
+          *barcode_seq = sequence.substr(sequence.length() - g_barcode_length, sequence.length());
+          *barcode_quality = quality_sequence.substr(quality_sequence.length() - g_barcode_length, quality_sequence.length());
       }
       else if (strcmp(orientation.c_str(), "FIRST_BP_RC") == 0)
       {
-          barcode_seq = reverseComplement(sequence).substr(0, g_barcode_length);
+          *barcode_seq = reverseComplement(sequence).substr(0, g_barcode_length);
           reverse(quality_sequence.begin(), quality_sequence.end());
-          barcode_quality = quality_sequence.substr(0, g_barcode_length);
+          *barcode_quality = quality_sequence.substr(0, g_barcode_length);
       }
       else if (strcmp(orientation.c_str(), "LAST_BP_RC") == 0)
       {    
           std::string reverse_complement = reverseComplement(sequence);
-          barcode_seq = reverse_complement.substr(reverse_complement.length() - g_barcode_length, reverse_complement.length());
+          *barcode_seq = reverse_complement.substr(reverse_complement.length() - g_barcode_length, reverse_complement.length());
           
           reverse(quality_sequence.begin(), quality_sequence.end());
-          barcode_quality = quality_sequence.substr(0, g_barcode_length);
+          *barcode_quality = quality_sequence.substr(0, g_barcode_length);
       }
       else 
           crash(std::string("Incorrect barcode orientation format.\n"));
   }
+}
+
+// fill sam record -- this function was modified and moved from fastqprocess.cpp, samplefastq.cpp and fastq_slideseq.cpp
+void fillSamRecord(SamRecord* samRecord, FastQFile* fastQFileI1,
+                   FastQFile* fastQFileR1, FastQFile* fastQFileR2, FastQFile* fastQFileR3,
+                   bool has_I1_file_list, bool has_R3_file_list, std::string orientation, 
+                   std::vector<std::pair<char, int>> g_parsed_read_structure)  
+{
+  std::string barcode_seq, barcode_quality, umi_seq, umi_quality;
+  splitBarcodeRead(fastQFileR1->myRawSequence.c_str(), fastQFileR1->myQualityString.c_str(), orientation,
+                   has_R3_file_list, g_parsed_read_structure,
+                   &barcode_seq, &barcode_quality, &umi_seq, &umi_quality);
 
   fillSamRecordCommon(samRecord, fastQFileI1, fastQFileR1, fastQFileR2, fastQFileR3, 
                       has_I1_file_list, has_R3_file_list,
@@ -467,8 +950,12 @@ std::string barcodeGetter(SamRecord* sam)
 // should be sent.
 int32_t correctBarcodeToWhitelist(
     const std::string& barcode, SamRecord* sam_record, const WhiteListCorrector* corrector,
-    int* n_barcode_corrected, int* n_barcode_correct, int* n_barcode_errors, int num_writer_threads)
+    int* n_barcode_corrected, int* n_barcode_correct, int* n_barcode_errors, int num_writer_threads,
+    BarcodeMatch* match)
 {
+  BarcodeMatch ignored;
+  if (!match)
+    match = &ignored;
   std::string correct_barcode;
   // bucket barcode is used to pick the target bam file
   // This is done because in the case of incorrectible barcodes
@@ -480,18 +967,21 @@ int32_t correctBarcodeToWhitelist(
   if (auto it = corrector->mutations.find(barcode) ; it != corrector->mutations.end())
   {
     int64_t mutation_index = it->second;
-    if (mutation_index == -1) // -1 means raw barcode is correct
+    // negative means raw barcode is correct, though with a barcode
+    // translation it's reported as its translation
+    if (mutation_index < 0)
     {
-      correct_barcode = barcode;
       *n_barcode_correct += 1;
+      *match = BarcodeMatch::kCorrect;
     }
+    // otherwise it is a 1-mutation of some whitelist barcode so get the
+    // barcode by indexing into the vector of whitelist barcodes
     else
     {
-      // it is a 1-mutation of some whitelist barcode so get the
-      // barcode by indexing into the vector of whitelist barcodes
-      correct_barcode = corrector->whitelist[mutation_index];
       *n_barcode_corrected += 1;
+      *match = BarcodeMatch::kCorrected;
     }
+    correct_barcode = corrector->correctedBarcode(barcode, mutation_index);
     // is used for computing the file index
     bucket_barcode = correct_barcode;
 
@@ -501,6 +991,7 @@ int32_t correctBarcodeToWhitelist(
   else     // not possible to correct the raw barcode -- aseel: is this raw?
   {
     *n_barcode_errors += 1;
+    *match = BarcodeMatch::kUncorrectable;
     bucket_barcode = barcode;
   }
   // destination bam file index computed based on the bucket_barcode
@@ -532,13 +1023,82 @@ bool readOneItem(FastQFile& fastQFileI1, bool has_I1_file_list,
   );
 }
 
+// Like readOneItem(), but for --interleaved input, where the R1 stream holds
+// each R1 record immediately followed by its R2 record. The R1 record is copied
+// out into r1_holder (a FastQFile used only for its fields, never opened), and
+// the R2 record is left in 'interleaved'.
+bool readOneInterleavedItem(FastQFile& fastQFileI1, bool has_I1_file_list,
+                            FastQFile& interleaved, FastQFile& r1_holder,
+                            FastQFile& fastQFileR3, bool has_R3_file_list)
+{
+  if ((has_I1_file_list && fastQFileI1.readFastQSequence() != FastQStatus::FASTQ_SUCCESS) ||
+      interleaved.readFastQSequence() != FastQStatus::FASTQ_SUCCESS)
+  {
+    return false;
+  }
+  r1_holder.mySequenceIdLine = interleaved.mySequenceIdLine;
+  r1_holder.mySequenceIdentifier = interleaved.mySequenceIdentifier;
+  r1_holder.myRawSequence = interleaved.myRawSequence;
+  r1_holder.myQualityString = interleaved.myQualityString;
+
+  if (interleaved.readFastQSequence() != FastQStatus::FASTQ_SUCCESS)
+    crash("ERROR: interleaved input ended between an R1 record and its R2 record.");
+
+  return !has_R3_file_list || fastQFileR3.readFastQSequence() == FastQStatus::FASTQ_SUCCESS;
+}
+
+// Replaces the cDNA read fillSamRecord() put in 'sam' with its trimmed part.
+void setTrimmedRead(SamRecord* sam, FastQFile const& read, TrimResult const& trimmed)
+{
+  int length = trimmed.end - trimmed.start;
+  sam->setSequence(std::string(read.myRawSequence.c_str() + trimmed.start, length).c_str());
+  std::string quality(read.myQualityString.c_str() + trimmed.start, length);
+  sam->setQuality(outputQualities(quality.c_str()));
+}
+
+// Size of the FASTQ text of the record 'file' last read.
+int64_t fastqRecordBytes(FastQFile const& file)
+{
+  return file.mySequenceIdLine.Length() + file.myRawSequence.Length() +
+         file.myPlusLine.Length() + file.myQualityString.Length() + 4;
+}
+
+// The whitelist corrector, once it's built; crash()es on this thread if it
+// couldn't be.
+WhiteListCorrector const& waitForWhiteList(std::shared_future<WhiteListCorrector> const& whitelist)
+{
+  try
+  {
+    return whitelist.get();
+  }
+  catch (CrashError const& error)
+  {
+    crash(error.what());
+    throw;
+  }
+}
+
 void fastQFileReaderThread(
-    int reader_thread_index, std::string filenameI1, String filenameR1,
-    String filenameR2, std::string filenameR3, const WhiteListCorrector* corrector, std::string barcode_orientation,
-    std::vector<std::pair<char, int>> g_parsed_read_structure)
+    int reader_thread_index, std::string filenameI1, std::string filenameI2, String filenameR1,
+    String filenameR2, std::string filenameR3, std::shared_future<WhiteListCorrector> whitelist,
+    std::string barcode_orientation,
+    std::vector<std::pair<char, int>> g_parsed_read_structure, PipelineOptions const& pipeline)
 {
+  pinToNumaNode(g_numa_placement.reader_nodes, reader_thread_index);
+  g_read_arenas[reader_thread_index]->allocate();
+
+  bool interleaved = pipeline.interleaved;
+  // With a non-default --input-backend, the files opened are pipes fed by
+  // these; see input_backend.h. Declared first so that the FastQFiles are
+  // closed before these are destroyed.
+  std::vector<std::unique_ptr<PrefetchedInput>> prefetched;
+  auto input = [&](std::string const& path) {
+    return String(prefetchInput(path, pipeline, &prefetched).c_str());
+  };
+
   /// setting the shortest sequence allowed to be read
   FastQFile fastQFileI1(4, 4);
+  FastQFile fastQFileI2(4, 4);
   FastQFile fastQFileR1(4, 4);
   FastQFile fastQFileR2(4, 4);
   FastQFile fastQFileR3(4, 4);
@@ -546,7 +1106,7 @@ void fastQFileReaderThread(
   bool has_I1_file_list = true;
   if (!filenameI1.empty())
   {
-    if (fastQFileI1.openFile(String(filenameI1.c_str()), BaseAsciiMap::UNKNOWN) !=
+    if (fastQFileI1.openFile(input(filenameI1), BaseAsciiMap::UNKNOWN) !=
         FastQStatus::FASTQ_SUCCESS)
     {
       crash(std::string("Failed to open file: ") + filenameI1);
@@ -555,11 +1115,16 @@ void fastQFileReaderThread(
   else
     has_I1_file_list = false;
 
+  // Only read to demultiplex by a dual-index --sample-sheet.
+  bool has_I2_file = !filenameI2.empty();
+  if (has_I2_file && fastQFileI2.openFile(input(filenameI2), BaseAsciiMap::UNKNOWN) != FastQStatus::FASTQ_SUCCESS)
+    crash(std::string("Failed to open file: ") + filenameI2);
+
   //This is for the 3rd atacseq file. 
   bool has_R3_file_list = true;
   if (!filenameR3.empty())
   {
-    if (fastQFileR3.openFile(String(filenameR3.c_str()), BaseAsciiMap::UNKNOWN) !=
+    if (fastQFileR3.openFile(input(filenameR3), BaseAsciiMap::UNKNOWN) !=
         FastQStatus::FASTQ_SUCCESS)
     {
       crash(std::string("Failed to open file: ") + filenameR3);
@@ -568,16 +1133,20 @@ void fastQFileReaderThread(
   else
     has_R3_file_list = false;
 
-  if (fastQFileR1.openFile(filenameR1, BaseAsciiMap::UNKNOWN) !=
+  if (fastQFileR1.openFile(input(filenameR1.c_str()), BaseAsciiMap::UNKNOWN) !=
       FastQStatus::FASTQ_SUCCESS)
   {
     crash(std::string("Failed to open file: ") + filenameR1.c_str());
   }
-  if (fastQFileR2.openFile(filenameR2, BaseAsciiMap::UNKNOWN) !=
+  // With interleaved input R2 records come from the R1 stream, and fastQFileR2
+  // just holds the R1 record that preceded each of them.
+  if (!interleaved && fastQFileR2.openFile(input(filenameR2.c_str()), BaseAsciiMap::UNKNOWN) !=
       FastQStatus::FASTQ_SUCCESS)
   {
     crash(std::string("Failed to open file: ") + filenameR2.c_str());
   }
+  FastQFile* r1_record = interleaved ? &fastQFileR2 : &fastQFileR1;
+  FastQFile* r2_record = interleaved ? &fastQFileR1 : &fastQFileR2;
 
   // Keep reading the file until there are no more fastq sequences to process.
   int total_reads = 0;
@@ -586,53 +1155,233 @@ void fastQFileReaderThread(
   int n_barcode_correct = 0;
   printf("Opening the thread in %d\n", reader_thread_index);
 
+  auto read_item = [&]() {
+    return (interleaved
+        ? readOneInterleavedItem(fastQFileI1, has_I1_file_list, fastQFileR1, fastQFileR2, fastQFileR3, has_R3_file_list)
+        : readOneItem(fastQFileI1, has_I1_file_list, fastQFileR1, fastQFileR2, fastQFileR3, has_R3_file_list))
+        && (!has_I2_file || fastQFileI2.readFastQSequence() == FastQStatus::FASTQ_SUCCESS);
+  };
+  // The whitelist corrector is built while the readers start decoding; see
+  // mainCommon(). Null until this reader has seen that it's ready.
+  const WhiteListCorrector* corrector = nullptr;
+  // Filled records held until then, with their shard sets.
+  std::vector<std::pair<SamRecord*, int>> uncorrected;
+  // Held records haven't been written, so a checkpoint doesn't count them.
+  ReaderProgress held_progress;
+  auto progress = [&]() {
+    return ReaderCheckpoint{held_progress.done(total_reads), n_barcode_correct,
+                            n_barcode_corrected, n_barcode_errors};
+  };
+  int64_t inflated_bytes = 0;
+  TrimCounts trim_counts;
+  int64_t prefiltered_reads = 0;
+
+  // Corrects the barcode of a filled record and hands it to its writer.
+  auto route = [&](SamRecord* samrec, int shard_set) {
+    // get barcode 
+    std::string barcode = barcodeGetter(samrec);
+                                  
+    // bucket barcode is used to pick the target bam file
+    // This is done because in the case of incorrigible barcodes
+    // we need a mechanism to uniformly distribute the alignments
+    // so that no bam is oversized to putting all such barcode less
+    // sequences into one particular. Incorregible barcodes are simply
+    // added withouth the CB tag
+    BarcodeMatch match;
+    int32_t bam_bucket = correctBarcodeToWhitelist(
+        barcode, samrec, corrector, &n_barcode_corrected, 
+        &n_barcode_correct, &n_barcode_errors, g_shards_per_set, &match);
+    bam_bucket += shard_set * g_shards_per_set;
+
+    // With --cell-prefilter, only the cells' reads are written.
+    if (g_cells && !g_cells->count(samrec->getString("CB").c_str()))
+    {
+      prefiltered_reads++;
+      g_read_arenas[reader_thread_index]->releaseSamRecordMemory(samrec);
+      return;
+    }
+
+    outputHandler(g_write_queues[bam_bucket].get(), samrec, reader_thread_index, match);
+  };
+  // Waits for the corrector, then routes the records held until it was ready.
+  auto route_uncorrected = [&]() {
+    corrector = &waitForWhiteList(whitelist);
+    for (auto [samrec, shard_set] : uncorrected)
+      route(samrec, shard_set);
+    uncorrected = {};
+    held_progress.releaseHeld();
+  };
+  auto publish_stats = [&]() {
+    ReaderStats& stats = *g_reader_stats[reader_thread_index];
+    stats.reads.store(total_reads, std::memory_order_relaxed);
+    stats.inflated_bytes.store(inflated_bytes, std::memory_order_relaxed);
+    stats.barcodes_correct.store(n_barcode_correct, std::memory_order_relaxed);
+    stats.barcodes_corrected.store(n_barcode_corrected, std::memory_order_relaxed);
+    stats.barcodes_uncorrectable.store(n_barcode_errors, std::memory_order_relaxed);
+  };
+
+  // With --compact-read-names, where the original names go. When resuming it
+  // is rewritten from the start, as the skipped reads pass through here too.
+  std::unique_ptr<ShardOutputStream> read_names;
+  std::string read_names_fname = readNamesPath(pipeline, reader_thread_index);
+  if (pipeline.compact_read_names)
+  {
+    read_names = std::make_unique<ShardOutputStream>(read_names_fname, pipeline.output_compression_level);
+    if (!*read_names)
+      crash("ERROR: Failed to open read name mapping " + read_names_fname + " for writing");
+  }
+  auto compact_read_name = [&]() {
+    std::string name = compactReadName(reader_thread_index, total_reads);
+    *read_names << name << '\t' << r2_record->mySequenceIdentifier.c_str() << '\n';
+    return name;
+  };
+
+  // When resuming, skip the reads that already made it into the shards. They
+  // are trimmed as before, so that the trimming counts and the read name
+  // mapping (which has no lines for reads trimmed away) come out the same.
+  if (!g_resume_from.readers.empty())
+  {
+    ReaderCheckpoint const& resumed = g_resume_from.readers[reader_thread_index];
+    while (total_reads < resumed.records && fastQFileR1.keepReadingFile())
+      if (read_item())
+      {
+        total_reads++;
+        if (g_read_trimmer &&
+            !g_read_trimmer->trim(r2_record->myRawSequence.c_str(), r2_record->myRawSequence.Length(),
+                                  &trim_counts).keep)
+          continue;
+        if (read_names)
+          compact_read_name();
+      }
+    if (total_reads != resumed.records)
+      crash("ERROR: " + std::string(filenameR1.c_str()) + " has fewer reads than its checkpoint; can't resume.");
+    n_barcode_correct = resumed.n_barcode_correct;
+    n_barcode_corrected = resumed.n_barcode_corrected;
+    n_barcode_errors = resumed.n_barcode_errors;
+    printf("Resuming %s after %d reads\n", filenameR1.c_str(), total_reads);
+  }
+
+  // A reader waiting for a slot still has to let checkpoints go ahead.
+  auto acquire_slot = [&]() {
+    while (!g_reader_slots->tryAcquire(std::chrono::milliseconds(100)))
+      if (g_checkpointer)
+        g_checkpointer->maybePause(reader_thread_index, progress());
+  };
+  if (g_reader_slots)
+    acquire_slot();
+
   while (fastQFileR1.keepReadingFile())
   {
-    if (readOneItem(fastQFileI1, has_I1_file_list, fastQFileR1, fastQFileR2, fastQFileR3, has_R3_file_list))
+    if (g_checkpointer)
+      g_checkpointer->maybePause(reader_thread_index, progress());
+
+    if (read_item())
     {
       total_reads++;
+      inflated_bytes += fastqRecordBytes(*r1_record) + fastqRecordBytes(*r2_record);
+      if (has_I1_file_list)
+        inflated_bytes += fastqRecordBytes(fastQFileI1);
+      if (has_I2_file)
+        inflated_bytes += fastqRecordBytes(fastQFileI2);
+      if (has_R3_file_list)
+        inflated_bytes += fastqRecordBytes(fastQFileR3);
+      if (total_reads % kReaderStatsInterval == 0)
+      {
+        publish_stats();
+        if (g_reader_slots && g_reader_slots->overLimit())
+        {
+          g_reader_slots->release();
+          acquire_slot();
+        }
+      }
+
+      if (total_reads % 10000000 == 0)
+      {
+        printf("%d\n", total_reads);
+        std::string a = std::string(fastQFileR1.myRawSequence.c_str());
+        printf("%s\n", r1_record->mySequenceIdLine.c_str());
+        printf("%s\n", r2_record->mySequenceIdLine.c_str());
+        printf("%s\n", fastQFileR3.mySequenceIdLine.c_str());
+      }
+
+      // Reads trimming leaves too short or too repetitive go no further.
+      int r2_length = r2_record->myRawSequence.Length();
+      TrimResult trimmed{0, r2_length, true};
+      if (g_read_trimmer)
+      {
+        trimmed = g_read_trimmer->trim(r2_record->myRawSequence.c_str(), r2_length, &trim_counts);
+        if (!trimmed.keep)
+          continue;
+      }
 
       SamRecord* samrec = g_read_arenas[reader_thread_index]->acquireSamRecordMemory();
 
       // prepare the samrecord with the sequence, barcode, UMI, and their quality sequences
-      fillSamRecord(samrec, &fastQFileI1, &fastQFileR1, &fastQFileR2, &fastQFileR3, has_I1_file_list,
+      fillSamRecord(samrec, &fastQFileI1, r1_record, r2_record, &fastQFileR3, has_I1_file_list,
                         has_R3_file_list, barcode_orientation, g_parsed_read_structure); 
+      if (trimmed.start > 0 || trimmed.end < r2_length)
+        setTrimmedRead(samrec, *r2_record, trimmed);
+      if (read_names)
+        samrec->setReadName(compact_read_name().c_str());
+
+      // With --sample-sheet, the sample's set of shards.
+      int shard_set = 0;
+      if (g_demux)
+      {
+        int sample = g_demux->assign(fastQFileI1.myRawSequence.c_str(), fastQFileI2.myRawSequence.c_str());
+        shard_set = sample == SampleDemultiplexer::kUndetermined ? g_demux->numSamples() : sample;
+      }
 
-      // get barcode 
-      std::string barcode = barcodeGetter(samrec);
-                                    
-      // bucket barcode is used to pick the target bam file
-      // This is done because in the case of incorrigible barcodes
-      // we need a mechanism to uniformly distribute the alignments
-      // so that no bam is oversized to putting all such barcode less
-      // sequences into one particular. Incorregible barcodes are simply
-      // added withouth the CB tag
-      int32_t bam_bucket = correctBarcodeToWhitelist(
-          barcode, samrec, corrector, &n_barcode_corrected, 
-          &n_barcode_correct, &n_barcode_errors, g_write_queues.size());
-
-      outputHandler(g_write_queues[bam_bucket].get(), samrec, reader_thread_index);
-
-      if (total_reads % 10000000 == 0)
+      // Until the whitelist corrector is built, hold on to the filled records
+      // (as many as the arena has, less one, before waiting for it).
+      if (!corrector)
       {
-        printf("%d\n", total_reads);
-        std::string a = std::string(fastQFileR1.myRawSequence.c_str());
-        printf("%s\n", fastQFileR1.mySequenceIdLine.c_str());
-        printf("%s\n", fastQFileR2.mySequenceIdLine.c_str());
-        printf("%s\n", fastQFileR3.mySequenceIdLine.c_str());
+        if (whitelist.wait_for(std::chrono::seconds(0)) != std::future_status::ready &&
+            uncorrected.size() + 1 < g_read_arenas[reader_thread_index]->capacity())
+        {
+          uncorrected.emplace_back(samrec, shard_set);
+          held_progress.hold(total_reads);
+          continue;
+        }
+        route_uncorrected();
       }
+      route(samrec, shard_set);
     }
   }
+  // The input may have ended before the corrector was ready.
+  if (!corrector)
+    route_uncorrected();
+
+  publish_stats();
+  g_prefiltered_reads += prefiltered_reads;
+  if (g_read_trimmer)
+  {
+    std::lock_guard<std::mutex> lock(g_trim_counts_mutex);
+    g_trim_counts.add(trim_counts);
+  }
+  if (g_reader_slots)
+    g_reader_slots->release();
+  if (g_checkpointer)
+    g_checkpointer->readerFinished(reader_thread_index, progress());
 
   // Finished processing all of the sequences in the file.
   // Close the input files.
   if (has_I1_file_list)
     fastQFileI1.closeFile();
+  if (has_I2_file)
+    fastQFileI2.closeFile();
   if (has_R3_file_list)
     fastQFileR3.closeFile();  
   
   fastQFileR1.closeFile();
-  fastQFileR2.closeFile();
+  if (!interleaved)
+    fastQFileR2.closeFile();
+  if (read_names)
+  {
+    read_names->close();
+    if (!*read_names)
+      crash("ERROR: Failed to write read name mapping " + read_names_fname);
+  }
 
   printf("Total barcodes:%d\n correct:%d\ncorrected:%d\nuncorrectible"
          ":%d\nuncorrected:%lf\n",
@@ -640,39 +1389,376 @@ void fastQFileReaderThread(
          n_barcode_errors/static_cast<double>(total_reads) * 100);
 }
 
+// The --cell-prefilter first pass over one barcode read input: adds how many
+// reads each corrected barcode has to reads_per_barcode.
+void countBarcodesThread(std::string filenameR1, const WhiteListCorrector* corrector,
+                         std::string barcode_orientation, std::vector<std::pair<char, int>> g_parsed_read_structure,
+                         bool has_R3_file_list, bool interleaved,
+                         std::unordered_map<std::string, int64_t>* reads_per_barcode)
+{
+  FastQFile fastQFileR1(4, 4);
+  if (fastQFileR1.openFile(String(filenameR1.c_str()), BaseAsciiMap::UNKNOWN) != FastQStatus::FASTQ_SUCCESS)
+    crash(std::string("Failed to open file: ") + filenameR1);
+
+  std::string barcode, barcode_quality, umi, umi_quality;
+  while (fastQFileR1.keepReadingFile())
+  {
+    if (fastQFileR1.readFastQSequence() != FastQStatus::FASTQ_SUCCESS)
+      continue;
+    barcode.clear();
+    barcode_quality.clear();
+    umi.clear();
+    umi_quality.clear();
+    splitBarcodeRead(fastQFileR1.myRawSequence.c_str(), fastQFileR1.myQualityString.c_str(),
+                     barcode_orientation, has_R3_file_list, g_parsed_read_structure,
+                     &barcode, &barcode_quality, &umi, &umi_quality);
+    if (auto it = corrector->mutations.find(barcode); it != corrector->mutations.end())
+      (*reads_per_barcode)[corrector->correctedBarcode(barcode, it->second)]++;
+
+    // Skip the R2 record that follows.
+    if (interleaved && fastQFileR1.readFastQSequence() != FastQStatus::FASTQ_SUCCESS)
+      crash("ERROR: interleaved input ended between an R1 record and its R2 record.");
+  }
+  fastQFileR1.closeFile();
+}
+
+// Runs the --cell-prefilter first pass over all R1s at once, and sets g_cells
+// to the barcodes 'spec' picks. The counts go to kCellPrefilterCountsName.
+void prefilterCells(CellPrefilterSpec const& spec, std::vector<std::string> const& R1s,
+                    WhiteListCorrector const& corrector, std::string const& barcode_orientation,
+                    std::vector<std::pair<char, int>> const& g_parsed_read_structure, bool has_R3_file_list,
+                    PipelineOptions const& pipeline)
+{
+  std::vector<std::unordered_map<std::string, int64_t>> counts(R1s.size());
+  std::vector<std::thread> counters;
+  for (int i = 0; i < R1s.size(); i++)
+    counters.emplace_back(countBarcodesThread, R1s[i], &corrector, barcode_orientation, g_parsed_read_structure,
+                          has_R3_file_list, pipeline.interleaved, &counts[i]);
+  for (auto& counter : counters)
+    counter.join();
+  for (int i = 1; i < counts.size(); i++)
+    for (auto const& [barcode, reads] : counts[i])
+      counts[0][barcode] += reads;
+
+  std::vector<std::pair<std::string, int64_t>> ranked = rankBarcodes(counts[0]);
+  int64_t num_cells = numCells(ranked, spec);
+  g_cells = std::make_unique<std::unordered_set<std::string>>();
+  int64_t cell_reads = 0;
+  int64_t barcoded_reads = 0;
+  for (int64_t i = 0; i < ranked.size(); i++)
+  {
+    if (i < num_cells)
+    {
+      g_cells->insert(ranked[i].first);
+      cell_reads += ranked[i].second;
+    }
+    barcoded_reads += ranked[i].second;
+  }
+  writeBarcodeCounts(outputPath(pipeline, kCellPrefilterCountsName), ranked, num_cells);
+  std::cout << "cell-prefilter: keeping " << num_cells << " of " << ranked.size() << " barcodes, with "
+            << cell_reads << " of " << barcoded_reads << " reads with a valid barcode" << std::endl;
+}
+
 // ---------------------------------------------------
 // Main 
 // ---------------------------------------------------
 
+std::chrono::steady_clock::time_point g_pipeline_start;
+
+MetricsSnapshot samplePipelineMetrics(std::vector<std::string> const& R1s)
+{
+  constexpr double kNanosPerSec = 1e9;
+  MetricsSnapshot snapshot;
+  snapshot.elapsed_sec = nanosSince(g_pipeline_start) / kNanosPerSec;
+  for (int i = 0; i < g_reader_stats.size(); i++)
+  {
+    ReaderStats const& stats = *g_reader_stats[i];
+    ReaderMetrics reader;
+    reader.input = R1s[i];
+    reader.reads = stats.reads.load(std::memory_order_relaxed);
+    reader.inflated_bytes = stats.inflated_bytes.load(std::memory_order_relaxed);
+    reader.blocked_sec = g_read_arenas[i]->blockedNanos() / kNanosPerSec;
+    reader.barcodes_correct = stats.barcodes_correct.load(std::memory_order_relaxed);
+    reader.barcodes_corrected = stats.barcodes_corrected.load(std::memory_order_relaxed);
+    reader.barcodes_uncorrectable = stats.barcodes_uncorrectable.load(std::memory_order_relaxed);
+    snapshot.readers.push_back(reader);
+  }
+  for (int i = 0; i < g_shard_stats.size(); i++)
+  {
+    ShardStats const& stats = *g_shard_stats[i];
+    ShardMetrics shard;
+    shard.queue_depth = g_write_queues[i]->depth();
+    shard.records = stats.records.load(std::memory_order_relaxed);
+    shard.uncompressed_bytes = stats.uncompressed_bytes.load(std::memory_order_relaxed);
+    shard.deflated_bytes = stats.deflated_bytes.load(std::memory_order_relaxed);
+    shard.blocked_sec = g_write_queues[i]->blockedNanos() / kNanosPerSec;
+    snapshot.shards.push_back(shard);
+  }
+  return snapshot;
+}
+
+// Prints what trimming removed, over the reads trimmed in this run (so after
+// --resume, not the ones before the checkpoint).
+void printTrimReport()
+{
+  TrimCounts const& counts = g_trim_counts;
+  auto percent = [&](int64_t n) { return 100.0 * n / std::max<int64_t>(counts.reads, 1); };
+  printf("Trimming of %ld reads:\n", counts.reads);
+  printf("  TSO trimmed: %ld (%.2f%%)\n", counts.tso_trimmed, percent(counts.tso_trimmed));
+  printf("  adapter trimmed: %ld (%.2f%%)\n", counts.adapter_trimmed, percent(counts.adapter_trimmed));
+  printf("  poly-A trimmed: %ld (%.2f%%)\n", counts.poly_a_trimmed, percent(counts.poly_a_trimmed));
+  printf("  bases trimmed: %ld\n", counts.bases_trimmed);
+  printf("  dropped as too short: %ld (%.2f%%)\n", counts.too_short, percent(counts.too_short));
+  printf("  dropped as low complexity: %ld (%.2f%%)\n", counts.low_complexity, percent(counts.low_complexity));
+}
+
+// Prints the peak memory use of each component, as far as it's known.
+void printMemoryReport()
+{
+  constexpr double kMiB = 1024.0 * 1024.0;
+  size_t arena_capacity = 0;
+  size_t arena_peak = 0;
+  for (auto& arena : g_read_arenas)
+  {
+    arena_capacity += arena->capacity();
+    arena_peak += arena->peakInUse();
+  }
+  size_t queue_peak = 0;
+  for (auto& write_queue : g_write_queues)
+    queue_peak = std::max(queue_peak, write_queue->peakDepth());
+  int64_t sort_peak = 0;
+  for (int64_t bytes : g_sort_peak_bytes)
+    sort_peak += bytes;
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  printf("Peak memory use:\n");
+  printf("  whitelist (estimated): %.1f MB\n", g_memory_plan.whitelist_bytes / kMiB);
+  printf("  output buffers (estimated): %.1f MB\n", g_memory_plan.output_buffer_bytes / kMiB);
+  printf("  reader arenas: %zu of %zu records in use (~%.1f MB allocated)\n", arena_peak,
+         arena_capacity, arena_capacity * kEstimatedSamRecordBytes / kMiB);
+  printf("  write queues: at most %zu records in one queue\n", queue_peak);
+  if (g_memory_plan.sort_bytes > 0)
+    printf("  sort buffers: %.1f of %.1f MB\n", sort_peak / kMiB, g_memory_plan.sort_bytes / kMiB);
+  // ru_maxrss is in kilobytes on Linux.
+  printf("  process max RSS: %.1f MB\n", usage.ru_maxrss / 1024.0);
+}
+
 void mainCommon(
     std::string white_list_file, std::string barcode_orientation,
     int num_writer_threads, std::string output_format,
     std::vector<std::string> I1s, std::vector<std::string> R1s, 
     std::vector<std::string> R2s, std::vector<std::string> R3s,
     std::string sample_id,  std::vector<std::pair<char, int>> g_parsed_read_structure,
-    bool sample_bool)
+    bool sample_bool, PipelineOptions const& pipeline)
 {
-  std::cout << "reading whitelist file " << white_list_file << "...";
-  // stores barcode correction map and vector of correct barcodes
-  WhiteListCorrector corrector = readWhiteListFile(white_list_file);
-  std::cout << "done" << std::endl;
+  // stores barcode correction map and vector of correct barcodes. It's built
+  // while the readers start on their input, as they can fill records without
+  // it; they hold those until it's ready.
+  std::cout << "reading whitelist file " << white_list_file << std::endl;
+  std::shared_future<WhiteListCorrector> whitelist =
+      std::async(std::launch::async, [white_list_file, &pipeline]() {
+        CrashThrows crash_throws;
+        auto start = std::chrono::steady_clock::now();
+        WhiteListCorrector corrector = readWhiteListFile(white_list_file);
+        if (!pipeline.barcode_translation.empty())
+          readBarcodeTranslationFile(pipeline.barcode_translation, &corrector);
+        std::cout << "whitelist ready after " << nanosSince(start) / 1e9 << " sec" << std::endl;
+        return corrector;
+      }).share();
+
+  if (!pipeline.quality_binning.empty())
+    g_quality_binning = std::make_unique<QualityBinning>(QualityBinning::fromOption(pipeline.quality_binning));
+  if (!pipeline.output_tags.empty())
+  {
+    g_output_tags = std::make_unique<OutputTagSet>(OutputTagSet::parse(pipeline.output_tags));
+    g_output_tags->add(requiredOutputTags(output_format, sample_bool, !R3s.empty(), pipeline.sort_by_barcode));
+  }
+
+  // With --sample-sheet, each sample and the undetermined reads get
+  // num_writer_threads shards of their own.
+  g_shards_per_set = num_writer_threads;
+  int num_shards = num_writer_threads;
+  if (!pipeline.sample_sheet.empty())
+  {
+    g_demux = std::make_unique<SampleDemultiplexer>(readSampleSheet(pipeline.sample_sheet));
+    num_shards = (g_demux->numSamples() + 1) * num_writer_threads;
+    for (int i = 0; i < num_shards; i += num_writer_threads)
+      std::filesystem::create_directories(outputPath(pipeline, shardSampleName(i)));
+    std::cout << "sample-sheet: demultiplexing into " << g_demux->numSamples() << " samples" << std::endl;
+  }
+
+  // A checkpoint syncs the shards and records their sizes, and resuming cuts
+  // them back to those sizes; a shard streamed into a FIFO has neither.
+  if (pipeline.checkpoint_interval_sec > 0 || pipeline.resume)
+  {
+    std::vector<std::string> output_paths;
+    for (int i = 0; i < num_shards; i++)
+    {
+      if (output_format == "BAM")
+        output_paths.push_back(bamShardPath(pipeline, i));
+      else
+      {
+        output_paths.push_back(fastqShardPath(pipeline, "R1", i));
+        output_paths.push_back(fastqShardPath(pipeline, "R2", i));
+        if (!R3s.empty())
+          output_paths.push_back(fastqShardPath(pipeline, "R3", i));
+      }
+    }
+    if (pipeline.compact_read_names)
+      for (int i = 0; i < R1s.size(); i++)
+        output_paths.push_back(readNamesPath(pipeline, i));
+    for (std::string const& path : output_paths)
+      if (isStreamingInput(path))
+        crash("ERROR: checkpoint-interval-sec and resume can't be combined with output streamed to FIFOs, "
+              "and " + path + " is one.");
+  }
+
+  if (!pipeline.cell_prefilter.empty())
+    prefilterCells(CellPrefilterSpec::parse(pipeline.cell_prefilter), R1s, waitForWhiteList(whitelist),
+                   barcode_orientation, g_parsed_read_structure, !R3s.empty(), pipeline);
+
+  TrimOptions trim_options;
+  trim_options.tso = pipeline.trim_tso;
+  trim_options.adapter = pipeline.trim_adapter;
+  trim_options.poly_a_length = pipeline.trim_poly_a;
+  trim_options.min_length = pipeline.min_read_length;
+  trim_options.min_complexity = pipeline.min_read_complexity;
+  if (trim_options.enabled())
+    g_read_trimmer = std::make_unique<ReadTrimmer>(trim_options);
+
+  int files_per_shard = output_format == "BAM" ? 1 : (R3s.empty() ? 2 : 3);
+  g_memory_plan = planMemory(pipeline, estimateWhiteListFileBytes(white_list_file), R1s.size(),
+                             num_shards * files_per_shard);
+  if (pipeline.memory_limit_mb > 0)
+    std::cout << "memory-limit-mb " << pipeline.memory_limit_mb << ": " << g_memory_plan.arena_records
+              << " records per reader" << std::endl;
 
   for (int i = 0; i < R1s.size(); i++)
-    g_read_arenas.push_back(std::make_unique<SamRecordArena>());
-  for (int i = 0; i < num_writer_threads; i++)
+    g_read_arenas.push_back(std::make_unique<SamRecordArena>(g_memory_plan.arena_records));
+  for (int i = 0; i < num_shards; i++)
     g_write_queues.push_back(std::make_unique<WriteQueue>());
+  g_sort_peak_bytes.assign(num_shards, 0);
+  g_shard_summaries.assign(num_shards, ShardSummary());
+  if (g_demux)
+    for (int i = 0; i < num_shards; i++)
+      g_shard_summaries[i].sample = shardSampleName(i);
+  for (int i = 0; i < R1s.size(); i++)
+    g_reader_stats.push_back(std::make_unique<ReaderStats>());
+  for (int i = 0; i < num_shards; i++)
+    g_shard_stats.push_back(std::make_unique<ShardStats>());
+
+  std::string manifest_path = outputPath(pipeline, kCheckpointManifestName);
+  if (pipeline.resume)
+  {
+    if (readCheckpointManifest(manifest_path, &g_resume_from))
+    {
+      if (g_resume_from.output_format != output_format || g_resume_from.R1s != R1s ||
+          g_resume_from.readers.size() != R1s.size() ||
+          g_resume_from.shards.size() != num_shards)
+      {
+        crash("ERROR: The checkpoint at " + manifest_path + " is from a run with different "
+              "inputs, output format or number of output files; can't resume.");
+      }
+      std::cout << "resuming from checkpoint " << manifest_path << std::endl;
+    }
+    else
+    {
+      std::cout << "no checkpoint at " << manifest_path << "; starting from scratch" << std::endl;
+    }
+  }
+  if (pipeline.checkpoint_interval_sec > 0)
+  {
+    CheckpointManifest initial = g_resume_from;
+    initial.output_format = output_format;
+    initial.R1s = R1s;
+    initial.readers.resize(R1s.size());
+    initial.shards.resize(num_shards);
+    g_checkpointer = std::make_unique<CheckpointCoordinator>(
+        manifest_path, initial, pipeline.checkpoint_interval_sec, []() {
+          for (auto& write_queue : g_write_queues)
+            write_queue->enqueueCheckpointSignal();
+        });
+    g_checkpointer->start();
+  }
+
+  g_pipeline_start = std::chrono::steady_clock::now();
+  std::unique_ptr<MetricsReporter> metrics_reporter;
+  if (!pipeline.metrics_file.empty())
+  {
+    metrics_reporter = std::make_unique<MetricsReporter>(
+        pipeline.metrics_file, pipeline.metrics_interval_sec, [&R1s]() { return samplePipelineMetrics(R1s); });
+    metrics_reporter->start();
+  }
+
+  // Each reader's input size, or 0 if it's streamed.
+  std::vector<int64_t> input_bytes;
+  std::vector<std::string> const* inputs[] = {&I1s, &pipeline.I2s, &R1s, &R2s, &R3s};
+  for (int i = 0; i < R1s.size(); i++)
+  {
+    int64_t bytes = 0;
+    for (auto const* files : inputs)
+      if (!files->empty() && !isStreamingInput((*files)[i]))
+        bytes += std::filesystem::file_size((*files)[i]);
+    input_bytes.push_back(bytes);
+  }
+
+  if (pipeline.numa)
+  {
+    std::vector<NumaNode> nodes = readNumaTopology("/sys/devices/system/node", allowedCpus());
+    if (nodes.size() > 1)
+    {
+      g_numa_placement = placeOnNumaNodes(nodes, input_bytes, num_shards);
+      for (int n = 0; n < nodes.size(); n++)
+        std::cout << "numa: node " << nodes[n].id << " gets "
+                  << std::count(g_numa_placement.reader_nodes.begin(), g_numa_placement.reader_nodes.end(), n)
+                  << " readers and "
+                  << std::count(g_numa_placement.writer_nodes.begin(), g_numa_placement.writer_nodes.end(), n)
+                  << " writers" << std::endl;
+    }
+    else
+    {
+      std::cout << "numa: only one NUMA node available; not pinning threads" << std::endl;
+    }
+  }
+
+  std::unique_ptr<ThreadTuner> thread_tuner;
+  if (pipeline.auto_threads && R1s.size() < 2)
+  {
+    // It only limits the readers, and a lone one always runs.
+    std::cout << "auto-threads: only one R1 input, so only one reader; nothing to tune" << std::endl;
+  }
+  else if (pipeline.auto_threads)
+  {
+    ThreadPlan plan = planThreads(availableCores(), input_bytes, num_shards, output_format,
+                                  pipeline.output_compression_level);
+    std::cout << "auto-threads: running " << plan.reader_slots << " of " << plan.num_readers
+              << " readers at once on " << plan.cores << " cores" << std::endl;
+    g_reader_slots = std::make_unique<ReaderSlots>(plan.reader_slots);
+    thread_tuner = std::make_unique<ThreadTuner>(
+        plan, g_reader_slots.get(), kThreadTunerInterval, []() {
+          int64_t readers_blocked = 0;
+          int64_t writers_blocked = 0;
+          for (auto const& arena : g_read_arenas)
+            readers_blocked += arena->blockedNanos();
+          for (auto const& write_queue : g_write_queues)
+            writers_blocked += write_queue->blockedNanos();
+          return std::make_pair(readers_blocked, writers_blocked);
+        });
+    thread_tuner->start();
+  }
 
   // execute the bam file writers threads
   std::vector<std::thread> writers;
   if (output_format == "BAM")
-    for (int i = 0; i < num_writer_threads; i++)
-      writers.emplace_back(bamWriterThread, i, sample_id);
+    for (int i = 0; i < num_shards; i++)
+      writers.emplace_back(bamWriterThread, i, sample_id, std::cref(pipeline));
   else if (output_format == "FASTQ")
-    for (int i = 0; i < num_writer_threads; i++)
+    for (int i = 0; i < num_shards; i++)
       if (R3s.empty())
-          writers.emplace_back(fastqWriterThread, i, sample_bool);
+          writers.emplace_back(fastqWriterThread, i, sample_bool, std::cref(pipeline));
       else
-          writers.emplace_back(fastqWriterThreadATAC, i, sample_bool);
+          writers.emplace_back(fastqWriterThreadATAC, i, sample_bool, std::cref(pipeline));
   else
     crash("ERROR: Output-format must be either FASTQ or BAM");
 
@@ -682,16 +1768,25 @@ void mainCommon(
   for (unsigned int i = 0; i < R1s.size(); i++)
   {
     assert(I1s.empty() || I1s.size() == R1s.size());
-    // if there is no I1/R3 file then send an empty file name
-    readers.emplace_back(fastQFileReaderThread, i, I1s.empty() ? "" : I1s[i], R1s[i].c_str(),
-                         R2s[i].c_str(), R3s.empty() ? "" : R3s[i].c_str(), 
-                         &corrector, barcode_orientation,
-                         g_parsed_read_structure);
+    assert(pipeline.interleaved ? R2s.empty() : R2s.size() == R1s.size());
+    // if there is no I1/R2/R3 file then send an empty file name
+    readers.emplace_back(fastQFileReaderThread, i, I1s.empty() ? "" : I1s[i],
+                         pipeline.I2s.empty() ? "" : pipeline.I2s[i], R1s[i].c_str(),
+                         R2s.empty() ? "" : R2s[i].c_str(), R3s.empty() ? "" : R3s[i].c_str(), 
+                         whitelist, barcode_orientation,
+                         g_parsed_read_structure, std::cref(pipeline));
   }
 
   for (auto& reader : readers)
     reader.join();
 
+  if (thread_tuner)
+    thread_tuner->stop();
+
+  // A checkpoint needs the writers, so stop taking them before shutting down.
+  if (g_checkpointer)
+    g_checkpointer->stop();
+
   // Now that there's nothing left to read, we can safely append a shutdown
   // signal to all the write queues.
   for (auto& write_queue : g_write_queues)
@@ -699,4 +1794,42 @@ void mainCommon(
 
   for (auto& writer : writers)
     writer.join();
+
+  // The outputs are complete, so there's nothing left to resume.
+  std::remove(manifest_path.c_str());
+
+  OutputManifest output_manifest;
+  output_manifest.output_format = output_format;
+  for (auto const& stats : g_reader_stats)
+  {
+    output_manifest.barcodes.correct += stats->barcodes_correct;
+    output_manifest.barcodes.corrected += stats->barcodes_corrected;
+    output_manifest.barcodes.uncorrectable += stats->barcodes_uncorrectable;
+  }
+  output_manifest.shards = g_shard_summaries;
+  writeOutputManifest(outputPath(pipeline, kOutputManifestName), output_manifest);
+
+  if (g_demux)
+  {
+    for (int i = 0; i < num_shards; i += g_shards_per_set)
+    {
+      int64_t records = 0;
+      for (int j = i; j < i + g_shards_per_set; j++)
+        records += g_shard_summaries[j].records;
+      std::cout << "sample " << shardSampleName(i) << ": " << records << " records" << std::endl;
+    }
+  }
+
+  if (metrics_reporter)
+    metrics_reporter->stop();
+  if (!pipeline.metrics_summary_file.empty())
+    writeMetricsSummary(pipeline.metrics_summary_file, samplePipelineMetrics(R1s));
+
+  if (g_cells)
+    std::cout << "cell-prefilter: dropped " << g_prefiltered_reads << " reads of non-cell barcodes" << std::endl;
+  if (g_read_trimmer)
+    printTrimReport();
+  printMemoryReport();
+  if (thread_tuner)
+    thread_tuner->printReport();
 }
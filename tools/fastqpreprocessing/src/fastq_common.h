@@ -1,6 +1,7 @@
 #ifndef __SCTOOLS_FASTQPREPROCESSING_FASTQ_COMMON_H_
 #define __SCTOOLS_FASTQPREPROCESSING_FASTQ_COMMON_H_
 
+#include <atomic>
 #include <condition_variable>
 #include <functional>
 #include <mutex>
@@ -8,26 +9,44 @@
 #include <string>
 #include <vector>
 
+#include "input_options.h"
+#include "shard_manifest.h"
+
 #include "FastQFile.h"
 #include "FastQStatus.h"
 #include "SamFile.h"
 #include "SamValidation.h"
 
-// A pointer to a valid SamRecord waiting to be written to disk, and the index
-// of the g_read_arenas that pointer should be released to after the write.
-using PendingWrite = std::pair<SamRecord*, int>;
+// A pointer to a valid SamRecord waiting to be written to disk, the index of
+// the g_read_arenas that pointer should be released to after the write, and
+// how its barcode matched the whitelist.
+struct PendingWrite
+{
+  SamRecord* sam;
+  int source_reader_index;
+  BarcodeMatch barcode_match = BarcodeMatch::kUncorrectable;
+};
 
 class WriteQueue
 {
 public:
   static constexpr int kShutdown = -1;
+  static constexpr int kCheckpoint = -2;
   PendingWrite dequeueWrite();
   void enqueueWrite(PendingWrite write);
   void enqueueShutdownSignal();
+  void enqueueCheckpointSignal();
+  size_t depth();
+  // Most writes waiting in the queue at any one time.
+  size_t peakDepth();
+  // Total time dequeueWrite() has spent waiting for the queue to fill.
+  int64_t blockedNanos() const { return blocked_ns_.load(std::memory_order_relaxed); }
 private:
   std::mutex mutex_;
   std::condition_variable cv_;
   std::queue<PendingWrite> queue_;
+  size_t peak_depth_ = 0;
+  std::atomic<int64_t> blocked_ns_{0};
 };
 
 // This is a hack for the sake of samplefastq program.
@@ -36,10 +55,22 @@ void releaseReaderThreadMemory(int reader_thread_index, SamRecord* samRecord);
 std::vector<std::pair<char, int>> parseReadStructure(std::string const& read_structure);
 std::string reverseComplement(std::string sequence);
 
+// The per-read stages of the pipeline, exposed for the benchmarks in bench/.
+struct WhiteListCorrector;
+void fillSamRecord(SamRecord* samRecord, FastQFile* fastQFileI1,
+                   FastQFile* fastQFileR1, FastQFile* fastQFileR2, FastQFile* fastQFileR3,
+                   bool has_I1_file_list, bool has_R3_file_list, std::string orientation,
+                   std::vector<std::pair<char, int>> g_parsed_read_structure);
+int32_t correctBarcodeToWhitelist(
+    const std::string& barcode, SamRecord* sam_record, const WhiteListCorrector* corrector,
+    int* n_barcode_corrected, int* n_barcode_correct, int* n_barcode_errors, int num_writer_threads,
+    BarcodeMatch* match = nullptr);
+void writeFastqRecord(std::ostream& r1_out, std::ostream& r2_out, SamRecord* sam, bool sample_bool);
+
 void mainCommon(
     std::string white_list_file, std::string barcode_orientation, int num_writer_threads, std::string output_format,
     std::vector<std::string> I1s, std::vector<std::string> R1s, std::vector<std::string> R2s, std::vector<std::string> R3s,
     std::string sample_id, std::vector<std::pair<char, int>> g_parsed_read_structure,
-    bool sample_bool);
+    bool sample_bool, PipelineOptions const& pipeline = PipelineOptions());
 
 #endif // __SCTOOLS_FASTQPREPROCESSING_FASTQ_COMMON_H_
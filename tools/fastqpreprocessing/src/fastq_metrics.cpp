@@ -1,12 +1,14 @@
-#include "FastQFile.h"
-#include "FastQStatus.h"
 #include "fastq_metrics.h"
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <fstream>
 #include <iostream>
 #include <cassert>
+#include <thread>
 
 using std::string;
+using std::vector;
 
 std::vector<std::pair<char, int>> parseReadStructure(std::string read_structure)
 {
@@ -33,61 +35,119 @@ int getLengthOfType(string read_structure,char type)
   return total_length;
 }
 
-void PositionWeightMatrix::recordChunk(string s)
+// The column of PositionWeightMatrix::counts_ each character is counted in.
+constexpr std::array<uint8_t, 256> makeBaseColumns()
 {
-  for (int index = 0; index < s.size(); index++)
-  {
-    switch (s[index])
-    {
-    case 'A':
-    case 'a':
-      A[index]++;
-      break;
-    case 'C':
-    case 'c':
-      C[index]++;
-      break;
-    case 'G':
-    case 'g':
-      G[index]++;
-      break;
-    case 'T':
-    case 't':
-      T[index]++;
-      break;
-    case 'N':
-    case 'n':
-      N[index]++;
-      break;
-    default:
-      std::cerr<<"Unknown character:"<<s[index]<<std::endl;
-    }
-  }
+  std::array<uint8_t, 256> columns{};
+  for (auto& column : columns)
+    column = 5;
+  columns['A'] = columns['a'] = 0;
+  columns['C'] = columns['c'] = 1;
+  columns['G'] = columns['g'] = 2;
+  columns['T'] = columns['t'] = 3;
+  columns['N'] = columns['n'] = 4;
+  return columns;
 }
+constexpr std::array<uint8_t, 256> kBaseColumns = makeBaseColumns();
 
-FastQMetricsShard::FastQMetricsShard(std::string read_structure)
+void PositionWeightMatrix::recordChunk(std::string_view s)
+{
+  int64_t* counts = counts_.data();
+  int length = std::min<int>(s.size(), length_);
+  for (int index = 0; index < length; index++, counts += kNumCodes)
+    counts[kBaseColumns[static_cast<uint8_t>(s[index])]]++;
+}
+
+int64_t PositionWeightMatrix::unknownBases() const
+{
+  int64_t unknown = 0;
+  for (int i = 0; i < length_; i++)
+    unknown += counts_[i * kNumCodes + 5];
+  return unknown;
+}
+
+void QualityHistogram::recordChunk(std::string_view quality)
+{
+  int64_t* counts = counts_.data();
+  int length = std::min<int>(quality.size(), length_);
+  for (int index = 0; index < length; index++, counts += kNumScores)
+    counts[std::clamp(quality[index] - '!', 0, kNumScores - 1)]++;
+}
+
+// How many sequences of 'length' bases a ConcurrentApproximateCounter of
+// num_partitions can hold in 'bytes', besides their HyperLogLogs.
+size_t spaceSavingCapacity(int64_t bytes, int length, int num_partitions)
+{
+  int64_t entry_bytes = kSpaceSavingEntryBytes + (length > 15 ? 2 * (length + 1) : 0);
+  return std::max<int64_t>(1, (bytes - num_partitions * (1 << 14)) / entry_bytes);
+}
+
+FastQMetricsShard::FastQMetricsShard(std::string read_structure, int64_t approximate_bytes, int num_threads)
   : read_structure_(read_structure),
     barcode_length_(getLengthOfType(read_structure_,'C')),
     umi_length_(getLengthOfType(read_structure_,'M')),
     tagged_lengths_(parseReadStructure(read_structure_)),
+    barcode_counts_(barcode_length_),
+    umi_counts_(umi_length_),
     barcode_(barcode_length_),
-    umi_(umi_length_) {}
+    umi_(umi_length_),
+    barcode_quality_histogram_(barcode_length_),
+    umi_quality_histogram_(umi_length_)
+{
+  if (approximate_bytes > 0)
+  {
+    approximate_barcode_batch_.emplace(std::make_shared<ConcurrentApproximateCounter>(
+        spaceSavingCapacity(approximate_bytes / 2, barcode_length_, num_threads), num_threads));
+    approximate_umi_batch_.emplace(std::make_shared<ConcurrentApproximateCounter>(
+        spaceSavingCapacity(approximate_bytes / 2, umi_length_, num_threads), num_threads));
+    approximate_barcode_counts_.emplace(0);
+    approximate_umi_counts_.emplace(0);
+  }
+}
+
+FastQMetricsShard FastQMetricsShard::sharingCounts()
+{
+  FastQMetricsShard shard(read_structure_);
+  if (approximate_barcode_batch_)
+  {
+    shard.approximate_barcode_batch_.emplace(approximate_barcode_batch_->counter());
+    shard.approximate_umi_batch_.emplace(approximate_umi_batch_->counter());
+    shard.approximate_barcode_counts_.emplace(0);
+    shard.approximate_umi_counts_.emplace(0);
+  }
+  else
+  {
+    shard.barcode_counts_ = barcode_counts_.sharingDenseCounts();
+    shard.umi_counts_ = umi_counts_.sharingDenseCounts();
+  }
+  return shard;
+}
 
 // Read a chunk from a fastq r1 and get UMI and Cellbarcode filled
-void FastQMetricsShard::ingestBarcodeAndUMI(std::string_view raw_seq)
+void FastQMetricsShard::ingestBarcodeAndUMI(std::string_view raw_seq, std::string_view raw_quality)
 {
   // extract the raw barcode and UMI 8C18X6C9M1X and raw barcode and UMI quality string
-  std::string barcode_seq, umi_seq;
+  std::string& barcode_seq = barcode_seq_;
+  std::string& umi_seq = umi_seq_;
+  barcode_seq.clear();
+  umi_seq.clear();
+  barcode_quality_.clear();
+  umi_quality_.clear();
   int cur_ind = 0;
   for (auto [tag, length] : tagged_lengths_)
   {
+    // A read shorter than the read structure just gets shorter segments.
+    std::string_view seq = raw_seq.substr(std::min<size_t>(cur_ind, raw_seq.size()), length);
+    std::string_view quality = raw_quality.substr(std::min<size_t>(cur_ind, raw_quality.size()), length);
     switch (tag)
     {
     case 'C':
-      barcode_seq += raw_seq.substr(cur_ind, length);
+      barcode_seq += seq;
+      barcode_quality_ += quality;
       break;
     case 'M':
-      umi_seq += raw_seq.substr(cur_ind, length);
+      umi_seq += seq;
+      umi_quality_ += quality;
       break;
     default:
       break;
@@ -95,75 +155,86 @@ void FastQMetricsShard::ingestBarcodeAndUMI(std::string_view raw_seq)
     cur_ind += length;
   }
 
-  barcode_counts_[barcode_seq]++;
-  umi_counts_[umi_seq]++;
+  if (approximate_barcode_batch_)
+  {
+    approximate_barcode_batch_->add(barcode_seq);
+    approximate_umi_batch_->add(umi_seq);
+  }
+  else
+  {
+    barcode_counts_.add(barcode_seq);
+    umi_counts_.add(umi_seq);
+  }
   barcode_.recordChunk(barcode_seq);
   umi_.recordChunk(umi_seq);
+  barcode_quality_histogram_.recordChunk(barcode_quality_);
+  umi_quality_histogram_.recordChunk(umi_quality_);
 }
 
 
-// This is a wrapper to use std thread
-void processShard(FastQMetricsShard* fastq_metrics_shard, String filenameR1,
-                  std::string read_structure, const WhiteListCorrector* whitelist)
+void FastQMetricsShard::ingestFastqBlock(std::string_view block)
 {
-  fastq_metrics_shard->processShard(filenameR1, read_structure, whitelist);
+  forEachFastqRecord(block, [this](std::string_view seq, std::string_view quality) {
+    ingestBarcodeAndUMI(seq, quality);
+  });
+  if (approximate_barcode_batch_)
+  {
+    approximate_barcode_batch_->flush();
+    approximate_umi_batch_->flush();
+  }
 }
-void FastQMetricsShard::processShard(String filenameR1, std::string read_structure,
-                                     const WhiteListCorrector* whitelist)
-{
-  /// setting the shortest sequence allowed to be read
-  FastQFile fastQFileR1(4, 4);
-  // open the R1 file
-  if (fastQFileR1.openFile(filenameR1, BaseAsciiMap::UNKNOWN) != FastQStatus::FASTQ_SUCCESS)
-    crash("Failed to open R1 file");
 
-  // Keep reading the file until there are no more fastq sequences to process.
-  int n_lines_read = 0;
-  while (fastQFileR1.keepReadingFile())
+void FastQMetricsShard::collectApproximateCounts()
+{
+  if (approximate_barcode_batch_)
   {
-    if (fastQFileR1.readFastQSequence() != FastQStatus::FASTQ_SUCCESS)
-      break;
-
-    ingestBarcodeAndUMI(std::string_view(fastQFileR1.myRawSequence.c_str(),fastQFileR1.myRawSequence.Length()));
-
-    n_lines_read++;
-    if (n_lines_read % 10000000 == 0)
-    {
-      printf("%d\n", n_lines_read);
-      std::string a = std::string(fastQFileR1.myRawSequence.c_str());
-      printf("%s\n", fastQFileR1.mySequenceIdLine.c_str());
-    }
+    approximate_barcode_counts_ = approximate_barcode_batch_->counter()->merged();
+    approximate_umi_counts_ = approximate_umi_batch_->counter()->merged();
   }
-  // Finished processing all of the sequences in the file.
-  // Close the input files.
-  fastQFileR1.closeFile();
 }
 
 PositionWeightMatrix& PositionWeightMatrix::operator+=(const PositionWeightMatrix& rhs)
 {
-  for (int i=0; i < A.size(); i++)
-  {
-    A[i] += rhs.A[i];
-    C[i] += rhs.C[i];
-    G[i] += rhs.G[i];
-    T[i] += rhs.T[i];
-    N[i] += rhs.N[i];
-  }
+  for (size_t i = 0; i < counts_.size(); i++)
+    counts_[i] += rhs.counts_[i];
+  return *this;
+}
+
+QualityHistogram& QualityHistogram::operator+=(const QualityHistogram& rhs)
+{
+  for (size_t i = 0; i < counts_.size(); i++)
+    counts_[i] += rhs.counts_[i];
   return *this;
 }
 
 FastQMetricsShard& FastQMetricsShard::operator+=(const FastQMetricsShard& rhs)
 {
-  for (auto [key,value] : rhs.barcode_counts_)
-    barcode_counts_[key] += value;
-  for (auto [key,value] : rhs.umi_counts_)
-    umi_counts_[key] += value;
+  if (read_structure_ != rhs.read_structure_)
+    crash("ERROR: Can't merge the metrics of read structures " + read_structure_ + " and " + rhs.read_structure_);
+  if (approximate_barcode_counts_.has_value() != rhs.approximate_barcode_counts_.has_value())
+    crash("ERROR: Can't merge approximate metrics with exact ones");
+
+  barcode_counts_ += rhs.barcode_counts_;
+  umi_counts_ += rhs.umi_counts_;
+  if (approximate_barcode_counts_)
+  {
+    *approximate_barcode_counts_ += *rhs.approximate_barcode_counts_;
+    *approximate_umi_counts_ += *rhs.approximate_umi_counts_;
+  }
 
   barcode_+=rhs.barcode_;
   umi_+=rhs.umi_;
+  barcode_quality_histogram_ += rhs.barcode_quality_histogram_;
+  umi_quality_histogram_ += rhs.umi_quality_histogram_;
   return *this;
 }
 
+// --threads, or one per core.
+int numThreads(INPUT_OPTIONS_FASTQ_READ_STRUCTURE const& options)
+{
+  return options.num_threads > 0 ? options.num_threads : std::max(1u, std::thread::hardware_concurrency());
+}
+
 /** @copydoc process_inputs */
 void process_inputs(const INPUT_OPTIONS_FASTQ_READ_STRUCTURE& options,
                     const WhiteListCorrector* whitelist)
@@ -171,72 +242,223 @@ void process_inputs(const INPUT_OPTIONS_FASTQ_READ_STRUCTURE& options,
   // number of files based on the input size
   int num_files = options.R1s.size();
 
-  // compute UMI and cell_barcode lengths
-
-  int umi_length = getLengthOfType(options.read_structure,'M');
-  int CB_length = getLengthOfType(options.read_structure,'C');
+  // Up to num_threads R1s are decompressed at once, and split into blocks
+  // that num_threads workers count, each into its own shard.
+  int num_threads = numThreads(options);
+  FastqBlockQueue blocks(2 * num_threads);
 
-  // create the data for the threads
-  vector <FastQMetricsShard> fastqMetrics;
-  for (int i = 0; i < num_files; i++)
-    fastqMetrics.emplace_back(options.read_structure);
-
-  // execute the fastq readers threads
+  std::atomic<int> next_file{0};
   vector<std::thread> readers;
-  for (unsigned int i = 0; i < options.R1s.size(); i++)
+  for (int i = 0; i < std::min(num_threads, num_files); i++)
   {
-    readers.emplace_back(processShard,
-                         &fastqMetrics[i],
-                         options.R1s[i].c_str(),
-                         options.read_structure.c_str(),
-                         whitelist);
+    readers.emplace_back([&]() {
+      for (int file; (file = next_file++) < num_files; )
+        readFastqBlocks(options.R1s[file], &blocks);
+    });
+  }
 
+  // The workers' shards share the memory for the barcode and UMI counts.
+  int64_t approximate_bytes = options.approximate_memory_mb * (int64_t{1} << 20);
+  vector <FastQMetricsShard> fastqMetrics;
+  fastqMetrics.reserve(num_threads);
+  fastqMetrics.emplace_back(options.read_structure, approximate_bytes, num_threads);
+  for (int i = 1; i < num_threads; i++)
+    fastqMetrics.push_back(fastqMetrics.front().sharingCounts());
+  vector<std::thread> workers;
+  for (int i = 0; i < num_threads; i++)
+  {
+    workers.emplace_back([&blocks, shard = &fastqMetrics[i]]() {
+      for (std::string block; blocks.pop(&block); )
+        shard->ingestFastqBlock(block);
+    });
   }
 
-  // every reader thread joins.
-  for (unsigned int i = 0; i < options.R1s.size(); i++)
-    readers[i].join();
+  for (std::thread& reader : readers)
+    reader.join();
+  blocks.close();
+  for (std::thread& worker : workers)
+    worker.join();
+  fastqMetrics.front().collectApproximateCounts();
 
-  std::cout << "Done reading all shards. Will now aggregate and write to file; "
-            << "this will take a few minutes." << std::endl;
-  FastQMetricsShard::mergeMetricsShardsToFile(options.sample_id, fastqMetrics, umi_length, CB_length);
+  std::cout << "Done reading all shards. Will now aggregate and write to file." << std::endl;
+  FastQMetricsShard::mergeMetricsShardsToFile(options.sample_id, &fastqMetrics, num_threads, options.save_state);
 }
 
-void writeCountsFile(std::unordered_map<string,int> counts, std::string filename)
+void PositionWeightMatrix::writeToFile(std::string filename)
 {
   std::ofstream out(filename, std::ofstream::out);
-  std::vector<std::pair<std::string,int>> sorted_counts;
-  for (auto [str, count] : counts)
-    sorted_counts.emplace_back(str, count);
-  std::sort(sorted_counts.begin(), sorted_counts.end(), //sort counts from most to fewest!
-            [](std::pair<std::string,int> const& a, std::pair<std::string,int> const& b)
+  out << "position\tA\tC\tG\tT\tN\n";
+  for (int i = 0; i < length_; i++)
   {
-    return a.second > b.second;
-  });
-  for (auto [str, count] : sorted_counts)
-    out << count << "\t" << str << "\n";
+    int64_t const* counts = &counts_[i * kNumCodes];
+    out << (i + 1) << "\t" << counts[0] << "\t" << counts[1] << "\t" << counts[2] << "\t" << counts[3] << "\t"
+        << counts[4] << "\n";
+  }
 }
-void PositionWeightMatrix::writeToFile(std::string filename)
+
+void QualityHistogram::writeToFile(std::string filename)
 {
+  int max_score = 0;
+  for (size_t i = 0; i < counts_.size(); i++)
+    if (counts_[i] != 0)
+      max_score = std::max<int>(max_score, i % kNumScores);
+
   std::ofstream out(filename, std::ofstream::out);
-  out << "position\tA\tC\tG\tT\tN\n";
-  for (int i = 0; i < A.size(); i++)
-    out << (i + 1) << "\t" << A[i] << "\t" << C[i] << "\t" << G[i] << "\t" << T[i] << "\t" << N[i] << "\n";
+  out << "position\tmean\tfraction_Q30";
+  for (int score = 0; score <= max_score; score++)
+    out << "\t" << score;
+  out << "\n";
+  for (int i = 0; i < length_; i++)
+  {
+    int64_t const* counts = &counts_[i * kNumScores];
+    int64_t total = 0, score_sum = 0, q30 = 0;
+    for (int score = 0; score < kNumScores; score++)
+    {
+      total += counts[score];
+      score_sum += score * counts[score];
+      if (score >= 30)
+        q30 += counts[score];
+    }
+    out << (i + 1) << "\t" << (total ? static_cast<double>(score_sum) / total : 0) << "\t"
+        << (total ? static_cast<double>(q30) / total : 0);
+    for (int score = 0; score <= max_score; score++)
+      out << "\t" << counts[score];
+    out << "\n";
+  }
 }
-void FastQMetricsShard::mergeMetricsShardsToFile(std::string filename_prefix, vector<FastQMetricsShard> shards, int umi_length, int CB_length)
+void FastQMetricsShard::mergeMetricsShardsToFile(std::string filename_prefix, vector<FastQMetricsShard>* shards,
+                                                 int num_threads, std::string const& save_state_path)
 {
-  FastQMetricsShard total(shards[0].read_structure_);
-  for (FastQMetricsShard const& shard : shards)
-    total += shard;
+  // Each shard merged into another is emptied, to free its counts.
+  mergeInTree(shards->size(), [shards](int into, int from) {
+    (*shards)[into] += (*shards)[from];
+    (*shards)[from] = FastQMetricsShard((*shards)[from].read_structure_);
+  });
+  FastQMetricsShard& total = shards->front();
 
-  writeCountsFile(total.umi_counts_, filename_prefix + ".numReads_perCell_XM.txt");
-  writeCountsFile(total.barcode_counts_, filename_prefix + ".numReads_perCell_XC.txt");
+  if (total.approximate_barcode_counts_)
+  {
+    writeApproximateCountsFile(*total.approximate_umi_counts_, filename_prefix + ".numReads_perCell_XM.txt");
+    writeApproximateCountsFile(*total.approximate_barcode_counts_, filename_prefix + ".numReads_perCell_XC.txt");
+  }
+  else
+  {
+    writeCountsFile(total.umi_counts_, filename_prefix + ".numReads_perCell_XM.txt", num_threads);
+    writeCountsFile(total.barcode_counts_, filename_prefix + ".numReads_perCell_XC.txt", num_threads);
+  }
   total.barcode_.writeToFile(filename_prefix + ".barcode_distribution_XC.txt");
   total.umi_.writeToFile(filename_prefix + ".barcode_distribution_XM.txt");
+  total.barcode_quality_histogram_.writeToFile(filename_prefix + ".quality_distribution_XC.txt");
+  total.umi_quality_histogram_.writeToFile(filename_prefix + ".quality_distribution_XM.txt");
+  if (int64_t unknown = total.barcode_.unknownBases() + total.umi_.unknownBases())
+    std::cerr << "Warning: " << unknown << " barcode and UMI bases were none of ACGTN" << std::endl;
+  if (!save_state_path.empty())
+    total.saveState(save_state_path);
+}
+
+// Starts every state file, followed by its version.
+constexpr int64_t kStateMagic = 0x5453534d51544641; // "AFTQMSST"
+constexpr int64_t kStateVersion = 2;
+
+void PositionWeightMatrix::load(StateReader* in)
+{
+  std::vector<int64_t> counts = in->readInts();
+  if (counts.size() != counts_.size())
+    crash("ERROR: State file " + in->path() + " is corrupt");
+  counts_ = std::move(counts);
+}
+
+void QualityHistogram::load(StateReader* in)
+{
+  std::vector<int64_t> counts = in->readInts();
+  if (counts.size() != counts_.size())
+    crash("ERROR: State file " + in->path() + " is corrupt");
+  counts_ = std::move(counts);
+}
+
+void FastQMetricsShard::saveState(std::string const& path) const
+{
+  StateWriter out(path);
+  out.writeInt(kStateMagic);
+  out.writeInt(kStateVersion);
+  out.writeString(read_structure_);
+  barcode_.save(&out);
+  umi_.save(&out);
+  barcode_quality_histogram_.save(&out);
+  umi_quality_histogram_.save(&out);
+  out.writeInt(approximate_barcode_counts_.has_value());
+  if (approximate_barcode_counts_)
+  {
+    approximate_barcode_counts_->save(&out);
+    approximate_umi_counts_->save(&out);
+  }
+  else
+  {
+    barcode_counts_.save(&out);
+    umi_counts_.save(&out);
+  }
+  out.close();
+}
+
+FastQMetricsShard FastQMetricsShard::loadState(std::string const& path)
+{
+  StateReader in(path);
+  if (in.readInt() != kStateMagic)
+    crash("ERROR: " + path + " isn't a fastq_metrics state file");
+  if (int64_t version = in.readInt(); version != kStateVersion)
+    crash("ERROR: State file " + path + " has unknown version " + std::to_string(version));
+
+  FastQMetricsShard shard(in.readString());
+  shard.barcode_.load(&in);
+  shard.umi_.load(&in);
+  shard.barcode_quality_histogram_.load(&in);
+  shard.umi_quality_histogram_.load(&in);
+  if (in.readInt())
+  {
+    shard.approximate_barcode_counts_ = ApproximateSequenceCounter::load(&in);
+    shard.approximate_umi_counts_ = ApproximateSequenceCounter::load(&in);
+  }
+  else
+  {
+    shard.barcode_counts_ = PackedSequenceCounter::load(&in);
+    shard.umi_counts_ = PackedSequenceCounter::load(&in);
+  }
+  return shard;
+}
+
+// `fastq_metrics merge`: adds up the state files, each of up to num_threads
+// threads loading its share of them in turn, and writes the totals.
+void mergeStates(INPUT_OPTIONS_FASTQ_READ_STRUCTURE const& options)
+{
+  int num_states = options.state_files.size();
+  int num_threads = std::min(numThreads(options), num_states);
+  vector<std::optional<FastQMetricsShard>> totals(num_threads);
+  runInParallel(num_threads, [&](int thread) {
+    for (int i = thread; i < num_states; i += num_threads)
+    {
+      FastQMetricsShard shard = FastQMetricsShard::loadState(options.state_files[i]);
+      if (totals[thread])
+        *totals[thread] += shard;
+      else
+        totals[thread] = std::move(shard);
+    }
+  });
+  vector<FastQMetricsShard> shards;
+  for (auto& total : totals)
+    shards.push_back(std::move(*total));
+  std::cout << "Read " << num_states << " state files. Will now aggregate and write to file." << std::endl;
+  FastQMetricsShard::mergeMetricsShardsToFile(options.sample_id, &shards, numThreads(options), options.save_state);
 }
 
 int main(int argc, char** argv)
 {
+  // `fastq_metrics merge` combines the --save-state files of earlier runs.
+  if (argc > 1 && std::string(argv[1]) == "merge")
+  {
+    mergeStates(readOptionsFastqMetricsMerge(argc - 1, argv + 1));
+    return 0;
+  }
+
   INPUT_OPTIONS_FASTQ_READ_STRUCTURE options = readOptionsFastqMetrics(argc, argv);
   std::cout << "reading whitelist file " << options.white_list_file << "...";
   WhiteListCorrector whitelist = readWhiteListFile(options.white_list_file);
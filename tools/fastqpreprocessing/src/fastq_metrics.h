@@ -1,56 +1,122 @@
 #ifndef __FASTQ_METRICS_H__
 #define __FASTQ_METRICS_H__
 
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
-#include <thread>
-
-#include "BaseAsciiMap.h"
-#include "FastQFile.h"
-#include "FastQStatus.h"
 
+#include "approximate_counts.h"
+#include "fastq_blocks.h"
 #include "input_options.h"
+#include "metrics_output.h"
+#include "metrics_state.h"
+#include "packed_counts.h"
 #include "whitelist_corrector.h"
 
 
+// Counts of each base (A, C, G, T or N, in either case) at each position.
 class PositionWeightMatrix
 {
 public:
-  PositionWeightMatrix(int length): A(length), C(length), G(length), T(length), N(length) {}
-  void recordChunk(std::string s);
+  PositionWeightMatrix(int length): length_(length), counts_(length * kNumCodes) {}
+  void recordChunk(std::string_view s);
   PositionWeightMatrix& operator+=(const PositionWeightMatrix& rhs);
   void writeToFile(std::string filename);
+  // How many characters recorded weren't any of the bases.
+  int64_t unknownBases() const;
+  void save(StateWriter* out) const { out->writeInts(counts_); }
+  // Replaces the counts with those save()d to 'in'.
+  void load(StateReader* in);
+
+private:
+  // counts_ holds, for each position in turn, the counts of A, C, G, T, N and
+  // anything else.
+  static constexpr int kNumCodes = 6;
+  int length_;
+  std::vector<int64_t> counts_;
+};
+
+// Counts of each Phred+33 quality score at each position.
+class QualityHistogram
+{
+public:
+  QualityHistogram(int length): length_(length), counts_(length * kNumScores) {}
+  void recordChunk(std::string_view quality);
+  QualityHistogram& operator+=(const QualityHistogram& rhs);
+  // One line per position: the mean score, the fraction of scores of at least
+  // 30, and the count of each score up to the highest seen.
+  void writeToFile(std::string filename);
+  void save(StateWriter* out) const { out->writeInts(counts_); }
+  // Replaces the counts with those save()d to 'in'.
+  void load(StateReader* in);
 
-  std::vector<int> A;
-  std::vector<int> C;
-  std::vector<int> G;
-  std::vector<int> T;
-  std::vector<int> N;
+private:
+  // '!' (0) to '~' (93); characters outside count as the nearest.
+  static constexpr int kNumScores = 94;
+  int length_;
+  std::vector<int64_t> counts_;
 };
 
 class FastQMetricsShard
 {
 public:
-  FastQMetricsShard(std::string read_structure);
-  void ingestBarcodeAndUMI(std::string_view raw_seq);
-  void processShard(String filenameR1, std::string read_structure,
-                    const WhiteListCorrector* whitelist);
+  // With approximate_bytes, barcodes and UMIs are counted approximately in
+  // about that many bytes (in all), by up to num_threads threads at once; see
+  // ConcurrentApproximateCounter.
+  FastQMetricsShard(std::string read_structure, int64_t approximate_bytes = 0, int num_threads = 1);
+  // An empty shard that adds its barcode and UMI counts to the same arrays or
+  // approximate counters as this one (see
+  // PackedSequenceCounter::sharingDenseCounts()), so that each worker has a
+  // shard of its own, but the memory for the counts is only spent once.
+  FastQMetricsShard sharingCounts();
+  // Ingests the sequence and quality of each (4 line) FASTQ record in 'block'.
+  void ingestFastqBlock(std::string_view block);
+  // Once every shard sharing the approximate counters is done ingesting,
+  // takes in all of their counts (leaving the others' approximate counts
+  // empty).
+  void collectApproximateCounts();
+  // Merges 'shards' (into the first, emptying the others) on up to
+  // num_threads threads, and writes the totals. Also saves them to
+  // save_state_path if it isn't empty.
   static void mergeMetricsShardsToFile(std::string filename_prefix,
-                                       std::vector<FastQMetricsShard> shards,
-                                       int umi_length, int CB_length);
+                                       std::vector<FastQMetricsShard>* shards,
+                                       int num_threads, std::string const& save_state_path = "");
+  // Crashes unless both count the same read structure, both exactly or both
+  // approximately.
   FastQMetricsShard& operator+=(const FastQMetricsShard& rhs);
 
+  // All of the counts, in a file `fastq_metrics merge` can add to others';
+  // see metrics_state.h.
+  void saveState(std::string const& path) const;
+  static FastQMetricsShard loadState(std::string const& path);
 
 private:
+  void ingestBarcodeAndUMI(std::string_view raw_seq, std::string_view raw_quality);
+
   std::string read_structure_;
   int barcode_length_;
   int umi_length_;
   std::vector<std::pair<char, int>> tagged_lengths_;
-  std::unordered_map<std::string, int> barcode_counts_;
-  std::unordered_map<std::string, int> umi_counts_;
+  // Reused for every read, to not allocate them each time.
+  std::string barcode_seq_;
+  std::string umi_seq_;
+  std::string barcode_quality_;
+  std::string umi_quality_;
+  PackedSequenceCounter barcode_counts_;
+  PackedSequenceCounter umi_counts_;
+  // Used instead of the above when counting approximately: the batches are
+  // added to the shared counters after each block, and those collected into
+  // the counts once all are done.
+  std::optional<ApproximateCountBatch> approximate_barcode_batch_;
+  std::optional<ApproximateCountBatch> approximate_umi_batch_;
+  std::optional<ApproximateSequenceCounter> approximate_barcode_counts_;
+  std::optional<ApproximateSequenceCounter> approximate_umi_counts_;
   PositionWeightMatrix barcode_;
   PositionWeightMatrix umi_;
+  QualityHistogram barcode_quality_histogram_;
+  QualityHistogram umi_quality_histogram_;
 };
 
 #endif // __FASTQ_METRICS_H__
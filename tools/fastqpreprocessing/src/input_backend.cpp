@@ -0,0 +1,246 @@
+#include "input_backend.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// O_DIRECT transfers must be aligned to the device's logical block size;
+// 4KiB covers every device we run on.
+constexpr size_t kDirectIoAlignment = 4096;
+
+PrefetchedInput::PrefetchedInput(std::string const& path, InputBackend backend,
+                                 size_t block_size, int queue_depth)
+  : path_(path), backend_(backend), block_size_(block_size), queue_depth_(queue_depth)
+{
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) != 0)
+    crash("ERROR: Failed to create a pipe for reading " + path + ": " + strerror(errno));
+  read_fd_ = fds[0];
+  write_fd_ = fds[1];
+  // A pipe holds 64KiB by default; a bigger one lets the helper run further
+  // ahead. Unprivileged processes are capped at /proc/sys/fs/pipe-max-size
+  // (1MiB by default), so fall back to that.
+  if (fcntl(write_fd_, F_SETPIPE_SZ, static_cast<int>(block_size_)) < 0)
+    fcntl(write_fd_, F_SETPIPE_SZ, 1024 * 1024);
+  pipe_path_ = "/dev/fd/" + std::to_string(read_fd_);
+  thread_ = std::thread(&PrefetchedInput::run, this);
+}
+
+PrefetchedInput::~PrefetchedInput()
+{
+  // With no read end left open, a helper still writing gets EPIPE and stops.
+  close(read_fd_);
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void PrefetchedInput::run()
+{
+  // Report a closed pipe as EPIPE rather than killing the process.
+  sigset_t sigpipe;
+  sigemptyset(&sigpipe);
+  sigaddset(&sigpipe, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigpipe, nullptr);
+
+  int flags = O_RDONLY | O_CLOEXEC;
+  if (backend_ == InputBackend::kDirect)
+    flags |= O_DIRECT;
+  int fd = open(path_.c_str(), flags);
+  if (fd < 0 && backend_ == InputBackend::kDirect && errno == EINVAL)
+  {
+    // Some filesystems (e.g. tmpfs) don't do O_DIRECT.
+    std::cout << path_ << " doesn't support O_DIRECT; using readahead instead" << std::endl;
+    backend_ = InputBackend::kReadahead;
+    fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+  }
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0)
+    crash("ERROR: Failed to open " + path_ + ": " + strerror(errno));
+
+  switch (backend_)
+  {
+  case InputBackend::kMmap:
+    streamMmap(fd, st.st_size);
+    break;
+  case InputBackend::kDirect:
+    streamDirect(fd);
+    break;
+  default:
+    streamReadahead(fd, st.st_size);
+    break;
+  }
+  close(fd);
+  close(write_fd_);
+}
+
+void PrefetchedInput::streamMmap(int fd, int64_t size)
+{
+  if (size == 0)
+    return;
+  char* data = static_cast<char*>(mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0));
+  if (data == MAP_FAILED)
+    crash("ERROR: Failed to mmap " + path_ + ": " + strerror(errno));
+  madvise(data, size, MADV_SEQUENTIAL);
+
+  int64_t advised = 0;
+  for (int64_t offset = 0; offset < size; offset += block_size_)
+  {
+    // Keep queue_depth blocks ahead faulting in while this one is written.
+    int64_t advise_until = std::min<int64_t>(size, offset + (queue_depth_ + 1) * block_size_);
+    if (advised < advise_until)
+    {
+      madvise(data + advised, advise_until - advised, MADV_WILLNEED);
+      advised = advise_until;
+    }
+    if (!writeToPipe(data + offset, std::min<int64_t>(block_size_, size - offset)))
+      break;
+  }
+  munmap(data, size);
+}
+
+void PrefetchedInput::streamReadahead(int fd, int64_t size)
+{
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  std::vector<char> block(block_size_);
+  int64_t advised = 0;
+  int64_t offset = 0;
+  while (true)
+  {
+    // Keep queue_depth blocks ahead in flight while this one is read and
+    // written.
+    int64_t advise_until = std::min<int64_t>(size, offset + (queue_depth_ + 1) * block_size_);
+    if (advised < advise_until)
+    {
+      posix_fadvise(fd, advised, advise_until - advised, POSIX_FADV_WILLNEED);
+      advised = advise_until;
+    }
+    ssize_t n = pread(fd, block.data(), block.size(), offset);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      crash("ERROR: Failed to read " + path_ + ": " + strerror(errno));
+    if (n == 0 || !writeToPipe(block.data(), n))
+      break;
+    offset += n;
+  }
+}
+
+void PrefetchedInput::streamDirect(int fd)
+{
+  // O_DIRECT bypasses the kernel's readahead, and a pread waits for its
+  // transfer, so queue_depth reader threads each keep one read in flight:
+  // reader k reads blocks k, k + queue_depth, ... into buffer k, and this
+  // thread writes the blocks out in order, handing each buffer back to its
+  // reader once written.
+  struct Slot
+  {
+    char* data = nullptr;
+    ssize_t size = 0;
+    bool full = false;
+  };
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<Slot> slots(queue_depth_);
+  bool stop = false;
+
+  for (Slot& slot : slots)
+  {
+    void* buffer = nullptr;
+    if (posix_memalign(&buffer, kDirectIoAlignment, block_size_) != 0)
+      crash("ERROR: Failed to allocate read buffers for " + path_);
+    slot.data = static_cast<char*>(buffer);
+  }
+
+  std::vector<std::thread> readers;
+  for (int k = 0; k < queue_depth_; k++)
+  {
+    readers.emplace_back([&, k]() {
+      Slot& slot = slots[k];
+      for (int64_t block = k; ; block += queue_depth_)
+      {
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          cv.wait(lock, [&] { return stop || !slot.full; });
+          if (stop)
+            return;
+        }
+        ssize_t n;
+        do
+          n = pread(fd, slot.data, block_size_, block * block_size_);
+        while (n < 0 && errno == EINTR);
+        if (n < 0)
+          crash("ERROR: Failed to read " + path_ + " with O_DIRECT: " + strerror(errno));
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          slot.size = n;
+          slot.full = true;
+        }
+        cv.notify_all();
+        // Only the last block of the file (or one past it) comes up short.
+        if (n < block_size_)
+          return;
+      }
+    });
+  }
+
+  for (int64_t block = 0; ; block++)
+  {
+    Slot& slot = slots[block % queue_depth_];
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&] { return slot.full; });
+    }
+    bool ok = slot.size > 0 && writeToPipe(slot.data, slot.size);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      slot.full = false;
+      stop = !ok || slot.size < block_size_;
+    }
+    cv.notify_all();
+    if (stop)
+      break;
+  }
+  for (std::thread& reader : readers)
+    reader.join();
+  for (Slot& slot : slots)
+    free(slot.data);
+}
+
+bool PrefetchedInput::writeToPipe(const char* data, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t written = write(write_fd_, data, len);
+    if (written < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      if (errno == EPIPE)
+        return false;
+      crash("ERROR: Failed to pass on the contents of " + path_ + ": " + strerror(errno));
+    }
+    data += written;
+    len -= written;
+  }
+  return true;
+}
+
+std::string prefetchInput(std::string const& path, PipelineOptions const& pipeline,
+                          std::vector<std::unique_ptr<PrefetchedInput>>* prefetched)
+{
+  if (pipeline.input_backend == InputBackend::kDefault || path.empty() || isStreamingInput(path))
+    return path;
+  prefetched->push_back(std::make_unique<PrefetchedInput>(
+      path, pipeline.input_backend, pipeline.input_block_kb * 1024, pipeline.input_queue_depth));
+  return prefetched->back()->path();
+}
@@ -0,0 +1,54 @@
+#ifndef __SCTOOLS_FASTQPREPROCESSING_INPUT_BACKEND_H_
+#define __SCTOOLS_FASTQPREPROCESSING_INPUT_BACKEND_H_
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "input_options.h"
+
+// libStatGen's FastQFile reads its input in small synchronous chunks, which
+// leaves most of the bandwidth of network-attached disks unused. With a
+// non-default --input-backend, each input file is instead read by a helper
+// thread in large blocks, with more blocks already requested from the disk,
+// and fed to FastQFile through a pipe (opened as /dev/fd/N, as for any other
+// FIFO input). The decompression in FastQFile then always has data waiting.
+class PrefetchedInput
+{
+public:
+  // Starts streaming the regular file at 'path' into a pipe.
+  PrefetchedInput(std::string const& path, InputBackend backend, size_t block_size,
+                  int queue_depth);
+  // Stops the helper thread, even if the pipe wasn't read to the end.
+  ~PrefetchedInput();
+
+  // What to open instead of the original path.
+  std::string const& path() const { return pipe_path_; }
+
+private:
+  void run();
+  void streamMmap(int fd, int64_t size);
+  void streamReadahead(int fd, int64_t size);
+  void streamDirect(int fd);
+  // Returns false once the reading side has gone away.
+  bool writeToPipe(const char* data, size_t len);
+
+  std::string path_;
+  InputBackend backend_;
+  size_t block_size_;
+  int queue_depth_;
+  int read_fd_ = -1;
+  int write_fd_ = -1;
+  std::string pipe_path_;
+  std::thread thread_;
+};
+
+// Returns the path a reader thread should open to read 'path'. With the
+// default backend, or for inputs that are already streams, that's 'path'
+// itself; otherwise it's a new PrefetchedInput, which is added to 'prefetched'
+// and must outlive the reading.
+std::string prefetchInput(std::string const& path, PipelineOptions const& pipeline,
+                          std::vector<std::unique_ptr<PrefetchedInput>>* prefetched);
+
+#endif // __SCTOOLS_FASTQPREPROCESSING_INPUT_BACKEND_H_
@@ -1,18 +1,55 @@
 #include "input_options.h"
+#include "cell_prefilter.h"
+#include "output_schema.h"
+#include "sample_demux.h"
 
 #include <filesystem>
 #include <getopt.h>
+#include <sys/stat.h>
 #include <cassert>
+#include <cstdlib>
 #include <iostream>
 #include <cmath>
 
 using std::string;
 
+namespace
+{
+thread_local bool t_crash_throws = false;
+} // namespace
+
+CrashThrows::CrashThrows() : was_throwing_(t_crash_throws)
+{
+  t_crash_throws = true;
+}
+
+CrashThrows::~CrashThrows()
+{
+  t_crash_throws = was_throwing_;
+}
+
 void crash(std::string msg)
 {
+  if (t_crash_throws)
+    throw CrashError(msg);
   std::cout << msg << std::endl;
   std::cerr << msg << std::endl;
-  exit(1);
+  std::quick_exit(1);
+}
+
+bool isStreamingInput(string const& path)
+{
+  if (path == "-" || path == "-.gz")
+    return true;
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+    return false;
+  return S_ISFIFO(st.st_mode) || S_ISCHR(st.st_mode);
+}
+
+string outputPath(PipelineOptions const& pipeline, string const& filename)
+{
+  return (std::filesystem::path(pipeline.output_dir) / filename).string();
 }
 
 int64_t filesize(string const& filename)
@@ -34,7 +71,11 @@ void printFileInfo(std::vector<string> const& fastqs,
     std::cout << "INFO " << type << " files:" << std::endl;
     for (unsigned int i= 0; i < fastqs.size(); i++)
     {
-      if (std::filesystem::exists(fastqs[i].c_str()))
+      // Don't stat() or fopen() a stream: opening a FIFO here would block
+      // until the producer connects, and stdin doesn't exist as a path.
+      if (isStreamingInput(fastqs[i]))
+        std::cout << "\t " << fastqs[i] << " is a stream, file size unknown" << std::endl;
+      else if (std::filesystem::exists(fastqs[i].c_str()))
       {
         std::cout << "\t " << fastqs[i]  <<  " exists, file size "
                   <<  filesize(fastqs[i])  <<  std::endl;
@@ -54,7 +95,13 @@ int64_t get_num_blocks(std::vector<string> const& I1s,
                      std::vector<string> const& R2s, 
                      std::vector<string> const& R3s, double bam_size)
 {
-  assert(R1s.size() == R2s.size());
+  assert(R2s.empty() || R1s.size() == R2s.size());
+
+  for (auto const* files : {&I1s, &R1s, &R2s, &R3s})
+    for (string const& file : *files)
+      if (isStreamingInput(file))
+        crash("ERROR: Can't size the output from streamed input " + file +
+              "; provide --num-output-files.");
 
   if (!R3s.empty())
     assert(R1s.size() == R3s.size());
@@ -68,7 +115,8 @@ int64_t get_num_blocks(std::vector<string> const& I1s,
 
     std::cout << "file " << R1s[i] << " : " << filesize(R1s[i]) << " bytes" << std::endl;
     tot_size += filesize(R1s[i]);
-    tot_size += filesize(R2s[i]);
+    if (!R2s.empty())
+      tot_size += filesize(R2s[i]);
     
     if (!R3s.empty())
       tot_size += filesize(R3s[i]);
@@ -88,6 +136,281 @@ int64_t get_num_blocks(INPUT_OPTIONS_FASTQ_READ_STRUCTURE const& options)
   return get_num_blocks(options.I1s, options.R1s, options.R2s, options.R3s, options.bam_size);
 }
 
+// getopt_long values for the long-only options filling PipelineOptions. Kept
+// above the char range so they can't collide with the short option letters.
+enum PipelineOptionCode
+{
+  kOptInterleaved = 1000,
+  kOptOutputDir,
+  kOptOutputCompressionLevel,
+  kOptSortByBarcode,
+  kOptSortMemoryMb,
+  kOptSortTempDir,
+  kOptCheckpointIntervalSec,
+  kOptResume,
+  kOptMemoryLimitMb,
+  kOptMetricsFile,
+  kOptMetricsIntervalSec,
+  kOptMetricsSummaryFile,
+  kOptInputBackend,
+  kOptInputBlockKb,
+  kOptInputQueueDepth,
+  kOptAutoThreads,
+  kOptNuma,
+  kOptQualityBinning,
+  kOptOutputTags,
+  kOptCompactReadNames,
+  kOptSampleSheet,
+  kOptI2,
+  kOptTrimTso,
+  kOptTrimAdapter,
+  kOptTrimPolyA,
+  kOptMinReadLength,
+  kOptMinReadComplexity,
+  kOptCellPrefilter,
+  kOptBarcodeTranslation,
+};
+
+// Handles the options shared by readOptionsFastqProcess() and
+// readOptionsFastqSlideseq() that fill in PipelineOptions. Returns false if
+// 'c' isn't one of them.
+bool parsePipelineOption(int c, PipelineOptions* pipeline)
+{
+  switch (c)
+  {
+  case kOptInterleaved:
+    pipeline->interleaved = true;
+    return true;
+  case kOptOutputDir:
+    pipeline->output_dir = string(optarg);
+    return true;
+  case kOptOutputCompressionLevel:
+    pipeline->output_compression_level = atoi(optarg);
+    return true;
+  case kOptSortByBarcode:
+    pipeline->sort_by_barcode = true;
+    return true;
+  case kOptSortMemoryMb:
+    pipeline->sort_memory_mb = atoll(optarg);
+    return true;
+  case kOptSortTempDir:
+    pipeline->sort_temp_dir = string(optarg);
+    return true;
+  case kOptCheckpointIntervalSec:
+    pipeline->checkpoint_interval_sec = atoi(optarg);
+    return true;
+  case kOptResume:
+    pipeline->resume = true;
+    return true;
+  case kOptMemoryLimitMb:
+    pipeline->memory_limit_mb = atoll(optarg);
+    return true;
+  case kOptMetricsFile:
+    pipeline->metrics_file = string(optarg);
+    return true;
+  case kOptMetricsIntervalSec:
+    pipeline->metrics_interval_sec = atoi(optarg);
+    return true;
+  case kOptMetricsSummaryFile:
+    pipeline->metrics_summary_file = string(optarg);
+    return true;
+  case kOptInputBackend:
+    if (string(optarg) == "default")
+      pipeline->input_backend = InputBackend::kDefault;
+    else if (string(optarg) == "mmap")
+      pipeline->input_backend = InputBackend::kMmap;
+    else if (string(optarg) == "readahead")
+      pipeline->input_backend = InputBackend::kReadahead;
+    else if (string(optarg) == "direct")
+      pipeline->input_backend = InputBackend::kDirect;
+    else
+      crash("ERROR: input-backend must be one of default, mmap, readahead or direct.");
+    return true;
+  case kOptInputBlockKb:
+    pipeline->input_block_kb = atoll(optarg);
+    return true;
+  case kOptInputQueueDepth:
+    pipeline->input_queue_depth = atoi(optarg);
+    return true;
+  case kOptAutoThreads:
+    pipeline->auto_threads = true;
+    return true;
+  case kOptNuma:
+    pipeline->numa = true;
+    return true;
+  case kOptQualityBinning:
+    pipeline->quality_binning = string(optarg);
+    return true;
+  case kOptOutputTags:
+    pipeline->output_tags = string(optarg);
+    return true;
+  case kOptCompactReadNames:
+    pipeline->compact_read_names = true;
+    return true;
+  case kOptSampleSheet:
+    pipeline->sample_sheet = string(optarg);
+    return true;
+  case kOptI2:
+    pipeline->I2s.push_back(string(optarg));
+    return true;
+  case kOptTrimTso:
+    pipeline->trim_tso = string(optarg);
+    return true;
+  case kOptTrimAdapter:
+    pipeline->trim_adapter = string(optarg);
+    return true;
+  case kOptTrimPolyA:
+    pipeline->trim_poly_a = atoi(optarg);
+    return true;
+  case kOptMinReadLength:
+    pipeline->min_read_length = atoi(optarg);
+    return true;
+  case kOptMinReadComplexity:
+    pipeline->min_read_complexity = atof(optarg);
+    return true;
+  case kOptCellPrefilter:
+    pipeline->cell_prefilter = string(optarg);
+    return true;
+  case kOptBarcodeTranslation:
+    pipeline->barcode_translation = string(optarg);
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Checks on the input file lists shared by fastqprocess and fastq_slideseq.
+void validateInputFiles(std::vector<string> const& I1s, std::vector<string> const& R1s,
+                        std::vector<string> const& R2s, std::vector<string> const& R3s,
+                        PipelineOptions const& pipeline)
+{
+  if (pipeline.interleaved)
+  {
+    if (!R2s.empty())
+      crash("ERROR: --interleaved reads R2 from the R1 inputs; don't provide --R2.");
+  }
+  else if ((R1s.size() != R2s.size()))
+  {
+    crash("ERROR: Unequal number of R1 and R2 fastq files in input: R1: " +
+          std::to_string(R1s.size()) + ", R2: " + std::to_string(R2s.size()));
+  }
+
+  if (R1s.empty())
+    crash("ERROR: No R1 file provided");
+
+  if (I1s.size() != R1s.size() && !I1s.empty())
+    crash("ERROR: Must provide as many I1 input files as R1 input files, or else no I1 input files at all.");
+
+  if (R3s.size() != R1s.size() && !R3s.empty())
+    crash("ERROR: Must provide as many R3 input files as R1 input files.");
+
+  if (!pipeline.sample_sheet.empty() && I1s.empty())
+    crash("ERROR: sample-sheet demultiplexes by the I1 index reads; provide --I1.");
+
+  if (!pipeline.I2s.empty() && (pipeline.sample_sheet.empty() || pipeline.I2s.size() != R1s.size()))
+    crash("ERROR: I2 input files are only read for a sample-sheet, one per R1 input file.");
+
+  // Each reader thread opens its own inputs, so stdin can feed only one of them.
+  int num_stdin = 0;
+  for (auto const* files : {&I1s, &pipeline.I2s, &R1s, &R2s, &R3s})
+    for (string const& file : *files)
+      if (file == "-" || file == "-.gz")
+        num_stdin++;
+  if (num_stdin > 1)
+    crash("ERROR: stdin (-) can be given as at most one input file.");
+
+  // Both resuming and the cell-prefilter first pass read the inputs again.
+  if (!pipeline.cell_prefilter.empty())
+    for (string const& file : R1s)
+      if (isStreamingInput(file))
+        crash("ERROR: --cell-prefilter reads the R1 inputs twice, so they can't be stdin or FIFOs: " + file);
+  if (pipeline.resume)
+    for (auto const* files : {&I1s, &pipeline.I2s, &R1s, &R2s, &R3s})
+      for (string const& file : *files)
+        if (isStreamingInput(file))
+          crash("ERROR: --resume needs to reread the inputs, so they can't be stdin or FIFOs: " + file);
+}
+
+// Checks on PipelineOptions that depend on the other options.
+void validatePipelineOptions(PipelineOptions const& pipeline, string const& output_format)
+{
+  if (!std::filesystem::is_directory(pipeline.output_dir))
+    crash("ERROR: output-dir " + pipeline.output_dir + " is not a directory.");
+
+  if (pipeline.output_compression_level < -1 || pipeline.output_compression_level > 9)
+    crash("ERROR: output-compression-level must be between -1 and 9.");
+
+  // libStatGen always writes BAM at its default BGZF level; it can only skip
+  // compression altogether.
+  if (output_format == "BAM" && pipeline.output_compression_level > 0)
+    crash("ERROR: BAM output supports only output-compression-level 0 (uncompressed) or -1 (default).");
+
+  if (pipeline.sort_memory_mb <= 0)
+    crash("ERROR: sort-memory-mb must be positive.");
+
+  if (!pipeline.sort_temp_dir.empty() && !std::filesystem::is_directory(pipeline.sort_temp_dir))
+    crash("ERROR: sort-temp-dir " + pipeline.sort_temp_dir + " is not a directory.");
+
+  if (pipeline.memory_limit_mb < 0)
+    crash("ERROR: memory-limit-mb must not be negative.");
+
+  // O_DIRECT needs block-aligned reads.
+  if (pipeline.input_block_kb <= 0 || pipeline.input_block_kb % 4 != 0)
+    crash("ERROR: input-block-kb must be a positive multiple of 4.");
+
+  if (pipeline.input_queue_depth <= 0)
+    crash("ERROR: input-queue-depth must be positive.");
+
+  if (pipeline.metrics_interval_sec <= 0)
+    crash("ERROR: metrics-interval-sec must be positive.");
+
+  if (pipeline.checkpoint_interval_sec < 0)
+    crash("ERROR: checkpoint-interval-sec must not be negative.");
+
+  if (!pipeline.quality_binning.empty() && pipeline.quality_binning != "illumina8" &&
+      !std::filesystem::is_regular_file(pipeline.quality_binning))
+  {
+    crash("ERROR: quality-binning must be illumina8 or the path of a binning table.");
+  }
+
+  // Crashes on unknown tags.
+  if (!pipeline.output_tags.empty())
+    OutputTagSet::parse(pipeline.output_tags);
+
+  // Crashes on malformed sheets.
+  if (!pipeline.sample_sheet.empty())
+  {
+    SampleSheet sheet = readSampleSheet(pipeline.sample_sheet);
+    if (!sheet.rows.front().index2.empty() && pipeline.I2s.empty())
+      crash("ERROR: sample-sheet " + pipeline.sample_sheet + " has dual indexes; provide --I2.");
+  }
+
+  // Crashes on malformed specs.
+  if (!pipeline.cell_prefilter.empty())
+    CellPrefilterSpec::parse(pipeline.cell_prefilter);
+
+  // Barcodes aren't kept apart by sample, so a cell of one would let the
+  // same barcode through in all of them.
+  if (!pipeline.cell_prefilter.empty() && !pipeline.sample_sheet.empty())
+    crash("ERROR: cell-prefilter can't be combined with sample-sheet.");
+
+  for (string const* oligo : {&pipeline.trim_tso, &pipeline.trim_adapter})
+    if (oligo->find_first_not_of("ACGTN") != string::npos)
+      crash("ERROR: trim-tso and trim-adapter must be DNA sequences.");
+
+  if (pipeline.trim_poly_a < 0 || pipeline.min_read_length < 0 ||
+      pipeline.min_read_complexity < 0 || pipeline.min_read_complexity > 1)
+  {
+    crash("ERROR: trim-poly-a and min-read-length must not be negative, and min-read-complexity "
+          "must be between 0 and 1.");
+  }
+
+  // A sorted shard is only written once all its input is in, so there's no
+  // partial output to checkpoint.
+  if (pipeline.sort_by_barcode && (pipeline.checkpoint_interval_sec > 0 || pipeline.resume))
+    crash("ERROR: sort-by-barcode can't be combined with checkpoint-interval-sec or resume.");
+}
+
 InputOptionsFastqProcess readOptionsFastqProcess(int argc, char** argv)
 {
   InputOptionsFastqProcess options;
@@ -113,6 +436,35 @@ InputOptionsFastqProcess readOptionsFastqProcess(int argc, char** argv)
     {"sample_bool",         required_argument, 0, 'D'},
     {"white-list",          required_argument, 0, 'w'},
     {"output-format",       required_argument, 0, 'F'},
+    {"interleaved",         no_argument,       0, kOptInterleaved},
+    {"output-dir",          required_argument, 0, kOptOutputDir},
+    {"output-compression-level", required_argument, 0, kOptOutputCompressionLevel},
+    {"sort-by-barcode",     no_argument,       0, kOptSortByBarcode},
+    {"sort-memory-mb",      required_argument, 0, kOptSortMemoryMb},
+    {"sort-temp-dir",       required_argument, 0, kOptSortTempDir},
+    {"checkpoint-interval-sec", required_argument, 0, kOptCheckpointIntervalSec},
+    {"resume",              no_argument,       0, kOptResume},
+    {"memory-limit-mb",     required_argument, 0, kOptMemoryLimitMb},
+    {"metrics-file",        required_argument, 0, kOptMetricsFile},
+    {"metrics-interval-sec", required_argument, 0, kOptMetricsIntervalSec},
+    {"metrics-summary-file", required_argument, 0, kOptMetricsSummaryFile},
+    {"input-backend",       required_argument, 0, kOptInputBackend},
+    {"input-block-kb",      required_argument, 0, kOptInputBlockKb},
+    {"input-queue-depth",   required_argument, 0, kOptInputQueueDepth},
+    {"auto-threads",        no_argument,       0, kOptAutoThreads},
+    {"numa",                no_argument,       0, kOptNuma},
+    {"quality-binning",     required_argument, 0, kOptQualityBinning},
+    {"output-tags",         required_argument, 0, kOptOutputTags},
+    {"compact-read-names",  no_argument,       0, kOptCompactReadNames},
+    {"sample-sheet",        required_argument, 0, kOptSampleSheet},
+    {"I2",                  required_argument, 0, kOptI2},
+    {"trim-tso",            required_argument, 0, kOptTrimTso},
+    {"trim-adapter",        required_argument, 0, kOptTrimAdapter},
+    {"trim-poly-a",         required_argument, 0, kOptTrimPolyA},
+    {"min-read-length",     required_argument, 0, kOptMinReadLength},
+    {"min-read-complexity", required_argument, 0, kOptMinReadComplexity},
+    {"cell-prefilter",      required_argument, 0, kOptCellPrefilter},
+    {"barcode-translation", required_argument, 0, kOptBarcodeTranslation},
     {0, 0, 0, 0}
   };
 
@@ -132,6 +484,35 @@ InputOptionsFastqProcess readOptionsFastqProcess(int argc, char** argv)
     "sample_bool [optional: default false. When set to false, all barcodes (valid + invalid) are printed. If set to true, only valid barcodes are printed.]",
     "whitelist (from cellranger) of barcodes [required]",
     "output-format : either FASTQ or BAM [required]",
+    "interleaved [optional: each R1 input holds R1 and R2 records alternating; no R2 inputs]",
+    "output-dir [optional: default current directory. Existing FIFOs named like the output shards are streamed to]",
+    "output-compression-level [optional: default -1 (default compression). 0 writes uncompressed shards, 1-9 sets the FASTQ gzip level]",
+    "sort-by-barcode [optional: write each shard grouped and sorted by corrected barcode, then UMI]",
+    "sort-memory-mb [optional: default 1024. Memory for sort-by-barcode, split across all shards]",
+    "sort-temp-dir [optional: default output-dir. Where sort-by-barcode spills sorted runs]",
+    "checkpoint-interval-sec [optional: default 0 (off). How often to record progress in output-dir for --resume]",
+    "resume [optional: continue from the checkpoint in output-dir, if there is one]",
+    "memory-limit-mb [optional: default 0 (no limit). Sizes the read buffers and sort-by-barcode memory to fit]",
+    "metrics-file [optional: append JSON lines of throughput and backpressure metrics here]",
+    "metrics-interval-sec [optional: default 10. How often to write to metrics-file]",
+    "metrics-summary-file [optional: write the metrics of the whole run here, as JSON, at the end]",
+    "input-backend [optional: default, mmap, readahead or direct. How input files are read]",
+    "input-block-kb [optional: default 4096. Read size of the non-default input backends]",
+    "input-queue-depth [optional: default 8. Blocks the non-default input backends read ahead]",
+    "auto-threads [optional: limit how many readers run at once to balance reading against writing on the available cores; needs several R1 inputs]",
+    "numa [optional: on multi-socket hosts, pin readers and writers to NUMA nodes and keep their buffers node-local]",
+    "quality-binning [optional: illumina8, or a file of 'low high score' lines. Bins all output quality scores]",
+    "output-tags [optional: default all. Comma-separated tags to add from S1,Q1,CR,CY,UR,UY,SR,SY,S3,Q3]",
+    "compact-read-names [optional: name reads <reader>:<number>, writing the original names to read_names_<reader>.tsv(.gz)]",
+    "sample-sheet [optional: file of 'sample index1 [index2]' lines. Demultiplexes reads by I1 (and I2) into a subdirectory per sample]",
+    "I2 [optional: second index reads, one per R1, for a dual-index sample-sheet]",
+    "trim-tso [optional: template switch oligo to trim, with what precedes it, from the 5' end of the cDNA read]",
+    "trim-adapter [optional: adapter to trim, with what follows it, from the 3' end of the cDNA read]",
+    "trim-poly-a [optional: default 0 (off). Trim a trailing poly-A run at least this long from the cDNA read]",
+    "min-read-length [optional: default 1. Drop reads whose cDNA read is shorter than this after trimming]",
+    "min-read-complexity [optional: default 0. Drop reads whose cDNA read has fewer base changes than this fraction, e.g. 0.3]",
+    "cell-prefilter [optional: knee, top:<N> or min-reads:<N>. Count reads per barcode first, then write only the chosen cells' reads]",
+    "barcode-translation [optional: file of <whitelist barcode> <translated barcode> lines, e.g. multiome ATAC to GEX. Corrected barcodes (CB) are written translated]",
   };
 
 
@@ -209,24 +590,12 @@ InputOptionsFastqProcess readOptionsFastqProcess(int argc, char** argv)
       /* getopt_long already printed an error message. */
       return options;
     default:
-      abort();
+      if (!parsePipelineOption(c, &options.pipeline))
+        abort();
     }
   }
 
-  if ((options.R1s.size() != options.R2s.size()))
-  {
-    crash("ERROR: Unequal number of R1 and R2 fastq files in input: R1: " +
-          std::to_string(options.R1s.size()) + ", R2: " + std::to_string(options.R2s.size()));
-  }
-
-  if (options.R1s.empty())
-    crash("ERROR: No R1 file provided");
-
-  if (options.I1s.size() != options.R1s.size() && !options.I1s.empty())
-    crash("ERROR: Must provide as many I1 input files as R1 input files, or else no I1 input files at all.");
-
-  if (options.R3s.size() != options.R1s.size() && !options.R3s.empty())
-    crash("ERROR: Must provide as many R3 input files as R1 input files.");
+  validateInputFiles(options.I1s, options.R1s, options.R2s, options.R3s, options.pipeline);
 
   if (options.bam_size <= 0)
     crash("ERROR: Size of a bam file (in GB) cannot be negative or 0.");
@@ -243,6 +612,8 @@ InputOptionsFastqProcess readOptionsFastqProcess(int argc, char** argv)
   if (options.output_format!="FASTQ" && options.output_format!="BAM")
     crash("ERROR: output-format must be either FASTQ or BAM");
 
+  validatePipelineOptions(options.pipeline, options.output_format);
+
   if (verbose_flag)
   {
     if (!options.I1s.empty())
@@ -283,6 +654,35 @@ INPUT_OPTIONS_FASTQ_READ_STRUCTURE readOptionsFastqSlideseq(int argc, char** arg
     {"sample_bool",         required_argument, 0, 'D'},
     {"white-list",          required_argument, 0, 'w'},
     {"output-format",       required_argument, 0, 'F'},
+    {"interleaved",         no_argument,       0, kOptInterleaved},
+    {"output-dir",          required_argument, 0, kOptOutputDir},
+    {"output-compression-level", required_argument, 0, kOptOutputCompressionLevel},
+    {"sort-by-barcode",     no_argument,       0, kOptSortByBarcode},
+    {"sort-memory-mb",      required_argument, 0, kOptSortMemoryMb},
+    {"sort-temp-dir",       required_argument, 0, kOptSortTempDir},
+    {"checkpoint-interval-sec", required_argument, 0, kOptCheckpointIntervalSec},
+    {"resume",              no_argument,       0, kOptResume},
+    {"memory-limit-mb",     required_argument, 0, kOptMemoryLimitMb},
+    {"metrics-file",        required_argument, 0, kOptMetricsFile},
+    {"metrics-interval-sec", required_argument, 0, kOptMetricsIntervalSec},
+    {"metrics-summary-file", required_argument, 0, kOptMetricsSummaryFile},
+    {"input-backend",       required_argument, 0, kOptInputBackend},
+    {"input-block-kb",      required_argument, 0, kOptInputBlockKb},
+    {"input-queue-depth",   required_argument, 0, kOptInputQueueDepth},
+    {"auto-threads",        no_argument,       0, kOptAutoThreads},
+    {"numa",                no_argument,       0, kOptNuma},
+    {"quality-binning",     required_argument, 0, kOptQualityBinning},
+    {"output-tags",         required_argument, 0, kOptOutputTags},
+    {"compact-read-names",  no_argument,       0, kOptCompactReadNames},
+    {"sample-sheet",        required_argument, 0, kOptSampleSheet},
+    {"I2",                  required_argument, 0, kOptI2},
+    {"trim-tso",            required_argument, 0, kOptTrimTso},
+    {"trim-adapter",        required_argument, 0, kOptTrimAdapter},
+    {"trim-poly-a",         required_argument, 0, kOptTrimPolyA},
+    {"min-read-length",     required_argument, 0, kOptMinReadLength},
+    {"min-read-complexity", required_argument, 0, kOptMinReadComplexity},
+    {"cell-prefilter",      required_argument, 0, kOptCellPrefilter},
+    {"barcode-translation", required_argument, 0, kOptBarcodeTranslation},
     {0, 0, 0, 0}
   };
 
@@ -302,6 +702,35 @@ INPUT_OPTIONS_FASTQ_READ_STRUCTURE readOptionsFastqSlideseq(int argc, char** arg
     "sample_bool [optional: default false. When set to false, all barcodes (valid + invalid) are printed. If set to true, only valid barcodes are printed.]",
     "whitelist (from cellranger) of barcodes [required]",
     "output-format : either FASTQ or BAM [required]",
+    "interleaved [optional: each R1 input holds R1 and R2 records alternating; no R2 inputs]",
+    "output-dir [optional: default current directory. Existing FIFOs named like the output shards are streamed to]",
+    "output-compression-level [optional: default -1 (default compression). 0 writes uncompressed shards, 1-9 sets the FASTQ gzip level]",
+    "sort-by-barcode [optional: write each shard grouped and sorted by corrected barcode, then UMI]",
+    "sort-memory-mb [optional: default 1024. Memory for sort-by-barcode, split across all shards]",
+    "sort-temp-dir [optional: default output-dir. Where sort-by-barcode spills sorted runs]",
+    "checkpoint-interval-sec [optional: default 0 (off). How often to record progress in output-dir for --resume]",
+    "resume [optional: continue from the checkpoint in output-dir, if there is one]",
+    "memory-limit-mb [optional: default 0 (no limit). Sizes the read buffers and sort-by-barcode memory to fit]",
+    "metrics-file [optional: append JSON lines of throughput and backpressure metrics here]",
+    "metrics-interval-sec [optional: default 10. How often to write to metrics-file]",
+    "metrics-summary-file [optional: write the metrics of the whole run here, as JSON, at the end]",
+    "input-backend [optional: default, mmap, readahead or direct. How input files are read]",
+    "input-block-kb [optional: default 4096. Read size of the non-default input backends]",
+    "input-queue-depth [optional: default 8. Blocks the non-default input backends read ahead]",
+    "auto-threads [optional: limit how many readers run at once to balance reading against writing on the available cores; needs several R1 inputs]",
+    "numa [optional: on multi-socket hosts, pin readers and writers to NUMA nodes and keep their buffers node-local]",
+    "quality-binning [optional: illumina8, or a file of 'low high score' lines. Bins all output quality scores]",
+    "output-tags [optional: default all. Comma-separated tags to add from S1,Q1,CR,CY,UR,UY,SR,SY,S3,Q3]",
+    "compact-read-names [optional: name reads <reader>:<number>, writing the original names to read_names_<reader>.tsv(.gz)]",
+    "sample-sheet [optional: file of 'sample index1 [index2]' lines. Demultiplexes reads by I1 (and I2) into a subdirectory per sample]",
+    "I2 [optional: second index reads, one per R1, for a dual-index sample-sheet]",
+    "trim-tso [optional: template switch oligo to trim, with what precedes it, from the 5' end of the cDNA read]",
+    "trim-adapter [optional: adapter to trim, with what follows it, from the 3' end of the cDNA read]",
+    "trim-poly-a [optional: default 0 (off). Trim a trailing poly-A run at least this long from the cDNA read]",
+    "min-read-length [optional: default 1. Drop reads whose cDNA read is shorter than this after trimming]",
+    "min-read-complexity [optional: default 0. Drop reads whose cDNA read has fewer base changes than this fraction, e.g. 0.3]",
+    "cell-prefilter [optional: knee, top:<N> or min-reads:<N>. Count reads per barcode first, then write only the chosen cells' reads]",
+    "barcode-translation [optional: file of <whitelist barcode> <translated barcode> lines, e.g. multiome ATAC to GEX. Corrected barcodes (CB) are written translated]",
   };
 
 
@@ -378,24 +807,12 @@ INPUT_OPTIONS_FASTQ_READ_STRUCTURE readOptionsFastqSlideseq(int argc, char** arg
       /* getopt_long already printed an error message. */
       return options;
     default:
-      abort();
+      if (!parsePipelineOption(c, &options.pipeline))
+        abort();
     }
   }
 
-  if ((options.R1s.size() != options.R2s.size()))
-  {
-    crash("ERROR: Unequal number of R1 and R2 fastq files in input: R1: " +
-          std::to_string(options.R1s.size()) + ", R2: " + std::to_string(options.R2s.size()));
-  }
-
-  if (options.R1s.empty())
-    crash("ERROR: No R1 file provided");
-
-  if (options.I1s.size() != options.R1s.size() && !options.I1s.empty())
-    crash("ERROR: Must provide as many I1 input files as R1 input files, or else no I1 input files at all.");
-
-  if (options.R3s.size() != options.R1s.size() && !options.R3s.empty())
-    crash("ERROR: Must provide as many R3 input files as R1 input files.");
+  validateInputFiles(options.I1s, options.R1s, options.R2s, options.R3s, options.pipeline);
 
   if (options.bam_size <= 0)
     crash("ERROR: Size of a bam file (in GB) cannot be negative or 0.");
@@ -409,6 +826,8 @@ INPUT_OPTIONS_FASTQ_READ_STRUCTURE readOptionsFastqSlideseq(int argc, char** arg
   if (options.output_format!="FASTQ" && options.output_format!="BAM")
     crash("ERROR: output-format must be either FASTQ or BAM");
 
+  validatePipelineOptions(options.pipeline, options.output_format);
+
   if (options.read_structure.empty())
     crash("ERROR: Must provide read structures");
 
@@ -443,6 +862,9 @@ INPUT_OPTIONS_FASTQ_READ_STRUCTURE readOptionsFastqMetrics(int argc, char** argv
     {"sample-id",         required_argument, 0, 's'},
     {"R1",                required_argument, 0, 'R'},
     {"white-list",        required_argument, 0, 'w'},
+    {"threads",           required_argument, 0, 't'},
+    {"approximate-memory-mb", required_argument, 0, 'a'},
+    {"save-state",        required_argument, 0, 'o'},
     {0, 0, 0, 0}
   };
 
@@ -454,13 +876,16 @@ INPUT_OPTIONS_FASTQ_READ_STRUCTURE readOptionsFastqMetrics(int argc, char** argv
     "sample id [required]",
     "R1 [required]",
     "whitelist of cell/bead barcodes [required]",
+    "threads [optional: default one per core. Threads decompressing the R1s, and as many counting them]",
+    "approximate-memory-mb [optional: count only the most frequent barcodes and UMIs, approximately, in about this much memory]",
+    "save-state [optional: also save the counts to this file, to be added to other runs' by `fastq_metrics merge`]",
   };
 
 
   /* getopt_long stores the option index here. */
   int option_index = 0;
   while ((c = getopt_long(argc, argv,
-                          "S:s:R:w:v",
+                          "S:s:R:w:t:a:o:v",
                           long_options,
                           &option_index)) !=- 1
         )
@@ -492,6 +917,15 @@ INPUT_OPTIONS_FASTQ_READ_STRUCTURE readOptionsFastqMetrics(int argc, char** argv
     case 'w':
       options.white_list_file = string(optarg);
       break;
+    case 't':
+      options.num_threads = atoi(optarg);
+      break;
+    case 'a':
+      options.approximate_memory_mb = atoi(optarg);
+      break;
+    case 'o':
+      options.save_state = string(optarg);
+      break;
     case '?':
     case 'h':
       i = 0;
@@ -520,8 +954,88 @@ INPUT_OPTIONS_FASTQ_READ_STRUCTURE readOptionsFastqMetrics(int argc, char** argv
   if (options.sample_id.empty())
     crash("ERROR: Must provide a sample id or name");
 
+  if (options.num_threads < 0)
+    crash("ERROR: threads must not be negative.");
+
+  if (options.approximate_memory_mb < 0)
+    crash("ERROR: approximate-memory-mb must not be negative.");
+
   if (verbose_flag && !options.R1s.empty())
     printFileInfo(options.R1s, string("R1"));
 
   return options;
 }
+
+INPUT_OPTIONS_FASTQ_READ_STRUCTURE readOptionsFastqMetricsMerge(int argc, char** argv)
+{
+  INPUT_OPTIONS_FASTQ_READ_STRUCTURE options;
+  int c;
+  int i;
+
+  static struct option long_options[] =
+  {
+    {"sample-id",         required_argument, 0, 's'},
+    {"threads",           required_argument, 0, 't'},
+    {"save-state",        required_argument, 0, 'o'},
+    {0, 0, 0, 0}
+  };
+
+  // help messages when the user types -h
+  const char* help_messages[] =
+  {
+    "sample id [required]",
+    "threads [optional: default one per core. Threads loading the state files, and merging them]",
+    "save-state [optional: also save the merged counts to this file]",
+  };
+
+  /* getopt_long stores the option index here. */
+  int option_index = 0;
+  while ((c = getopt_long(argc, argv,
+                          "s:t:o:",
+                          long_options,
+                          &option_index)) !=- 1
+        )
+  {
+    // process the option or arguments
+    switch (c)
+    {
+    case 's':
+      options.sample_id = string(optarg);
+      break;
+    case 't':
+      options.num_threads = atoi(optarg);
+      break;
+    case 'o':
+      options.save_state = string(optarg);
+      break;
+    case '?':
+    case 'h':
+      i = 0;
+      printf("Usage: %s [options] <state files from --save-state>\n", argv[0]);
+      while (long_options[i].name != 0)
+      {
+        printf("\t--%-20s  %-25s  %-35s\n", long_options[i].name,
+               long_options[i].has_arg == no_argument?
+               "no argument" : "required_argument",
+               help_messages[i]);
+        i = i + 1;
+      }
+      /* getopt_long already printed an error message. */
+      return options;
+    default:
+      abort();
+    }
+  }
+  options.state_files.assign(argv + optind, argv + argc);
+
+  if (options.state_files.empty())
+    crash("ERROR: No state files provided");
+
+  if (options.sample_id.empty())
+    crash("ERROR: Must provide a sample id or name");
+
+  if (options.num_threads < 0)
+    crash("ERROR: threads must not be negative.");
+
+  return options;
+}
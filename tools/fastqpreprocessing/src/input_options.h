@@ -1,11 +1,144 @@
 #ifndef __SCTOOLS_FASTQPREPROCESSING_INPUT_OPTIONS_H_
 #define __SCTOOLS_FASTQPREPROCESSING_INPUT_OPTIONS_H_
 
+#include <cstdint>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
+// Prints msg and exits 1, without destroying static objects (such as queues
+// other threads may still be waiting on); or, on a thread with a CrashThrows
+// in scope, throws CrashError(msg).
 void crash(std::string msg);
 
+// For a helper thread's errors to be reported by whichever thread waits on
+// its result: that thread catches the CrashError and crash()es with it.
+class CrashError : public std::runtime_error
+{
+public:
+  using std::runtime_error::runtime_error;
+};
+class CrashThrows
+{
+public:
+  CrashThrows();
+  ~CrashThrows();
+
+private:
+  bool was_throwing_;
+};
+
+// How reader threads get their input bytes; see input_backend.h.
+enum class InputBackend
+{
+  kDefault,   // libStatGen opens and reads the file itself
+  kMmap,      // a helper thread maps the file and feeds it through a pipe
+  kReadahead, // a helper thread reads large blocks, keeping more requested ahead
+  kDirect,    // like kReadahead, but with O_DIRECT reads bypassing the page cache
+};
+
+// Options shared by fastqprocess, fastq_slideseq and samplefastq that tune how
+// mainCommon() moves reads from the input files to the output shards. The
+// defaults reproduce the original behavior.
+struct PipelineOptions
+{
+  // Each R1 input holds R1 and R2 records alternating (R1 first), and no R2
+  // inputs are given. Lets a single FIFO or stdin carry both reads.
+  bool interleaved = false;
+
+  // Directory the output shards are written to. A shard path that already
+  // exists there as a FIFO is written to as a stream, e.g. for an aligner to
+  // consume directly as the shard is produced.
+  std::string output_dir = ".";
+
+  // 0 = uncompressed (FASTQ shards are then named .fastq, BAM shards .ubam),
+  // 1-9 = gzip level for FASTQ shards, -1 = the default compression.
+  int output_compression_level = -1;
+
+  // Write each shard grouped and sorted by corrected barcode (CB), then UMI,
+  // instead of in arrival order. Uses up to sort_memory_mb in total across all
+  // shards, spilling sorted runs to sort_temp_dir (default: output_dir).
+  bool sort_by_barcode = false;
+  int64_t sort_memory_mb = 1024;
+  std::string sort_temp_dir;
+
+  // Every checkpoint_interval_sec (0 = never), sync the output shards and
+  // record in output_dir how far each input has been read, so that a killed
+  // run can be continued with resume instead of starting over.
+  int checkpoint_interval_sec = 0;
+  bool resume = false;
+
+  // Upper bound for the memory of the whole run (0 = none): the whitelist,
+  // output buffers, reader arenas (and with them the write queues) and sort
+  // buffers are sized to fit in it. See memory_budget.h.
+  int64_t memory_limit_mb = 0;
+
+  // If set, every metrics_interval_sec a JSON line of per-reader and per-shard
+  // throughput, blocked time and queue depth is appended to metrics_file.
+  // metrics_summary_file gets the same for the whole run at the end.
+  std::string metrics_file;
+  int metrics_interval_sec = 10;
+  std::string metrics_summary_file;
+
+  // Non-default backends read each regular input file in input_block_kb
+  // blocks, with input_queue_depth blocks requested ahead of the one being
+  // consumed.
+  InputBackend input_backend = InputBackend::kDefault;
+  int64_t input_block_kb = 4096;
+  int input_queue_depth = 8;
+
+  // If set, how many reader threads run at once is planned from the available
+  // cores and the relative cost of reading and writing, and adjusted while
+  // running from how long each side waits on the other.
+  bool auto_threads = false;
+
+  // If set, reader and writer threads are pinned to NUMA nodes, and allocate
+  // their buffers there; see numa_placement.h.
+  bool numa = false;
+
+  // If set ("illumina8" or a table file), every quality string in the output
+  // is binned; see quality_binning.h.
+  std::string quality_binning;
+
+  // If set, the comma-separated optional tags to add to each record (see
+  // output_schema.h); tags the chosen output needs are added regardless.
+  std::string output_tags;
+  // If set, reads are renamed <reader>:<number>, and each reader writes the
+  // original names to a read_names_<reader> sidecar file.
+  bool compact_read_names = false;
+
+  // If set, reads are demultiplexed by their I1 (and I2s, one per R1) index
+  // reads into a set of output shards per sample of the sheet, each in its own
+  // subdirectory of output_dir; see sample_demux.h.
+  std::string sample_sheet;
+  std::vector<std::string> I2s;
+
+  // Trimming of the cDNA read and dropping of reads left too short or too
+  // repetitive; see read_trimmer.h.
+  std::string trim_tso;
+  std::string trim_adapter;
+  int trim_poly_a = 0;
+  int min_read_length = 0;
+  double min_read_complexity = 0;
+
+  // If set, a first pass over the barcode reads counts reads per corrected
+  // barcode, and only the reads of the cells it picks are written; see
+  // cell_prefilter.h.
+  std::string cell_prefilter;
+
+  // If set, a table translating whitelist barcodes to the barcodes they're
+  // reported as (e.g. multiome ATAC to GEX), applied as barcodes are
+  // corrected; see readBarcodeTranslationFile().
+  std::string barcode_translation;
+};
+
+// Path of the output file 'filename' inside pipeline.output_dir.
+std::string outputPath(PipelineOptions const& pipeline, std::string const& filename);
+
+// True for inputs that can only be read once, front to back: "-" (stdin) and
+// FIFOs/character devices. Their size can't be known up front.
+bool isStreamingInput(std::string const& path);
+
 struct INPUT_OPTIONS_FASTQ_READ_STRUCTURE
 {
   // I1, R1 and R2 files name
@@ -31,6 +164,22 @@ struct INPUT_OPTIONS_FASTQ_READ_STRUCTURE
 
   // if set to false we print out all valid/invalid barcodes.
   bool sample_bool = false;
+
+  // fastq_metrics' threads (of each kind: reading the R1s and counting them);
+  // 0 for one per core.
+  int num_threads = 0;
+
+  // If set, fastq_metrics counts barcodes and UMIs approximately in about
+  // this much memory; see approximate_counts.h.
+  int approximate_memory_mb = 0;
+
+  // If set, fastq_metrics also saves its counts here, for `fastq_metrics merge`.
+  std::string save_state;
+
+  // The --save-state files `fastq_metrics merge` adds up.
+  std::vector<std::string> state_files;
+
+  PipelineOptions pipeline;
 };
 
 // Structure to hold input options for fastqprocess
@@ -59,6 +208,8 @@ struct InputOptionsFastqProcess
 
   // if set to false we print out all valid/invalid barcodes.
   bool sample_bool = false; 
+
+  PipelineOptions pipeline;
 };
 
 InputOptionsFastqProcess readOptionsFastqProcess(int argc, char** argv);
@@ -67,6 +218,9 @@ INPUT_OPTIONS_FASTQ_READ_STRUCTURE readOptionsFastqSlideseq(int argc, char** arg
 
 INPUT_OPTIONS_FASTQ_READ_STRUCTURE readOptionsFastqMetrics(int argc, char** argv);
 
+// `fastq_metrics merge [options] <state files>`, argv[0] being "merge".
+INPUT_OPTIONS_FASTQ_READ_STRUCTURE readOptionsFastqMetricsMerge(int argc, char** argv);
+
 int64_t get_num_blocks(InputOptionsFastqProcess const& options);
 int64_t get_num_blocks(INPUT_OPTIONS_FASTQ_READ_STRUCTURE const& options);
 
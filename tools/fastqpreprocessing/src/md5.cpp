@@ -0,0 +1,154 @@
+#include "md5.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include "input_options.h"
+
+namespace
+{
+constexpr uint32_t kSines[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+constexpr int kShifts[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5, 9,  14, 20, 5, 9,  14, 20, 5, 9,  14, 20, 5, 9,  14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};
+
+uint32_t rotateLeft(uint32_t x, int n)
+{
+  return (x << n) | (x >> (32 - n));
+}
+} // namespace
+
+void Md5::reset()
+{
+  state_[0] = 0x67452301;
+  state_[1] = 0xefcdab89;
+  state_[2] = 0x98badcfe;
+  state_[3] = 0x10325476;
+  total_bytes_ = 0;
+}
+
+void Md5::transform(const uint8_t block[64])
+{
+  uint32_t words[16];
+  for (int i = 0; i < 16; i++)
+    words[i] = block[i * 4] | (block[i * 4 + 1] << 8) | (block[i * 4 + 2] << 16) |
+               (static_cast<uint32_t>(block[i * 4 + 3]) << 24);
+
+  uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+  for (int i = 0; i < 64; i++)
+  {
+    uint32_t f;
+    int g;
+    if (i < 16)
+    {
+      f = (b & c) | (~b & d);
+      g = i;
+    }
+    else if (i < 32)
+    {
+      f = (d & b) | (~d & c);
+      g = (5 * i + 1) % 16;
+    }
+    else if (i < 48)
+    {
+      f = b ^ c ^ d;
+      g = (3 * i + 5) % 16;
+    }
+    else
+    {
+      f = c ^ (b | ~d);
+      g = (7 * i) % 16;
+    }
+    uint32_t rotated = b + rotateLeft(a + f + kSines[i] + words[g], kShifts[i]);
+    a = d;
+    d = c;
+    c = b;
+    b = rotated;
+  }
+  state_[0] += a;
+  state_[1] += b;
+  state_[2] += c;
+  state_[3] += d;
+}
+
+void Md5::update(const void* data, size_t len)
+{
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  size_t buffered = total_bytes_ % 64;
+  total_bytes_ += len;
+  if (buffered > 0)
+  {
+    size_t fill = std::min(len, 64 - buffered);
+    memcpy(buffer_ + buffered, bytes, fill);
+    bytes += fill;
+    len -= fill;
+    if (buffered + fill < 64)
+      return;
+    transform(buffer_);
+  }
+  for (; len >= 64; bytes += 64, len -= 64)
+    transform(bytes);
+  memcpy(buffer_, bytes, len);
+}
+
+std::string Md5::hexDigest()
+{
+  uint64_t bit_length = total_bytes_ * 8;
+  uint8_t padding[72] = {0x80};
+  size_t buffered = total_bytes_ % 64;
+  update(padding, buffered < 56 ? 56 - buffered : 120 - buffered);
+  uint8_t length[8];
+  for (int i = 0; i < 8; i++)
+    length[i] = bit_length >> (8 * i);
+  update(length, 8);
+
+  std::string hex;
+  for (uint32_t word : state_)
+    for (int i = 0; i < 4; i++)
+    {
+      char byte[3];
+      snprintf(byte, sizeof(byte), "%02x", (word >> (8 * i)) & 0xff);
+      hex += byte;
+    }
+  return hex;
+}
+
+void Md5::updateFromFile(std::string const& path, int64_t bytes)
+{
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    crash("ERROR: Failed to open " + path + " to checksum it");
+  std::vector<char> buf(1 << 20);
+  while (bytes != 0)
+  {
+    size_t want = bytes < 0 ? buf.size() : std::min<int64_t>(bytes, buf.size());
+    in.read(buf.data(), want);
+    if (in.gcount() == 0)
+      break;
+    update(buf.data(), in.gcount());
+    if (bytes > 0)
+      bytes -= in.gcount();
+  }
+  if (bytes > 0)
+    crash("ERROR: " + path + " is shorter than expected");
+}
+
+std::string md5File(std::string const& path)
+{
+  Md5 md5;
+  md5.updateFromFile(path);
+  return md5.hexDigest();
+}
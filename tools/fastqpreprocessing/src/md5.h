@@ -0,0 +1,32 @@
+#ifndef __SCTOOLS_FASTQPREPROCESSING_MD5_H_
+#define __SCTOOLS_FASTQPREPROCESSING_MD5_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Incremental MD5 (RFC 1321), so that output files can be checksummed as
+// they're written; hexDigest() matches md5sum's output for the same bytes.
+class Md5
+{
+public:
+  Md5() { reset(); }
+
+  void reset();
+  void update(const void* data, size_t len);
+  // Hashes the first 'bytes' bytes of the file at 'path' (all of it if -1).
+  void updateFromFile(std::string const& path, int64_t bytes = -1);
+  // Finishes the hash; call reset() before reusing this object.
+  std::string hexDigest();
+
+private:
+  void transform(const uint8_t block[64]);
+
+  uint32_t state_[4];
+  uint64_t total_bytes_;
+  uint8_t buffer_[64];
+};
+
+std::string md5File(std::string const& path);
+
+#endif // __SCTOOLS_FASTQPREPROCESSING_MD5_H_
@@ -0,0 +1,85 @@
+#include "memory_budget.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+constexpr int64_t kMiB = 1024 * 1024;
+
+MemoryPlan planMemory(PipelineOptions const& pipeline, int64_t whitelist_bytes,
+                      int num_readers, int num_output_files)
+{
+  MemoryPlan plan;
+  plan.whitelist_bytes = whitelist_bytes;
+  plan.output_buffer_bytes = num_output_files * kEstimatedOutputFileBytes;
+  plan.sort_bytes = pipeline.sort_by_barcode ? pipeline.sort_memory_mb * kMiB : 0;
+  if (pipeline.memory_limit_mb == 0)
+    return plan;
+
+  int64_t min_arena_bytes = num_readers * kMinArenaRecords * kEstimatedSamRecordBytes;
+  int64_t available = pipeline.memory_limit_mb * kMiB - kEstimatedBaseBytes -
+                      plan.whitelist_bytes - plan.output_buffer_bytes;
+  if (available < min_arena_bytes)
+  {
+    crash("ERROR: memory-limit-mb " + std::to_string(pipeline.memory_limit_mb) +
+          " is too small: the program itself takes ~" + std::to_string(kEstimatedBaseBytes / kMiB) +
+          " MB, the whitelist ~" + std::to_string(plan.whitelist_bytes / kMiB) +
+          " MB, the output buffers ~" + std::to_string(plan.output_buffer_bytes / kMiB) +
+          " MB, and the readers need at least " + std::to_string(min_arena_bytes / kMiB + 1) + " MB.");
+  }
+
+  if (pipeline.sort_by_barcode)
+  {
+    plan.sort_bytes = std::min({plan.sort_bytes, available / 2, available - min_arena_bytes});
+    available -= plan.sort_bytes;
+  }
+  // More than the default doesn't make the readers or writers any faster, so
+  // the limit only ever shrinks the arenas.
+  plan.arena_records = std::min(kDefaultArenaRecords, available / num_readers / kEstimatedSamRecordBytes);
+  return plan;
+}
+
+namespace
+{
+// Strings longer than libstdc++'s 15 character short string buffer keep
+// their characters on the heap.
+int64_t stringBytes(std::string const& s)
+{
+  return sizeof(std::string) + (s.size() > 15 ? s.capacity() + 1 : 0);
+}
+
+// Each unordered_map entry is a separately allocated node holding the next
+// pointer, the key/value pair and the cached hash, plus its bucket slot.
+constexpr int64_t kMutationNodeBytes =
+    sizeof(void*) + sizeof(std::pair<const std::string, int64_t>) + sizeof(size_t);
+} // namespace
+
+int64_t estimateWhiteListBytes(WhiteListCorrector const& corrector)
+{
+  int64_t bytes = corrector.whitelist.capacity() * sizeof(std::string);
+  for (std::string const& barcode : corrector.whitelist)
+    bytes += stringBytes(barcode) - sizeof(std::string);
+  int64_t key_heap_bytes =
+      corrector.whitelist.empty() ? 0 : stringBytes(corrector.whitelist[0]) - sizeof(std::string);
+  bytes += corrector.mutations.size() * (kMutationNodeBytes + key_heap_bytes);
+  bytes += corrector.mutations.bucket_count() * sizeof(void*);
+  return bytes;
+}
+
+int64_t estimateWhiteListFileBytes(std::string const& white_list_file)
+{
+  std::ifstream file(white_list_file);
+  std::string first_barcode;
+  std::error_code error;
+  int64_t file_bytes = std::filesystem::file_size(white_list_file, error);
+  if (!getline(file, first_barcode) || first_barcode.empty() || error)
+    return 0;
+
+  // Every barcode is as long as the first, and brings itself and its 4
+  // one-base substitutions (N included) at each position to the mutations.
+  int64_t num_barcodes = file_bytes / (first_barcode.size() + 1);
+  int64_t num_mutations = num_barcodes * (4 * first_barcode.size() + 1);
+  int64_t key_heap_bytes = stringBytes(first_barcode) - sizeof(std::string);
+  return num_barcodes * stringBytes(first_barcode) +
+         num_mutations * (kMutationNodeBytes + key_heap_bytes + sizeof(void*));
+}
@@ -0,0 +1,51 @@
+#ifndef __SCTOOLS_FASTQPREPROCESSING_MEMORY_BUDGET_H_
+#define __SCTOOLS_FASTQPREPROCESSING_MEMORY_BUDGET_H_
+
+#include <cstdint>
+
+#include "input_options.h"
+#include "whitelist_corrector.h"
+
+// SamRecords in each reader's arena when there is no --memory-limit-mb. Every
+// record queued for writing is loaned out by an arena, so this also bounds the
+// write queues: a reader whose arena is empty waits for the writers.
+constexpr int64_t kDefaultArenaRecords = 10000;
+// Below this, readers and writers would spend their time waiting on each other.
+constexpr int64_t kMinArenaRecords = 100;
+// A SamRecord's own buffers plus the sequence, qualities and tags of a
+// typical ~150bp read.
+constexpr int64_t kEstimatedSamRecordBytes = 2048;
+// The program and its libraries, thread stacks and the readers' input buffers.
+constexpr int64_t kEstimatedBaseBytes = 16 * 1024 * 1024;
+// One ShardOutputStream: its two 256KiB buffers plus zlib's deflate state.
+constexpr int64_t kEstimatedOutputFileBytes = 1024 * 1024;
+
+// How the memory of a run is split between the components holding most of it.
+struct MemoryPlan
+{
+  // Estimated; spent before planning, when the whitelist is read.
+  int64_t whitelist_bytes = 0;
+  // Estimated; all output files' buffers and compressors together.
+  int64_t output_buffer_bytes = 0;
+  int64_t arena_records = kDefaultArenaRecords;
+  // Total for --sort-by-barcode, split evenly between the shards.
+  int64_t sort_bytes = 0;
+};
+
+// With pipeline.memory_limit_mb == 0, arenas get kDefaultArenaRecords and
+// sorting gets sort_memory_mb, as without a limit. Otherwise, whatever the
+// whitelist and output buffers leave of the limit goes to the arenas of the
+// num_readers readers, and, when sorting, up to half of it (but no more than
+// sort_memory_mb) to the sort buffers. Crashes if the limit is too small.
+MemoryPlan planMemory(PipelineOptions const& pipeline, int64_t whitelist_bytes,
+                      int num_readers, int num_output_files);
+
+// Approximate heap footprint of 'corrector'.
+int64_t estimateWhiteListBytes(WhiteListCorrector const& corrector);
+
+// The same for the corrector readWhiteListFile() will build from
+// 'white_list_file', judged from its size and first barcode, so the memory
+// can be planned before it's built. 0 if the file can't be read.
+int64_t estimateWhiteListFileBytes(std::string const& white_list_file);
+
+#endif // __SCTOOLS_FASTQPREPROCESSING_MEMORY_BUDGET_H_
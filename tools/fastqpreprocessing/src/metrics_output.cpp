@@ -0,0 +1,56 @@
+#include "metrics_output.h"
+
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+
+// Fewest counts worth giving a thread of their own when sorting and writing.
+constexpr size_t kMinCountsPerThread = 1 << 16;
+
+void writeCountsFile(PackedSequenceCounter const& counts, std::string filename, int num_threads)
+{
+  std::vector<std::pair<std::string,int>> sorted_counts = counts.counts();
+  // Each thread sorts a chunk, then pairs of neighboring runs are merged
+  // until one is left.
+  auto by_count = [](std::pair<std::string,int> const& a, std::pair<std::string,int> const& b)
+  {
+    return a.second != b.second ? a.second > b.second : a.first < b.first;
+  };
+  int num_chunks = std::clamp<size_t>(sorted_counts.size() / kMinCountsPerThread, 1, num_threads);
+  auto chunk_start = [&](int chunk) {
+    return sorted_counts.begin() + sorted_counts.size() * std::min(chunk, num_chunks) / num_chunks;
+  };
+  runInParallel(num_chunks, [&](int chunk) {
+    std::sort(chunk_start(chunk), chunk_start(chunk + 1), by_count);
+  });
+  mergeInTree(num_chunks, [&](int into, int from) {
+    int width = from - into;
+    std::inplace_merge(chunk_start(into), chunk_start(from), chunk_start(from + width), by_count);
+  });
+
+  // Each thread formats a chunk of the lines, which are written in order.
+  std::vector<std::string> formatted(num_chunks);
+  runInParallel(num_chunks, [&](int chunk) {
+    std::string& text = formatted[chunk];
+    char count_chars[16];
+    for (auto it = chunk_start(chunk); it != chunk_start(chunk + 1); ++it)
+    {
+      char* end = std::to_chars(count_chars, count_chars + sizeof(count_chars), it->second).ptr;
+      text.append(count_chars, end).append(1, '\t').append(it->first).append(1, '\n');
+    }
+  });
+  std::ofstream out(filename, std::ofstream::out);
+  for (std::string const& text : formatted)
+    out.write(text.data(), text.size());
+}
+
+void writeApproximateCountsFile(ApproximateSequenceCounter const& counts, std::string filename)
+{
+  std::ofstream out(filename, std::ofstream::out);
+  std::vector<SpaceSavingCounter::Entry> entries = counts.top().entries();
+  out << "# approximate: the " << entries.size() << " most frequent of about "
+      << static_cast<int64_t>(counts.distinctEstimate()) << " distinct sequences in " << counts.top().total()
+      << " reads; each count may be too high by up to its third column\n";
+  for (SpaceSavingCounter::Entry const& entry : entries)
+    out << entry.count << "\t" << entry.seq << "\t" << entry.error << "\n";
+}
@@ -0,0 +1,46 @@
+#ifndef __SCTOOLS_FASTQPREPROCESSING_METRICS_OUTPUT_H_
+#define __SCTOOLS_FASTQPREPROCESSING_METRICS_OUTPUT_H_
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "approximate_counts.h"
+#include "packed_counts.h"
+
+// Runs f(0), ..., f(n - 1), each on its own thread.
+template <typename F> void runInParallel(int n, F f)
+{
+  std::vector<std::thread> threads;
+  for (int i = 0; i < n; i++)
+    threads.emplace_back(f, i);
+  for (std::thread& thread : threads)
+    thread.join();
+}
+
+// Merges items 0, ..., n - 1 into item 0 as a tree of merge(into, from)
+// calls: in each round, every other remaining item takes in its neighbor, all
+// at once.
+template <typename F> void mergeInTree(int n, F merge)
+{
+  for (int width = 1; width < n; width *= 2)
+  {
+    runInParallel((n + width - 1) / (2 * width), [&](int pair) {
+      merge(2 * width * pair, 2 * width * pair + width);
+    });
+  }
+}
+
+// Writes a "<count>\t<sequence>" line for each sequence counted, from most to
+// fewest counts (ties by sequence, so the output doesn't depend on the order
+// the counts were merged in), sorting and formatting on up to num_threads
+// threads.
+void writeCountsFile(PackedSequenceCounter const& counts, std::string filename, int num_threads);
+
+// Writes the same "<count>\t<sequence>" lines as writeCountsFile() for the
+// sequences 'counts' kept, with a third column: how much higher than the
+// true count the count may be. A first '#' line says the counts are
+// approximate.
+void writeApproximateCountsFile(ApproximateSequenceCounter const& counts, std::string filename);
+
+#endif // __SCTOOLS_FASTQPREPROCESSING_METRICS_OUTPUT_H_
@@ -0,0 +1,103 @@
+#include "metrics_state.h"
+
+#include <algorithm>
+
+#include "input_options.h"
+
+// gzread() and gzwrite() take at most an unsigned int of bytes at a time.
+constexpr size_t kMaxIoBytes = 1 << 30;
+
+StateWriter::StateWriter(std::string path) : path_(std::move(path)), file_(gzopen(path_.c_str(), "wb"))
+{
+  if (!file_)
+    crash("ERROR: Failed to open state file for writing: " + path_);
+}
+
+StateWriter::~StateWriter()
+{
+  if (file_)
+    gzclose(file_);
+}
+
+void StateWriter::write(const void* data, size_t size)
+{
+  for (size_t done = 0; done < size; done += kMaxIoBytes)
+  {
+    unsigned chunk = std::min(kMaxIoBytes, size - done);
+    if (gzwrite(file_, static_cast<const char*>(data) + done, chunk) != static_cast<int>(chunk))
+      crash("ERROR: Failed to write state file " + path_);
+  }
+}
+
+void StateWriter::writeInt(int64_t value)
+{
+  write(&value, sizeof(value));
+}
+
+void StateWriter::writeString(std::string_view value)
+{
+  writeInt(value.size());
+  write(value.data(), value.size());
+}
+
+void StateWriter::writeInts(std::vector<int64_t> const& values)
+{
+  writeInt(values.size());
+  write(values.data(), values.size() * sizeof(int64_t));
+}
+
+void StateWriter::close()
+{
+  gzFile file = file_;
+  file_ = nullptr;
+  if (gzclose(file) != Z_OK)
+    crash("ERROR: Failed to write state file " + path_);
+}
+
+StateReader::StateReader(std::string path) : path_(std::move(path)), file_(gzopen(path_.c_str(), "rb"))
+{
+  if (!file_)
+    crash("ERROR: Failed to open state file " + path_);
+}
+
+StateReader::~StateReader()
+{
+  gzclose(file_);
+}
+
+void StateReader::read(void* data, size_t size)
+{
+  for (size_t done = 0; done < size; done += kMaxIoBytes)
+  {
+    unsigned chunk = std::min(kMaxIoBytes, size - done);
+    if (gzread(file_, static_cast<char*>(data) + done, chunk) != static_cast<int>(chunk))
+      crash("ERROR: State file " + path_ + " is truncated or unreadable");
+  }
+}
+
+int64_t StateReader::readInt()
+{
+  int64_t value;
+  read(&value, sizeof(value));
+  return value;
+}
+
+std::string StateReader::readString()
+{
+  int64_t size = readInt();
+  if (size < 0 || size > (1 << 30))
+    crash("ERROR: State file " + path_ + " is corrupt");
+  std::string value(size, '\0');
+  read(value.data(), size);
+  return value;
+}
+
+std::vector<int64_t> StateReader::readInts()
+{
+  int64_t size = readInt();
+  if (size < 0 || size > (int64_t{1} << 32))
+    crash("ERROR: State file " + path_ + " is corrupt");
+  std::vector<int64_t> values(size);
+  read(values.data(), size * sizeof(int64_t));
+  return values;
+}
@@ -0,0 +1,50 @@
+#ifndef __SCTOOLS_FASTQPREPROCESSING_METRICS_STATE_H_
+#define __SCTOOLS_FASTQPREPROCESSING_METRICS_STATE_H_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <zlib.h>
+
+// Gzipped binary files holding fastq_metrics' counts (--save-state), so that
+// runs over separate inputs can be merged by `fastq_metrics merge` exactly as
+// if they had been one run. Integers are written as 8 bytes in the host's
+// byte order. Both classes crash on any I/O error, naming the file.
+class StateWriter
+{
+public:
+  explicit StateWriter(std::string path);
+  ~StateWriter();
+  void writeInt(int64_t value);
+  void writeString(std::string_view value);
+  void writeInts(std::vector<int64_t> const& values);
+  // Must be called for the file to be complete.
+  void close();
+
+private:
+  void write(const void* data, size_t size);
+
+  std::string path_;
+  gzFile file_;
+};
+
+class StateReader
+{
+public:
+  explicit StateReader(std::string path);
+  ~StateReader();
+  int64_t readInt();
+  std::string readString();
+  std::vector<int64_t> readInts();
+  std::string const& path() const { return path_; }
+
+private:
+  void read(void* data, size_t size);
+
+  std::string path_;
+  gzFile file_;
+};
+
+#endif // __SCTOOLS_FASTQPREPROCESSING_METRICS_STATE_H_
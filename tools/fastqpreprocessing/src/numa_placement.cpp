@@ -0,0 +1,158 @@
+#include "numa_placement.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+
+#include "input_options.h"
+
+std::vector<int> parseCpuList(std::string const& cpu_list)
+{
+  std::vector<int> cpus;
+  std::stringstream ss(cpu_list);
+  std::string range;
+  while (std::getline(ss, range, ','))
+  {
+    range.erase(std::remove_if(range.begin(), range.end(), ::isspace), range.end());
+    if (range.empty())
+      continue;
+    size_t dash = range.find('-');
+    try
+    {
+      int first = std::stoi(range.substr(0, dash));
+      int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+      for (int cpu = first; cpu <= last; cpu++)
+        cpus.push_back(cpu);
+    }
+    catch (std::exception const&)
+    {
+      crash("ERROR: Can't parse CPU list '" + cpu_list + "'");
+    }
+  }
+  return cpus;
+}
+
+std::vector<NumaNode> readNumaTopology(std::string const& sysfs_root, std::vector<int> const& allowed_cpus)
+{
+  std::vector<NumaNode> nodes;
+  std::error_code ec;
+  for (auto const& entry : std::filesystem::directory_iterator(sysfs_root, ec))
+  {
+    std::string name = entry.path().filename().string();
+    if (name.rfind("node", 0) != 0 || name.size() == 4 ||
+        !std::all_of(name.begin() + 4, name.end(), ::isdigit))
+    {
+      continue;
+    }
+    std::ifstream in(entry.path() / "cpulist");
+    std::string cpu_list;
+    if (!std::getline(in, cpu_list))
+      continue;
+
+    NumaNode node;
+    node.id = std::stoi(name.substr(4));
+    for (int cpu : parseCpuList(cpu_list))
+      if (std::find(allowed_cpus.begin(), allowed_cpus.end(), cpu) != allowed_cpus.end())
+        node.cpus.push_back(cpu);
+    if (!node.cpus.empty())
+      nodes.push_back(node);
+  }
+  std::sort(nodes.begin(), nodes.end(), [](NumaNode const& a, NumaNode const& b) { return a.id < b.id; });
+  return nodes;
+}
+
+std::vector<int> allowedCpus()
+{
+  std::vector<int> cpus;
+  cpu_set_t set;
+  if (sched_getaffinity(0, sizeof(set), &set) != 0)
+    return cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    if (CPU_ISSET(cpu, &set))
+      cpus.push_back(cpu);
+  return cpus;
+}
+
+NumaPlacement placeOnNumaNodes(std::vector<NumaNode> const& nodes, std::vector<int64_t> const& input_bytes,
+                               int num_writers)
+{
+  NumaPlacement placement;
+  placement.nodes = nodes;
+  if (nodes.empty())
+    return placement;
+
+  int64_t known_bytes = 0;
+  int known = 0;
+  for (int64_t bytes : input_bytes)
+    if (bytes > 0)
+    {
+      known_bytes += bytes;
+      known++;
+    }
+  int64_t unknown_bytes = known > 0 ? known_bytes / known : 1;
+  std::vector<int64_t> sizes;
+  for (int64_t bytes : input_bytes)
+    sizes.push_back(bytes > 0 ? bytes : unknown_bytes);
+
+  // Largest inputs first, each to the node with the least input per CPU so far.
+  std::vector<int> order(sizes.size());
+  for (int i = 0; i < order.size(); i++)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return sizes[a] > sizes[b]; });
+  std::vector<double> node_bytes(nodes.size(), 0);
+  placement.reader_nodes.resize(sizes.size());
+  for (int reader : order)
+  {
+    int best = 0;
+    for (int n = 1; n < nodes.size(); n++)
+      if ((node_bytes[n] + sizes[reader]) / nodes[n].cpus.size() <
+          (node_bytes[best] + sizes[reader]) / nodes[best].cpus.size())
+      {
+        best = n;
+      }
+    node_bytes[best] += sizes[reader];
+    placement.reader_nodes[reader] = best;
+  }
+
+  // Writers in proportion to each node's input, by largest remainder.
+  double total_bytes = 0;
+  for (double bytes : node_bytes)
+    total_bytes += bytes;
+  std::vector<int> writers_per_node(nodes.size(), 0);
+  std::vector<double> remainders(nodes.size(), 0);
+  int assigned = 0;
+  for (int n = 0; n < nodes.size(); n++)
+  {
+    double share = total_bytes > 0 ? num_writers * node_bytes[n] / total_bytes : 0;
+    writers_per_node[n] = share;
+    remainders[n] = share - writers_per_node[n];
+    assigned += writers_per_node[n];
+  }
+  while (assigned < num_writers)
+  {
+    int n = std::max_element(remainders.begin(), remainders.end()) - remainders.begin();
+    writers_per_node[n]++;
+    remainders[n] = -1;
+    assigned++;
+    if (*std::max_element(remainders.begin(), remainders.end()) < 0)
+      std::fill(remainders.begin(), remainders.end(), 0);
+  }
+  for (int n = 0; n < nodes.size(); n++)
+    placement.writer_nodes.insert(placement.writer_nodes.end(), writers_per_node[n], n);
+  return placement;
+}
+
+void pinCurrentThreadToNode(NumaNode const& node)
+{
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : node.cpus)
+    CPU_SET(cpu, &set);
+  // Not fatal: the thread just runs wherever the scheduler puts it.
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+    fprintf(stderr, "WARNING: Failed to pin a thread to NUMA node %d\n", node.id);
+}
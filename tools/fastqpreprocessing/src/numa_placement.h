@@ -0,0 +1,54 @@
+#ifndef __SCTOOLS_FASTQPREPROCESSING_NUMA_PLACEMENT_H_
+#define __SCTOOLS_FASTQPREPROCESSING_NUMA_PLACEMENT_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Overview of --numa:
+// * The NUMA nodes and their CPUs are read from sysfs (no libnuma needed),
+//   keeping only the CPUs this process is allowed to run on.
+// * Each reader thread is pinned to a node, spreading the input bytes evenly
+//   over the nodes' CPUs. Threads inherit their creator's affinity, so a
+//   reader's input prefetch threads (see input_backend.h) run there too.
+// * Readers allocate their own arena once pinned, so with Linux's default
+//   first-touch policy the records live on the reader's node. Writers allocate
+//   their output buffers themselves, likewise.
+// * Barcodes are hashed across all shards, so every shard's producers are
+//   spread over the nodes in proportion to the readers' input there. Writers
+//   are split over the nodes in that same proportion, which keeps most
+//   records on the node that filled them.
+
+struct NumaNode
+{
+  int id = 0;
+  std::vector<int> cpus;
+};
+
+// Parses a sysfs CPU list such as "0-3,8,10-11".
+std::vector<int> parseCpuList(std::string const& cpu_list);
+
+// The nodes under sysfs_root (normally /sys/devices/system/node) that have
+// any CPU in allowed_cpus. Empty if sysfs has no NUMA information.
+std::vector<NumaNode> readNumaTopology(std::string const& sysfs_root, std::vector<int> const& allowed_cpus);
+
+// The CPUs this process may run on.
+std::vector<int> allowedCpus();
+
+struct NumaPlacement
+{
+  std::vector<NumaNode> nodes;
+  // Index into nodes for each reader and each writer.
+  std::vector<int> reader_nodes;
+  std::vector<int> writer_nodes;
+};
+
+// input_bytes: the size of each reader's inputs (0 if unknown, e.g. streamed,
+// which counts as the average of the known sizes).
+NumaPlacement placeOnNumaNodes(std::vector<NumaNode> const& nodes, std::vector<int64_t> const& input_bytes,
+                               int num_writers);
+
+// Restricts the calling thread to the node's CPUs.
+void pinCurrentThreadToNode(NumaNode const& node);
+
+#endif // __SCTOOLS_FASTQPREPROCESSING_NUMA_PLACEMENT_H_
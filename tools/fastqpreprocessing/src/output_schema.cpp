@@ -0,0 +1,66 @@
+#include "output_schema.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "input_options.h"
+
+const std::vector<std::string> kOptionalOutputTags = {
+    "S1", "Q1", "CR", "CY", "UR", "UY", "SR", "SY", "S3", "Q3"};
+
+OutputTagSet OutputTagSet::all()
+{
+  OutputTagSet tags;
+  for (std::string const& tag : kOptionalOutputTags)
+    tags.add(tag);
+  return tags;
+}
+
+OutputTagSet OutputTagSet::parse(std::string const& tag_list)
+{
+  OutputTagSet tags;
+  std::stringstream ss(tag_list);
+  std::string tag;
+  while (std::getline(ss, tag, ','))
+  {
+    if (std::find(kOptionalOutputTags.begin(), kOptionalOutputTags.end(), tag) == kOptionalOutputTags.end())
+      crash("ERROR: Unknown output tag '" + tag + "'; output-tags can list S1, Q1, CR, CY, UR, UY, SR, SY, S3 and Q3.");
+    tags.add(tag);
+  }
+  return tags;
+}
+
+void OutputTagSet::add(std::string const& tag)
+{
+  bits_.set(index(tag.c_str()));
+}
+
+OutputTagSet requiredOutputTags(std::string const& output_format, bool sample_bool, bool has_R3,
+                                bool sort_by_barcode)
+{
+  OutputTagSet tags;
+  tags.add("CR");
+  if (sort_by_barcode)
+    tags.add("UR");
+  if (output_format == "FASTQ")
+  {
+    for (const char* tag : {"CR", "CY", "UR", "UY"})
+      tags.add(tag);
+    if (sample_bool)
+    {
+      tags.add("S1");
+      tags.add("Q1");
+    }
+    if (has_R3)
+    {
+      tags.add("S3");
+      tags.add("Q3");
+    }
+  }
+  return tags;
+}
+
+std::string compactReadName(int reader, int64_t read)
+{
+  return std::to_string(reader) + ":" + std::to_string(read);
+}
@@ -0,0 +1,46 @@
+#ifndef __SCTOOLS_FASTQPREPROCESSING_OUTPUT_SCHEMA_H_
+#define __SCTOOLS_FASTQPREPROCESSING_OUTPUT_SCHEMA_H_
+
+#include <bitset>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The tags fillSamRecordCommon() can leave out (--output-tags). RG and the
+// corrected barcode CB are always added.
+extern const std::vector<std::string> kOptionalOutputTags;
+
+// A set of two-letter SAM tags, with constant-time lookup.
+class OutputTagSet
+{
+public:
+  static OutputTagSet all();
+  // A comma-separated list of tags from kOptionalOutputTags; crashes on
+  // anything else.
+  static OutputTagSet parse(std::string const& tag_list);
+
+  void add(std::string const& tag);
+  void add(OutputTagSet const& other) { bits_ |= other.bits_; }
+  bool has(const char* tag) const { return bits_[index(tag)]; }
+
+private:
+  static size_t index(const char* tag)
+  {
+    return static_cast<uint8_t>(tag[0]) << 8 | static_cast<uint8_t>(tag[1]);
+  }
+
+  std::bitset<65536> bits_;
+};
+
+// The tags the pipeline itself reads back, whatever --output-tags says: CR
+// (for barcode correction) always, UR for sort-by-barcode, and for FASTQ
+// output the tags its records are written from.
+OutputTagSet requiredOutputTags(std::string const& output_format, bool sample_bool, bool has_R3,
+                                bool sort_by_barcode);
+
+// The read name --compact-read-names gives read number 'read' (counting from
+// 1) of reader 'reader': unique within a run, and much shorter than the
+// sequencer's names.
+std::string compactReadName(int reader, int64_t read);
+
+#endif // __SCTOOLS_FASTQPREPROCESSING_OUTPUT_SCHEMA_H_
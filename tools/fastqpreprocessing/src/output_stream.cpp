@@ -0,0 +1,265 @@
+#include "output_stream.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "input_options.h"
+
+// Large enough that a FIFO consumer sees few, big writes.
+constexpr size_t kShardBufferSize = 256 * 1024;
+
+ShardOutputBuf::ShardOutputBuf() : in_buf_(kShardBufferSize), out_buf_(kShardBufferSize)
+{
+  setp(in_buf_.data(), in_buf_.data() + in_buf_.size());
+}
+
+ShardOutputBuf::~ShardOutputBuf()
+{
+  close();
+}
+
+bool ShardOutputBuf::open(std::string const& path, int compression_level, int64_t resume_offset)
+{
+  path_ = path;
+  if (resume_offset >= 0)
+  {
+    // Anything past resume_offset was written after the last checkpoint.
+    if (truncate(path.c_str(), resume_offset) != 0)
+      crash("ERROR: Failed to cut " + path + " back to its checkpointed size; can't resume.");
+    fd_ = ::open(path.c_str(), O_WRONLY | O_APPEND);
+    compressed_bytes_ = resume_offset;
+    if (fd_ >= 0)
+      md5_.updateFromFile(path, resume_offset);
+  }
+  else
+  {
+    // O_TRUNC is ignored for FIFOs, and opening one for writing blocks until
+    // its reader has opened the other end.
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  }
+  if (fd_ < 0)
+    return false;
+
+  compress_ = compression_level != 0;
+  if (compress_)
+  {
+    memset(&zstream_, 0, sizeof(zstream_));
+    // windowBits 15 + 16 selects a gzip (rather than zlib) wrapper.
+    if (deflateInit2(&zstream_, compression_level, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+      crash("ERROR: Failed to initialize gzip compression for " + path);
+    }
+  }
+  return true;
+}
+
+bool ShardOutputBuf::close()
+{
+  if (fd_ < 0)
+    return true;
+
+  bool ok = flushBuffer(Z_FINISH);
+  if (compress_)
+    deflateEnd(&zstream_);
+  ok = (::close(fd_) == 0) && ok;
+  fd_ = -1;
+  return ok;
+}
+
+int64_t ShardOutputBuf::checkpoint()
+{
+  // Z_FINISH rather than Z_SYNC_FLUSH, so that the file is a complete gzip
+  // stream if it gets cut back to this size when resuming.
+  if (!flushBuffer(Z_FINISH) || fdatasync(fd_) != 0)
+    crash("ERROR: Failed to flush " + path_ + " for a checkpoint");
+  return compressed_bytes_;
+}
+
+int ShardOutputBuf::overflow(int c)
+{
+  if (!flushBuffer(Z_NO_FLUSH))
+    return traits_type::eof();
+  if (c != traits_type::eof())
+  {
+    *pptr() = c;
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+int ShardOutputBuf::sync()
+{
+  return flushBuffer(Z_SYNC_FLUSH) ? 0 : -1;
+}
+
+bool ShardOutputBuf::flushBuffer(int zlib_flush)
+{
+  if (fd_ < 0)
+    return false;
+
+  size_t pending = pptr() - pbase();
+  uncompressed_bytes_ += pending;
+  setp(in_buf_.data(), in_buf_.data() + in_buf_.size());
+
+  if (!compress_)
+    return writeAll(in_buf_.data(), pending);
+
+  zstream_.next_in = reinterpret_cast<Bytef*>(in_buf_.data());
+  zstream_.avail_in = pending;
+  // Keep deflating until zlib has consumed all the input and, for a flush,
+  // has nothing more to emit (i.e. it didn't fill the whole output buffer).
+  do
+  {
+    zstream_.next_out = reinterpret_cast<Bytef*>(out_buf_.data());
+    zstream_.avail_out = out_buf_.size();
+    int ret = deflate(&zstream_, zlib_flush);
+    if (ret == Z_STREAM_ERROR)
+      crash("ERROR: gzip compression failed for " + path_);
+    if (!writeAll(out_buf_.data(), out_buf_.size() - zstream_.avail_out))
+      return false;
+  } while (zstream_.avail_in > 0 || zstream_.avail_out == 0);
+
+  // After Z_FINISH the next write starts a new gzip member, which gzip readers
+  // treat as a continuation of the same file.
+  if (zlib_flush == Z_FINISH)
+    deflateReset(&zstream_);
+  return true;
+}
+
+bool ShardOutputBuf::writeAll(const char* data, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t written = ::write(fd_, data, len);
+    if (written < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    md5_.update(data, written);
+    data += written;
+    len -= written;
+    compressed_bytes_ += written;
+  }
+  return true;
+}
+
+ShardOutputStream::ShardOutputStream(std::string const& path, int compression_level,
+                                     int64_t resume_offset)
+  : std::ostream(&buf_)
+{
+  if (!buf_.open(path, compression_level, resume_offset))
+    setstate(std::ios::badbit);
+}
+
+ShardOutputStream::~ShardOutputStream()
+{
+  close();
+}
+
+void ShardOutputStream::close()
+{
+  if (!buf_.close())
+    setstate(std::ios::badbit);
+}
+
+ChecksummedOutputPipe::ChecksummedOutputPipe(std::string path) : path_(std::move(path))
+{
+  pipe_path_ = path_ + ".pipe" + std::filesystem::path(path_).extension().string();
+  // Left behind by a run that was killed.
+  unlink(pipe_path_.c_str());
+  if (mkfifo(pipe_path_.c_str(), 0600) != 0)
+    crash("ERROR: Failed to create a pipe for writing " + path_ + ": " + strerror(errno));
+  // Opening the read end without O_NONBLOCK would wait for a writer.
+  read_fd_ = open(pipe_path_.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (read_fd_ < 0)
+    crash("ERROR: Failed to open a pipe for writing " + path_ + ": " + strerror(errno));
+  // A bigger pipe than the default 64KiB means fewer, bigger copies.
+  fcntl(read_fd_, F_SETPIPE_SZ, 1024 * 1024);
+  file_fd_ = open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (file_fd_ < 0)
+    crash("ERROR: Failed to open " + path_ + " for writing: " + strerror(errno));
+}
+
+ChecksummedOutputPipe::~ChecksummedOutputPipe()
+{
+  if (thread_.joinable())
+    thread_.join();
+  if (read_fd_ >= 0)
+    close(read_fd_);
+  if (file_fd_ >= 0)
+    close(file_fd_);
+  unlink(pipe_path_.c_str());
+}
+
+void ChecksummedOutputPipe::start()
+{
+  unlink(pipe_path_.c_str());
+  thread_ = std::thread(&ChecksummedOutputPipe::run, this);
+}
+
+void ChecksummedOutputPipe::run()
+{
+  std::vector<char> buf(kShardBufferSize);
+  while (true)
+  {
+    pollfd readable{read_fd_, POLLIN, 0};
+    if (poll(&readable, 1, -1) < 0 && errno != EINTR)
+      crash("ERROR: Failed to wait on the pipe for " + path_ + ": " + strerror(errno));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    ssize_t n = read(read_fd_, buf.data(), buf.size());
+    if (n == 0)
+      return; // The writer has closed its end.
+    if (n < 0)
+    {
+      if (errno == EAGAIN || errno == EINTR)
+        continue;
+      crash("ERROR: Failed to read the pipe for " + path_ + ": " + strerror(errno));
+    }
+    for (ssize_t done = 0; done < n;)
+    {
+      ssize_t written = write(file_fd_, buf.data() + done, n - done);
+      if (written < 0 && errno != EINTR)
+        crash("ERROR: Failed to write " + path_ + ": " + strerror(errno));
+      done += std::max<ssize_t>(written, 0);
+    }
+    md5_.update(buf.data(), n);
+    bytes_.fetch_add(n, std::memory_order_relaxed);
+  }
+}
+
+void ChecksummedOutputPipe::drain()
+{
+  while (true)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      int pending = 0;
+      if (ioctl(read_fd_, FIONREAD, &pending) != 0)
+        crash("ERROR: Failed to check the pipe for " + path_ + ": " + strerror(errno));
+      if (pending == 0)
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+void ChecksummedOutputPipe::finish()
+{
+  thread_.join();
+  int fd = file_fd_;
+  file_fd_ = -1;
+  if (close(fd) != 0)
+    crash("ERROR: Failed to write " + path_ + ": " + strerror(errno));
+}
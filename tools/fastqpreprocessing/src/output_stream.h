@@ -0,0 +1,131 @@
+#ifndef __SCTOOLS_FASTQPREPROCESSING_OUTPUT_STREAM_H_
+#define __SCTOOLS_FASTQPREPROCESSING_OUTPUT_STREAM_H_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+
+#include "md5.h"
+
+// streambuf behind ShardOutputStream: buffers text, deflates it (unless the
+// level is 0), and write()s the result to a file descriptor.
+class ShardOutputBuf : public std::streambuf
+{
+public:
+  ShardOutputBuf();
+  ~ShardOutputBuf();
+
+  // compression_level: 0 = plain uncompressed output, 1-9 = gzip level,
+  // -1 = zlib's default gzip level. If resume_offset >= 0, the existing file
+  // is cut back to that many bytes and appended to, instead of overwritten.
+  bool open(std::string const& path, int compression_level, int64_t resume_offset);
+  bool close();
+
+  // Ends the current gzip member, writes out everything buffered, and syncs
+  // the file to disk. Returns the file size at that point, which is a valid
+  // resume_offset for open().
+  int64_t checkpoint();
+
+  // Bytes handed to the stream, before compression.
+  int64_t uncompressedBytes() const { return uncompressed_bytes_; }
+  // Bytes written to the file descriptor, after compression (plus the
+  // resume_offset, if any).
+  int64_t compressedBytes() const { return compressed_bytes_; }
+  // MD5 of the bytes written to the file descriptor so far (including the
+  // resume_offset bytes kept from before, if any); complete after close().
+  std::string md5() const
+  {
+    Md5 copy = md5_;
+    return copy.hexDigest();
+  }
+
+protected:
+  int overflow(int c) override;
+  int sync() override;
+
+private:
+  bool flushBuffer(int zlib_flush);
+  bool writeAll(const char* data, size_t len);
+
+  std::string path_;
+  int fd_ = -1;
+  bool compress_ = false;
+  z_stream zstream_;
+  std::vector<char> in_buf_;
+  std::vector<char> out_buf_;
+  int64_t uncompressed_bytes_ = 0;
+  int64_t compressed_bytes_ = 0;
+  Md5 md5_;
+};
+
+// The output file of one shard. Writes go straight to a file descriptor, so
+// the path can just as well be a FIFO that a downstream tool (e.g. the aligner)
+// is reading: opening it waits for that reader to connect, and a slow reader
+// blocks only the thread writing this shard.
+class ShardOutputStream : public std::ostream
+{
+public:
+  ShardOutputStream(std::string const& path, int compression_level, int64_t resume_offset = -1);
+  ~ShardOutputStream();
+  void close();
+  int64_t checkpoint() { return buf_.checkpoint(); }
+
+  int64_t uncompressedBytes() const { return buf_.uncompressedBytes(); }
+  int64_t compressedBytes() const { return buf_.compressedBytes(); }
+  std::string md5() const { return buf_.md5(); }
+
+private:
+  ShardOutputBuf buf_;
+};
+
+// libStatGen writes BAM shards itself, to a path it opens. To checksum such a
+// shard as it's written rather than by reading it back, the library is given
+// a FIFO instead (named with the shard's extension, from which libStatGen
+// picks the format), and a helper thread copies everything written to it into
+// the real file, counting and hashing the bytes on the way.
+class ChecksummedOutputPipe
+{
+public:
+  // Creates the FIFO next to 'path', and 'path' itself (empty).
+  explicit ChecksummedOutputPipe(std::string path);
+  ~ChecksummedOutputPipe();
+
+  // What the library should open for writing.
+  std::string const& pipePath() const { return pipe_path_; }
+  // Call once the library has opened pipePath(): removes the FIFO's name and
+  // starts copying.
+  void start();
+  // Waits until everything written to the pipe so far is in the file, e.g.
+  // to sync it for a checkpoint.
+  void drain();
+  // Waits for the library to close its end; the file is then complete.
+  void finish();
+
+  // Bytes copied to the file so far; cheap enough to poll per record.
+  int64_t bytes() const { return bytes_.load(std::memory_order_relaxed); }
+  // MD5 of the file; call after finish().
+  std::string md5() { return md5_.hexDigest(); }
+
+private:
+  void run();
+
+  std::string path_;
+  std::string pipe_path_;
+  int read_fd_ = -1;
+  int file_fd_ = -1;
+  // Held while copying a chunk, so that drain() sees it either still in the
+  // pipe or in the file.
+  std::mutex mutex_;
+  std::atomic<int64_t> bytes_{0};
+  Md5 md5_;
+  std::thread thread_;
+};
+
+#endif // __SCTOOLS_FASTQPREPROCESSING_OUTPUT_STREAM_H_
@@ -0,0 +1,195 @@
+#include "packed_counts.h"
+
+#include <algorithm>
+#include <array>
+
+namespace
+{
+constexpr uint8_t kNotPackable = 4;
+
+constexpr std::array<uint8_t, 256> makeBaseCodes()
+{
+  std::array<uint8_t, 256> codes{};
+  for (auto& code : codes)
+    code = kNotPackable;
+  codes['A'] = 0;
+  codes['C'] = 1;
+  codes['G'] = 2;
+  codes['T'] = 3;
+  return codes;
+}
+constexpr std::array<uint8_t, 256> kBaseCodes = makeBaseCodes();
+
+// Fibonacci hashing: the top bits of the product are well mixed.
+inline uint64_t slotOf(uint64_t key, int bits)
+{
+  return (key * 0x9E3779B97F4A7C15ull) >> (64 - bits);
+}
+
+inline int log2(size_t power_of_two)
+{
+  return __builtin_ctzll(power_of_two);
+}
+
+// Calls f(packed, count) for each sequence in 'dense' counted at all.
+template <typename F> void forEachDenseCount(std::atomic<int> const* dense, size_t size, F f)
+{
+  for (size_t i = 0; i < size; i++)
+    if (int count = dense[i].load(std::memory_order_relaxed))
+      f(i, count);
+}
+} // namespace
+
+bool packSequence(std::string_view seq, uint64_t* packed)
+{
+  if (seq.size() > kMaxPackedLength)
+    return false;
+  uint64_t ret = 0;
+  uint8_t invalid = 0;
+  for (char base : seq)
+  {
+    uint8_t code = kBaseCodes[static_cast<uint8_t>(base)];
+    invalid |= code;
+    ret = (ret << 2) | (code & 3);
+  }
+  *packed = ret;
+  return !(invalid & kNotPackable);
+}
+
+std::string unpackSequence(uint64_t packed, int length)
+{
+  std::string seq(length, 'A');
+  for (int i = length - 1; i >= 0; i--, packed >>= 2)
+    seq[i] = "ACGT"[packed & 3];
+  return seq;
+}
+
+void PackedCountTable::add(uint64_t key, int count)
+{
+  // Kept at most half full, so probes stay short.
+  if (2 * (size_ + 1) > slots_.size())
+    grow();
+  int bits = log2(slots_.size());
+  size_t mask = slots_.size() - 1;
+  for (size_t i = slotOf(key, bits); ; i = (i + 1) & mask)
+  {
+    Slot& slot = slots_[i];
+    if (slot.count == 0)
+    {
+      slot.key = key;
+      slot.count = count;
+      size_++;
+      return;
+    }
+    if (slot.key == key)
+    {
+      slot.count += count;
+      return;
+    }
+  }
+}
+
+void PackedCountTable::grow()
+{
+  std::vector<Slot> old_slots(std::max<size_t>(1024, 2 * slots_.size()), Slot{0, 0});
+  old_slots.swap(slots_);
+  size_ = 0;
+  for (Slot const& slot : old_slots)
+    if (slot.count != 0)
+      add(slot.key, slot.count);
+}
+
+PackedSequenceCounter::PackedSequenceCounter(int length) : length_(length) {}
+
+void PackedSequenceCounter::allocateDenseCounts()
+{
+  if (!dense_counts_)
+    dense_counts_ = std::make_shared<DenseCounts>(size_t{1} << (2 * length_));
+}
+
+PackedSequenceCounter PackedSequenceCounter::sharingDenseCounts()
+{
+  PackedSequenceCounter counter(length_);
+  if (dense())
+  {
+    allocateDenseCounts();
+    counter.dense_counts_ = dense_counts_;
+  }
+  return counter;
+}
+
+void PackedSequenceCounter::add(std::string_view seq, int count)
+{
+  uint64_t packed;
+  if (seq.size() != length_ || !packable() || !packSequence(seq, &packed))
+    escaped_counts_[std::string(seq)] += count;
+  else if (dense())
+  {
+    allocateDenseCounts();
+    dense_counts_->counts[packed].fetch_add(count, std::memory_order_relaxed);
+  }
+  else
+    table_counts_.add(packed, count);
+}
+
+PackedSequenceCounter& PackedSequenceCounter::operator+=(PackedSequenceCounter const& rhs)
+{
+  if (rhs.dense_counts_ && rhs.dense_counts_ != dense_counts_)
+  {
+    allocateDenseCounts();
+    for (size_t i = 0; i < dense_counts_->size; i++)
+      dense_counts_->counts[i].fetch_add(rhs.dense_counts_->counts[i].load(std::memory_order_relaxed),
+                                         std::memory_order_relaxed);
+  }
+  rhs.table_counts_.forEach([this](uint64_t key, int count) { table_counts_.add(key, count); });
+  for (auto const& [seq, count] : rhs.escaped_counts_)
+    escaped_counts_[seq] += count;
+  return *this;
+}
+
+std::vector<std::pair<std::string, int>> PackedSequenceCounter::counts() const
+{
+  std::vector<std::pair<std::string, int>> ret(escaped_counts_.begin(), escaped_counts_.end());
+  if (dense_counts_)
+    forEachDenseCount(dense_counts_->counts.get(), dense_counts_->size, [&](uint64_t packed, int count) {
+      ret.emplace_back(unpackSequence(packed, length_), count);
+    });
+  table_counts_.forEach([&](uint64_t key, int count) { ret.emplace_back(unpackSequence(key, length_), count); });
+  return ret;
+}
+
+void PackedSequenceCounter::save(StateWriter* out) const
+{
+  out->writeInt(length_);
+  // The dense counts as (packed sequence, count) pairs of those seen, and
+  // the table's likewise.
+  std::vector<int64_t> pairs;
+  if (dense_counts_)
+    forEachDenseCount(dense_counts_->counts.get(), dense_counts_->size, [&](uint64_t packed, int count) {
+      pairs.insert(pairs.end(), {static_cast<int64_t>(packed), count});
+    });
+  table_counts_.forEach([&](uint64_t key, int count) {
+    pairs.insert(pairs.end(), {static_cast<int64_t>(key), count});
+  });
+  out->writeInts(pairs);
+  out->writeInt(escaped_counts_.size());
+  for (auto const& [seq, count] : escaped_counts_)
+  {
+    out->writeString(seq);
+    out->writeInt(count);
+  }
+}
+
+PackedSequenceCounter PackedSequenceCounter::load(StateReader* in)
+{
+  PackedSequenceCounter counter(in->readInt());
+  std::vector<int64_t> pairs = in->readInts();
+  for (size_t i = 0; i + 1 < pairs.size(); i += 2)
+    counter.add(unpackSequence(pairs[i], counter.length_), pairs[i + 1]);
+  for (int64_t num_escaped = in->readInt(); num_escaped > 0; num_escaped--)
+  {
+    std::string seq = in->readString();
+    counter.escaped_counts_[seq] += in->readInt();
+  }
+  return counter;
+}
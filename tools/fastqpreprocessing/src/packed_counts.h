@@ -0,0 +1,109 @@
+#ifndef __SCTOOLS_FASTQPREPROCESSING_PACKED_COUNTS_H_
+#define __SCTOOLS_FASTQPREPROCESSING_PACKED_COUNTS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "metrics_state.h"
+
+// Longest sequence packSequence() can pack, 2 bits per base.
+constexpr int kMaxPackedLength = 32;
+
+// Sequences up to this long are counted in a dense array (4^12 = 16M counts);
+// longer ones in a hash table.
+constexpr int kMaxDenseLength = 12;
+
+// Packs the A/C/G/T sequence 'seq' into *packed, 2 bits per base with the
+// first base in the most significant bits. Returns false if 'seq' has any
+// other character (such as N) or is longer than kMaxPackedLength.
+bool packSequence(std::string_view seq, uint64_t* packed);
+
+// The 'length' base sequence packSequence() packed into 'packed'.
+std::string unpackSequence(uint64_t packed, int length);
+
+// Open addressing hash table (linear probing) counting packed sequences.
+class PackedCountTable
+{
+public:
+  void add(uint64_t key, int count);
+  int64_t size() const { return size_; }
+
+  // Calls f(key, count) for every key counted, in no particular order.
+  template <typename F> void forEach(F f) const
+  {
+    for (Slot const& slot : slots_)
+      if (slot.count != 0)
+        f(slot.key, slot.count);
+  }
+
+private:
+  // A slot is empty while its count is 0.
+  struct Slot
+  {
+    uint64_t key;
+    int count;
+  };
+  void grow();
+
+  std::vector<Slot> slots_;
+  int64_t size_ = 0;
+};
+
+// Counts how many times each sequence is seen, for sequences that are mostly
+// 'length' A/C/G/T bases: those are counted by their packed form, in a dense
+// array up to kMaxDenseLength bases and a PackedCountTable beyond. Anything
+// else (N bases, reads cut short) is counted by the string itself.
+//
+// The dense array (64 MiB for 12 bases) can be shared by counters on several
+// threads; see sharingDenseCounts().
+class PackedSequenceCounter
+{
+public:
+  explicit PackedSequenceCounter(int length);
+  // Copies would share the dense array without meaning to.
+  PackedSequenceCounter(PackedSequenceCounter&&) = default;
+  PackedSequenceCounter& operator=(PackedSequenceCounter&&) = default;
+
+  // An empty counter that adds to this one's dense array (allocating it now),
+  // with a table and escaped counts of its own: each thread counting with
+  // its own counter then shares the one array. Adding the two counters
+  // leaves the shared counts as they are.
+  PackedSequenceCounter sharingDenseCounts();
+
+  void add(std::string_view seq, int count = 1);
+  PackedSequenceCounter& operator+=(PackedSequenceCounter const& rhs);
+
+  // Every sequence counted and its count, in no particular order.
+  std::vector<std::pair<std::string, int>> counts() const;
+
+  // Writes the counts to 'out', to be read back by load().
+  void save(StateWriter* out) const;
+  static PackedSequenceCounter load(StateReader* in);
+
+private:
+  bool packable() const { return length_ <= kMaxPackedLength; }
+  bool dense() const { return length_ <= kMaxDenseLength; }
+
+  // Indexed by packed sequence. Counters sharing it add atomically.
+  struct DenseCounts
+  {
+    explicit DenseCounts(size_t size) : size(size), counts(new std::atomic<int>[size]()) {}
+    size_t size;
+    std::unique_ptr<std::atomic<int>[]> counts;
+  };
+  void allocateDenseCounts();
+
+  int length_;
+  // Allocated with the first count (or sharingDenseCounts()).
+  std::shared_ptr<DenseCounts> dense_counts_;
+  PackedCountTable table_counts_;
+  std::unordered_map<std::string, int> escaped_counts_;
+};
+
+#endif // __SCTOOLS_FASTQPREPROCESSING_PACKED_COUNTS_H_
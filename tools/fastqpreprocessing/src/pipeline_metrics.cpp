@@ -0,0 +1,136 @@
+#include "pipeline_metrics.h"
+
+#include <sstream>
+
+#include "input_options.h"
+
+std::string jsonString(std::string const& s)
+{
+  std::string ret = "\"";
+  for (char c : s)
+  {
+    if (c == '"' || c == '\\')
+      ret += '\\';
+    if (static_cast<unsigned char>(c) < 0x20)
+    {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      ret += escaped;
+    }
+    else
+    {
+      ret += c;
+    }
+  }
+  return ret + "\"";
+}
+
+namespace
+{
+double rate(int64_t now, int64_t before, double seconds)
+{
+  return seconds > 0 ? (now - before) / seconds : 0;
+}
+} // namespace
+
+std::string metricsToJson(MetricsSnapshot const& now, MetricsSnapshot const* previous)
+{
+  constexpr double kMB = 1000.0 * 1000.0;
+  double seconds = now.elapsed_sec - (previous ? previous->elapsed_sec : 0);
+  // A reader or shard missing from 'previous' counts from zero.
+  auto previous_reader = [&](int i) {
+    return previous && i < previous->readers.size() ? previous->readers[i] : ReaderMetrics();
+  };
+  auto previous_shard = [&](int i) {
+    return previous && i < previous->shards.size() ? previous->shards[i] : ShardMetrics();
+  };
+
+  std::ostringstream json;
+  json << "{\"elapsed_sec\":" << now.elapsed_sec << ",\"readers\":[";
+  int64_t total_reads = 0;
+  int64_t total_previous_reads = 0;
+  for (int i = 0; i < now.readers.size(); i++)
+  {
+    ReaderMetrics const& reader = now.readers[i];
+    ReaderMetrics const before = previous_reader(i);
+    total_reads += reader.reads;
+    total_previous_reads += before.reads;
+    json << (i ? "," : "") << "{\"input\":" << jsonString(reader.input)
+         << ",\"reads\":" << reader.reads
+         << ",\"reads_per_sec\":" << rate(reader.reads, before.reads, seconds)
+         << ",\"inflated_bytes\":" << reader.inflated_bytes
+         << ",\"inflated_mb_per_sec\":" << rate(reader.inflated_bytes, before.inflated_bytes, seconds) / kMB
+         << ",\"blocked_sec\":" << reader.blocked_sec
+         << ",\"barcodes_correct\":" << reader.barcodes_correct
+         << ",\"barcodes_corrected\":" << reader.barcodes_corrected
+         << ",\"barcodes_uncorrectable\":" << reader.barcodes_uncorrectable << "}";
+  }
+  json << "],\"shards\":[";
+  for (int i = 0; i < now.shards.size(); i++)
+  {
+    ShardMetrics const& shard = now.shards[i];
+    ShardMetrics const before = previous_shard(i);
+    json << (i ? "," : "") << "{\"queue_depth\":" << shard.queue_depth
+         << ",\"records\":" << shard.records
+         << ",\"uncompressed_bytes\":" << shard.uncompressed_bytes
+         << ",\"deflated_bytes\":" << shard.deflated_bytes
+         << ",\"deflated_mb_per_sec\":" << rate(shard.deflated_bytes, before.deflated_bytes, seconds) / kMB
+         << ",\"blocked_sec\":" << shard.blocked_sec << "}";
+  }
+  json << "],\"reads_per_sec\":" << rate(total_reads, total_previous_reads, seconds) << "}";
+  return json.str();
+}
+
+MetricsReporter::MetricsReporter(std::string path, int interval_sec,
+                                 std::function<MetricsSnapshot()> sample)
+  : out_(path, std::ios::app), interval_(interval_sec), sample_(sample)
+{
+  if (!out_)
+    crash("ERROR: Failed to open metrics file " + path + " for writing");
+}
+
+MetricsReporter::~MetricsReporter()
+{
+  stop();
+}
+
+void MetricsReporter::start()
+{
+  thread_ = std::thread(&MetricsReporter::run, this);
+}
+
+void MetricsReporter::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_)
+      return;
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable())
+    thread_.join();
+  report();
+}
+
+void MetricsReporter::run()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!cv_.wait_for(lock, interval_, [&] { return stopping_; }))
+    report();
+}
+
+void MetricsReporter::report()
+{
+  MetricsSnapshot now = sample_();
+  out_ << metricsToJson(now, &previous_) << std::endl;
+  previous_ = now;
+}
+
+void writeMetricsSummary(std::string const& path, MetricsSnapshot const& final_snapshot)
+{
+  std::ofstream out(path);
+  out << metricsToJson(final_snapshot, nullptr) << std::endl;
+  if (!out)
+    crash("ERROR: Failed to write metrics summary " + path);
+}
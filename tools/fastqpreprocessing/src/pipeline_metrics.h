@@ -0,0 +1,83 @@
+#ifndef __SCTOOLS_FASTQPREPROCESSING_PIPELINE_METRICS_H_
+#define __SCTOOLS_FASTQPREPROCESSING_PIPELINE_METRICS_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Counters of one reader thread, as of a MetricsSnapshot.
+struct ReaderMetrics
+{
+  std::string input;            // the reader's R1 file
+  int64_t reads = 0;
+  int64_t inflated_bytes = 0;   // FASTQ text parsed, across all its inputs
+  double blocked_sec = 0;       // waiting for an arena record to be released
+  int64_t barcodes_correct = 0;       // whitelist hits
+  int64_t barcodes_corrected = 0;     // hits after correcting one base
+  int64_t barcodes_uncorrectable = 0; // misses
+};
+
+// Counters of one writer thread (shard), as of a MetricsSnapshot.
+struct ShardMetrics
+{
+  int64_t queue_depth = 0;
+  int64_t records = 0;
+  // Only known for FASTQ shards; libStatGen does its own BAM compression.
+  int64_t uncompressed_bytes = 0;
+  // For BAM shards, as written to the file so far (0 when streamed to a FIFO).
+  int64_t deflated_bytes = 0;
+  double blocked_sec = 0;       // waiting for its queue to get a record
+};
+
+struct MetricsSnapshot
+{
+  double elapsed_sec = 0;
+  std::vector<ReaderMetrics> readers;
+  std::vector<ShardMetrics> shards;
+};
+
+// 's' as a quoted and escaped JSON string.
+std::string jsonString(std::string const& s);
+
+// One JSON object (no trailing newline) describing 'now'. Rates (reads_per_sec,
+// and MB/s for bytes) are over the time since 'previous', or over the whole
+// run if 'previous' is null.
+std::string metricsToJson(MetricsSnapshot const& now, MetricsSnapshot const* previous);
+
+// Every interval_sec, appends metricsToJson() of a fresh sample() to the file
+// at 'path' as a JSON line, so that a running job can be watched with tail -f.
+class MetricsReporter
+{
+public:
+  MetricsReporter(std::string path, int interval_sec, std::function<MetricsSnapshot()> sample);
+  ~MetricsReporter();
+
+  void start();
+  // Writes one last line, and stops.
+  void stop();
+
+private:
+  void run();
+  void report();
+
+  std::ofstream out_;
+  std::chrono::seconds interval_;
+  std::function<MetricsSnapshot()> sample_;
+  MetricsSnapshot previous_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_ = false;
+  std::thread thread_;
+};
+
+// Writes metricsToJson() of the whole run to 'path'.
+void writeMetricsSummary(std::string const& path, MetricsSnapshot const& final_snapshot);
+
+#endif // __SCTOOLS_FASTQPREPROCESSING_PIPELINE_METRICS_H_
@@ -0,0 +1,79 @@
+#include "quality_binning.h"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "input_options.h"
+
+constexpr int kPhredOffset = 33;
+constexpr int kMaxPhred = 126 - kPhredOffset;
+
+QualityBinning::QualityBinning()
+{
+  for (int i = 0; i < table_.size(); i++)
+    table_[i] = static_cast<char>(i);
+}
+
+void QualityBinning::addBin(int low, int high, int score)
+{
+  if (low < 0 || low > high || high > kMaxPhred || score < 0 || score > kMaxPhred)
+    crash("ERROR: Invalid quality bin " + std::to_string(low) + "-" + std::to_string(high) + " -> " +
+          std::to_string(score) + "; scores must be between 0 and " + std::to_string(kMaxPhred) + ".");
+  for (int q = low; q <= high; q++)
+    table_[q + kPhredOffset] = static_cast<char>(score + kPhredOffset);
+}
+
+QualityBinning QualityBinning::illumina8()
+{
+  QualityBinning binning;
+  binning.addBin(2, 9, 6);
+  binning.addBin(10, 19, 15);
+  binning.addBin(20, 24, 22);
+  binning.addBin(25, 29, 27);
+  binning.addBin(30, 34, 33);
+  binning.addBin(35, 39, 37);
+  binning.addBin(40, kMaxPhred, 40);
+  return binning;
+}
+
+QualityBinning QualityBinning::fromTableFile(std::string const& path)
+{
+  std::ifstream in(path);
+  if (!in)
+    crash("ERROR: Failed to open quality binning table " + path);
+  QualityBinning binning;
+  std::string line;
+  while (std::getline(in, line))
+  {
+    line = line.substr(0, line.find('#'));
+    if (line.find_first_not_of(" \t\r") == std::string::npos)
+      continue;
+    std::istringstream fields(line);
+    int low, high, score;
+    std::string rest;
+    if (!(fields >> low >> high >> score) || (fields >> rest))
+      crash("ERROR: Malformed line in quality binning table " + path + ": " + line);
+    binning.addBin(low, high, score);
+  }
+  return binning;
+}
+
+QualityBinning QualityBinning::fromOption(std::string const& option)
+{
+  return option == "illumina8" ? illumina8() : fromTableFile(option);
+}
+
+std::string QualityBinning::map(const char* qualities) const
+{
+  std::string ret;
+  map(qualities, &ret);
+  return ret;
+}
+
+void QualityBinning::map(const char* qualities, std::string* out) const
+{
+  out->assign(qualities, strlen(qualities));
+  for (char& c : *out)
+    c = map(c);
+}
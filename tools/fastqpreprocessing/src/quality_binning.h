@@ -0,0 +1,39 @@
+#ifndef __SCTOOLS_FASTQPREPROCESSING_QUALITY_BINNING_H_
+#define __SCTOOLS_FASTQPREPROCESSING_QUALITY_BINNING_H_
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+// Maps Phred+33 quality characters to fewer distinct values, which makes the
+// quality strings compress much better. Scores no bin covers, and anything
+// that isn't a quality character, are left as they are.
+class QualityBinning
+{
+public:
+  // Illumina's 8-level scheme: 2-9 -> 6, 10-19 -> 15, 20-24 -> 22,
+  // 25-29 -> 27, 30-34 -> 33, 35-39 -> 37, 40+ -> 40 (0 and 1, i.e. no-calls,
+  // are kept).
+  static QualityBinning illumina8();
+  // A table of "<low> <high> <score>" lines, one bin per line: Phred scores
+  // low to high inclusive become 'score'. Blank lines and '#' comments are
+  // ignored.
+  static QualityBinning fromTableFile(std::string const& path);
+  // "illumina8" or the path of a table file.
+  static QualityBinning fromOption(std::string const& option);
+
+  // Maps one bin of Phred scores (0-93) to 'score'.
+  void addBin(int low, int high, int score);
+
+  char map(char quality) const { return table_[static_cast<uint8_t>(quality)]; }
+  std::string map(const char* qualities) const;
+  // Writes the mapped 'qualities' to *out, reusing its memory.
+  void map(const char* qualities, std::string* out) const;
+
+private:
+  QualityBinning();
+
+  std::array<char, 256> table_;
+};
+
+#endif // __SCTOOLS_FASTQPREPROCESSING_QUALITY_BINNING_H_
@@ -0,0 +1,126 @@
+#include "read_trimmer.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+// Branch-free, so that it vectorizes.
+int countMismatches(const char* a, const char* b, int n)
+{
+  int mismatches = 0;
+  for (int i = 0; i < n; i++)
+    mismatches += a[i] != b[i];
+  return mismatches;
+}
+
+bool oligoMatches(const char* sequence, const char* oligo, int overlap)
+{
+  return overlap >= ReadTrimmer::kMinOligoOverlap && countMismatches(sequence, oligo, overlap) <= overlap / 10;
+}
+} // namespace
+
+void TrimCounts::add(TrimCounts const& other)
+{
+  reads += other.reads;
+  tso_trimmed += other.tso_trimmed;
+  adapter_trimmed += other.adapter_trimmed;
+  poly_a_trimmed += other.poly_a_trimmed;
+  bases_trimmed += other.bases_trimmed;
+  too_short += other.too_short;
+  low_complexity += other.low_complexity;
+}
+
+int findAdapter(const char* sequence, int length, std::string const& adapter)
+{
+  for (int start = 0; start + ReadTrimmer::kMinOligoOverlap <= length; start++)
+  {
+    int overlap = std::min<int>(adapter.size(), length - start);
+    if (oligoMatches(sequence + start, adapter.data(), overlap))
+      return start;
+  }
+  return length;
+}
+
+int findTsoEnd(const char* sequence, int length, std::string const& tso)
+{
+  int tso_length = tso.size();
+  for (int start = 0; start + tso_length <= length; start++)
+    if (oligoMatches(sequence + start, tso.data(), tso_length))
+      return start + tso_length;
+  // Then the longest end of the TSO the read starts with.
+  for (int overlap = std::min(tso_length - 1, length); overlap >= ReadTrimmer::kMinOligoOverlap; overlap--)
+    if (oligoMatches(sequence, tso.data() + tso_length - overlap, overlap))
+      return overlap;
+  return 0;
+}
+
+int polyATailLength(const char* sequence, int length)
+{
+  // 8 bases at a time while they're all As.
+  constexpr uint64_t kEightAs = 0x4141414141414141;
+  int run = 0;
+  while (length - run >= 8)
+  {
+    uint64_t word;
+    memcpy(&word, sequence + length - run - 8, sizeof(word));
+    if (word != kEightAs)
+      break;
+    run += 8;
+  }
+  while (run < length && sequence[length - run - 1] == 'A')
+    run++;
+  return run;
+}
+
+double sequenceComplexity(const char* sequence, int length)
+{
+  if (length < 2)
+    return 0;
+  int changes = 0;
+  for (int i = 0; i + 1 < length; i++)
+    changes += sequence[i] != sequence[i + 1];
+  return changes / static_cast<double>(length - 1);
+}
+
+ReadTrimmer::ReadTrimmer(TrimOptions options) : options_(std::move(options)) {}
+
+TrimResult ReadTrimmer::trim(const char* sequence, int length, TrimCounts* counts) const
+{
+  TrimResult result{0, length, true};
+  counts->reads++;
+  if (!options_.tso.empty())
+  {
+    result.start = findTsoEnd(sequence, length, options_.tso);
+    counts->tso_trimmed += result.start > 0;
+  }
+  if (!options_.adapter.empty())
+  {
+    int adapter_start = result.start + findAdapter(sequence + result.start, length - result.start, options_.adapter);
+    counts->adapter_trimmed += adapter_start < length;
+    result.end = adapter_start;
+  }
+  if (options_.poly_a_length > 0)
+  {
+    int run = polyATailLength(sequence + result.start, result.end - result.start);
+    if (run >= options_.poly_a_length)
+    {
+      result.end -= run;
+      counts->poly_a_trimmed++;
+    }
+  }
+  counts->bases_trimmed += length - (result.end - result.start);
+
+  if (result.end - result.start < std::max(options_.min_length, 1))
+  {
+    result.keep = false;
+    counts->too_short++;
+  }
+  else if (options_.min_complexity > 0 &&
+           sequenceComplexity(sequence + result.start, result.end - result.start) < options_.min_complexity)
+  {
+    result.keep = false;
+    counts->low_complexity++;
+  }
+  return result;
+}
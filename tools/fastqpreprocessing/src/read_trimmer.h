@@ -0,0 +1,82 @@
+#ifndef __SCTOOLS_FASTQPREPROCESSING_READ_TRIMMER_H_
+#define __SCTOOLS_FASTQPREPROCESSING_READ_TRIMMER_H_
+
+#include <cstdint>
+#include <string>
+
+// What to trim from the cDNA read (R2; R1 for scATAC), and which reads to
+// drop afterwards. Everything is off by default.
+struct TrimOptions
+{
+  // Template switch oligo: removed, with everything before it, when found
+  // near the 5' end (a suffix of it at the very start is enough).
+  std::string tso;
+  // Removed, with everything after it, wherever it starts (a prefix of it
+  // at the very end is enough).
+  std::string adapter;
+  // A trailing run of at least this many As is removed (0 = don't).
+  int poly_a_length = 0;
+  // Reads shorter than this after trimming are dropped. Reads trimmed away
+  // entirely are dropped regardless, as SEQ can't be empty.
+  int min_length = 0;
+  // Reads whose fraction of bases differing from the next base is below this
+  // are dropped, e.g. all-G no-signal reads.
+  double min_complexity = 0;
+
+  bool enabled() const
+  {
+    return !tso.empty() || !adapter.empty() || poly_a_length > 0 || min_length > 0 || min_complexity > 0;
+  }
+};
+
+// Tallies of what trimming removed, summed over reads.
+struct TrimCounts
+{
+  int64_t reads = 0;
+  int64_t tso_trimmed = 0;
+  int64_t adapter_trimmed = 0;
+  int64_t poly_a_trimmed = 0;
+  int64_t bases_trimmed = 0;
+  int64_t too_short = 0;
+  int64_t low_complexity = 0;
+
+  void add(TrimCounts const& other);
+};
+
+// The part of a read to keep: bases [start, end), if keep.
+struct TrimResult
+{
+  int start;
+  int end;
+  bool keep;
+};
+
+// Finds what TrimOptions says to trim from a read. An oligo matches where it
+// has at most 1 mismatch per 10 bases of overlap with the read, and overlaps
+// by at least kMinOligoOverlap bases. The base comparisons are simple loops
+// over bytes the compiler vectorizes.
+class ReadTrimmer
+{
+public:
+  static constexpr int kMinOligoOverlap = 3;
+
+  explicit ReadTrimmer(TrimOptions options);
+
+  // Thread safe; adds to 'counts'.
+  TrimResult trim(const char* sequence, int length, TrimCounts* counts) const;
+
+private:
+  TrimOptions options_;
+};
+
+// Exposed for testing.
+// Where the 3' 'adapter' starts in 'sequence', or 'length' if it isn't there.
+int findAdapter(const char* sequence, int length, std::string const& adapter);
+// Where the read after the 5' 'tso' starts, or 0 if it isn't there.
+int findTsoEnd(const char* sequence, int length, std::string const& tso);
+// Length of the run of As ending 'sequence'.
+int polyATailLength(const char* sequence, int length);
+// Fraction of bases that differ from the next one.
+double sequenceComplexity(const char* sequence, int length);
+
+#endif // __SCTOOLS_FASTQPREPROCESSING_READ_TRIMMER_H_
@@ -0,0 +1,141 @@
+#include "sample_demux.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+
+#include "input_options.h"
+
+SampleSheet readSampleSheet(std::string const& path)
+{
+  std::ifstream in(path);
+  if (!in)
+    crash("ERROR: Failed to open sample sheet " + path);
+  SampleSheet sheet;
+  std::set<std::string> names;
+  std::string line;
+  while (std::getline(in, line))
+  {
+    line = line.substr(0, line.find('#'));
+    std::replace(line.begin(), line.end(), ',', ' ');
+    std::istringstream fields(line);
+    SampleSheet::Row row;
+    if (!(fields >> row.name))
+      continue;
+    std::string rest;
+    if (!(fields >> row.index1) || ((fields >> row.index2) && (fields >> rest)))
+      crash("ERROR: Malformed line in sample sheet " + path + ": " + line);
+    for (std::string const* index : {&row.index1, &row.index2})
+      if (index->find_first_not_of("ACGT") != std::string::npos)
+        crash("ERROR: Index other than ACGT in sample sheet " + path + ": " + line);
+    if (row.name == "." || row.name == ".." || row.name == kUndeterminedSampleName ||
+        row.name.find('/') != std::string::npos)
+    {
+      crash("ERROR: Sample name '" + row.name + "' in sample sheet " + path + " can't be used.");
+    }
+    if (names.insert(row.name).second)
+      sheet.samples.push_back(row.name);
+    sheet.rows.push_back(row);
+  }
+  if (sheet.rows.empty())
+    crash("ERROR: Sample sheet " + path + " lists no samples.");
+
+  SampleSheet::Row const& first = sheet.rows.front();
+  for (SampleSheet::Row const& row : sheet.rows)
+    if (row.index1.size() != first.index1.size() || row.index2.size() != first.index2.size())
+      crash("ERROR: Sample " + row.name + "'s indexes in sample sheet " + path +
+            " have a different length than " + first.name + "'s.");
+  return sheet;
+}
+
+namespace
+{
+// Adds each of the indexes (keys of 'samples_of_index') to 'corrector',
+// crashing if two of them are close enough to share a 1-mismatch neighbor,
+// unless both are only of the same sample: a read between them then goes to
+// that sample (or none) whichever it's corrected to.
+void addIndexes(WhiteListCorrector& corrector, std::map<std::string, std::set<std::string>> const& samples_of_index,
+                const char* column)
+{
+  for (auto const& [index, samples] : samples_of_index)
+  {
+    std::string neighbor = index;
+    for (int i = 0; i < index.size(); i++)
+    {
+      for (char base : {'A', 'C', 'G', 'T', 'N'})
+      {
+        neighbor[i] = base;
+        if (auto it = corrector.mutations.find(neighbor); it != corrector.mutations.end())
+        {
+          std::string const& other = it->second == -1 ? neighbor : corrector.whitelist[it->second];
+          if (samples.size() != 1 || samples_of_index.at(other) != samples)
+            crash(std::string("ERROR: ") + column + " indexes " + index + " and " + other +
+                  " are too similar to tell apart with 1 mismatch.");
+        }
+      }
+      neighbor[i] = index[i];
+    }
+    addMutationsOfBarcodeToWhiteList(corrector, index);
+  }
+}
+
+// The sheet index the first 'length' bases of 'read' are corrected to, or
+// empty if there's none.
+std::string correctIndex(WhiteListCorrector const& corrector, const char* read, size_t length)
+{
+  if (strnlen(read, length) < length)
+    return "";
+  std::string index(read, length);
+  auto it = corrector.mutations.find(index);
+  if (it == corrector.mutations.end())
+    return "";
+  return it->second == -1 ? index : corrector.whitelist[it->second];
+}
+} // namespace
+
+SampleDemultiplexer::SampleDemultiplexer(SampleSheet sheet)
+  : sheet_(std::move(sheet)),
+    index1_length_(sheet_.rows.front().index1.size()),
+    index2_length_(sheet_.rows.front().index2.size())
+{
+  std::map<std::string, std::set<std::string>> samples_of_index1, samples_of_index2;
+  for (SampleSheet::Row const& row : sheet_.rows)
+  {
+    samples_of_index1[row.index1].insert(row.name);
+    samples_of_index2[row.index2].insert(row.name);
+  }
+  addIndexes(index1_corrector_, samples_of_index1, "I1");
+  if (dualIndex())
+    addIndexes(index2_corrector_, samples_of_index2, "I2");
+
+  std::unordered_map<std::string, int> sample_numbers;
+  for (int i = 0; i < sheet_.samples.size(); i++)
+    sample_numbers[sheet_.samples[i]] = i;
+  for (SampleSheet::Row const& row : sheet_.rows)
+  {
+    std::string key = dualIndex() ? row.index1 + "+" + row.index2 : row.index1;
+    int sample = sample_numbers[row.name];
+    auto [it, added] = sample_of_indexes_.emplace(key, sample);
+    if (!added && it->second != sample)
+      crash("ERROR: Samples " + sampleName(it->second) + " and " + row.name + " have the same indexes.");
+  }
+}
+
+int SampleDemultiplexer::assign(const char* i1, const char* i2) const
+{
+  std::string key = correctIndex(index1_corrector_, i1, index1_length_);
+  if (key.empty())
+    return kUndetermined;
+  if (dualIndex())
+  {
+    std::string index2 = correctIndex(index2_corrector_, i2, index2_length_);
+    if (index2.empty())
+      return kUndetermined;
+    key += "+" + index2;
+  }
+  auto it = sample_of_indexes_.find(key);
+  return it == sample_of_indexes_.end() ? kUndetermined : it->second;
+}
@@ -0,0 +1,66 @@
+#ifndef __SCTOOLS_FASTQPREPROCESSING_SAMPLE_DEMUX_H_
+#define __SCTOOLS_FASTQPREPROCESSING_SAMPLE_DEMUX_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "whitelist_corrector.h"
+
+// The libraries sequenced together on a lane, and their sample indexes. A
+// sample may have several rows, e.g. the 4 oligos of a 10x SI-GA index set.
+struct SampleSheet
+{
+  struct Row
+  {
+    std::string name;
+    std::string index1;
+    std::string index2; // empty for single-index sheets
+  };
+  std::vector<Row> rows;
+  // The distinct names of 'rows', in the order they first appear.
+  std::vector<std::string> samples;
+};
+
+// Reads a sample sheet of "<name> <index1> [<index2>]" lines, separated by
+// tabs, spaces or commas. Either every row has an index2 or none does.
+// Blank lines and '#' comments are ignored. Crashes on malformed sheets,
+// including names that can't be used as a directory name.
+SampleSheet readSampleSheet(std::string const& path);
+
+// Assigns reads to samples by their I1 (and I2) index reads. Each index read
+// is corrected to its column of the sheet like barcodes are to the whitelist:
+// an index within 1 mismatch of a row's is taken as that index. Index reads
+// longer than the sheet's indexes are matched on their first bases.
+class SampleDemultiplexer
+{
+public:
+  static constexpr int kUndetermined = -1;
+
+  // Crashes if two indexes in a column of different samples are within 2
+  // mismatches of each other, since a read 1 mismatch from both couldn't be
+  // told apart, or if two samples have the same indexes.
+  explicit SampleDemultiplexer(SampleSheet sheet);
+
+  // The index into the sheet's samples of the read with these index reads
+  // (i2 is ignored for single-index sheets), or kUndetermined.
+  int assign(const char* i1, const char* i2) const;
+
+  bool dualIndex() const { return !sheet_.rows.front().index2.empty(); }
+  int numSamples() const { return sheet_.samples.size(); }
+  std::string const& sampleName(int sample) const { return sheet_.samples[sample]; }
+
+private:
+  SampleSheet sheet_;
+  WhiteListCorrector index1_corrector_;
+  WhiteListCorrector index2_corrector_;
+  size_t index1_length_;
+  size_t index2_length_;
+  // Keyed by index1 + "+" + index2 (just index1 for single-index sheets).
+  std::unordered_map<std::string, int> sample_of_indexes_;
+};
+
+// Name of the output directory of reads that match no sample.
+constexpr char kUndeterminedSampleName[] = "Undetermined";
+
+#endif // __SCTOOLS_FASTQPREPROCESSING_SAMPLE_DEMUX_H_
@@ -17,6 +17,6 @@ int main(int argc, char** argv)
 
   mainCommon(options.white_list_file, options.barcode_orientation, /*num_writer_threads=*/1, options.output_format,
              options.I1s, options.R1s, options.R2s, options.R3s, options.sample_id, g_parsed_read_structure,
-             true);
+             true, options.pipeline);
   return 0;
 }
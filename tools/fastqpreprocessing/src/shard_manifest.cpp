@@ -0,0 +1,80 @@
+#include "shard_manifest.h"
+
+#include <fstream>
+#include <sstream>
+#include <string_view>
+
+#include "input_options.h"
+#include "pipeline_metrics.h"
+
+void ShardBarcodeCounter::resume(BarcodeTallies const& tallies)
+{
+  tallies_ = tallies;
+  resumed_ = true;
+}
+
+void ShardBarcodeCounter::add(const char* cb, BarcodeMatch match)
+{
+  if (match == BarcodeMatch::kUncorrectable)
+  {
+    tallies_.uncorrectable++;
+    return;
+  }
+  if (match == BarcodeMatch::kCorrect)
+    tallies_.correct++;
+  else
+    tallies_.corrected++;
+  if (!resumed_)
+    distinct_.insert(std::hash<std::string_view>{}(cb));
+}
+
+namespace
+{
+void barcodesToJson(std::ostream& json, BarcodeTallies const& barcodes)
+{
+  json << "{\"correct\":" << barcodes.correct << ",\"corrected\":" << barcodes.corrected
+       << ",\"uncorrectable\":" << barcodes.uncorrectable;
+}
+
+// -1 stands for unknown.
+std::string countOrNull(int64_t count)
+{
+  return count < 0 ? "null" : std::to_string(count);
+}
+} // namespace
+
+std::string outputManifestToJson(OutputManifest const& manifest)
+{
+  std::ostringstream json;
+  json << "{\"output_format\":" << jsonString(manifest.output_format) << ",\"barcodes\":";
+  barcodesToJson(json, manifest.barcodes);
+  json << "},\"shards\":[";
+  for (int i = 0; i < manifest.shards.size(); i++)
+  {
+    ShardSummary const& shard = manifest.shards[i];
+    json << (i ? "," : "") << "\n{\"shard\":" << i;
+    if (!shard.sample.empty())
+      json << ",\"sample\":" << jsonString(shard.sample);
+    json << ",\"records\":" << shard.records << ",\"barcodes\":";
+    barcodesToJson(json, shard.barcodes);
+    json << ",\"distinct\":" << countOrNull(shard.distinct_barcodes) << "},\"files\":[";
+    for (int j = 0; j < shard.files.size(); j++)
+    {
+      ShardFileSummary const& file = shard.files[j];
+      json << (j ? "," : "") << "{\"path\":" << jsonString(file.path)
+           << ",\"bytes\":" << countOrNull(file.bytes)
+           << ",\"md5\":" << (file.md5.empty() ? "null" : jsonString(file.md5)) << "}";
+    }
+    json << "]}";
+  }
+  json << "]}";
+  return json.str();
+}
+
+void writeOutputManifest(std::string const& path, OutputManifest const& manifest)
+{
+  std::ofstream out(path);
+  out << outputManifestToJson(manifest) << std::endl;
+  if (!out)
+    crash("ERROR: Failed to write output manifest " + path);
+}
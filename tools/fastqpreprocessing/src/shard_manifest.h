@@ -0,0 +1,83 @@
+#ifndef __SCTOOLS_FASTQPREPROCESSING_SHARD_MANIFEST_H_
+#define __SCTOOLS_FASTQPREPROCESSING_SHARD_MANIFEST_H_
+
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// The output manifest, written next to the shards at the end of a run, says
+// for each shard how many records it holds, how their barcodes fared, and the
+// size and MD5 of each of its files, so that downstream steps needn't read
+// the outputs back to find out.
+
+struct BarcodeTallies
+{
+  int64_t correct = 0;
+  int64_t corrected = 0;
+  int64_t uncorrectable = 0;
+};
+
+struct ShardFileSummary
+{
+  std::string path;
+  int64_t bytes = -1;  // -1 if unknown
+  std::string md5;     // empty if unknown (a BAM shard written to a FIFO)
+};
+
+struct ShardSummary
+{
+  // With --sample-sheet, the sample the shard holds reads of.
+  std::string sample;
+  // Records written to the shard's files.
+  int64_t records = 0;
+  BarcodeTallies barcodes;
+  // Distinct corrected barcodes in the shard; -1 if unknown (after --resume).
+  int64_t distinct_barcodes = -1;
+  std::vector<ShardFileSummary> files;
+};
+
+struct OutputManifest
+{
+  std::string output_format;
+  // Over all reads, including any a FASTQ shard left out for sample_bool.
+  BarcodeTallies barcodes;
+  std::vector<ShardSummary> shards;
+};
+
+// How a read's barcode matched the whitelist, as its reader found it.
+enum class BarcodeMatch
+{
+  kCorrect,
+  kCorrected,
+  kUncorrectable,
+};
+
+// Counts a shard's records by barcode outcome, and its distinct corrected
+// barcodes.
+class ShardBarcodeCounter
+{
+public:
+  // Continues from the tallies of a checkpoint, if resuming; the distinct
+  // barcodes from before it are then unknown.
+  void resume(BarcodeTallies const& tallies);
+  // cb is the record's CB tag (empty if it's uncorrectable). It is the
+  // translated barcode with --barcode-translation, so it can't tell a
+  // correct barcode from a corrected one by itself.
+  void add(const char* cb, BarcodeMatch match);
+
+  BarcodeTallies const& tallies() const { return tallies_; }
+  int64_t distinctBarcodes() const { return resumed_ ? -1 : distinct_.size(); }
+
+private:
+  BarcodeTallies tallies_;
+  bool resumed_ = false;
+  // Hashes rather than strings: a collision among a shard's barcodes is
+  // vanishingly unlikely, and this is a fraction of the memory.
+  std::unordered_set<uint64_t> distinct_;
+};
+
+std::string outputManifestToJson(OutputManifest const& manifest);
+void writeOutputManifest(std::string const& path, OutputManifest const& manifest);
+
+#endif // __SCTOOLS_FASTQPREPROCESSING_SHARD_MANIFEST_H_
@@ -0,0 +1,188 @@
+#include "thread_tuner.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <sched.h>
+
+// Rough figures from `make bench`; only their ratios matter.
+double readerMicrosPerRead()
+{
+  return 5.0;
+}
+
+double writerMicrosPerRead(std::string const& output_format, int compression_level)
+{
+  if (output_format == "BAM")
+    return compression_level == 0 ? 2.0 : 20.0;
+  switch (compression_level)
+  {
+  case 0:
+    return 1.2;
+  case 1:
+    return 4.0;
+  case 2:
+  case 3:
+    return 6.0;
+  case 4:
+  case 5:
+    return 12.0;
+  case 7:
+  case 8:
+  case 9:
+    return 45.0;
+  default: // 6, and -1 which means 6
+    return 29.0;
+  }
+}
+
+ThreadPlan planThreads(int cores, std::vector<int64_t> const& input_bytes, int num_writers,
+                       std::string const& output_format, int compression_level)
+{
+  ThreadPlan plan;
+  plan.cores = std::max(cores, 1);
+  plan.num_readers = std::max<int>(input_bytes.size(), 1);
+  plan.num_writers = num_writers;
+
+  int64_t total = 0;
+  int64_t largest = 0;
+  bool all_known = true;
+  for (int64_t bytes : input_bytes)
+  {
+    total += bytes;
+    largest = std::max(largest, bytes);
+    all_known = all_known && bytes > 0;
+  }
+  plan.input_parallelism = all_known && largest > 0 ? static_cast<double>(total) / largest : plan.num_readers;
+
+  double reader_cost = readerMicrosPerRead();
+  double writer_cost = writerMicrosPerRead(output_format, compression_level);
+  plan.reader_share = reader_cost / (reader_cost + writer_cost);
+
+  int slots = std::ceil(plan.cores * plan.reader_share);
+  slots = std::min<int>(slots, std::ceil(plan.input_parallelism));
+  plan.reader_slots = std::clamp(slots, 1, plan.num_readers);
+  return plan;
+}
+
+int availableCores()
+{
+  cpu_set_t cpus;
+  if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
+    return CPU_COUNT(&cpus);
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+bool ReaderSlots::tryAcquire(std::chrono::milliseconds timeout)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!cv_.wait_for(lock, timeout, [&] { return in_use_ < limit_; }))
+    return false;
+  in_use_++;
+  return true;
+}
+
+void ReaderSlots::release()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    in_use_--;
+  }
+  cv_.notify_one();
+}
+
+bool ReaderSlots::overLimit()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return in_use_ > limit_;
+}
+
+void ReaderSlots::setLimit(int limit)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    limit_ = limit;
+  }
+  cv_.notify_all();
+}
+
+int ReaderSlots::limit()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return limit_;
+}
+
+int adjustReaderSlots(int slots, int num_readers, double reader_blocked_fraction,
+                      double writer_blocked_fraction)
+{
+  // Writers idle while readers are busy: the readers are the bottleneck.
+  if (writer_blocked_fraction > 0.5 && reader_blocked_fraction < 0.2)
+    return std::min(slots + 1, num_readers);
+  // Readers mostly waiting for the writers: fewer of them would do, leaving
+  // the CPU to the writers.
+  if (reader_blocked_fraction > 0.5 && writer_blocked_fraction < 0.2)
+    return std::max(slots - 1, 1);
+  return slots;
+}
+
+ThreadTuner::ThreadTuner(ThreadPlan const& plan, ReaderSlots* slots, std::chrono::milliseconds interval,
+                         std::function<std::pair<int64_t, int64_t>()> sample)
+  : plan_(plan), slots_(slots), interval_(interval), sample_(sample),
+    min_slots_(plan.reader_slots), max_slots_(plan.reader_slots) {}
+
+ThreadTuner::~ThreadTuner()
+{
+  stop();
+}
+
+void ThreadTuner::start()
+{
+  thread_ = std::thread(&ThreadTuner::run, this);
+}
+
+void ThreadTuner::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void ThreadTuner::run()
+{
+  auto [reader_blocked_before, writer_blocked_before] = sample_();
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!cv_.wait_for(lock, interval_, [&] { return stopping_; }))
+  {
+    auto [reader_blocked, writer_blocked] = sample_();
+    double interval_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(interval_).count();
+    int slots = slots_->limit();
+    double reader_fraction = (reader_blocked - reader_blocked_before) / (interval_ns * slots);
+    double writer_fraction = (writer_blocked - writer_blocked_before) / (interval_ns * plan_.num_writers);
+    reader_blocked_before = reader_blocked;
+    writer_blocked_before = writer_blocked;
+
+    int new_slots = adjustReaderSlots(slots, plan_.num_readers, reader_fraction, writer_fraction);
+    if (new_slots != slots)
+    {
+      slots_->setLimit(new_slots);
+      adjustments_++;
+      min_slots_ = std::min(min_slots_, new_slots);
+      max_slots_ = std::max(max_slots_, new_slots);
+    }
+  }
+}
+
+void ThreadTuner::printReport()
+{
+  printf("Thread plan: %d cores, %d writers, readers get %.0f%% of the work per read.\n",
+         plan_.cores, plan_.num_writers, plan_.reader_share * 100);
+  printf("  reader slots: started at %d of %d (input parallelism %.1f), ended at %d",
+         plan_.reader_slots, plan_.num_readers, plan_.input_parallelism, slots_->limit());
+  if (adjustments_ > 0)
+    printf(" after %d adjustments (range %d-%d)", adjustments_, min_slots_, max_slots_);
+  printf("\n");
+}
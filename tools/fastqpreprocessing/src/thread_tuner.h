@@ -0,0 +1,110 @@
+#ifndef __SCTOOLS_FASTQPREPROCESSING_THREAD_TUNER_H_
+#define __SCTOOLS_FASTQPREPROCESSING_THREAD_TUNER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Overview of --auto-threads:
+// * There is one reader thread per R1 file (each does decompression, parsing
+//   and barcode correction for its inputs) and one writer thread per output
+//   shard (serialization and compression). Neither count can change without
+//   changing the outputs, but how many readers run at once can.
+// * planThreads() splits the cores between reading and writing in proportion
+//   to the measured per-read cost of each, given the output format and
+//   compression level, and caps the concurrently active readers accordingly.
+// * While running, ThreadTuner compares how long readers wait on the writers
+//   (for arena records) with how long writers wait on the readers (for queued
+//   records), and moves the reader limit toward whichever side is short.
+
+// Approximate CPU time per read of each stage, from `make bench`: reading
+// covers decompressing the inputs, fillSamRecord and barcode correction;
+// writing covers serialization plus compression at the given settings.
+double readerMicrosPerRead();
+double writerMicrosPerRead(std::string const& output_format, int compression_level);
+
+struct ThreadPlan
+{
+  int cores = 1;
+  int num_readers = 1;
+  int num_writers = 1;
+  int reader_slots = 1;  // readers allowed to run at once
+  // The most readers that can be kept busy for most of the run, given how the
+  // input is spread across the R1 files: total size / largest file.
+  double input_parallelism = 1;
+  double reader_share = 0.5;  // of the CPU time needed per read
+};
+
+// input_bytes: the size of each reader's inputs (0 if unknown, e.g. streamed).
+ThreadPlan planThreads(int cores, std::vector<int64_t> const& input_bytes, int num_writers,
+                       std::string const& output_format, int compression_level);
+
+// The CPUs this process may run on.
+int availableCores();
+
+// Limits how many reader threads run at once; the limit can change at any time.
+class ReaderSlots
+{
+public:
+  explicit ReaderSlots(int limit) : limit_(limit) {}
+
+  // Waits up to 'timeout' for a slot; returns whether it got one.
+  bool tryAcquire(std::chrono::milliseconds timeout);
+  void release();
+  // True if the caller, holding a slot, should give it up because the limit
+  // was lowered below the number of slots in use.
+  bool overLimit();
+  void setLimit(int limit);
+  int limit();
+
+private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  int limit_;
+  int in_use_ = 0;
+};
+
+// Given the fraction of the last interval that active readers spent waiting
+// for the writers and that writers spent waiting for the readers, returns the
+// new number of reader slots (between 1 and num_readers).
+int adjustReaderSlots(int slots, int num_readers, double reader_blocked_fraction,
+                      double writer_blocked_fraction);
+
+// Runs adjustReaderSlots() every interval on the blocked time counters.
+class ThreadTuner
+{
+public:
+  // sample() must return the total nanoseconds {readers, writers} have been
+  // blocked so far.
+  ThreadTuner(ThreadPlan const& plan, ReaderSlots* slots, std::chrono::milliseconds interval,
+              std::function<std::pair<int64_t, int64_t>()> sample);
+  ~ThreadTuner();
+
+  void start();
+  void stop();
+  // Prints the initial plan, and how it was adjusted.
+  void printReport();
+
+private:
+  void run();
+
+  ThreadPlan plan_;
+  ReaderSlots* slots_;
+  std::chrono::milliseconds interval_;
+  std::function<std::pair<int64_t, int64_t>()> sample_;
+  int adjustments_ = 0;
+  int min_slots_;
+  int max_slots_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_ = false;
+  std::thread thread_;
+};
+
+#endif // __SCTOOLS_FASTQPREPROCESSING_THREAD_TUNER_H_
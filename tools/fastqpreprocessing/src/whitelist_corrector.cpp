@@ -1,6 +1,8 @@
 #include "whitelist_corrector.h"
 
+#include <algorithm>
 #include <fstream>
+#include <sstream>
 
 // Returns false if barcode has an unexpected character (i.e. not ACGTN)
 bool addMutationsOfBarcodeToWhiteList(WhiteListCorrector& corrector, std::string barcode)
@@ -49,3 +51,39 @@ WhiteListCorrector readWhiteListFile(std::string const& white_list_file)
 
   return corrector;
 }
+
+void readBarcodeTranslationFile(std::string const& translation_file, WhiteListCorrector* corrector)
+{
+  std::ifstream file(translation_file);
+  if (!file.is_open())
+    crash("Couldn't open barcode translation file " + translation_file);
+
+  std::unordered_map<std::string, std::string> translations;
+  for (std::string line; getline(file, line); )
+  {
+    std::replace(line.begin(), line.end(), ',', ' ');
+    std::istringstream fields(line);
+    std::string barcode, translated, extra;
+    if (!(fields >> barcode))
+      continue;
+    if (!(fields >> translated) || (fields >> extra) || translated.find_first_not_of("ACGTN") != std::string::npos)
+      crash("ERROR: barcode translation file " + translation_file + " line isn't two barcodes: '" + line + "'");
+    // A repeated line is harmless; two translations of one barcode aren't.
+    auto [it, added] = translations.emplace(barcode, translated);
+    if (!added && it->second != translated)
+      crash("ERROR: barcode translation file " + translation_file + " translates " + barcode + " to both " +
+            it->second + " and " + translated);
+  }
+
+  for (int64_t i = 0; i < corrector->whitelist.size(); i++)
+  {
+    std::string& barcode = corrector->whitelist[i];
+    auto translation = translations.find(barcode);
+    if (translation == translations.end())
+      crash("ERROR: barcode translation file " + translation_file + " has no translation of whitelist barcode " +
+            barcode);
+    if (auto exact = corrector->mutations.find(barcode); exact->second == -1)
+      exact->second = -2 - i;
+    barcode = translation->second;
+  }
+}
@@ -23,10 +23,24 @@ struct WhiteListCorrector
   // This keeps the behavior identical to a previous Python implementation.
   // (In practice, whitelist entries are expected to be >1 Hamming distance
   //  from each other, so, famous last words, this bug should never happen.)
+  //
+  // Once readBarcodeTranslationFile() has translated the whitelist, a barcode
+  // listed at index i maps to -2 - i instead of -1, since what it's corrected
+  // to is no longer itself.
   std::unordered_map<std::string, int64_t> mutations;
 
-  // all of the barcodes listed in the whitelist file, without any mutations.
+  // all of the barcodes listed in the whitelist file, without any mutations
+  // (or what they translate to).
   std::vector<std::string> whitelist;
+
+  // The barcode that 'barcode', found in 'mutations' with value 'index', is
+  // corrected to.
+  std::string const& correctedBarcode(std::string const& barcode, int64_t index) const
+  {
+    if (index >= 0)
+      return whitelist[index];
+    return index == -1 ? barcode : whitelist[-2 - index];
+  }
 };
 
 // Builds WhiteListCorrector as described above, from the 10x Genomics whitelist
@@ -39,4 +53,12 @@ WhiteListCorrector readWhiteListFile(std::string const& white_list_file);
 // Returns false if 'barcode' has an unexpected character (i.e. not ACGTN)
 bool addMutationsOfBarcodeToWhiteList(WhiteListCorrector& corrector, std::string barcode);
 
+// Reads a table of "<whitelist barcode> <translated barcode>" lines (tab,
+// space or comma separated), such as the pairing of multiome ATAC and GEX
+// barcodes, and replaces each barcode of 'corrector's whitelist by its
+// translation, so that raw barcodes are corrected straight to the translated
+// ones. Crashes if a whitelist barcode has no translation, or conflicting
+// ones.
+void readBarcodeTranslationFile(std::string const& translation_file, WhiteListCorrector* corrector);
+
 #endif // FASTQ_PREPROCESSING_WHITELIST_CORRECTOR_H_
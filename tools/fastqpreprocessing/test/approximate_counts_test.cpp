@@ -0,0 +1,130 @@
+#include "../src/approximate_counts.h"
+
+#include <memory>
+#include <random>
+#include <thread>
+
+#include "gmock/gmock-matchers.h"
+#include "gtest/gtest.h"
+
+TEST(ApproximateCountsTest, HyperLogLog)
+{
+  HyperLogLog few, many;
+  for (int i = 0; i < 1000; i++)
+    few.add("barcode" + std::to_string(i % 100));
+  EXPECT_NEAR(few.estimate(), 100, 2);
+  for (int i = 0; i < 200000; i++)
+    many.add("barcode" + std::to_string(i));
+  EXPECT_NEAR(many.estimate(), 200000, 200000 * 0.03);
+
+  few += many;
+  EXPECT_NEAR(few.estimate(), 200000, 200000 * 0.03);
+}
+
+TEST(ApproximateCountsTest, SpaceSavingExactWhileNotFull)
+{
+  SpaceSavingCounter counter(10);
+  counter.add("AAAA", 3);
+  counter.add("CCCC");
+  counter.add("AAAA");
+  auto entries = counter.entries();
+  ASSERT_EQ(entries.size(), 2);
+  EXPECT_EQ(entries[0].seq, "AAAA");
+  EXPECT_EQ(entries[0].count, 4);
+  EXPECT_EQ(entries[0].error, 0);
+  EXPECT_EQ(entries[1].seq, "CCCC");
+  EXPECT_EQ(entries[1].count, 1);
+  EXPECT_EQ(counter.total(), 5);
+}
+
+TEST(ApproximateCountsTest, SpaceSavingKeepsHeavyHitters)
+{
+  // 5 heavy hitters with 1000 reads each, in a stream of 20000 singletons,
+  // split over two counters that are then merged.
+  SpaceSavingCounter a(100), b(100);
+  std::mt19937 rng(11);
+  for (int i = 0; i < 25000; i++)
+  {
+    SpaceSavingCounter& counter = i % 2 ? a : b;
+    if (i % 5 == 0)
+      counter.add("HEAVY" + std::to_string(i / 5 % 5));
+    else
+      counter.add("noise" + std::to_string(rng()));
+  }
+  a += b;
+  auto entries = a.entries();
+  EXPECT_LE(entries.size(), 100);
+  for (int i = 0; i < 5; i++)
+  {
+    std::string heavy = entries[i].seq;
+    EXPECT_EQ(heavy.substr(0, 5), "HEAVY");
+    EXPECT_GE(entries[i].count, 1000);
+    EXPECT_LE(entries[i].count - entries[i].error, 1000);
+  }
+  EXPECT_EQ(a.total(), 25000);
+}
+
+TEST(ApproximateCountsTest, DisjointSummariesKeepTheirBounds)
+{
+  // 'full' has seen more sequences than it holds; 'roomy' hasn't.
+  SpaceSavingCounter full(2), roomy(10);
+  full.add("AAAA", 5);
+  full.add("CCCC", 3);
+  full.add("GGGG", 1);
+  roomy.add("TTTT", 2);
+  full.addDisjoint(roomy);
+  EXPECT_EQ(full.capacity(), 12);
+  EXPECT_EQ(full.total(), 11);
+  auto entries = full.entries();
+  ASSERT_EQ(entries.size(), 3);
+  EXPECT_EQ(entries[2].seq, "TTTT");
+  EXPECT_EQ(entries[2].count, 2);
+  EXPECT_EQ(entries[2].error, 0);
+
+  // A new sequence might have been one 'full' dropped, seen as often as the
+  // fewest it kept (GGGG, 4).
+  full.add("ACGT");
+  entries = full.entries();
+  EXPECT_EQ(entries[1].seq, "ACGT");
+  EXPECT_EQ(entries[1].count, 5);
+  EXPECT_EQ(entries[1].error, 4);
+}
+
+TEST(ApproximateCountsTest, ConcurrentCounterHasTheWholeCapacity)
+{
+  // As SpaceSavingKeepsHeavyHitters, in batches from 4 threads.
+  auto counter = std::make_shared<ConcurrentApproximateCounter>(200, 4);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++)
+  {
+    threads.emplace_back([counter, t]() {
+      ApproximateCountBatch batch(counter);
+      std::mt19937 rng(t);
+      for (int i = 0; i < 25000; i++)
+      {
+        if (i % 5 == 0)
+          batch.add("HEAVY" + std::to_string(i / 5 % 5));
+        else
+          batch.add("noise" + std::to_string(rng()));
+        if (i % 1000 == 999)
+          batch.flush();
+      }
+      batch.flush();
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+
+  ApproximateSequenceCounter merged = counter->merged();
+  EXPECT_EQ(merged.top().capacity(), 200);
+  EXPECT_EQ(merged.top().total(), 100000);
+  auto entries = merged.top().entries();
+  EXPECT_EQ(entries.size(), 200);
+  for (int i = 0; i < 5; i++)
+  {
+    EXPECT_EQ(entries[i].seq.substr(0, 5), "HEAVY");
+    EXPECT_GE(entries[i].count, 4000);
+    EXPECT_LE(entries[i].count - entries[i].error, 4000);
+  }
+  EXPECT_NEAR(merged.distinctEstimate(), 80005, 80005 * 0.03);
+}
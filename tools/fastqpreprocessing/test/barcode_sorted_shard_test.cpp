@@ -0,0 +1,92 @@
+#include "../src/barcode_sorted_shard.h"
+
+#include "gmock/gmock-matchers.h"
+#include "gtest/gtest.h"
+#include <filesystem>
+
+void fillTestRecord(SamRecord* sam, std::string const& name, std::string const& cr,
+                    std::string const& cb, std::string const& ur)
+{
+  sam->resetRecord();
+  sam->addTag("RG", 'Z', "A");
+  sam->setFlag(4);
+  sam->setReadName(name.c_str());
+  sam->setSequence("ACGTACGT");
+  sam->setQuality("FFFFFFFF");
+  sam->addTag("CR", 'Z', cr.c_str());
+  sam->addTag("UR", 'Z', ur.c_str());
+  if (!cb.empty())
+    sam->addTag("CB", 'Z', cb.c_str());
+}
+
+// Sorts the same records with a big buffer (in memory) and with a tiny one
+// (one spilled run per record), and checks both give the expected order.
+std::vector<std::string> sortedNames(int64_t memory_limit_bytes, int* num_runs,
+                                     int max_merge_fan_in = BarcodeSortedShard::kMaxMergeFanIn)
+{
+  std::string prefix = (std::filesystem::temp_directory_path() / "barcode_sorted_shard_test").string();
+  BarcodeSortedShard sorter(prefix, memory_limit_bytes, max_merge_fan_in);
+  SamRecord sam;
+  fillTestRecord(&sam, "r1", "TTTT", "", "AAA");
+  sorter.add(&sam);
+  fillTestRecord(&sam, "r2", "CCCA", "CCCC", "GGG");
+  sorter.add(&sam);
+  fillTestRecord(&sam, "r3", "AAAA", "AAAA", "TTT");
+  sorter.add(&sam);
+  fillTestRecord(&sam, "r4", "CCCC", "CCCC", "AAA");
+  sorter.add(&sam);
+  fillTestRecord(&sam, "r5", "AAAC", "AAAA", "TTT");
+  sorter.add(&sam);
+  fillTestRecord(&sam, "r6", "GGGG", "", "AAA");
+  sorter.add(&sam);
+
+  std::vector<std::string> names;
+  sorter.finish([&names](SamRecord* sorted) { names.push_back(sorted->getReadName()); });
+  *num_runs = sorter.numRuns();
+  return names;
+}
+
+TEST(BarcodeSortedShardTest, SortsByBarcodeThenUmi)
+{
+  // Uncorrectable (no CB) last, sorted by CR; ties keep arrival order.
+  std::vector<std::string> expected = {"r3", "r5", "r4", "r2", "r6", "r1"};
+  int num_runs;
+  EXPECT_EQ(sortedNames(1 << 20, &num_runs), expected);
+  EXPECT_EQ(num_runs, 0);
+  EXPECT_EQ(sortedNames(1, &num_runs), expected);
+  EXPECT_EQ(num_runs, 6);
+}
+
+// With more runs than may be open at once, they're merged in several passes,
+// to the same order, and none of the run files are left behind.
+TEST(BarcodeSortedShardTest, MergesInBoundedFanInPasses)
+{
+  std::vector<std::string> expected = {"r3", "r5", "r4", "r2", "r6", "r1"};
+  for (int max_merge_fan_in : {2, 3, 4})
+  {
+    int num_runs;
+    EXPECT_EQ(sortedNames(1, &num_runs, max_merge_fan_in), expected) << max_merge_fan_in;
+    EXPECT_EQ(num_runs, 6);
+    for (auto const& entry : std::filesystem::directory_iterator(std::filesystem::temp_directory_path()))
+      EXPECT_EQ(entry.path().filename().string().find("barcode_sorted_shard_test.sortrun_"), std::string::npos);
+  }
+}
+
+TEST(BarcodeSortedShardTest, SerializationRoundTrip)
+{
+  SamRecord sam;
+  fillTestRecord(&sam, "read:1", "AAAC", "AAAA", "TTT");
+  std::string serialized;
+  serializeSamRecord(&sam, &serialized);
+
+  SamRecord restored;
+  deserializeSamRecord(serialized, &restored);
+  EXPECT_STREQ(restored.getReadName(), "read:1");
+  EXPECT_EQ(restored.getFlag(), 4);
+  EXPECT_STREQ(restored.getSequence(), "ACGTACGT");
+  EXPECT_STREQ(restored.getQuality(), "FFFFFFFF");
+  EXPECT_STREQ(restored.getString("RG").c_str(), "A");
+  EXPECT_STREQ(restored.getString("CR").c_str(), "AAAC");
+  EXPECT_STREQ(restored.getString("CB").c_str(), "AAAA");
+  EXPECT_STREQ(restored.getString("UR").c_str(), "TTT");
+}
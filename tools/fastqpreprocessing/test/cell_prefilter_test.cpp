@@ -0,0 +1,51 @@
+#include "../src/cell_prefilter.h"
+
+#include "gmock/gmock-matchers.h"
+#include "gtest/gtest.h"
+
+using ::testing::ElementsAre;
+using ::testing::Pair;
+
+TEST(CellPrefilterTest, ParseSpec)
+{
+  EXPECT_EQ(CellPrefilterSpec::parse("knee").method, CellPrefilterSpec::Method::kKnee);
+  CellPrefilterSpec top = CellPrefilterSpec::parse("top:3000");
+  EXPECT_EQ(top.method, CellPrefilterSpec::Method::kTopN);
+  EXPECT_EQ(top.value, 3000);
+  CellPrefilterSpec min_reads = CellPrefilterSpec::parse("min-reads:500");
+  EXPECT_EQ(min_reads.method, CellPrefilterSpec::Method::kMinReads);
+  EXPECT_EQ(min_reads.value, 500);
+}
+
+TEST(CellPrefilterTest, RankBarcodes)
+{
+  EXPECT_THAT(rankBarcodes({{"AAAA", 3}, {"CCCC", 10}, {"GGGG", 3}}),
+              ElementsAre(Pair("CCCC", 10), Pair("AAAA", 3), Pair("GGGG", 3)));
+}
+
+TEST(CellPrefilterTest, KneeRank)
+{
+  // 1000 cells with about 10000 reads each, then 100000 empty droplets
+  // tailing off from 20 reads to 1.
+  std::vector<int64_t> counts;
+  for (int i = 0; i < 1000; i++)
+    counts.push_back(12000 - 4 * i);
+  for (int i = 0; i < 100000; i++)
+    counts.push_back(20 - i / 5000);
+  int64_t knee = kneeRank(counts);
+  EXPECT_GE(knee, 990);
+  EXPECT_LE(knee, 1010);
+
+  EXPECT_EQ(kneeRank({5, 4}), 2);
+  // A curve bending the other way has no knee.
+  EXPECT_EQ(kneeRank({1000, 10, 5, 4}), 4);
+}
+
+TEST(CellPrefilterTest, NumCells)
+{
+  std::vector<std::pair<std::string, int64_t>> ranked = {{"A", 100}, {"C", 90}, {"G", 5}, {"T", 1}};
+  EXPECT_EQ(numCells(ranked, CellPrefilterSpec::parse("top:3")), 3);
+  EXPECT_EQ(numCells(ranked, CellPrefilterSpec::parse("top:10")), 4);
+  EXPECT_EQ(numCells(ranked, CellPrefilterSpec::parse("min-reads:5")), 3);
+  EXPECT_EQ(numCells(ranked, CellPrefilterSpec::parse("knee")), 2);
+}
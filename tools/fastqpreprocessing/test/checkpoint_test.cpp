@@ -0,0 +1,125 @@
+#include "../src/checkpoint.h"
+
+#include "gmock/gmock-matchers.h"
+#include "gtest/gtest.h"
+#include <filesystem>
+
+std::string tempPath(std::string const& name)
+{
+  return (std::filesystem::temp_directory_path() / name).string();
+}
+
+TEST(CheckpointTest, ManifestRoundTrip)
+{
+  CheckpointManifest manifest;
+  manifest.output_format = "FASTQ";
+  manifest.R1s = {"a_R1.fastq.gz", "b_R1.fastq.gz"};
+  manifest.readers.resize(2);
+  manifest.readers[0] = ReaderCheckpoint{1000, 900, 50, 50};
+  manifest.readers[1] = ReaderCheckpoint{7, 7, 0, 0};
+  manifest.shards.resize(2);
+  manifest.shards[0].records = 600;
+  manifest.shards[0].barcodes_correct = 500;
+  manifest.shards[0].barcodes_corrected = 60;
+  manifest.shards[0].barcodes_uncorrectable = 40;
+  manifest.shards[0].files = {{"fastq_R1_0.fastq.gz", 12345}, {"fastq_R2_0.fastq.gz", 23456}};
+  manifest.shards[1].records = 407;
+
+  std::string path = tempPath("checkpoint_test_manifest.tsv");
+  writeCheckpointManifest(path, manifest);
+
+  CheckpointManifest read_back;
+  ASSERT_TRUE(readCheckpointManifest(path, &read_back));
+  EXPECT_EQ(read_back.output_format, "FASTQ");
+  EXPECT_EQ(read_back.R1s, manifest.R1s);
+  ASSERT_EQ(read_back.readers.size(), 2);
+  EXPECT_EQ(read_back.readers[0].records, 1000);
+  EXPECT_EQ(read_back.readers[0].n_barcode_correct, 900);
+  EXPECT_EQ(read_back.readers[0].n_barcode_corrected, 50);
+  EXPECT_EQ(read_back.readers[0].n_barcode_errors, 50);
+  EXPECT_EQ(read_back.readers[1].records, 7);
+  ASSERT_EQ(read_back.shards.size(), 2);
+  EXPECT_EQ(read_back.shards[0].records, 600);
+  EXPECT_EQ(read_back.shards[0].barcodes_correct, 500);
+  EXPECT_EQ(read_back.shards[0].barcodes_corrected, 60);
+  EXPECT_EQ(read_back.shards[0].barcodes_uncorrectable, 40);
+  ASSERT_EQ(read_back.shards[0].files.size(), 2);
+  EXPECT_EQ(read_back.shards[0].files[1].path, "fastq_R2_0.fastq.gz");
+  EXPECT_EQ(read_back.shards[0].files[1].bytes, 23456);
+  EXPECT_EQ(read_back.shards[1].records, 407);
+  EXPECT_TRUE(read_back.shards[1].files.empty());
+  std::filesystem::remove(path);
+}
+
+TEST(CheckpointTest, MissingManifest)
+{
+  CheckpointManifest manifest;
+  EXPECT_FALSE(readCheckpointManifest(tempPath("checkpoint_test_no_such_manifest.tsv"), &manifest));
+}
+
+namespace
+{
+// Reads 1..num_reads as a reader does: multiples of 'trim' are trimmed away,
+// and from read 'hold_from' until read 'release_at' (if they're set) the kept
+// ones are held back. Checkpoints after read 'checkpoint_at' and stops there
+// if 'interrupt', returning the checkpoint; the reads written go to *written.
+int64_t runReader(int64_t start, int64_t num_reads, int64_t trim, int64_t hold_from, int64_t release_at,
+                  int64_t checkpoint_at, bool interrupt, std::vector<int64_t>* written)
+{
+  ReaderProgress progress;
+  std::vector<int64_t> held;
+  int64_t checkpoint = -1;
+  for (int64_t read = start + 1; read <= num_reads; read++)
+  {
+    if (read % trim != 0)
+    {
+      if (read >= hold_from && read < release_at)
+      {
+        held.push_back(read);
+        progress.hold(read);
+      }
+      else
+      {
+        written->insert(written->end(), held.begin(), held.end());
+        held.clear();
+        progress.releaseHeld();
+        written->push_back(read);
+      }
+    }
+    if (read == checkpoint_at)
+    {
+      checkpoint = progress.done(read);
+      if (interrupt)
+        return checkpoint;
+    }
+  }
+  written->insert(written->end(), held.begin(), held.end());
+  return checkpoint;
+}
+} // namespace
+
+TEST(CheckpointTest, ResumeAfterHeldAndTrimmedReads)
+{
+  // Reads 3-7 are held, read 6 is trimmed away, and the checkpoint comes
+  // after read 6: only reads 1 and 2 have been written.
+  std::vector<int64_t> uninterrupted;
+  runReader(0, 12, 6, 3, 8, 6, false, &uninterrupted);
+
+  std::vector<int64_t> written;
+  int64_t checkpoint = runReader(0, 12, 6, 3, 8, 6, true, &written);
+  EXPECT_EQ(checkpoint, 2);
+  EXPECT_EQ(written, (std::vector<int64_t>{1, 2}));
+
+  // Resumed (with the corrector ready at once), nothing is lost or repeated.
+  runReader(checkpoint, 12, 6, 0, 0, 0, false, &written);
+  EXPECT_EQ(written, uninterrupted);
+
+  // With nothing held, the checkpoint counts every read, trimmed ones too.
+  ReaderProgress progress;
+  EXPECT_EQ(progress.done(6), 6);
+  progress.hold(7);
+  progress.hold(9);
+  EXPECT_EQ(progress.done(9), 6);
+  progress.releaseHeld();
+  EXPECT_EQ(progress.done(10), 10);
+}
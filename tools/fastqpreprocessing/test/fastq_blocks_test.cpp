@@ -0,0 +1,108 @@
+#include "../src/fastq_blocks.h"
+
+#include <algorithm>
+#include <fstream>
+#include <utility>
+#include <vector>
+#include <zlib.h>
+
+#include "gmock/gmock-matchers.h"
+#include "gtest/gtest.h"
+
+using ::testing::ElementsAre;
+using ::testing::Pair;
+
+namespace
+{
+std::string writeFile(std::string const& name, std::string const& contents)
+{
+  std::string path = ::testing::TempDir() + "/" + name;
+  std::ofstream(path, std::ofstream::binary) << contents;
+  return path;
+}
+
+// The blocks readFastqBlocks() pushes for 'path'.
+std::vector<std::string> readBlocks(std::string const& path, size_t block_bytes)
+{
+  FastqBlockQueue queue(1000);
+  readFastqBlocks(path, &queue, block_bytes);
+  queue.close();
+  std::vector<std::string> blocks;
+  for (std::string block; queue.pop(&block); )
+    blocks.push_back(std::move(block));
+  return blocks;
+}
+
+std::vector<std::pair<std::string, std::string>> records(std::vector<std::string> const& blocks)
+{
+  std::vector<std::pair<std::string, std::string>> ret;
+  for (std::string const& block : blocks)
+    forEachFastqRecord(block, [&](std::string_view seq, std::string_view quality) {
+      ret.emplace_back(seq, quality);
+    });
+  return ret;
+}
+
+std::string fastq(int num_records, std::string const& newline = "\n")
+{
+  std::string ret;
+  for (int i = 0; i < num_records; i++)
+    ret += "@read" + std::to_string(i) + newline + std::string(i % 7 + 1, "ACGT"[i % 4]) + newline + "+" +
+           newline + std::string(i % 7 + 1, 'A' + i % 20) + newline;
+  return ret;
+}
+} // namespace
+
+TEST(FastqBlocksTest, BlocksEndAtRecordBoundaries)
+{
+  std::string contents = fastq(50);
+  std::string path = writeFile("fastq_blocks_boundaries.fastq", contents);
+  // Reads of 1 byte to more than a record at a time all end mid-record.
+  for (size_t block_bytes : {1, 7, 30, 4096})
+  {
+    std::vector<std::string> blocks = readBlocks(path, block_bytes);
+    std::string joined;
+    for (std::string const& block : blocks)
+    {
+      ASSERT_FALSE(block.empty());
+      EXPECT_EQ(block.back(), '\n');
+      EXPECT_EQ(std::count(block.begin(), block.end(), '\n') % 4, 0);
+      joined += block;
+    }
+    EXPECT_EQ(joined, contents) << block_bytes;
+    EXPECT_EQ(records(blocks).size(), 50) << block_bytes;
+  }
+}
+
+TEST(FastqBlocksTest, LastRecordWithoutNewline)
+{
+  std::string contents = "@a\nACGT\n+\nIIII\n@b\nTTGC\n+\n#III";
+  std::string path = writeFile("fastq_blocks_no_newline.fastq", contents);
+  for (size_t block_bytes : {3, 4096})
+  {
+    std::vector<std::string> blocks = readBlocks(path, block_bytes);
+    EXPECT_THAT(records(blocks), ElementsAre(Pair("ACGT", "IIII"), Pair("TTGC", "#III")));
+    EXPECT_EQ(blocks.back(), "@b\nTTGC\n+\n#III");
+  }
+  path = writeFile("fastq_blocks_newline.fastq", contents + "\n");
+  EXPECT_THAT(records(readBlocks(path, 3)), ElementsAre(Pair("ACGT", "IIII"), Pair("TTGC", "#III")));
+}
+
+TEST(FastqBlocksTest, CrlfLineEndings)
+{
+  std::string path = writeFile("fastq_blocks_crlf.fastq", fastq(20, "\r\n"));
+  std::vector<std::pair<std::string, std::string>> expected = records({fastq(20)});
+  for (size_t block_bytes : {5, 4096})
+    EXPECT_EQ(records(readBlocks(path, block_bytes)), expected) << block_bytes;
+  EXPECT_THAT(records({"@a\r\nAC\r\n+\r\nII"}), ElementsAre(Pair("AC", "II")));
+}
+
+TEST(FastqBlocksTest, Gzipped)
+{
+  std::string contents = fastq(30);
+  std::string path = ::testing::TempDir() + "/fastq_blocks.fastq.gz";
+  gzFile file = gzopen(path.c_str(), "wb");
+  gzwrite(file, contents.data(), contents.size());
+  gzclose(file);
+  EXPECT_EQ(records(readBlocks(path, 11)), records({contents}));
+}
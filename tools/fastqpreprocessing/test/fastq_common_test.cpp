@@ -1,4 +1,9 @@
 #include "../src/fastq_common.h"
+#include "../src/whitelist_corrector.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sys/stat.h>
 
 #include "gmock/gmock-matchers.h"
 #include "gtest/gtest.h"
@@ -78,3 +83,75 @@ TEST(MainCommonTest, BarcodeOrientation_FirstBPIfR3sEmptyTest) {
   EXPECT_EQ(barcode_orientation, "FIRST_BP");
 }
 
+
+// The whitelist is read while the readers start; a bad one must still end the
+// run (with an error), rather than leave it waiting on the readers forever.
+TEST(MainCommonTest, BadWhitelistExits) {
+  std::string white_list_file = ::testing::TempDir() + "/bad_whitelist.txt";
+  std::ofstream(white_list_file) << "AAACCCAAGAAACACT\nACGTXACGTACGTACG\n";
+  std::vector<std::string> R1s = {"/warptools/fastqpreprocessing/test/input_test_data/R1_1.fastq"};
+  std::vector<std::string> R2s = {"/warptools/fastqpreprocessing/test/input_test_data/R2_1.fastq"};
+  PipelineOptions pipeline;
+  pipeline.output_dir = ::testing::TempDir();
+
+  EXPECT_EXIT(mainCommon(white_list_file, "FIRST_BP", 2, "FASTQ", {}, R1s, R2s, {}, "bad_whitelist",
+                         {{'C', 16}, {'M', 10}}, false, pipeline),
+              ::testing::ExitedWithCode(1), "Character other than ACGTN");
+}
+
+// Checkpointing syncs and sizes the shards, which a FIFO shard can't be; that
+// includes the shards in the subdirectories of a sample sheet's samples.
+TEST(MainCommonTest, CheckpointRefusesFifoShards) {
+  std::string dir = ::testing::TempDir() + "/fifo_shards";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir + "/liver");
+  std::string white_list_file = dir + "/whitelist.txt";
+  std::ofstream(white_list_file) << "AAACCCAAGAAACACT\n";
+  std::string sample_sheet = dir + "/samples.csv";
+  std::ofstream(sample_sheet) << "liver,AAAAAAAA\nlung,CCCCCCCC\n";
+  std::vector<std::string> R1s = {"R1.fastq"};
+  std::vector<std::string> R2s = {"R2.fastq"};
+
+  PipelineOptions pipeline;
+  pipeline.output_dir = dir;
+  pipeline.checkpoint_interval_sec = 60;
+  ASSERT_EQ(mkfifo((dir + "/subfile_1.bam").c_str(), 0600), 0);
+  EXPECT_EXIT(mainCommon(white_list_file, "FIRST_BP", 2, "BAM", {}, R1s, R2s, {}, "fifo_shards",
+                         {{'C', 16}, {'M', 10}}, false, pipeline),
+              ::testing::ExitedWithCode(1), "subfile_1.bam is one");
+
+  pipeline.sample_sheet = sample_sheet;
+  ASSERT_EQ(mkfifo((dir + "/liver/fastq_R2_0.fastq.gz").c_str(), 0600), 0);
+  EXPECT_EXIT(mainCommon(white_list_file, "FIRST_BP", 2, "FASTQ", {"I1.fastq"}, R1s, R2s, {}, "fifo_shards",
+                         {{'C', 16}, {'M', 10}}, false, pipeline),
+              ::testing::ExitedWithCode(1), "liver/fastq_R2_0.fastq.gz is one");
+  std::filesystem::remove_all(dir);
+}
+
+// With a barcode translation, an exact whitelist hit gets a CB different from
+// its CR; the shard counts still take it as correct.
+TEST(CorrectBarcodeTest, TranslatedBarcodesCountedByMatch) {
+  WhiteListCorrector corrector;
+  addMutationsOfBarcodeToWhiteList(corrector, "AAAA");
+  std::string path = ::testing::TempDir() + "/correct_barcode_translation.tsv";
+  std::ofstream(path) << "AAAA\tTTTT\n";
+  readBarcodeTranslationFile(path, &corrector);
+
+  ShardBarcodeCounter counter;
+  int n_corrected = 0, n_correct = 0, n_errors = 0;
+  for (std::string barcode : {"AAAA", "AAAC", "GGGG"})
+  {
+    SamRecord sam;
+    sam.addTag("CR", 'Z', barcode.c_str());
+    BarcodeMatch match;
+    correctBarcodeToWhitelist(barcode, &sam, &corrector, &n_corrected, &n_correct, &n_errors, 1, &match);
+    counter.add(sam.getString("CB").c_str(), match);
+  }
+  EXPECT_EQ(counter.tallies().correct, 1);
+  EXPECT_EQ(counter.tallies().corrected, 1);
+  EXPECT_EQ(counter.tallies().uncorrectable, 1);
+  EXPECT_EQ(counter.distinctBarcodes(), 1);
+  EXPECT_EQ(n_correct, 1);
+  EXPECT_EQ(n_corrected, 1);
+  EXPECT_EQ(n_errors, 1);
+}
@@ -0,0 +1,85 @@
+#include "../src/input_backend.h"
+
+#include "gmock/gmock-matchers.h"
+#include "gtest/gtest.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+std::string tempPath(std::string const& name)
+{
+  return (std::filesystem::temp_directory_path() / name).string();
+}
+
+std::string readAll(std::string const& path)
+{
+  std::ifstream in(path, std::ios::binary);
+  std::stringstream ret;
+  ret << in.rdbuf();
+  return ret.str();
+}
+
+// Several blocks plus a partial one, so every backend hits its last-block path.
+std::string writeTestFile(std::string const& path)
+{
+  std::string contents;
+  for (int i = 0; contents.size() < 3 * 64 * 1024 + 1000; i++)
+    contents += "@read" + std::to_string(i) + "\nACGTACGTAC\n+\nFFFFFFFFFF\n";
+  std::ofstream(path, std::ios::binary) << contents;
+  return contents;
+}
+
+TEST(InputBackendTest, AllBackendsPassFileThrough)
+{
+  std::string path = tempPath("input_backend_test.fastq");
+  std::string expected = writeTestFile(path);
+  for (InputBackend backend : {InputBackend::kMmap, InputBackend::kReadahead, InputBackend::kDirect})
+  {
+    PrefetchedInput input(path, backend, 64 * 1024, 2);
+    EXPECT_EQ(readAll(input.path()), expected);
+  }
+  std::filesystem::remove(path);
+}
+
+// O_DIRECT reads are spread over queue_depth threads and put back in order,
+// whether or not the file ends on a block boundary.
+TEST(InputBackendTest, DirectQueueDepths)
+{
+  std::string path = tempPath("input_backend_test_direct.fastq");
+  std::string expected = writeTestFile(path);
+  for (int queue_depth : {1, 3, 8})
+  {
+    PrefetchedInput input(path, InputBackend::kDirect, 64 * 1024, queue_depth);
+    EXPECT_EQ(readAll(input.path()), expected) << queue_depth;
+  }
+  expected.resize(2 * 64 * 1024);
+  std::ofstream(path, std::ios::binary) << expected;
+  for (int queue_depth : {1, 3})
+  {
+    PrefetchedInput input(path, InputBackend::kDirect, 64 * 1024, queue_depth);
+    EXPECT_EQ(readAll(input.path()), expected) << queue_depth;
+  }
+  std::filesystem::remove(path);
+}
+
+// Destroying an input that was never read must not hang.
+TEST(InputBackendTest, UnreadInput)
+{
+  std::string path = tempPath("input_backend_test_unread.fastq");
+  writeTestFile(path);
+  for (InputBackend backend : {InputBackend::kReadahead, InputBackend::kDirect})
+  {
+    PrefetchedInput input(path, backend, 64 * 1024, 2);
+  }
+  std::filesystem::remove(path);
+}
+
+TEST(InputBackendTest, DefaultBackendUsesPathAsIs)
+{
+  PipelineOptions pipeline;
+  std::vector<std::unique_ptr<PrefetchedInput>> prefetched;
+  EXPECT_EQ(prefetchInput("some_R1.fastq.gz", pipeline, &prefetched), "some_R1.fastq.gz");
+  pipeline.input_backend = InputBackend::kReadahead;
+  EXPECT_EQ(prefetchInput("-", pipeline, &prefetched), "-");
+  EXPECT_TRUE(prefetched.empty());
+}
@@ -3,6 +3,8 @@
 #include "gmock/gmock-matchers.h"
 #include "gtest/gtest.h"
 #include <filesystem>
+#include <sys/stat.h>
+#include <unistd.h>
 
 // Tests if input parameters set are of correct type and size
 TEST(ReadOptionsFastqProcessTest, BasicParsing)
@@ -91,3 +93,16 @@ TEST(ReadOptionsFastqProcessTest, ValidBarcodeOrientation) {
       << "Invalid barcode_orientation value: " << options.barcode_orientation;
 }
 
+
+// Tests that stdin and FIFOs are recognized as streams, and regular files are not.
+TEST(ReadOptionsFastqProcessTest, StreamingInputs) {
+  ASSERT_TRUE(isStreamingInput("-"));
+  ASSERT_TRUE(isStreamingInput("-.gz"));
+  ASSERT_FALSE(isStreamingInput("/warptools/fastqpreprocessing/test/input_test_data/R1_1.fastq"));
+
+  std::string fifo = (std::filesystem::temp_directory_path() / "input_options_test_fifo").string();
+  std::filesystem::remove(fifo);
+  ASSERT_EQ(mkfifo(fifo.c_str(), 0600), 0);
+  ASSERT_TRUE(isStreamingInput(fifo));
+  std::filesystem::remove(fifo);
+}
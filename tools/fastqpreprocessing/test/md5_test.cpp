@@ -0,0 +1,55 @@
+#include "../src/md5.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+#include "gmock/gmock-matchers.h"
+#include "gtest/gtest.h"
+
+std::string md5Of(std::string const& s)
+{
+  Md5 md5;
+  md5.update(s.data(), s.size());
+  return md5.hexDigest();
+}
+
+// Test vectors from RFC 1321.
+TEST(Md5Test, KnownDigests)
+{
+  EXPECT_EQ(md5Of(""), "d41d8cd98f00b204e9800998ecf8427e");
+  EXPECT_EQ(md5Of("abc"), "900150983cd24fb0d6963f7d28e17f72");
+  EXPECT_EQ(md5Of("abcdefghijklmnopqrstuvwxyz"), "c3fcd3d76192e4007dfb496cca67e13b");
+  EXPECT_EQ(md5Of("12345678901234567890123456789012345678901234567890123456789012345678901234567890"),
+            "57edf4a22be3c955ac49da2e2107b67a");
+}
+
+TEST(Md5Test, IncrementalMatchesOneShot)
+{
+  std::string data;
+  for (int i = 0; i < 1000; i++)
+    data += std::to_string(i * 7919) + "\n";
+
+  // Pieces of every size from 1 to 130 bytes, straddling block boundaries.
+  Md5 md5;
+  size_t pos = 0;
+  for (size_t len = 1; pos < data.size(); len = len % 130 + 1)
+  {
+    size_t n = std::min(len, data.size() - pos);
+    md5.update(data.data() + pos, n);
+    pos += n;
+  }
+  EXPECT_EQ(md5.hexDigest(), md5Of(data));
+}
+
+TEST(Md5Test, File)
+{
+  std::string path = (std::filesystem::temp_directory_path() / "md5_test.txt").string();
+  std::ofstream(path) << "abcdefghijklmnopqrstuvwxyz";
+  EXPECT_EQ(md5File(path), "c3fcd3d76192e4007dfb496cca67e13b");
+
+  Md5 prefix;
+  prefix.updateFromFile(path, 3);
+  EXPECT_EQ(prefix.hexDigest(), "900150983cd24fb0d6963f7d28e17f72");
+  std::remove(path.c_str());
+}
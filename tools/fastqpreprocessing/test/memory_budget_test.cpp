@@ -0,0 +1,83 @@
+#include "../src/memory_budget.h"
+
+#include <fstream>
+#include <random>
+
+#include "gmock/gmock-matchers.h"
+#include "gtest/gtest.h"
+
+constexpr int64_t kMiB = 1024 * 1024;
+
+// Without a limit, everything is sized as it always was.
+TEST(MemoryBudgetTest, NoLimit)
+{
+  PipelineOptions pipeline;
+  MemoryPlan plan = planMemory(pipeline, 50 * kMiB, 4, 8);
+  EXPECT_EQ(plan.arena_records, kDefaultArenaRecords);
+  EXPECT_EQ(plan.sort_bytes, 0);
+  EXPECT_EQ(plan.output_buffer_bytes, 8 * kEstimatedOutputFileBytes);
+
+  pipeline.sort_by_barcode = true;
+  EXPECT_EQ(planMemory(pipeline, 50 * kMiB, 4, 8).sort_bytes, pipeline.sort_memory_mb * kMiB);
+}
+
+TEST(MemoryBudgetTest, LimitShrinksArenas)
+{
+  PipelineOptions pipeline;
+  pipeline.memory_limit_mb = 80;
+  // 80 MiB - 16 MiB base - 50 MiB whitelist - 4 MiB output buffers leaves
+  // 10 MiB for 4 readers.
+  MemoryPlan plan = planMemory(pipeline, 50 * kMiB, 4, 4);
+  EXPECT_EQ(plan.arena_records, 10 * kMiB / 4 / kEstimatedSamRecordBytes);
+
+  // A generous limit doesn't grow the arenas past the default.
+  pipeline.memory_limit_mb = 1024 * 1024;
+  EXPECT_EQ(planMemory(pipeline, 50 * kMiB, 4, 4).arena_records, kDefaultArenaRecords);
+}
+
+TEST(MemoryBudgetTest, LimitSplitsWithSortBuffers)
+{
+  PipelineOptions pipeline;
+  pipeline.sort_by_barcode = true;
+  pipeline.sort_memory_mb = 1024;
+  pipeline.memory_limit_mb = 80;
+  MemoryPlan plan = planMemory(pipeline, 50 * kMiB, 4, 4);
+  EXPECT_EQ(plan.sort_bytes, 5 * kMiB);
+  EXPECT_EQ(plan.arena_records, 5 * kMiB / 4 / kEstimatedSamRecordBytes);
+
+  // A small sort_memory_mb leaves the rest to the arenas.
+  pipeline.sort_memory_mb = 1;
+  plan = planMemory(pipeline, 50 * kMiB, 4, 4);
+  EXPECT_EQ(plan.sort_bytes, kMiB);
+  EXPECT_EQ(plan.arena_records, 9 * kMiB / 4 / kEstimatedSamRecordBytes);
+}
+
+TEST(MemoryBudgetTest, WhiteListEstimateGrowsWithWhiteList)
+{
+  WhiteListCorrector small;
+  addMutationsOfBarcodeToWhiteList(small, "AAAAAAAAAAAAAAAA");
+  WhiteListCorrector large = small;
+  addMutationsOfBarcodeToWhiteList(large, "CCCCCCCCCCCCCCCC");
+  addMutationsOfBarcodeToWhiteList(large, "GGGGGGGGGGGGGGGG");
+  EXPECT_GT(estimateWhiteListBytes(small), 0);
+  EXPECT_GT(estimateWhiteListBytes(large), estimateWhiteListBytes(small));
+}
+
+TEST(MemoryBudgetTest, WhiteListFileEstimateMatchesBuiltWhiteList)
+{
+  std::string path = ::testing::TempDir() + "memory_budget_whitelist.txt";
+  {
+    std::ofstream file(path);
+    std::mt19937 rng(7);
+    for (int i = 0; i < 20000; i++)
+    {
+      std::string barcode(16, 'A');
+      for (char& base : barcode)
+        base = "ACGT"[rng() % 4];
+      file << barcode << '\n';
+    }
+  }
+  double built = estimateWhiteListBytes(readWhiteListFile(path));
+  EXPECT_NEAR(estimateWhiteListFileBytes(path) / built, 1.0, 0.25);
+  EXPECT_EQ(estimateWhiteListFileBytes(path + ".missing"), 0);
+}
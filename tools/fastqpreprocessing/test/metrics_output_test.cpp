@@ -0,0 +1,98 @@
+#include "../src/metrics_output.h"
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <sstream>
+
+#include "gtest/gtest.h"
+
+namespace
+{
+std::string readFile(std::string const& path)
+{
+  std::ifstream in(path);
+  std::stringstream contents;
+  contents << in.rdbuf();
+  return contents.str();
+}
+} // namespace
+
+TEST(MetricsOutputTest, MergeInTree)
+{
+  for (int n = 1; n <= 9; n++)
+  {
+    std::vector<int> values(n, 1);
+    std::vector<int> merged_from;
+    std::mutex mutex;
+    mergeInTree(n, [&](int into, int from) {
+      values[into] += values[from];
+      values[from] = 0;
+      std::lock_guard<std::mutex> lock(mutex);
+      merged_from.push_back(from);
+    });
+    EXPECT_EQ(values[0], n);
+    // Every item but the first is merged exactly once.
+    std::sort(merged_from.begin(), merged_from.end());
+    std::vector<int> expected(n - 1);
+    for (int i = 0; i < n - 1; i++)
+      expected[i] = i + 1;
+    EXPECT_EQ(merged_from, expected);
+  }
+}
+
+TEST(MetricsOutputTest, WriteCountsFile)
+{
+  PackedSequenceCounter counts(4);
+  counts.add("TTTT", 2);
+  counts.add("ACGT", 5);
+  counts.add("AAAA", 2);
+  counts.add("ANNA", 3);
+  std::string path = ::testing::TempDir() + "/metrics_output_counts.txt";
+  writeCountsFile(counts, path, 4);
+  EXPECT_EQ(readFile(path), "5\tACGT\n3\tANNA\n2\tAAAA\n2\tTTTT\n");
+}
+
+// The lines of the original single threaded writeCountsFile(): a sort by
+// count alone, here with ties by sequence as the chunked sort breaks them.
+TEST(MetricsOutputTest, WriteCountsFileMatchesOneSort)
+{
+  // Enough sequences for several threads' chunks.
+  PackedSequenceCounter counts(16);
+  std::mt19937_64 random(7);
+  for (int i = 0; i < 300000; i++)
+    counts.add(unpackSequence(random(), 16), 1 + random() % 50);
+
+  std::vector<std::pair<std::string, int>> sorted_counts = counts.counts();
+  std::sort(sorted_counts.begin(), sorted_counts.end(),
+            [](std::pair<std::string, int> const& a, std::pair<std::string, int> const& b) {
+    return a.second != b.second ? a.second > b.second : a.first < b.first;
+  });
+  std::ostringstream expected;
+  for (auto [str, count] : sorted_counts)
+    expected << count << "\t" << str << "\n";
+
+  std::string path = ::testing::TempDir() + "/metrics_output_many_counts.txt";
+  for (int num_threads : {1, 3, 8})
+  {
+    writeCountsFile(counts, path, num_threads);
+    EXPECT_EQ(readFile(path), expected.str()) << num_threads;
+  }
+}
+
+TEST(MetricsOutputTest, WriteApproximateCountsFile)
+{
+  ApproximateSequenceCounter counts(2);
+  counts.add("AAAA");
+  counts.add("CCCC");
+  counts.add("CCCC");
+  counts.add("GGGG");
+  std::string path = ::testing::TempDir() + "/metrics_output_approximate.txt";
+  writeApproximateCountsFile(counts, path);
+  std::string contents = readFile(path);
+  EXPECT_EQ(contents.substr(0, contents.find('\n')),
+            "# approximate: the 2 most frequent of about 3 distinct sequences in 4 reads; "
+            "each count may be too high by up to its third column");
+  EXPECT_EQ(contents.substr(contents.find('\n') + 1), "2\tCCCC\t0\n2\tGGGG\t1\n");
+}
@@ -0,0 +1,96 @@
+#include "../src/approximate_counts.h"
+#include "../src/metrics_state.h"
+#include "../src/packed_counts.h"
+
+#include <algorithm>
+
+#include "gmock/gmock-matchers.h"
+#include "gtest/gtest.h"
+
+using ::testing::ElementsAre;
+using ::testing::Pair;
+
+namespace
+{
+std::vector<std::pair<std::string, int>> sortedCounts(PackedSequenceCounter const& counter)
+{
+  auto counts = counter.counts();
+  std::sort(counts.begin(), counts.end());
+  return counts;
+}
+} // namespace
+
+TEST(MetricsStateTest, RoundTripsValues)
+{
+  std::string path = ::testing::TempDir() + "/metrics_state_values";
+  StateWriter out(path);
+  out.writeInt(-7);
+  out.writeString("ACGT");
+  out.writeInts({1, 2, 3});
+  out.close();
+
+  StateReader in(path);
+  EXPECT_EQ(in.readInt(), -7);
+  EXPECT_EQ(in.readString(), "ACGT");
+  EXPECT_EQ(in.readInts(), (std::vector<int64_t>{1, 2, 3}));
+}
+
+TEST(MetricsStateTest, RoundTripsPackedCounts)
+{
+  // Dense (4 bases), hash table (16 bases), and escaped counts (N, short).
+  PackedSequenceCounter dense(4), table(16);
+  dense.add("ACGT", 3);
+  dense.add("ACGN");
+  dense.add("AC");
+  table.add("ACGTACGTACGTACGT", 2);
+  table.add("TTTTTTTTTTTTTTTT");
+
+  std::string path = ::testing::TempDir() + "/metrics_state_packed";
+  StateWriter out(path);
+  dense.save(&out);
+  table.save(&out);
+  out.close();
+
+  StateReader in(path);
+  PackedSequenceCounter loaded_dense = PackedSequenceCounter::load(&in);
+  PackedSequenceCounter loaded_table = PackedSequenceCounter::load(&in);
+  EXPECT_THAT(sortedCounts(loaded_dense), ElementsAre(Pair("AC", 1), Pair("ACGN", 1), Pair("ACGT", 3)));
+  EXPECT_THAT(sortedCounts(loaded_table),
+              ElementsAre(Pair("ACGTACGTACGTACGT", 2), Pair("TTTTTTTTTTTTTTTT", 1)));
+
+  // Loaded counts keep counting as before.
+  loaded_dense += dense;
+  EXPECT_THAT(sortedCounts(loaded_dense), ElementsAre(Pair("AC", 2), Pair("ACGN", 2), Pair("ACGT", 6)));
+}
+
+TEST(MetricsStateTest, RoundTripsApproximateCounts)
+{
+  ApproximateSequenceCounter counter(2);
+  for (int i = 0; i < 100; i++)
+    counter.add(i % 2 ? "AAAA" : "CCCC" + std::to_string(i));
+
+  std::string path = ::testing::TempDir() + "/metrics_state_approximate";
+  StateWriter out(path);
+  counter.save(&out);
+  out.close();
+
+  StateReader in(path);
+  ApproximateSequenceCounter loaded = ApproximateSequenceCounter::load(&in);
+  EXPECT_EQ(loaded.top().capacity(), 2);
+  EXPECT_EQ(loaded.top().total(), 100);
+  EXPECT_EQ(loaded.distinctEstimate(), counter.distinctEstimate());
+  auto entries = loaded.top().entries();
+  auto expected = counter.top().entries();
+  ASSERT_EQ(entries.size(), expected.size());
+  for (size_t i = 0; i < entries.size(); i++)
+  {
+    EXPECT_EQ(entries[i].seq, expected[i].seq);
+    EXPECT_EQ(entries[i].count, expected[i].count);
+    EXPECT_EQ(entries[i].error, expected[i].error);
+  }
+  EXPECT_EQ(entries[0].seq, "AAAA");
+
+  // Adds up like the counter it was saved from.
+  loaded.add("AAAA");
+  EXPECT_EQ(loaded.top().entries()[0].count, expected[0].count + 1);
+}
@@ -0,0 +1,66 @@
+#include "../src/numa_placement.h"
+
+#include <filesystem>
+#include <fstream>
+
+#include "gmock/gmock-matchers.h"
+#include "gtest/gtest.h"
+
+using ::testing::ElementsAre;
+
+TEST(NumaPlacementTest, ParseCpuList)
+{
+  EXPECT_THAT(parseCpuList("0-3,8,10-11\n"), ElementsAre(0, 1, 2, 3, 8, 10, 11));
+  EXPECT_THAT(parseCpuList("5"), ElementsAre(5));
+  EXPECT_TRUE(parseCpuList("").empty());
+}
+
+TEST(NumaPlacementTest, ReadNumaTopology)
+{
+  std::filesystem::path root = std::filesystem::temp_directory_path() / "numa_placement_test";
+  std::filesystem::remove_all(root);
+  auto add_node = [&](std::string const& name, std::string const& cpulist) {
+    std::filesystem::create_directories(root / name);
+    std::ofstream(root / name / "cpulist") << cpulist << "\n";
+  };
+  add_node("node1", "4-7");
+  add_node("node0", "0-3");
+  add_node("node2", "8-11");
+  std::filesystem::create_directories(root / "power");
+
+  // node2 has none of the allowed CPUs, so it's left out.
+  std::vector<NumaNode> nodes = readNumaTopology(root, {1, 2, 3, 4, 5});
+  ASSERT_EQ(nodes.size(), 2);
+  EXPECT_EQ(nodes[0].id, 0);
+  EXPECT_THAT(nodes[0].cpus, ElementsAre(1, 2, 3));
+  EXPECT_EQ(nodes[1].id, 1);
+  EXPECT_THAT(nodes[1].cpus, ElementsAre(4, 5));
+
+  EXPECT_TRUE(readNumaTopology(root / "missing", {0}).empty());
+  std::filesystem::remove_all(root);
+}
+
+TEST(NumaPlacementTest, ReadersBalancedByBytes)
+{
+  std::vector<NumaNode> nodes = {{0, {0, 1}}, {1, {2, 3}}};
+  // Largest first, each to the node with less input so far.
+  NumaPlacement placement = placeOnNumaNodes(nodes, {100, 60, 40, 20, 20}, 4);
+  EXPECT_THAT(placement.reader_nodes, ElementsAre(0, 1, 1, 0, 1));
+  // 120 bytes on each node, so two writers each.
+  EXPECT_THAT(placement.writer_nodes, ElementsAre(0, 0, 1, 1));
+}
+
+TEST(NumaPlacementTest, WritersFollowInput)
+{
+  std::vector<NumaNode> nodes = {{0, {0}}, {1, {1, 2, 3}}};
+  // Node 1 has three times the CPUs, so it gets three times the input...
+  NumaPlacement placement = placeOnNumaNodes(nodes, {10, 10, 10, 10}, 8);
+  EXPECT_THAT(placement.reader_nodes, ElementsAre(1, 1, 0, 1));
+  // ...and three times the writers.
+  EXPECT_THAT(placement.writer_nodes, ElementsAre(0, 0, 1, 1, 1, 1, 1, 1));
+
+  // Unknown sizes count as average ones; every writer gets a node.
+  placement = placeOnNumaNodes(nodes, {0, 0}, 3);
+  EXPECT_EQ(placement.reader_nodes.size(), 2);
+  EXPECT_EQ(placement.writer_nodes.size(), 3);
+}
@@ -0,0 +1,50 @@
+#include "../src/output_schema.h"
+
+#include "gmock/gmock-matchers.h"
+#include "gtest/gtest.h"
+
+TEST(OutputSchemaTest, ParseTagList)
+{
+  OutputTagSet tags = OutputTagSet::parse("CR,UR,SR");
+  EXPECT_TRUE(tags.has("CR"));
+  EXPECT_TRUE(tags.has("UR"));
+  EXPECT_TRUE(tags.has("SR"));
+  EXPECT_FALSE(tags.has("S1"));
+  EXPECT_FALSE(tags.has("Q1"));
+  EXPECT_FALSE(tags.has("CY"));
+
+  OutputTagSet all = OutputTagSet::all();
+  for (std::string const& tag : kOptionalOutputTags)
+    EXPECT_TRUE(all.has(tag.c_str()));
+  EXPECT_FALSE(all.has("CB"));
+}
+
+TEST(OutputSchemaTest, UnknownTagCrashes)
+{
+  EXPECT_EXIT(OutputTagSet::parse("CR,XX"), ::testing::ExitedWithCode(1), "Unknown output tag 'XX'");
+}
+
+TEST(OutputSchemaTest, RequiredTags)
+{
+  OutputTagSet bam = requiredOutputTags("BAM", false, false, false);
+  EXPECT_TRUE(bam.has("CR"));
+  EXPECT_FALSE(bam.has("UR"));
+  EXPECT_FALSE(bam.has("S1"));
+  EXPECT_TRUE(requiredOutputTags("BAM", false, false, true).has("UR"));
+
+  OutputTagSet fastq = requiredOutputTags("FASTQ", false, false, false);
+  for (const char* tag : {"CR", "CY", "UR", "UY"})
+    EXPECT_TRUE(fastq.has(tag)) << tag;
+  EXPECT_FALSE(fastq.has("S1"));
+  EXPECT_FALSE(fastq.has("S3"));
+
+  OutputTagSet atac_sampled = requiredOutputTags("FASTQ", true, true, false);
+  for (const char* tag : {"S1", "Q1", "S3", "Q3"})
+    EXPECT_TRUE(atac_sampled.has(tag)) << tag;
+}
+
+TEST(OutputSchemaTest, CompactReadName)
+{
+  EXPECT_EQ(compactReadName(0, 1), "0:1");
+  EXPECT_EQ(compactReadName(12, 123456789), "12:123456789");
+}
@@ -0,0 +1,122 @@
+#include "../src/output_stream.h"
+
+#include "gmock/gmock-matchers.h"
+#include "gtest/gtest.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <zlib.h>
+
+std::string readGzipped(std::string const& path)
+{
+  gzFile in = gzopen(path.c_str(), "rb");
+  std::string ret;
+  char buf[4096];
+  int n;
+  while ((n = gzread(in, buf, sizeof(buf))) > 0)
+    ret.append(buf, n);
+  gzclose(in);
+  return ret;
+}
+
+std::string tempPath(std::string const& name)
+{
+  return (std::filesystem::temp_directory_path() / name).string();
+}
+
+// Level 0 writes the text as-is.
+TEST(ShardOutputStreamTest, Uncompressed)
+{
+  std::string path = tempPath("output_stream_test.fastq");
+  {
+    ShardOutputStream out(path, 0);
+    ASSERT_TRUE(out);
+    out << "@read1\nACGT\n+\nFFFF\n";
+  }
+  std::ifstream in(path);
+  std::stringstream contents;
+  contents << in.rdbuf();
+  EXPECT_EQ(contents.str(), "@read1\nACGT\n+\nFFFF\n");
+  std::filesystem::remove(path);
+}
+
+// Output larger than the internal buffers round-trips through gzip, and the
+// byte counters see both sides of the compression.
+TEST(ShardOutputStreamTest, GzipRoundTrip)
+{
+  std::string path = tempPath("output_stream_test.fastq.gz");
+  std::string expected;
+  for (int i = 0; i < 100000; i++)
+    expected += "@read" + std::to_string(i) + "\nACGTACGTAC\n+\nFFFFFFFFFF\n";
+  {
+    ShardOutputStream out(path, 1);
+    ASSERT_TRUE(out);
+    out << expected;
+    out.close();
+    EXPECT_EQ(out.uncompressedBytes(), expected.size());
+    EXPECT_EQ(out.compressedBytes(), std::filesystem::file_size(path));
+    EXPECT_LT(out.compressedBytes(), out.uncompressedBytes());
+  }
+  EXPECT_EQ(readGzipped(path), expected);
+  std::filesystem::remove(path);
+}
+
+// Resuming from a checkpoint drops whatever was written after it.
+TEST(ShardOutputStreamTest, ResumeFromCheckpoint)
+{
+  std::string path = tempPath("output_stream_test_resume.fastq.gz");
+  int64_t checkpointed_size;
+  {
+    ShardOutputStream out(path, 1);
+    out << "@kept\nACGT\n+\nFFFF\n";
+    checkpointed_size = out.checkpoint();
+    EXPECT_EQ(checkpointed_size, std::filesystem::file_size(path));
+    out << "@lost\nACGT\n+\nFFFF\n";
+  }
+  {
+    ShardOutputStream out(path, 1, checkpointed_size);
+    ASSERT_TRUE(out);
+    out << "@resumed\nTTTT\n+\nFFFF\n";
+  }
+  EXPECT_EQ(readGzipped(path), "@kept\nACGT\n+\nFFFF\n@resumed\nTTTT\n+\nFFFF\n");
+  std::filesystem::remove(path);
+}
+
+TEST(ShardOutputStreamTest, BadPath)
+{
+  ShardOutputStream out("/nonexistent_dir/shard.fastq.gz", -1);
+  EXPECT_FALSE(out);
+}
+
+// What's written to the FIFO lands in the file, counted and hashed.
+TEST(ChecksummedOutputPipeTest, CopiesAndHashes)
+{
+  std::string path = tempPath("output_stream_test_checksummed.bam");
+  std::string expected;
+  for (int i = 0; i < 200000; i++)
+    expected += "record " + std::to_string(i) + "\n";
+  ChecksummedOutputPipe checksummed(path);
+  EXPECT_EQ(checksummed.pipePath(), path + ".pipe.bam");
+  FILE* out = fopen(checksummed.pipePath().c_str(), "w");
+  ASSERT_TRUE(out);
+  checksummed.start();
+  EXPECT_FALSE(std::filesystem::exists(checksummed.pipePath()));
+
+  size_t half = expected.size() / 2;
+  fwrite(expected.data(), 1, half, out);
+  fflush(out);
+  checksummed.drain();
+  EXPECT_EQ(checksummed.bytes(), half);
+  EXPECT_EQ(std::filesystem::file_size(path), half);
+
+  fwrite(expected.data() + half, 1, expected.size() - half, out);
+  fclose(out);
+  checksummed.finish();
+  EXPECT_EQ(checksummed.bytes(), expected.size());
+  Md5 md5;
+  md5.update(expected.data(), expected.size());
+  std::string digest = md5.hexDigest();
+  EXPECT_EQ(checksummed.md5(), digest);
+  EXPECT_EQ(md5File(path), digest);
+  std::filesystem::remove(path);
+}
@@ -0,0 +1,87 @@
+#include "../src/packed_counts.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "gmock/gmock-matchers.h"
+#include "gtest/gtest.h"
+
+using ::testing::Pair;
+using ::testing::ElementsAre;
+
+TEST(PackedCountsTest, PackAndUnpack)
+{
+  uint64_t packed;
+  ASSERT_TRUE(packSequence("ACGT", &packed));
+  EXPECT_EQ(packed, 0b00011011);
+  EXPECT_EQ(unpackSequence(packed, 4), "ACGT");
+  std::string longest(kMaxPackedLength, 'T');
+  ASSERT_TRUE(packSequence(longest, &packed));
+  EXPECT_EQ(unpackSequence(packed, kMaxPackedLength), longest);
+
+  EXPECT_FALSE(packSequence("ACNT", &packed));
+  EXPECT_FALSE(packSequence("acgt", &packed));
+  EXPECT_FALSE(packSequence(longest + "A", &packed));
+}
+
+TEST(PackedCountsTest, DenseCounts)
+{
+  PackedSequenceCounter counter(4);
+  counter.add("ACGT");
+  counter.add("ACGT");
+  counter.add("TTTT", 5);
+  // Escaped: an N, and a read cut short.
+  counter.add("ACNT");
+  counter.add("AC");
+  auto counts = counter.counts();
+  std::sort(counts.begin(), counts.end());
+  EXPECT_THAT(counts, ElementsAre(Pair("AC", 1), Pair("ACGT", 2), Pair("ACNT", 1), Pair("TTTT", 5)));
+}
+
+TEST(PackedCountsTest, TableCountsAndMerge)
+{
+  // Enough distinct 16 base sequences for the table to grow a few times.
+  PackedSequenceCounter a(16), b(16);
+  for (int i = 0; i < 5000; i++)
+  {
+    std::string seq = unpackSequence(i * 7919ull, 16);
+    a.add(seq);
+    b.add(seq, 2);
+  }
+  b.add("NNNNNNNNNNNNNNNN");
+  a += b;
+  auto counts = a.counts();
+  EXPECT_EQ(counts.size(), 5001);
+  for (auto const& [seq, count] : counts)
+    EXPECT_EQ(count, seq[0] == 'N' ? 1 : 3) << seq;
+}
+
+TEST(PackedCountsTest, SharedDenseCounts)
+{
+  PackedSequenceCounter a(4);
+  PackedSequenceCounter b = a.sharingDenseCounts();
+  std::thread thread([&b]() {
+    for (int i = 0; i < 10000; i++)
+      b.add("ACGT");
+    b.add("ACNT");
+  });
+  for (int i = 0; i < 10000; i++)
+    a.add("ACGT");
+  a.add("TTTT");
+  thread.join();
+
+  // The dense counts are already shared: merging adds only b's own counts.
+  a += b;
+  auto counts = a.counts();
+  std::sort(counts.begin(), counts.end());
+  EXPECT_THAT(counts, ElementsAre(Pair("ACGT", 20000), Pair("ACNT", 1), Pair("TTTT", 1)));
+
+  // Unlike a counter of its own.
+  PackedSequenceCounter c(4);
+  c.add("ACGT", 3);
+  a += c;
+  EXPECT_THAT(c.counts(), ElementsAre(Pair("ACGT", 3)));
+  counts = a.counts();
+  std::sort(counts.begin(), counts.end());
+  EXPECT_THAT(counts, ElementsAre(Pair("ACGT", 20003), Pair("ACNT", 1), Pair("TTTT", 1)));
+}
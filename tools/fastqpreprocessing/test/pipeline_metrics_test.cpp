@@ -0,0 +1,64 @@
+#include "../src/pipeline_metrics.h"
+
+#include "gmock/gmock-matchers.h"
+#include "gtest/gtest.h"
+#include <filesystem>
+#include <fstream>
+
+using ::testing::HasSubstr;
+
+MetricsSnapshot makeSnapshot(double elapsed_sec, int64_t reads, int64_t deflated_bytes)
+{
+  MetricsSnapshot snapshot;
+  snapshot.elapsed_sec = elapsed_sec;
+  ReaderMetrics reader;
+  reader.input = "dir/R1 \"quoted\".fastq.gz";
+  reader.reads = reads;
+  reader.barcodes_correct = reads - 1;
+  reader.barcodes_uncorrectable = 1;
+  snapshot.readers.push_back(reader);
+  ShardMetrics shard;
+  shard.queue_depth = 7;
+  shard.records = reads;
+  shard.deflated_bytes = deflated_bytes;
+  snapshot.shards.push_back(shard);
+  return snapshot;
+}
+
+TEST(PipelineMetricsTest, WholeRunRates)
+{
+  std::string json = metricsToJson(makeSnapshot(10, 1000, 20000000), nullptr);
+  EXPECT_THAT(json, HasSubstr("\"input\":\"dir/R1 \\\"quoted\\\".fastq.gz\""));
+  EXPECT_THAT(json, HasSubstr("\"reads\":1000,\"reads_per_sec\":100,"));
+  EXPECT_THAT(json, HasSubstr("\"barcodes_correct\":999,"));
+  EXPECT_THAT(json, HasSubstr("\"barcodes_uncorrectable\":1}"));
+  EXPECT_THAT(json, HasSubstr("\"queue_depth\":7,"));
+  EXPECT_THAT(json, HasSubstr("\"deflated_mb_per_sec\":2,"));
+  EXPECT_EQ(json.front(), '{');
+  EXPECT_EQ(json.back(), '}');
+}
+
+TEST(PipelineMetricsTest, IntervalRates)
+{
+  MetricsSnapshot before = makeSnapshot(10, 1000, 0);
+  std::string json = metricsToJson(makeSnapshot(12, 1600, 0), &before);
+  EXPECT_THAT(json, HasSubstr("\"reads\":1600,\"reads_per_sec\":300,"));
+  EXPECT_THAT(json, HasSubstr("],\"reads_per_sec\":300}"));
+}
+
+TEST(PipelineMetricsTest, ReporterWritesFinalLine)
+{
+  std::string path = (std::filesystem::temp_directory_path() / "pipeline_metrics_test.jsonl").string();
+  std::filesystem::remove(path);
+  {
+    MetricsReporter reporter(path, 60, []() { return makeSnapshot(1, 10, 0); });
+    reporter.start();
+    reporter.stop();
+  }
+  std::ifstream in(path);
+  std::string line;
+  ASSERT_TRUE(std::getline(in, line));
+  EXPECT_THAT(line, HasSubstr("\"reads\":10,"));
+  EXPECT_FALSE(std::getline(in, line));
+  std::filesystem::remove(path);
+}
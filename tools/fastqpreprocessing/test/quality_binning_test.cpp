@@ -0,0 +1,73 @@
+#include "../src/quality_binning.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+#include "gmock/gmock-matchers.h"
+#include "gtest/gtest.h"
+
+char phred(int q)
+{
+  return static_cast<char>(q + 33);
+}
+
+TEST(QualityBinningTest, Illumina8)
+{
+  QualityBinning binning = QualityBinning::illumina8();
+  EXPECT_EQ(binning.map(phred(0)), phred(0));
+  EXPECT_EQ(binning.map(phred(1)), phred(1));
+  EXPECT_EQ(binning.map(phred(2)), phred(6));
+  EXPECT_EQ(binning.map(phred(9)), phred(6));
+  EXPECT_EQ(binning.map(phred(10)), phred(15));
+  EXPECT_EQ(binning.map(phred(24)), phred(22));
+  EXPECT_EQ(binning.map(phred(25)), phred(27));
+  EXPECT_EQ(binning.map(phred(32)), phred(33));
+  EXPECT_EQ(binning.map(phred(38)), phred(37));
+  EXPECT_EQ(binning.map(phred(41)), phred(40));
+  EXPECT_EQ(binning.map("FFFF:,#"), "FFFF<0'");
+  // Not quality characters.
+  EXPECT_EQ(binning.map('\n'), '\n');
+}
+
+TEST(QualityBinningTest, TableFile)
+{
+  std::string path = (std::filesystem::temp_directory_path() / "quality_binning_test.txt").string();
+  std::ofstream(path) << "# low high score\n"
+                         "0 19 10\n"
+                         "\n"
+                         "20 93 30  # everything else\n";
+  QualityBinning binning = QualityBinning::fromOption(path);
+  EXPECT_EQ(binning.map(phred(3)), phred(10));
+  EXPECT_EQ(binning.map(phred(19)), phred(10));
+  EXPECT_EQ(binning.map(phred(20)), phred(30));
+  EXPECT_EQ(binning.map(phred(41)), phred(30));
+  std::remove(path.c_str());
+}
+
+TEST(QualityBinningTest, MalformedTableLinesCrash)
+{
+  std::string path = (std::filesystem::temp_directory_path() / "quality_binning_test_bad.txt").string();
+  for (const char* line : {"x 2 9 6\n", "2-9 6\n", "2 9\n", "2 9 6 7\n"})
+  {
+    std::ofstream(path) << "0 1 0\n  \t\n" << line;
+    EXPECT_EXIT(QualityBinning::fromTableFile(path), ::testing::ExitedWithCode(1), "ERROR") << line;
+  }
+  std::remove(path.c_str());
+}
+
+TEST(QualityBinningTest, MapIntoBuffer)
+{
+  QualityBinning binning = QualityBinning::illumina8();
+  std::string binned = "a longer string than the qualities";
+  binning.map("FFFF:,#", &binned);
+  EXPECT_EQ(binned, "FFFF<0'");
+}
+
+TEST(QualityBinningTest, UncoveredScoresKept)
+{
+  QualityBinning binning = QualityBinning::illumina8();
+  binning.addBin(30, 34, 31);
+  EXPECT_EQ(binning.map(phred(34)), phred(31));
+  EXPECT_EQ(binning.map(phred(35)), phred(37));
+}
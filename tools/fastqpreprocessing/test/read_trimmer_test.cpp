@@ -0,0 +1,99 @@
+#include "../src/read_trimmer.h"
+
+#include <string>
+
+#include "gmock/gmock-matchers.h"
+#include "gtest/gtest.h"
+
+constexpr char kTso[] = "AAGCAGTGGTATCAACGCAGAGTACATGGG";
+constexpr char kAdapter[] = "CTGTCTCTTATACACATCT";
+
+int findAdapter(std::string const& read, std::string const& adapter)
+{
+  return findAdapter(read.data(), read.size(), adapter);
+}
+
+int findTsoEnd(std::string const& read, std::string const& tso)
+{
+  return findTsoEnd(read.data(), read.size(), tso);
+}
+
+TEST(ReadTrimmerTest, FindAdapter)
+{
+  std::string insert = "TTGACCATGACGTTAGCA";
+  EXPECT_EQ(findAdapter(insert + kAdapter + "GGGG", kAdapter), insert.size());
+  // One mismatch in the 19 bases is allowed, two aren't.
+  EXPECT_EQ(findAdapter(insert + "CTGTCTCTTATTCACATCT", kAdapter), insert.size());
+  EXPECT_EQ(findAdapter(insert + "CTGTCTGTTATTCACATCT", kAdapter), insert.size() + 19);
+  // A prefix of the adapter at the end of the read.
+  EXPECT_EQ(findAdapter(insert + "CTGTC", kAdapter), insert.size());
+  EXPECT_EQ(findAdapter(insert, kAdapter), insert.size());
+}
+
+TEST(ReadTrimmerTest, FindTsoEnd)
+{
+  std::string insert = "TTGACCATGACGTTAGCA";
+  EXPECT_EQ(findTsoEnd(kTso + insert, kTso), 30);
+  EXPECT_EQ(findTsoEnd("CC" + (kTso + insert), kTso), 32);
+  // The end of the TSO at the start of the read.
+  EXPECT_EQ(findTsoEnd("ACATGGG" + insert, kTso), 7);
+  EXPECT_EQ(findTsoEnd(insert, kTso), 0);
+}
+
+TEST(ReadTrimmerTest, PolyAAndComplexity)
+{
+  EXPECT_EQ(polyATailLength("CGTAAAAAAAAAAAAAAAAAAA", 22), 19);
+  EXPECT_EQ(polyATailLength("CGTAAAC", 7), 0);
+  EXPECT_EQ(polyATailLength("AAAA", 4), 4);
+  EXPECT_DOUBLE_EQ(sequenceComplexity("GGGGG", 5), 0);
+  EXPECT_DOUBLE_EQ(sequenceComplexity("ACGTA", 5), 1);
+  EXPECT_DOUBLE_EQ(sequenceComplexity("GGGGGGGGGA", 10), 1.0 / 9);
+}
+
+TEST(ReadTrimmerTest, Trim)
+{
+  TrimOptions options;
+  options.tso = kTso;
+  options.adapter = kAdapter;
+  options.poly_a_length = 10;
+  options.min_length = 20;
+  options.min_complexity = 0.3;
+  ReadTrimmer trimmer(options);
+  TrimCounts counts;
+
+  std::string insert = "TTGACCATGACGTTAGCATTGACCATGACG";
+  std::string read = kTso + insert + std::string(12, 'A') + kAdapter;
+  TrimResult result = trimmer.trim(read.data(), read.size(), &counts);
+  EXPECT_TRUE(result.keep);
+  EXPECT_EQ(read.substr(result.start, result.end - result.start), insert);
+
+  std::string too_short = kTso + insert.substr(0, 15);
+  EXPECT_FALSE(trimmer.trim(too_short.data(), too_short.size(), &counts).keep);
+  std::string repetitive = std::string(40, 'T');
+  EXPECT_FALSE(trimmer.trim(repetitive.data(), repetitive.size(), &counts).keep);
+
+  EXPECT_EQ(counts.reads, 3);
+  EXPECT_EQ(counts.tso_trimmed, 2);
+  EXPECT_EQ(counts.adapter_trimmed, 1);
+  EXPECT_EQ(counts.poly_a_trimmed, 1);
+  EXPECT_EQ(counts.bases_trimmed, 30 + 12 + 19 + 30);
+  EXPECT_EQ(counts.too_short, 1);
+  EXPECT_EQ(counts.low_complexity, 1);
+}
+
+// With no --min-read-length, a read trimmed to nothing is still dropped.
+TEST(ReadTrimmerTest, TrimmedAwayEntirely)
+{
+  TrimOptions options;
+  options.adapter = kAdapter;
+  ReadTrimmer trimmer(options);
+  TrimCounts counts;
+
+  std::string adapter_only = kAdapter;
+  EXPECT_FALSE(trimmer.trim(adapter_only.data(), adapter_only.size(), &counts).keep);
+  std::string one_base = "G" + adapter_only;
+  TrimResult result = trimmer.trim(one_base.data(), one_base.size(), &counts);
+  EXPECT_TRUE(result.keep);
+  EXPECT_EQ(result.end - result.start, 1);
+  EXPECT_EQ(counts.too_short, 1);
+}
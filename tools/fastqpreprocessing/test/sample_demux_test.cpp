@@ -0,0 +1,102 @@
+#include "../src/sample_demux.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+#include "gmock/gmock-matchers.h"
+#include "gtest/gtest.h"
+
+SampleSheet sheetFromText(std::string const& text)
+{
+  std::string path = (std::filesystem::temp_directory_path() / "sample_demux_test.csv").string();
+  std::ofstream(path) << text;
+  SampleSheet sheet = readSampleSheet(path);
+  std::remove(path.c_str());
+  return sheet;
+}
+
+TEST(SampleDemuxTest, ReadSampleSheet)
+{
+  SampleSheet sheet = sheetFromText("# sample,index1,index2\n"
+                                    "liver,AAAACCCC,GGGGTTTT\n"
+                                    "\n"
+                                    "lung\tCCCCGGGG\tTTTTAAAA  # lane 2\n");
+  ASSERT_EQ(sheet.rows.size(), 2);
+  EXPECT_EQ(sheet.rows[0].name, "liver");
+  EXPECT_EQ(sheet.rows[0].index1, "AAAACCCC");
+  EXPECT_EQ(sheet.rows[0].index2, "GGGGTTTT");
+  EXPECT_EQ(sheet.rows[1].name, "lung");
+  EXPECT_EQ(sheet.rows[1].index1, "CCCCGGGG");
+  EXPECT_EQ(sheet.rows[1].index2, "TTTTAAAA");
+  EXPECT_EQ(sheet.samples, std::vector<std::string>({"liver", "lung"}));
+}
+
+TEST(SampleDemuxTest, SingleIndex)
+{
+  SampleDemultiplexer demux(sheetFromText("a AAAAAAAA\n"
+                                          "b CCCCCCCC\n"
+                                          "c GGGGGGGG\n"));
+  EXPECT_FALSE(demux.dualIndex());
+  EXPECT_EQ(demux.numSamples(), 3);
+  EXPECT_EQ(demux.sampleName(2), "c");
+  EXPECT_EQ(demux.assign("CCCCCCCC", ""), 1);
+  // One mismatch or no-call is corrected; two aren't.
+  EXPECT_EQ(demux.assign("CCCACCCC", ""), 1);
+  EXPECT_EQ(demux.assign("GGGGGGGN", ""), 2);
+  EXPECT_EQ(demux.assign("AAAAAATT", ""), SampleDemultiplexer::kUndetermined);
+  // Index reads longer than the indexes are matched on their first bases.
+  EXPECT_EQ(demux.assign("AAAAAAAATT", ""), 0);
+  EXPECT_EQ(demux.assign("AAAA", ""), SampleDemultiplexer::kUndetermined);
+  // I2 isn't looked at.
+  EXPECT_EQ(demux.assign("CCCCCCCC", "TTTTTTTT"), 1);
+}
+
+TEST(SampleDemuxTest, DualIndex)
+{
+  // Index1s and index2s shared between samples, but no pair is.
+  SampleDemultiplexer demux(sheetFromText("a AAAAAAAA CCCCCCCC\n"
+                                          "b AAAAAAAA GGGGGGGG\n"
+                                          "c TTTTTTTT CCCCCCCC\n"));
+  EXPECT_TRUE(demux.dualIndex());
+  EXPECT_EQ(demux.assign("AAAAAAAA", "CCCCCCCC"), 0);
+  EXPECT_EQ(demux.assign("AAAAAAAA", "GGGGAGGG"), 1);
+  EXPECT_EQ(demux.assign("TTTTTTTA", "CCCCCCCC"), 2);
+  // Both indexes are in the sheet, but not as a pair.
+  EXPECT_EQ(demux.assign("TTTTTTTT", "GGGGGGGG"), SampleDemultiplexer::kUndetermined);
+  EXPECT_EQ(demux.assign("AAAAAAAA", "ACGTACGT"), SampleDemultiplexer::kUndetermined);
+}
+
+// A 10x SI-GA set: 4 oligos per sample, each read to its sample by any of them.
+TEST(SampleDemuxTest, SeveralIndexesPerSample)
+{
+  SampleDemultiplexer demux(sheetFromText("SI-GA-A1 GGTTTACT\n"
+                                          "SI-GA-A1 CTAAACGG\n"
+                                          "SI-GA-A1 TCGGCGTC\n"
+                                          "SI-GA-A1 AACCGTAA\n"
+                                          "SI-GA-A2 TTTCATGA\n"
+                                          "SI-GA-A2 ACGTCCCT\n"
+                                          "SI-GA-A2 CGCATGTG\n"
+                                          "SI-GA-A2 GAAGGAAC\n"));
+  EXPECT_EQ(demux.numSamples(), 2);
+  EXPECT_EQ(demux.sampleName(1), "SI-GA-A2");
+  EXPECT_EQ(demux.assign("GGTTTACT", ""), 0);
+  EXPECT_EQ(demux.assign("AACCGTAT", ""), 0);
+  EXPECT_EQ(demux.assign("CGCATGTG", ""), 1);
+  EXPECT_EQ(demux.assign("GAAGGAAA", ""), 1);
+}
+
+// Close indexes are only a problem between different samples.
+TEST(SampleDemuxTest, CloseIndexesOfOneSample)
+{
+  SampleDemultiplexer demux(sheetFromText("a AAAAAAAA\n"
+                                          "a AAAAAATT\n"
+                                          "b CCCCCCCC\n"));
+  EXPECT_EQ(demux.assign("AAAAAAAT", ""), 0);
+  EXPECT_EXIT(SampleDemultiplexer(sheetFromText("a AAAAAAAA\n"
+                                                "b AAAAAATT\n")),
+              ::testing::ExitedWithCode(1), "too similar");
+  EXPECT_EXIT(SampleDemultiplexer(sheetFromText("a AAAAAAAA\n"
+                                                "b AAAAAAAA\n")),
+              ::testing::ExitedWithCode(1), "too similar|same indexes");
+}
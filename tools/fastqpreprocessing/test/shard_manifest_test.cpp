@@ -0,0 +1,53 @@
+#include "../src/shard_manifest.h"
+
+#include "gmock/gmock-matchers.h"
+#include "gtest/gtest.h"
+
+TEST(ShardManifestTest, BarcodeCounter)
+{
+  ShardBarcodeCounter counter;
+  counter.add("AAAA", BarcodeMatch::kCorrect);
+  counter.add("AAAA", BarcodeMatch::kCorrected);
+  counter.add("CCCC", BarcodeMatch::kCorrect);
+  counter.add("", BarcodeMatch::kUncorrectable);
+  EXPECT_EQ(counter.tallies().correct, 2);
+  EXPECT_EQ(counter.tallies().corrected, 1);
+  EXPECT_EQ(counter.tallies().uncorrectable, 1);
+  EXPECT_EQ(counter.distinctBarcodes(), 2);
+}
+
+TEST(ShardManifestTest, ResumedCounterHasNoDistinctCount)
+{
+  ShardBarcodeCounter counter;
+  counter.resume(BarcodeTallies{10, 2, 3});
+  counter.add("AAAA", BarcodeMatch::kCorrect);
+  EXPECT_EQ(counter.tallies().correct, 11);
+  EXPECT_EQ(counter.tallies().corrected, 2);
+  EXPECT_EQ(counter.tallies().uncorrectable, 3);
+  EXPECT_EQ(counter.distinctBarcodes(), -1);
+}
+
+TEST(ShardManifestTest, Json)
+{
+  OutputManifest manifest;
+  manifest.output_format = "BAM";
+  manifest.barcodes = BarcodeTallies{5, 2, 1};
+  ShardSummary shard;
+  shard.records = 8;
+  shard.barcodes = BarcodeTallies{5, 2, 1};
+  shard.distinct_barcodes = 3;
+  shard.files.push_back(ShardFileSummary{"out/subfile_0.bam", 1234, "0123456789abcdef0123456789abcdef"});
+  manifest.shards.push_back(shard);
+  ShardSummary fifo;
+  fifo.files.push_back(ShardFileSummary{"out/subfile_1.bam"});
+  manifest.shards.push_back(fifo);
+
+  EXPECT_EQ(outputManifestToJson(manifest),
+            "{\"output_format\":\"BAM\",\"barcodes\":{\"correct\":5,\"corrected\":2,\"uncorrectable\":1},"
+            "\"shards\":[\n"
+            "{\"shard\":0,\"records\":8,\"barcodes\":{\"correct\":5,\"corrected\":2,\"uncorrectable\":1,"
+            "\"distinct\":3},\"files\":[{\"path\":\"out/subfile_0.bam\",\"bytes\":1234,"
+            "\"md5\":\"0123456789abcdef0123456789abcdef\"}]},\n"
+            "{\"shard\":1,\"records\":0,\"barcodes\":{\"correct\":0,\"corrected\":0,\"uncorrectable\":0,"
+            "\"distinct\":null},\"files\":[{\"path\":\"out/subfile_1.bam\",\"bytes\":null,\"md5\":null}]}]}");
+}
@@ -0,0 +1,85 @@
+#include "../src/thread_tuner.h"
+
+#include "gmock/gmock-matchers.h"
+#include "gtest/gtest.h"
+
+// Heavier compression shifts the cores from the readers to the writers.
+TEST(ThreadTunerTest, ReaderShareFollowsCompression)
+{
+  std::vector<int64_t> inputs(16, 1000);
+  ThreadPlan light = planThreads(16, inputs, 16, "FASTQ", 0);
+  ThreadPlan heavy = planThreads(16, inputs, 16, "FASTQ", 9);
+  EXPECT_GT(light.reader_share, heavy.reader_share);
+  EXPECT_GT(light.reader_slots, heavy.reader_slots);
+  EXPECT_GE(heavy.reader_slots, 1);
+  EXPECT_LE(light.reader_slots, 16);
+}
+
+TEST(ThreadTunerTest, SlotsCappedByInputParallelism)
+{
+  // One big file and a few small ones: only ~1.3 files' worth of parallelism.
+  ThreadPlan plan = planThreads(64, {1000, 100, 100, 100}, 4, "FASTQ", 0);
+  EXPECT_DOUBLE_EQ(plan.input_parallelism, 1.3);
+  EXPECT_EQ(plan.reader_slots, 2);
+
+  // Unknown sizes don't limit anything.
+  plan = planThreads(64, {1000, 0, 100, 100}, 4, "FASTQ", 0);
+  EXPECT_EQ(plan.input_parallelism, 4);
+  EXPECT_EQ(plan.reader_slots, 4);
+
+  // Never more slots than readers, never fewer than one.
+  EXPECT_EQ(planThreads(1, {10, 10}, 100, "BAM", 6).reader_slots, 1);
+  EXPECT_EQ(planThreads(1000, {10, 10}, 1, "FASTQ", 0).reader_slots, 2);
+}
+
+TEST(ThreadTunerTest, AdjustReaderSlots)
+{
+  // Writers starved, readers busy: add a reader.
+  EXPECT_EQ(adjustReaderSlots(2, 4, 0.0, 0.9), 3);
+  EXPECT_EQ(adjustReaderSlots(4, 4, 0.0, 0.9), 4);
+  // Readers waiting on busy writers: drop one.
+  EXPECT_EQ(adjustReaderSlots(2, 4, 0.9, 0.0), 1);
+  EXPECT_EQ(adjustReaderSlots(1, 4, 0.9, 0.0), 1);
+  // Balanced, or both waiting (e.g. on a downstream FIFO): leave it.
+  EXPECT_EQ(adjustReaderSlots(2, 4, 0.1, 0.1), 2);
+  EXPECT_EQ(adjustReaderSlots(2, 4, 0.9, 0.9), 2);
+}
+
+TEST(ThreadTunerTest, ReaderSlotsLimit)
+{
+  ReaderSlots slots(2);
+  EXPECT_TRUE(slots.tryAcquire(std::chrono::milliseconds(0)));
+  EXPECT_TRUE(slots.tryAcquire(std::chrono::milliseconds(0)));
+  EXPECT_FALSE(slots.tryAcquire(std::chrono::milliseconds(10)));
+  EXPECT_FALSE(slots.overLimit());
+
+  slots.setLimit(1);
+  EXPECT_TRUE(slots.overLimit());
+  slots.release();
+  EXPECT_FALSE(slots.overLimit());
+  EXPECT_FALSE(slots.tryAcquire(std::chrono::milliseconds(0)));
+
+  // Raising the limit wakes a waiting reader.
+  std::thread waiter([&]() { EXPECT_TRUE(slots.tryAcquire(std::chrono::seconds(10))); });
+  slots.setLimit(2);
+  waiter.join();
+  EXPECT_EQ(slots.limit(), 2);
+}
+
+TEST(ThreadTunerTest, TunerAdjustsFromBlockedTime)
+{
+  ThreadPlan plan = planThreads(4, {10, 10, 10, 10}, 2, "FASTQ", 0);
+  ReaderSlots slots(1);
+  plan.reader_slots = 1;
+  // Writers blocked the whole time, readers never.
+  std::atomic<int64_t> writer_blocked{0};
+  ThreadTuner tuner(plan, &slots, std::chrono::milliseconds(20), [&]() {
+    writer_blocked += 2 * 20 * 1000 * 1000;
+    return std::make_pair(int64_t{0}, writer_blocked.load());
+  });
+  tuner.start();
+  for (int i = 0; i < 500 && slots.limit() < 4; i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  tuner.stop();
+  EXPECT_EQ(slots.limit(), 4);
+}
@@ -1,5 +1,7 @@
 #include "../src/whitelist_corrector.h"
 
+#include <fstream>
+
 #include "gmock/gmock-matchers.h"
 #include "gtest/gtest.h"
 
@@ -71,3 +73,35 @@ TEST(WhiteListCorrectorTest, DuplicatedWhitelistEntriesOk)
   auto it = corrector.mutations.find("AAAAT");
   EXPECT_EQ(corrector.whitelist[it->second], "CAAAT");
 }
+
+TEST(WhiteListCorrectorTest, BarcodeTranslation)
+{
+  WhiteListCorrector corrector;
+  EXPECT_TRUE(addMutationsOfBarcodeToWhiteList(corrector, "AAAA"));
+  EXPECT_TRUE(addMutationsOfBarcodeToWhiteList(corrector, "CCCC"));
+  std::string path = ::testing::TempDir() + "barcode_translation.tsv";
+  std::ofstream(path) << "CCCC\tGGGG\nAAAA,TTTT\nACGT ACGT\n";
+  readBarcodeTranslationFile(path, &corrector);
+
+  // Exact matches and corrections alike end up at the translation.
+  auto exact = corrector.mutations.find("AAAA");
+  EXPECT_LT(exact->second, 0);
+  EXPECT_EQ(corrector.correctedBarcode("AAAA", exact->second), "TTTT");
+  auto corrected = corrector.mutations.find("CCTC");
+  EXPECT_GE(corrected->second, 0);
+  EXPECT_EQ(corrector.correctedBarcode("CCTC", corrected->second), "GGGG");
+}
+
+TEST(WhiteListCorrectorTest, RepeatedBarcodeTranslation)
+{
+  WhiteListCorrector corrector;
+  EXPECT_TRUE(addMutationsOfBarcodeToWhiteList(corrector, "AAAA"));
+  std::string path = ::testing::TempDir() + "barcode_translation_repeated.tsv";
+  std::ofstream(path) << "AAAA\tTTTT\nAAAA\tTTTT\n";
+  readBarcodeTranslationFile(path, &corrector);
+  EXPECT_EQ(corrector.whitelist[0], "TTTT");
+
+  std::ofstream(path) << "AAAA\tTTTT\nAAAA\tGGGG\n";
+  EXPECT_EXIT(readBarcodeTranslationFile(path, &corrector), ::testing::ExitedWithCode(1),
+              "translates AAAA to both TTTT and GGGG");
+}
@@ -0,0 +1,149 @@
+"""Generates deterministic synthetic FASTQs (and a whitelist) for benchmarking.
+
+The same arguments always produce the same files. Barcodes are drawn from the
+first --num-cells whitelist entries; each read's barcode is an exact whitelist
+hit with probability --hit-rate, a one-base error of one with probability
+--correctable-rate, and otherwise a random sequence (almost surely a miss).
+
+GEX-style example (16C12M, barcode + UMI at the start of R1):
+  python3 generate_fastq.py --out-dir data --num-reads 1000000
+ATAC-style example (barcode in the last 16 bases of a 24-base R2, plus R3):
+  python3 generate_fastq.py --out-dir data --read-structure 16C --atac \
+      --barcode-length-read 24 --orientation LAST_BP
+"""
+import argparse
+import gzip
+import os
+import random
+import re
+
+BASES = "ACGT"
+COMPLEMENT = str.maketrans("ACGTN", "TGCAN")
+
+parser = argparse.ArgumentParser()
+parser.add_argument("--out-dir", required=True, help="where to write the files")
+parser.add_argument("--num-reads", type=int, default=1000000)
+parser.add_argument("--read-structure", default="16C12M",
+                    help="as for fastqprocess --read-structure")
+parser.add_argument("--orientation", default="FIRST_BP",
+                    choices=["FIRST_BP", "LAST_BP", "FIRST_BP_RC", "LAST_BP_RC"],
+                    help="where the barcode is in its read (the non-FIRST_BP ones need --atac)")
+parser.add_argument("--atac", action="store_true",
+                    help="scATAC layout: R1 and R3 hold the reads, R2 the barcode")
+parser.add_argument("--barcode-length-read", type=int, default=0,
+                    help="length of the barcode read (default: the read structure's length)")
+parser.add_argument("--read-length", type=int, default=90, help="length of the cDNA read(s)")
+parser.add_argument("--whitelist-size", type=int, default=100000)
+parser.add_argument("--num-cells", type=int, default=5000,
+                    help="how many whitelist barcodes the reads come from")
+parser.add_argument("--hit-rate", type=float, default=0.85)
+parser.add_argument("--correctable-rate", type=float, default=0.07)
+parser.add_argument("--no-I1", dest="write_i1", action="store_false", help="don't write an I1 file")
+parser.add_argument("--seed", type=int, default=1)
+
+
+def parse_read_structure(read_structure):
+    return [(tag, int(length)) for length, tag in re.findall(r"(\d+)([A-Z])", read_structure)]
+
+
+def random_sequence(rng, length):
+    return "".join(rng.choices(BASES, k=length))
+
+
+def reverse_complement(sequence):
+    return sequence.translate(COMPLEMENT)[::-1]
+
+
+def one_base_error(rng, barcode):
+    pos = rng.randrange(len(barcode))
+    base = rng.choice([b for b in BASES if b != barcode[pos]])
+    return barcode[:pos] + base + barcode[pos + 1:]
+
+
+class SequencePool:
+    """Substrings of a fixed random 'transcriptome' and a fixed set of quality
+    strings, so reads look varied without paying for per-base randomness."""
+
+    def __init__(self, rng):
+        self.genome = random_sequence(rng, 1 << 20)
+        self.qualities = ["".join(rng.choices("FFFFFFFF:,", k=512)) for _ in range(1000)]
+
+    def sequence(self, rng, length):
+        start = rng.randrange(len(self.genome) - length)
+        return self.genome[start:start + length]
+
+    def quality(self, rng, length):
+        return rng.choice(self.qualities)[:length]
+
+
+def barcode_read(opts, rng, pool, structure, barcode):
+    """The read holding the barcode (R1 for GEX, R2 for ATAC)."""
+    structure_length = sum(length for _, length in structure)
+    length = max(opts.barcode_length_read, structure_length)
+    if opts.orientation == "FIRST_BP":
+        read = ""
+        barcode_left = barcode
+        for tag, seg_length in structure:
+            if tag == "C":
+                read += barcode_left[:seg_length]
+                barcode_left = barcode_left[seg_length:]
+            else:
+                read += random_sequence(rng, seg_length)
+        return read + random_sequence(rng, length - len(read))
+    filler = pool.sequence(rng, length - len(barcode))
+    if opts.orientation == "LAST_BP":
+        return filler + barcode
+    if opts.orientation == "FIRST_BP_RC":
+        return filler + reverse_complement(barcode)
+    return reverse_complement(barcode) + filler  # LAST_BP_RC
+
+
+def write_record(out, name, sequence, quality):
+    out.write("@%s\n%s\n+\n%s\n" % (name, sequence, quality))
+
+
+def main():
+    opts = parser.parse_args()
+    if opts.orientation != "FIRST_BP" and not opts.atac:
+        parser.error("--orientation other than FIRST_BP is only used for --atac")
+    structure = parse_read_structure(opts.read_structure)
+    barcode_length = sum(length for tag, length in structure if tag == "C")
+    rng = random.Random(opts.seed)
+    pool = SequencePool(rng)
+
+    os.makedirs(opts.out_dir, exist_ok=True)
+    whitelist = [random_sequence(rng, barcode_length) for _ in range(opts.whitelist_size)]
+    with open(os.path.join(opts.out_dir, "whitelist.txt"), "w") as out:
+        out.write("\n".join(whitelist) + "\n")
+    cells = whitelist[:opts.num_cells]
+
+    def open_out(name):
+        return gzip.open(os.path.join(opts.out_dir, name + ".fastq.gz"), "wt", compresslevel=1)
+
+    names = ["R1", "R2"] + (["R3"] if opts.atac else []) + (["I1"] if opts.write_i1 else [])
+    outs = {name: open_out(name) for name in names}
+    barcode_name = "R2" if opts.atac else "R1"
+    for i in range(opts.num_reads):
+        draw = rng.random()
+        if draw < opts.hit_rate:
+            barcode = rng.choice(cells)
+        elif draw < opts.hit_rate + opts.correctable_rate:
+            barcode = one_base_error(rng, rng.choice(cells))
+        else:
+            barcode = random_sequence(rng, barcode_length)
+        name = "SIM:1:FC:1:%d:%d:%d" % (1101 + i // 1000000, i % 1000, i // 1000 % 1000)
+
+        bc_read = barcode_read(opts, rng, pool, structure, barcode)
+        write_record(outs[barcode_name], name, bc_read, pool.quality(rng, len(bc_read)))
+        for read in ["R1", "R3"] if opts.atac else ["R2"]:
+            write_record(outs[read], name, pool.sequence(rng, opts.read_length),
+                         pool.quality(rng, opts.read_length))
+        if opts.write_i1:
+            write_record(outs["I1"], name, pool.sequence(rng, 8), pool.quality(rng, 8))
+
+    for out in outs.values():
+        out.close()
+
+
+if __name__ == "__main__":
+    main()